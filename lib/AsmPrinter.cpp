@@ -0,0 +1,271 @@
+#include "AsmPrinter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace descartes {
+
+namespace {
+
+const char *const registerNames[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp",
+                                     "rsi", "rdi", "r8",  "r9",  "r10", "r11",
+                                     "r12", "r13", "r14", "r15"};
+const char *const registerNames32[] = {
+    "eax", "ecx", "edx",  "ebx",  "esp",  "ebp",  "esi",  "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+const char *const registerNames16[] = {
+    "ax",  "cx",  "dx",   "bx",   "sp",   "bp",   "si",   "di",
+    "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"};
+const char *const registerNames8[] = {
+    "al",  "cl",  "dl",   "bl",   "spl",  "bpl",  "sil",  "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+
+// The name of the low `size` bytes of a register.
+const char *getRegisterName(int reg, int size) {
+  switch (size) {
+  case 1:
+    return registerNames8[reg];
+  case 2:
+    return registerNames16[reg];
+  case 4:
+    return registerNames32[reg];
+  default:
+    return registerNames[reg];
+  }
+}
+
+// The mnemonic of a load or store that touches fewer bytes than a word, along
+// with the size of its register operand.
+std::pair<const char *, int>
+getNarrowMnemonic(const x86::Instruction &instruction) {
+  const int size = instruction.size;
+  switch (instruction.op) {
+  case x86::Opcode::Movsx:
+    return {size == 1 ? "movsbq" : size == 2 ? "movswq" : "movslq",
+            ir::wordSize};
+  case x86::Opcode::Movzx:
+    // A 32 bit `mov` clears the upper half of its destination.
+    if (size == 4)
+      return {"movl", 4};
+    return {size == 1 ? "movzbq" : "movzwq", ir::wordSize};
+  default:
+    assert(instruction.op == x86::Opcode::Mov);
+    return {size == 1 ? "movb" : size == 2 ? "movw" : "movl", size};
+  }
+}
+
+const char *getMnemonic(x86::Opcode op) {
+  switch (op) {
+  case x86::Opcode::Mov:
+    return "movq";
+  case x86::Opcode::Lea:
+    return "leaq";
+  case x86::Opcode::Add:
+    return "addq";
+  case x86::Opcode::Sub:
+    return "subq";
+  case x86::Opcode::Imul:
+    return "imulq";
+  case x86::Opcode::And:
+    return "andq";
+  case x86::Opcode::Shl:
+    return "shlq";
+  case x86::Opcode::Sar:
+    return "sarq";
+  case x86::Opcode::Cqo:
+    return "cqto";
+  case x86::Opcode::Idiv:
+    return "idivq";
+  case x86::Opcode::Cmp:
+    return "cmpq";
+  case x86::Opcode::Jmp:
+    return "jmp";
+  case x86::Opcode::Call:
+    return "call";
+  case x86::Opcode::Push:
+    return "pushq";
+  case x86::Opcode::Pop:
+    return "popq";
+  case x86::Opcode::Leave:
+    return "leave";
+  case x86::Opcode::Ret:
+    return "ret";
+  case x86::Opcode::Label:
+  case x86::Opcode::Movsx:
+  case x86::Opcode::Movzx:
+  case x86::Opcode::Jcc:
+    break;
+  }
+  assert(!"Opcode has no fixed mnemonic");
+  return "";
+}
+
+const char *getConditionSuffix(x86::Condition condition) {
+  switch (condition) {
+  case x86::Condition::Equal:
+    return "e";
+  case x86::Condition::NotEqual:
+    return "ne";
+  case x86::Condition::Less:
+    return "l";
+  case x86::Condition::Greater:
+    return "g";
+  case x86::Condition::LessEqual:
+    return "le";
+  case x86::Condition::GreaterEqual:
+    return "ge";
+  }
+  return "";
+}
+
+// Labels within a function are local to the object file.
+std::string getLabel(Symbol label) { return ".L" + label.getName(); }
+
+} // namespace
+
+AsmPrinter::AsmPrinter(std::ostream &out) : out(out) {}
+
+void AsmPrinter::print(const std::vector<x86::Function> &functions) {
+  assert(!functions.empty());
+  rodataLabels.clear();
+  for (const x86::Function &function : functions) {
+    for (const x86::JumpTable &table : function.jumpTables)
+      rodataLabels.emplace(table.label.id, getLabel(table.label));
+  }
+  // String names aren't valid labels so they're numbered instead.
+  const std::vector<Symbol> strings = x86::getStrings(functions);
+  for (size_t i = 0; i < strings.size(); ++i)
+    rodataLabels.emplace(strings.at(i).id, ".Lstring" + std::to_string(i));
+  // The main program comes last.
+  out << "\t.text\n"
+      << "\t.globl _start\n"
+      << "_start:\n"
+      << "\tcall " << functions.back().level.name.getName() << "\n"
+      << "\tmovl $60, %eax\n"
+      << "\txorl %edi, %edi\n"
+      << "\tsyscall\n";
+  for (const x86::Function &function : functions) {
+    const auto &instructions = function.instructions;
+    assert(!instructions.empty() &&
+           instructions.front().op == x86::Opcode::Label);
+    out << "\n" << function.level.name.getName() << ":\n";
+    std::for_each(instructions.begin() + 1, instructions.end(),
+                  [this](const x86::Instruction &instruction) {
+                    printInstruction(instruction);
+                  });
+  }
+  if (!rodataLabels.empty()) {
+    out << "\n\t.section .rodata\n"
+        << "\t.p2align 3\n";
+    for (const x86::Function &function : functions) {
+      for (const x86::JumpTable &table : function.jumpTables) {
+        out << getLabel(table.label) << ":\n";
+        for (Symbol target : table.targets)
+          out << "\t.quad " << getLabel(target) << "\n";
+      }
+    }
+    for (Symbol string : strings) {
+      out << rodataLabels.at(string.id) << ":\n";
+      for (uint64_t word : ir::getStringWords(string))
+        out << "\t.quad " << word << "\n";
+    }
+  }
+  if (const int displaySize = x86::getDisplaySize(functions)) {
+    out << "\n\t.bss\n"
+        << "\t.p2align 3\n"
+        << ir::displayName << ":\n"
+        << "\t.zero " << displaySize << "\n";
+  }
+  // Nothing needs an executable stack.
+  out << "\n\t.section .note.GNU-stack,\"\",@progbits\n";
+}
+
+void AsmPrinter::printInstruction(const x86::Instruction &instruction) {
+  switch (instruction.op) {
+  case x86::Opcode::Label:
+    out << getLabel(*instruction.operands.front().symbol) << ":\n";
+    return;
+  case x86::Opcode::Jmp: {
+    const x86::Operand &target = instruction.operands.front();
+    out << "\tjmp ";
+    if (target.kind == x86::OperandKind::Label) {
+      out << getLabel(*target.symbol) << "\n";
+    } else {
+      out << "*";
+      printOperand(target);
+      out << "\n";
+    }
+    return;
+  }
+  case x86::Opcode::Jcc:
+    out << "\tj" << getConditionSuffix(instruction.condition) << " "
+        << getLabel(*instruction.operands.front().symbol) << "\n";
+    return;
+  case x86::Opcode::Call:
+    out << "\tcall " << instruction.operands.front().symbol->getName() << "\n";
+    return;
+  case x86::Opcode::Mov:
+  case x86::Opcode::Movsx:
+  case x86::Opcode::Movzx:
+    if (instruction.size != ir::wordSize) {
+      const auto [mnemonic, size] = getNarrowMnemonic(instruction);
+      out << "\t" << mnemonic << " ";
+      printOperand(instruction.operands.front(), size);
+      out << ", ";
+      printOperand(instruction.operands.back(), size);
+      out << "\n";
+      return;
+    }
+    break;
+  default:
+    break;
+  }
+  out << "\t" << getMnemonic(instruction.op);
+  const auto &operands = instruction.operands;
+  for (size_t i = 0; i < operands.size(); ++i) {
+    out << (i == 0 ? " " : ", ");
+    // Variable shift counts are in %cl.
+    const bool isShift = instruction.op == x86::Opcode::Shl ||
+                         instruction.op == x86::Opcode::Sar;
+    if (isShift && i == 0 && operands.at(i).isRegister(x86::rcx))
+      out << "%cl";
+    else
+      printOperand(operands.at(i));
+  }
+  out << "\n";
+}
+
+void AsmPrinter::printOperand(const x86::Operand &operand, int size) {
+  switch (operand.kind) {
+  case x86::OperandKind::Register:
+    assert(!x86::isVirtual(*operand.reg));
+    out << "%" << getRegisterName(*operand.reg, size);
+    break;
+  case x86::OperandKind::Immediate:
+    out << "$" << operand.value;
+    break;
+  case x86::OperandKind::Memory:
+    if (operand.symbol) {
+      const auto rodataLabel = rodataLabels.find(operand.symbol->id);
+      out << (rodataLabel != rodataLabels.end() ? rodataLabel->second
+                                                : operand.symbol->getName());
+      if (operand.value != 0)
+        out << (operand.value > 0 ? "+" : "") << operand.value;
+      out << "(%rip)";
+      break;
+    }
+    if (operand.value != 0)
+      out << operand.value;
+    out << "(%" << registerNames[*operand.reg];
+    if (operand.index)
+      out << ", %" << registerNames[*operand.index] << ", " << operand.scale;
+    out << ")";
+    break;
+  case x86::OperandKind::Label:
+    out << getLabel(*operand.symbol);
+    break;
+  }
+}
+
+} // namespace descartes
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <X86.h>
+
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+namespace descartes {
+
+// Writes allocated functions out as GNU assembly in AT&T syntax that `as` and
+// `ld` turn into a static executable. The entry point calls the main program
+// and exits, and the display is reserved in `.bss` when some level uses it.
+class AsmPrinter {
+public:
+  explicit AsmPrinter(std::ostream &out);
+  virtual ~AsmPrinter() = default;
+  void print(const std::vector<x86::Function> &functions);
+
+private:
+  void printInstruction(const x86::Instruction &instruction);
+  // Registers are named by the `size` bytes of them that are used.
+  void printOperand(const x86::Operand &operand, int size = ir::wordSize);
+  std::ostream &out;
+  // Jump tables and strings are local to the object file like labels are.
+  std::unordered_map<int, std::string> rodataLabels;
+};
+
+} // namespace descartes
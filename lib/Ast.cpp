@@ -13,6 +13,18 @@ const std::string &Symbol::getName() const {
 
 bool Symbol::operator==(const Symbol &other) const { return id == other.id; }
 
+ArrayIndex::ArrayIndex(ExprPtr low, ExprPtr high)
+    : low(std::move(low)), high(std::move(high)) {}
+
+ArrayIndex::ArrayIndex(Symbol typeIdentifier)
+    : typeIdentifier(typeIdentifier) {}
+
+Array::Array(ArrayIndex &&index, TypePtr elementType)
+    : index(std::move(index)), elementType(std::move(elementType)) {}
+
+Subrange::Subrange(ExprPtr low, ExprPtr high)
+    : low(std::move(low)), high(std::move(high)) {}
+
 ConstDef::ConstDef(Symbol identifier, ExprPtr constExpr)
     : identifier(identifier), constExpr(std::move(constExpr)) {}
 
@@ -53,6 +65,11 @@ MemberRef::MemberRef(ExprPtr expr, Symbol identifier)
 
 ExprKind MemberRef::getKind() const { return ExprKind::MemberRef; }
 
+IndexRef::IndexRef(ExprPtr expr, ExprPtr index)
+    : expr(std::move(expr)), index(std::move(index)) {}
+
+ExprKind IndexRef::getKind() const { return ExprKind::IndexRef; }
+
 const char *binaryOpKindToString(BinaryOpKind kind) {
   switch (kind) {
   case BinaryOpKind::Add:
@@ -13,7 +13,7 @@ struct Symbol {
   const std::string &getName() const;
   bool operator==(const Symbol &other) const;
   int id;
-  std::string *value;
+  const std::string *value;
 };
 
 struct SymbolHash {
@@ -29,16 +29,19 @@ enum class TypeKind {
   Record,
   Alias,
   String,
+  Array,
+  Subrange,
 };
 
 struct Type {
   virtual ~Type() = default;
   virtual TypeKind getKind() const = 0;
   bool isPointer = false;
+  // Only arrays and records can be packed.
+  bool isPacked = false;
 };
 using TypePtr = std::unique_ptr<Type>;
 
-// TODO: Implement ranged types.
 struct Integer : public Type {
   TypeKind getKind() const override { return TypeKind::Integer; }
 };
@@ -77,6 +80,7 @@ enum class ExprKind {
   BinaryOp,
   Call,
   MemberRef,
+  IndexRef,
 };
 
 class Expr {
@@ -86,6 +90,31 @@ public:
 };
 using ExprPtr = std::unique_ptr<Expr>;
 
+// The bounds of an index, either as constants or as an ordinal type that has
+// them.
+struct ArrayIndex {
+  ArrayIndex(ExprPtr low, ExprPtr high);
+  explicit ArrayIndex(Symbol typeIdentifier);
+  ExprPtr low, high;
+  std::optional<Symbol> typeIdentifier;
+};
+
+// Arrays with several indices are arrays of arrays, so each one has a single
+// index.
+struct Array : public Type {
+  Array(ArrayIndex &&index, TypePtr elementType);
+  TypeKind getKind() const override { return TypeKind::Array; }
+  ArrayIndex index;
+  TypePtr elementType;
+};
+
+// A range of values of an ordinal host type, with constant bounds.
+struct Subrange : public Type {
+  Subrange(ExprPtr low, ExprPtr high);
+  TypeKind getKind() const override { return TypeKind::Subrange; }
+  ExprPtr low, high;
+};
+
 struct ConstDef {
   ConstDef(Symbol identifier, ExprPtr constExpr);
   Symbol identifier;
@@ -142,18 +171,21 @@ struct If : public Statement {
 };
 
 struct CaseArm {
-  CaseArm(ExprPtr value, StatementPtr statement)
-      : value(std::move(value)), statement(std::move(statement)) {}
-  ExprPtr value;
+  CaseArm(std::vector<ExprPtr> &&values, StatementPtr statement)
+      : values(std::move(values)), statement(std::move(statement)) {}
+  std::vector<ExprPtr> values;
   StatementPtr statement;
 };
 
 struct Case : public Statement {
-  Case(ExprPtr expr, std::vector<CaseArm> &&arms)
-      : expr(std::move(expr)), arms(std::move(arms)) {}
+  Case(ExprPtr expr, std::vector<CaseArm> &&arms, StatementPtr elseStatement)
+      : expr(std::move(expr)), arms(std::move(arms)),
+        elseStatement(std::move(elseStatement)) {}
   StatementKind getKind() const override;
   ExprPtr expr;
   std::vector<CaseArm> arms;
+  // Taken when no arm matches. Optional.
+  StatementPtr elseStatement;
 };
 
 struct Repeat : public Statement {
@@ -249,6 +281,14 @@ struct MemberRef : public Expr {
   Symbol identifier;
 };
 
+// Selects a single element. Several indices in one pair of brackets select
+// from each array of arrays in turn.
+struct IndexRef : public Expr {
+  IndexRef(ExprPtr expr, ExprPtr index);
+  ExprKind getKind() const override;
+  ExprPtr expr, index;
+};
+
 struct Call : public Expr {
   Call(Symbol functionName, std::vector<ExprPtr> args);
   ExprKind getKind() const override;
@@ -313,6 +353,10 @@ template <> inline MemberRef *exprCast<MemberRef *>(Expr &expr) {
   return exprCastImpl<MemberRef *, ExprKind::MemberRef>(expr);
 }
 
+template <> inline IndexRef *exprCast<IndexRef *>(Expr &expr) {
+  return exprCastImpl<IndexRef *, ExprKind::IndexRef>(expr);
+}
+
 template <typename T, StatementKind kind>
 inline T statementCastImpl(Statement &ast) {
   if (ast.getKind() == kind)
@@ -138,10 +138,16 @@ json AstPrinter::convertCase(Statement &statement) {
   json armsObj = json::array();
   for (const auto &arm : caseStatement->arms) {
     json armObj;
-    armObj["Value"] = convertExpr(*arm.value);
+    json valuesObj = json::array();
+    for (const auto &value : arm.values)
+      valuesObj.emplace_back(convertExpr(*value));
+    armObj["Values"] = valuesObj;
     armObj["Statement"] = convertStatement(*arm.statement);
     armsObj.emplace_back(armObj);
   }
+  caseObj["Arms"] = armsObj;
+  if (caseStatement->elseStatement)
+    caseObj["Else"] = convertStatement(*caseStatement->elseStatement);
   return caseObj;
 }
 
@@ -190,6 +196,8 @@ json AstPrinter::convertExpr(Expr &expr) {
     return convertCall(expr);
   case ExprKind::MemberRef:
     return convertMemberRef(expr);
+  case ExprKind::IndexRef:
+    return convertIndexRef(expr);
   }
   return json::object();
 }
@@ -255,4 +263,14 @@ json AstPrinter::convertMemberRef(Expr &expr) {
   return memberRefObj;
 }
 
+json AstPrinter::convertIndexRef(Expr &expr) {
+  auto *indexRef = exprCast<IndexRef *>(expr);
+  assert(indexRef);
+  json indexRefObj;
+  indexRefObj["Type"] = "IndexRef";
+  indexRefObj["Expr"] = convertExpr(*indexRef->expr);
+  indexRefObj["Index"] = convertExpr(*indexRef->index);
+  return indexRefObj;
+}
+
 } // namespace descartes
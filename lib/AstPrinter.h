@@ -33,6 +33,7 @@ private:
   json convertBinaryOp(Expr &expr);
   json convertCall(Expr &expr);
   json convertMemberRef(Expr &expr);
+  json convertIndexRef(Expr &expr);
 };
 
 } // namespace descartes
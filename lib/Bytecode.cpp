@@ -0,0 +1,31 @@
+#include "Bytecode.h"
+
+#include <cassert>
+
+namespace descartes::bytecode {
+
+size_t getInstructionSize(const int32_t *code) {
+  switch (static_cast<Opcode>(code[0])) {
+  case Opcode::Return:
+    return 1;
+  case Opcode::FramePointer:
+  case Opcode::Jump:
+    return 2;
+  case Opcode::Const:
+  case Opcode::Move:
+  case Opcode::Address:
+    return 3;
+  case Opcode::JumpTable:
+    return 3 + code[2];
+  case Opcode::Call:
+  case Opcode::CallRuntime:
+    return 4 + code[3];
+  case Opcode::OpcodeCount:
+    assert(!"Not an opcode");
+    return 1;
+  default:
+    return 4;
+  }
+}
+
+} // namespace descartes::bytecode
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A compact register based bytecode for the IR that can be run without
+// generating native code.
+//
+// Every activation has a file of 64 bit registers. The first ones hold the
+// frame slots of the level in reverse so that the frame pointer is the address
+// of the last of them and `Mem(fp + offset)` is just a register. The IR's
+// temporaries come next and the registers used to evaluate expressions last.
+//
+// Instructions are a 32 bit opcode followed by their operands: registers,
+// immediates or the positions of other instructions in the code.
+namespace descartes::bytecode {
+
+enum class Opcode : int32_t {
+  // dst, value
+  Const,
+  // dst, src
+  Move,
+  // dst
+  FramePointer,
+  // dst, static
+  Address,
+  // dst, lhs, rhs
+  Add,
+  Subtract,
+  Multiply,
+  Divide,
+  ShiftLeft,
+  ShiftRight,
+  And,
+  MultiplyHigh,
+  // dst, lhs, value
+  AddImmediate,
+  MultiplyImmediate,
+  DivideImmediate,
+  ShiftLeftImmediate,
+  ShiftRightImmediate,
+  AndImmediate,
+  MultiplyHighImmediate,
+  // dst, base, displacement
+  Load,
+  // Narrow loads that sign or zero extend the bytes they read.
+  LoadInt8,
+  LoadUint8,
+  LoadInt16,
+  LoadUint16,
+  LoadInt32,
+  LoadUint32,
+  // base, displacement, src
+  Store,
+  // Narrow stores that keep the low bytes of `src`.
+  Store8,
+  Store16,
+  Store32,
+  // target
+  Jump,
+  // lhs, rhs, target
+  JumpIfEqual,
+  JumpIfNotEqual,
+  JumpIfLess,
+  JumpIfGreater,
+  JumpIfLessEqual,
+  JumpIfGreaterEqual,
+  // lhs, value, target
+  JumpIfEqualImmediate,
+  JumpIfNotEqualImmediate,
+  JumpIfLessImmediate,
+  JumpIfGreaterImmediate,
+  JumpIfLessEqualImmediate,
+  JumpIfGreaterEqualImmediate,
+  // index, count, targets...
+  JumpTable,
+  // dst or -1, function, count, args...
+  Call,
+  // dst or -1, runtime function, count, args...
+  CallRuntime,
+  Return,
+  OpcodeCount,
+};
+
+// The number of words that the instruction starting at `code` takes up.
+size_t getInstructionSize(const int32_t *code);
+
+struct Function {
+  std::string name;
+  size_t entry;
+  int frameSlotCount;
+  int registerCount;
+  // The registers that the arguments go in.
+  std::vector<int32_t> formals;
+  int32_t returnRegister;
+};
+
+// Memory that the program refers to by name. It starts out as `data`
+// followed by zeros.
+struct Static {
+  std::string name;
+  size_t size;
+  std::vector<uint64_t> data;
+};
+
+struct Module {
+  std::vector<int32_t> code;
+  std::vector<Function> functions;
+  std::vector<Static> statics;
+};
+
+} // namespace descartes::bytecode
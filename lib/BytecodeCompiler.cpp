@@ -0,0 +1,432 @@
+#include "BytecodeCompiler.h"
+
+#include <Runtime.h>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace descartes {
+
+namespace {
+
+bytecode::Opcode getArithOpcode(ir::ArithOpKind kind) {
+  switch (kind) {
+  case ir::ArithOpKind::Add:
+    return bytecode::Opcode::Add;
+  case ir::ArithOpKind::Subtract:
+    return bytecode::Opcode::Subtract;
+  case ir::ArithOpKind::Multiply:
+    return bytecode::Opcode::Multiply;
+  case ir::ArithOpKind::Divide:
+    return bytecode::Opcode::Divide;
+  case ir::ArithOpKind::ShiftLeft:
+    return bytecode::Opcode::ShiftLeft;
+  case ir::ArithOpKind::ShiftRight:
+    return bytecode::Opcode::ShiftRight;
+  case ir::ArithOpKind::And:
+    return bytecode::Opcode::And;
+  case ir::ArithOpKind::MultiplyHigh:
+    return bytecode::Opcode::MultiplyHigh;
+  }
+  return bytecode::Opcode::Add;
+}
+
+// The form of an operation that takes its right hand side as an immediate.
+std::optional<bytecode::Opcode> getImmediateOpcode(ir::ArithOpKind kind,
+                                                   int value) {
+  switch (kind) {
+  case ir::ArithOpKind::Add:
+    return bytecode::Opcode::AddImmediate;
+  case ir::ArithOpKind::Subtract:
+    // Subtracting is adding the negation, unless that doesn't fit.
+    break;
+  case ir::ArithOpKind::Multiply:
+    return bytecode::Opcode::MultiplyImmediate;
+  case ir::ArithOpKind::Divide:
+    if (value != 0)
+      return bytecode::Opcode::DivideImmediate;
+    break;
+  case ir::ArithOpKind::ShiftLeft:
+    return bytecode::Opcode::ShiftLeftImmediate;
+  case ir::ArithOpKind::ShiftRight:
+    return bytecode::Opcode::ShiftRightImmediate;
+  case ir::ArithOpKind::And:
+    return bytecode::Opcode::AndImmediate;
+  case ir::ArithOpKind::MultiplyHigh:
+    return bytecode::Opcode::MultiplyHighImmediate;
+  }
+  return std::nullopt;
+}
+
+bytecode::Opcode getLoadOpcode(ir::MemType type) {
+  switch (type) {
+  case ir::MemType::Word:
+    return bytecode::Opcode::Load;
+  case ir::MemType::Int8:
+    return bytecode::Opcode::LoadInt8;
+  case ir::MemType::Uint8:
+    return bytecode::Opcode::LoadUint8;
+  case ir::MemType::Int16:
+    return bytecode::Opcode::LoadInt16;
+  case ir::MemType::Uint16:
+    return bytecode::Opcode::LoadUint16;
+  case ir::MemType::Int32:
+    return bytecode::Opcode::LoadInt32;
+  case ir::MemType::Uint32:
+    return bytecode::Opcode::LoadUint32;
+  }
+  return bytecode::Opcode::Load;
+}
+
+bytecode::Opcode getStoreOpcode(ir::MemType type) {
+  switch (ir::getMemSize(type)) {
+  case 1:
+    return bytecode::Opcode::Store8;
+  case 2:
+    return bytecode::Opcode::Store16;
+  case 4:
+    return bytecode::Opcode::Store32;
+  default:
+    return bytecode::Opcode::Store;
+  }
+}
+
+bool isCommutative(ir::ArithOpKind kind) {
+  return kind == ir::ArithOpKind::Add || kind == ir::ArithOpKind::Multiply ||
+         kind == ir::ArithOpKind::And ||
+         kind == ir::ArithOpKind::MultiplyHigh;
+}
+
+bytecode::Opcode getJumpOpcode(ir::RelOpKind kind, bool isImmediate) {
+  int offset = 0;
+  switch (kind) {
+  case ir::RelOpKind::Equal:
+    offset = 0;
+    break;
+  case ir::RelOpKind::NotEqual:
+    offset = 1;
+    break;
+  case ir::RelOpKind::LessThan:
+    offset = 2;
+    break;
+  case ir::RelOpKind::GreaterThan:
+    offset = 3;
+    break;
+  case ir::RelOpKind::LessThanEqual:
+    offset = 4;
+    break;
+  case ir::RelOpKind::GreaterThanEqual:
+    offset = 5;
+    break;
+  }
+  const auto first = isImmediate ? bytecode::Opcode::JumpIfEqualImmediate
+                                 : bytecode::Opcode::JumpIfEqual;
+  return static_cast<bytecode::Opcode>(static_cast<int32_t>(first) + offset);
+}
+
+const ir::Const *getConst(const ir::Expr &expr) {
+  if (expr.getKind() != ir::ExprKind::Const)
+    return nullptr;
+  return static_cast<const ir::Const *>(&expr);
+}
+
+bool isFramePointer(const ir::Expr &expr) {
+  return expr.getKind() == ir::ExprKind::Temp &&
+         static_cast<const ir::Temp &>(expr).id == ir::framePointer;
+}
+
+// Splits an address into a base and a constant displacement.
+std::pair<const ir::Expr *, int> getBaseAndDisplacement(const ir::Expr &expr) {
+  if (expr.getKind() == ir::ExprKind::ArithOp) {
+    const auto &arithOp = static_cast<const ir::ArithOp &>(expr);
+    if (arithOp.op == ir::ArithOpKind::Add) {
+      if (const auto *rhs = getConst(*arithOp.rhs))
+        return {arithOp.lhs.get(), rhs->value};
+      if (const auto *lhs = getConst(*arithOp.lhs))
+        return {arithOp.rhs.get(), lhs->value};
+    }
+  }
+  return {&expr, 0};
+}
+
+} // namespace
+
+BytecodeCompiler::BytecodeCompiler()
+    : level(nullptr), frameSlotCount(0), firstScratchRegister(0),
+      nextRegister(0), registerCount(0) {}
+
+bytecode::Module
+BytecodeCompiler::compile(const std::vector<ir::Fragment> &frags) {
+  module = bytecode::Module();
+  functionIndices.clear();
+  staticIndices.clear();
+  // Calls can go to functions that come later.
+  for (const ir::Fragment &frag : frags) {
+    functionIndices.emplace(frag.first->name.getName(),
+                            module.functions.size());
+    module.functions.push_back(
+        {frag.first->name.getName(), 0, 0, 0, {}, 0});
+  }
+  int depth = -1;
+  for (const ir::Fragment &frag : frags) {
+    if (frag.first->isDisplayed)
+      depth = std::max(depth, frag.first->depth);
+  }
+  if (depth >= 0) {
+    staticIndices.emplace(ir::displayName, module.statics.size());
+    module.statics.push_back(
+        {ir::displayName, static_cast<size_t>(depth + 1) * ir::wordSize, {}});
+  }
+  for (const ir::Fragment &frag : frags)
+    compileFunction(frag);
+  return std::move(module);
+}
+
+void BytecodeCompiler::compileFunction(const ir::Fragment &frag) {
+  level = frag.first.get();
+  bytecode::Function &function =
+      module.functions.at(functionIndices.at(level->name.getName()));
+  // The frame pointer has to point at a register even when there are no
+  // slots.
+  frameSlotCount = std::max<int32_t>(level->locals.size(), 1);
+  firstScratchRegister = frameSlotCount + level->tempCount;
+  registerCount = firstScratchRegister;
+  labelOffsets.clear();
+  targetFixups.clear();
+  function.entry = module.code.size();
+  function.frameSlotCount = frameSlotCount;
+  function.formals.clear();
+  for (const ir::Access &formal : level->formals)
+    function.formals.push_back(frameSlotCount - 1 -
+                               -formal.offset / ir::wordSize);
+  function.returnRegister = frameSlotCount + ir::returnValue;
+  assert(frag.second->getKind() == ir::StatementKind::Sequence);
+  const auto &statements =
+      static_cast<const ir::Sequence &>(*frag.second).statements;
+  for (size_t i = 0; i < statements.size(); ++i) {
+    nextRegister = firstScratchRegister;
+    compileStatement(*statements.at(i), i + 1 < statements.size()
+                                            ? statements.at(i + 1).get()
+                                            : nullptr);
+  }
+  // Everything falls through to the end of the body.
+  emit(bytecode::Opcode::Return, {});
+  for (const auto &[offset, label] : targetFixups)
+    module.code.at(offset) = labelOffsets.at(label);
+  function.registerCount = registerCount;
+  level = nullptr;
+}
+
+void BytecodeCompiler::compileStatement(const ir::Statement &statement,
+                                        const ir::Statement *next) {
+  switch (statement.getKind()) {
+  case ir::StatementKind::Label:
+    labelOffsets.emplace(static_cast<const ir::Label &>(statement).label,
+                         module.code.size());
+    break;
+  case ir::StatementKind::Jump:
+    emit(bytecode::Opcode::Jump, {});
+    emitTarget(static_cast<const ir::Jump &>(statement).jumpLabel);
+    break;
+  case ir::StatementKind::CondJump:
+    compileCondJump(static_cast<const ir::CondJump &>(statement), next);
+    break;
+  case ir::StatementKind::JumpTable: {
+    const auto &jumpTable = static_cast<const ir::JumpTable &>(statement);
+    const int32_t index = compileExpr(*jumpTable.index, std::nullopt);
+    emit(bytecode::Opcode::JumpTable,
+         {index, static_cast<int32_t>(jumpTable.labels.size())});
+    for (Symbol label : jumpTable.labels)
+      emitTarget(label);
+    break;
+  }
+  case ir::StatementKind::Move:
+    compileMove(static_cast<const ir::Move &>(statement));
+    break;
+  case ir::StatementKind::CallStatement: {
+    const auto &call = static_cast<const ir::CallStatement &>(statement).call;
+    assert(call->getKind() == ir::ExprKind::Call);
+    compileCall(static_cast<const ir::Call &>(*call), -1);
+    break;
+  }
+  case ir::StatementKind::Sequence:
+    assert(!"Canonical IR has no nested sequences");
+    break;
+  }
+}
+
+void BytecodeCompiler::compileCondJump(const ir::CondJump &condJump,
+                                       const ir::Statement *next) {
+  ir::RelOpKind op = condJump.op;
+  const ir::Expr *lhs = condJump.lhs.get(), *rhs = condJump.rhs.get();
+  if (getConst(*lhs) && !getConst(*rhs)) {
+    std::swap(lhs, rhs);
+    op = ir::swapRelOp(op);
+  }
+  const int32_t lhsRegister = compileExpr(*lhs, std::nullopt);
+  if (const auto *rhsConst = getConst(*rhs)) {
+    emit(getJumpOpcode(op, true), {lhsRegister, rhsConst->value});
+  } else {
+    const int32_t rhsRegister = compileExpr(*rhs, std::nullopt);
+    emit(getJumpOpcode(op, false), {lhsRegister, rhsRegister});
+  }
+  emitTarget(condJump.thenLabel);
+  // The else label normally comes next so there's nothing to do on false.
+  if (!next || next->getKind() != ir::StatementKind::Label ||
+      !(static_cast<const ir::Label *>(next)->label == condJump.elseLabel)) {
+    emit(bytecode::Opcode::Jump, {});
+    emitTarget(condJump.elseLabel);
+  }
+}
+
+void BytecodeCompiler::compileMove(const ir::Move &move) {
+  if (const auto dst = getRegister(*move.dst)) {
+    if (move.src->getKind() == ir::ExprKind::Call)
+      compileCall(static_cast<const ir::Call &>(*move.src), *dst);
+    else
+      compileExpr(*move.src, *dst);
+    return;
+  }
+  assert(move.dst->getKind() == ir::ExprKind::Mem);
+  const auto &mem = static_cast<const ir::Mem &>(*move.dst);
+  const int32_t src = compileExpr(*move.src, std::nullopt);
+  const auto [base, displacement] = getBaseAndDisplacement(*mem.expr);
+  emit(getStoreOpcode(mem.type),
+       {compileExpr(*base, std::nullopt), displacement, src});
+}
+
+void BytecodeCompiler::compileCall(const ir::Call &call, int32_t dst) {
+  const std::string &name = call.functionName.getName();
+  const auto iter = functionIndices.find(name);
+  // Anything the program doesn't define is in the runtime.
+  const bool isRuntime = iter == functionIndices.end();
+  std::vector<int32_t> operands = {
+      dst,
+      static_cast<int32_t>(isRuntime ? runtime::findFunction(name).value()
+                                     : iter->second),
+      static_cast<int32_t>(call.args.size())};
+  for (const ir::ExprPtr &arg : call.args)
+    operands.push_back(compileExpr(*arg, std::nullopt));
+  emit(isRuntime ? bytecode::Opcode::CallRuntime : bytecode::Opcode::Call,
+       operands);
+}
+
+int32_t BytecodeCompiler::compileExpr(const ir::Expr &expr,
+                                      std::optional<int32_t> dst) {
+  if (const auto reg = getRegister(expr)) {
+    if (dst && *dst != *reg)
+      emit(bytecode::Opcode::Move, {*dst, *reg});
+    return dst.value_or(*reg);
+  }
+  const int32_t result = dst ? *dst : makeRegister();
+  switch (expr.getKind()) {
+  case ir::ExprKind::Const:
+    emit(bytecode::Opcode::Const,
+         {result, static_cast<const ir::Const &>(expr).value});
+    break;
+  case ir::ExprKind::Name:
+    emit(bytecode::Opcode::Address,
+         {result, static_cast<int32_t>(getStatic(
+                      static_cast<const ir::Name &>(expr).value))});
+    break;
+  case ir::ExprKind::Temp:
+    assert(isFramePointer(expr));
+    emit(bytecode::Opcode::FramePointer, {result});
+    break;
+  case ir::ExprKind::Mem: {
+    const auto &mem = static_cast<const ir::Mem &>(expr);
+    const auto [base, displacement] = getBaseAndDisplacement(*mem.expr);
+    emit(getLoadOpcode(mem.type),
+         {result, compileExpr(*base, std::nullopt), displacement});
+    break;
+  }
+  case ir::ExprKind::ArithOp:
+    return compileArithOp(static_cast<const ir::ArithOp &>(expr), result);
+  case ir::ExprKind::Call:
+    compileCall(static_cast<const ir::Call &>(expr), result);
+    break;
+  case ir::ExprKind::CondExpr:
+    assert(!"Canonical IR has no conditional expressions");
+    break;
+  }
+  return result;
+}
+
+int32_t BytecodeCompiler::compileArithOp(const ir::ArithOp &arithOp,
+                                         int32_t dst) {
+  const ir::Expr *lhs = arithOp.lhs.get(), *rhs = arithOp.rhs.get();
+  if (getConst(*lhs) && !getConst(*rhs) && isCommutative(arithOp.op))
+    std::swap(lhs, rhs);
+  if (const auto *rhsConst = getConst(*rhs)) {
+    std::optional<bytecode::Opcode> op =
+        getImmediateOpcode(arithOp.op, rhsConst->value);
+    int32_t value = rhsConst->value;
+    if (arithOp.op == ir::ArithOpKind::Subtract &&
+        value != std::numeric_limits<int32_t>::min()) {
+      op = bytecode::Opcode::AddImmediate;
+      value = -value;
+    }
+    if (op) {
+      emit(*op, {dst, compileExpr(*lhs, std::nullopt), value});
+      return dst;
+    }
+  }
+  const int32_t lhsRegister = compileExpr(*lhs, std::nullopt);
+  const int32_t rhsRegister = compileExpr(*rhs, std::nullopt);
+  emit(getArithOpcode(arithOp.op), {dst, lhsRegister, rhsRegister});
+  return dst;
+}
+
+std::optional<int32_t>
+BytecodeCompiler::getRegister(const ir::Expr &expr) const {
+  if (expr.getKind() == ir::ExprKind::Temp && !isFramePointer(expr))
+    return frameSlotCount + static_cast<const ir::Temp &>(expr).id;
+  // Narrow array elements share their slot with others.
+  if (expr.getKind() == ir::ExprKind::Mem &&
+      static_cast<const ir::Mem &>(expr).type == ir::MemType::Word)
+    return getFrameSlot(*static_cast<const ir::Mem &>(expr).expr);
+  return std::nullopt;
+}
+
+std::optional<int32_t>
+BytecodeCompiler::getFrameSlot(const ir::Expr &address) const {
+  const auto [base, displacement] = getBaseAndDisplacement(address);
+  if (!isFramePointer(*base) || displacement > 0 ||
+      displacement % ir::wordSize != 0)
+    return std::nullopt;
+  const int slot = -displacement / ir::wordSize;
+  if (slot >= frameSlotCount)
+    return std::nullopt;
+  return frameSlotCount - 1 - slot;
+}
+
+size_t BytecodeCompiler::getStatic(Symbol name) {
+  const auto iter = staticIndices.find(name.getName());
+  if (iter != staticIndices.end())
+    return iter->second;
+  assert(ir::isString(name));
+  std::vector<uint64_t> words = ir::getStringWords(name);
+  staticIndices.emplace(name.getName(), module.statics.size());
+  module.statics.push_back(
+      {name.getName(), words.size() * ir::wordSize, std::move(words)});
+  return module.statics.size() - 1;
+}
+
+int32_t BytecodeCompiler::makeRegister() {
+  registerCount = std::max(registerCount, nextRegister + 1);
+  return nextRegister++;
+}
+
+void BytecodeCompiler::emit(bytecode::Opcode op,
+                            const std::vector<int32_t> &operands) {
+  module.code.push_back(static_cast<int32_t>(op));
+  module.code.insert(module.code.end(), operands.begin(), operands.end());
+}
+
+void BytecodeCompiler::emitTarget(Symbol label) {
+  targetFixups.emplace_back(module.code.size(), label);
+  module.code.push_back(0);
+}
+
+} // namespace descartes
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Bytecode.h>
+#include <Ir.h>
+
+#include <unordered_map>
+
+namespace descartes {
+
+// Compiles canonical IR fragments into bytecode for the interpreter. Every
+// fragment becomes one function and every statement a handful of
+// instructions at most.
+//
+// Frame slots are registers, so loads and stores of `Mem(fp + offset)` vanish
+// into the operands of whatever uses them. Arithmetic and comparisons against
+// constants have their own instructions taking an immediate, so a typical
+// loop test of a local against a constant is a single conditional jump.
+class BytecodeCompiler {
+public:
+  BytecodeCompiler();
+  virtual ~BytecodeCompiler() = default;
+  bytecode::Module compile(const std::vector<ir::Fragment> &frags);
+
+private:
+  void compileFunction(const ir::Fragment &frag);
+  void compileStatement(const ir::Statement &statement,
+                        const ir::Statement *next);
+  void compileCondJump(const ir::CondJump &condJump,
+                       const ir::Statement *next);
+  void compileMove(const ir::Move &move);
+  void compileCall(const ir::Call &call, int32_t dst);
+  // Evaluates an expression and returns the register holding its value, which
+  // is `dst` if there is one.
+  int32_t compileExpr(const ir::Expr &expr, std::optional<int32_t> dst);
+  int32_t compileArithOp(const ir::ArithOp &arithOp, int32_t dst);
+  // The register that a temporary or frame slot lives in.
+  std::optional<int32_t> getRegister(const ir::Expr &expr) const;
+  std::optional<int32_t> getFrameSlot(const ir::Expr &address) const;
+  // The static that a name refers to. String literals are added the first
+  // time they come up.
+  size_t getStatic(Symbol name);
+  int32_t makeRegister();
+  void emit(bytecode::Opcode op, const std::vector<int32_t> &operands);
+  void emitTarget(Symbol label);
+  bytecode::Module module;
+  std::unordered_map<std::string, size_t> functionIndices;
+  std::unordered_map<std::string, size_t> staticIndices;
+  const ir::Level *level;
+  int32_t frameSlotCount;
+  int32_t firstScratchRegister;
+  int32_t nextRegister;
+  int32_t registerCount;
+  std::unordered_map<Symbol, size_t, SymbolHash> labelOffsets;
+  std::vector<std::pair<size_t, Symbol>> targetFixups;
+};
+
+} // namespace descartes
@@ -0,0 +1,260 @@
+#include "BytecodeImage.h"
+
+#include <Interfaces.h>
+#include <Runtime.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstring>
+
+namespace descartes {
+
+namespace {
+
+const uint8_t magic[] = {0x7f, 'D', 'B', 'C'};
+// Bumped whenever the bytecode or the layout changes.
+const uint32_t version = 5;
+
+// The magic number and version then the offset and count of each table.
+const size_t headerSize = 104;
+const size_t functionSize = 32;
+const size_t staticSize = 24;
+
+// Unmaps the image however reading it ends.
+class Mapping {
+public:
+  Mapping(const void *data, size_t size) : data(data), size(size) {}
+  ~Mapping() { munmap(const_cast<void *>(data), size); }
+  Mapping(const Mapping &) = delete;
+  Mapping &operator=(const Mapping &) = delete;
+
+private:
+  const void *data;
+  size_t size;
+};
+
+class ImageView {
+public:
+  ImageView(const uint8_t *data, size_t size) : data(data), size(size) {}
+  template <typename T> T get(uint64_t offset) const {
+    checkRange(offset, sizeof(T), "truncated");
+    T value;
+    std::memcpy(&value, data + offset, sizeof(T));
+    return value;
+  }
+  // Checks that a table of `count` entries fits at `offset`.
+  void check(uint64_t offset, uint64_t count, uint64_t entrySize,
+             const char *what) const {
+    if (offset % 8 != 0 || (entrySize && count > size / entrySize))
+      throw ImageError(std::string("Malformed image: ") + what);
+    checkRange(offset, count * entrySize, what);
+  }
+  std::string getString(uint64_t pool, uint64_t poolSize,
+                        uint32_t offset) const {
+    const void *end = offset < poolSize ? std::memchr(data + pool + offset, 0,
+                                                      poolSize - offset)
+                                        : nullptr;
+    if (!end)
+      throw ImageError("Malformed image: bad string");
+    return std::string(reinterpret_cast<const char *>(data + pool + offset));
+  }
+  const uint8_t *const data;
+
+private:
+  void checkRange(uint64_t offset, uint64_t length, const char *what) const {
+    if (offset > size || length > size - offset)
+      throw ImageError(std::string("Malformed image: ") + what);
+  }
+  const size_t size;
+};
+
+// Walks the code an instruction at a time so that decoding can't run off the
+// end of it.
+void checkCode(const std::vector<int32_t> &code) {
+  for (size_t i = 0; i < code.size();) {
+    const int32_t opcode = code.at(i);
+    if (opcode < 0 ||
+        opcode >= static_cast<int32_t>(bytecode::Opcode::OpcodeCount))
+      throw ImageError("Malformed image: bad opcode");
+    const bool isRuntimeCall =
+        opcode == static_cast<int32_t>(bytecode::Opcode::CallRuntime);
+    const bool hasCount =
+        opcode == static_cast<int32_t>(bytecode::Opcode::JumpTable) ||
+        opcode == static_cast<int32_t>(bytecode::Opcode::Call) ||
+        isRuntimeCall;
+    if (hasCount && (code.size() - i < 4 || code.at(i + 2) < 0 ||
+                     code.at(i + 3) < 0))
+      throw ImageError("Malformed image: truncated code");
+    // The runtime is part of the interpreter rather than the image.
+    if (isRuntimeCall &&
+        (static_cast<size_t>(code.at(i + 2)) >= runtime::functionCount ||
+         static_cast<size_t>(code.at(i + 3)) !=
+             runtime::functions[code.at(i + 2)].argumentCount))
+      throw ImageError("Malformed image: bad runtime function");
+    const size_t size = bytecode::getInstructionSize(&code.at(i));
+    if (size > code.size() - i)
+      throw ImageError("Malformed image: truncated code");
+    i += size;
+  }
+}
+
+} // namespace
+
+ImageWriter::ImageWriter(std::ostream &out) : out(out) {}
+
+void ImageWriter::write(const bytecode::Module &module) {
+  buffer.assign(headerSize, 0);
+  strings.clear();
+  std::vector<uint8_t> functions, formals, statics, data;
+  for (const bytecode::Function &function : module.functions) {
+    append<uint32_t>(functions, addString(function.name));
+    append<uint32_t>(functions, function.formals.size());
+    append<uint64_t>(functions, function.entry);
+    append<int32_t>(functions, function.frameSlotCount);
+    append<int32_t>(functions, function.registerCount);
+    append<uint32_t>(functions, formals.size() / sizeof(int32_t));
+    append<int32_t>(functions, function.returnRegister);
+    for (int32_t formal : function.formals)
+      append<int32_t>(formals, formal);
+  }
+  for (const bytecode::Static &object : module.statics) {
+    append<uint32_t>(statics, addString(object.name));
+    append<uint32_t>(statics, object.data.size());
+    append<uint64_t>(statics, object.size);
+    append<uint64_t>(statics, data.size() / sizeof(uint64_t));
+    for (uint64_t word : object.data)
+      append<uint64_t>(data, word);
+  }
+
+  std::vector<uint8_t> header(std::begin(magic), std::end(magic));
+  append<uint32_t>(header, version);
+  const auto addTable = [this, &header](const std::vector<uint8_t> &data,
+                                        uint64_t count) {
+    align(8);
+    append<uint64_t>(header, buffer.size());
+    append<uint64_t>(header, count);
+    buffer.insert(buffer.end(), data.begin(), data.end());
+  };
+  std::vector<uint8_t> code;
+  for (int32_t word : module.code)
+    append<int32_t>(code, word);
+  addTable(code, module.code.size());
+  addTable(functions, module.functions.size());
+  addTable(formals, formals.size() / sizeof(int32_t));
+  addTable(statics, module.statics.size());
+  addTable(strings, strings.size());
+  addTable(data, data.size() / sizeof(uint64_t));
+  assert(header.size() == headerSize);
+  std::copy(header.begin(), header.end(), buffer.begin());
+  out.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+}
+
+uint32_t ImageWriter::addString(const std::string &string) {
+  const uint32_t offset = strings.size();
+  strings.insert(strings.end(), string.begin(), string.end());
+  strings.push_back(0);
+  return offset;
+}
+
+void ImageWriter::align(uint64_t alignment) {
+  buffer.resize((buffer.size() + alignment - 1) / alignment * alignment, 0);
+}
+
+ImageReader::ImageReader() {}
+
+bytecode::Module ImageReader::read(const std::string &fileName) {
+  const int file = open(fileName.c_str(), O_RDONLY);
+  if (file < 0)
+    throw ImageError("Could not open image " + fileName);
+  struct stat status;
+  const bool hasStatus = fstat(file, &status) == 0;
+  if (!hasStatus || static_cast<size_t>(status.st_size) < headerSize) {
+    close(file);
+    throw ImageError("Not a bytecode image: " + fileName);
+  }
+  const size_t size = status.st_size;
+  void *pages = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (pages == MAP_FAILED)
+    throw ImageError("Could not map image " + fileName);
+  const Mapping mapping(pages, size);
+  const ImageView image(static_cast<const uint8_t *>(pages), size);
+  if (!std::equal(std::begin(magic), std::end(magic), image.data))
+    throw ImageError("Not a bytecode image: " + fileName);
+  const uint32_t imageVersion = image.get<uint32_t>(4);
+  if (imageVersion != version)
+    throw ImageError("Unsupported image version " +
+                     std::to_string(imageVersion));
+
+  const auto getTable = [&image](size_t index, uint64_t entrySize,
+                                 const char *what) {
+    const uint64_t offset = image.get<uint64_t>(8 + index * 16);
+    const uint64_t count = image.get<uint64_t>(16 + index * 16);
+    image.check(offset, count, entrySize, what);
+    return std::make_pair(offset, count);
+  };
+  const auto [codeOffset, codeCount] = getTable(0, sizeof(int32_t), "code");
+  const auto [functionsOffset, functionCount] =
+      getTable(1, functionSize, "functions");
+  const auto [formalsOffset, formalCount] =
+      getTable(2, sizeof(int32_t), "formals");
+  const auto [staticsOffset, staticCount] = getTable(3, staticSize, "statics");
+  const auto [stringsOffset, stringsSize] = getTable(4, 1, "strings");
+  const auto [dataOffset, dataCount] = getTable(5, sizeof(uint64_t), "data");
+
+  bytecode::Module module;
+  module.code.resize(codeCount);
+  std::memcpy(module.code.data(), image.data + codeOffset,
+              codeCount * sizeof(int32_t));
+  checkCode(module.code);
+  for (uint64_t i = 0; i < functionCount; ++i) {
+    const uint64_t offset = functionsOffset + i * functionSize;
+    bytecode::Function function;
+    function.name = image.getString(stringsOffset, stringsSize,
+                                    image.get<uint32_t>(offset));
+    const uint32_t formalsCount = image.get<uint32_t>(offset + 4);
+    function.entry = image.get<uint64_t>(offset + 8);
+    function.frameSlotCount = image.get<int32_t>(offset + 16);
+    function.registerCount = image.get<int32_t>(offset + 20);
+    const uint32_t firstFormal = image.get<uint32_t>(offset + 24);
+    function.returnRegister = image.get<int32_t>(offset + 28);
+    if (function.entry >= codeCount || function.registerCount <= 0 ||
+        function.frameSlotCount > function.registerCount ||
+        function.returnRegister < 0 ||
+        function.returnRegister >= function.registerCount ||
+        firstFormal > formalCount || formalsCount > formalCount - firstFormal)
+      throw ImageError("Malformed image: bad function " + function.name);
+    for (uint32_t j = 0; j < formalsCount; ++j) {
+      const int32_t formal = image.get<int32_t>(
+          formalsOffset + (firstFormal + j) * sizeof(int32_t));
+      if (formal < 0 || formal >= function.registerCount)
+        throw ImageError("Malformed image: bad function " + function.name);
+      function.formals.push_back(formal);
+    }
+    module.functions.push_back(std::move(function));
+  }
+  for (uint64_t i = 0; i < staticCount; ++i) {
+    const uint64_t offset = staticsOffset + i * staticSize;
+    bytecode::Static object;
+    object.name = image.getString(stringsOffset, stringsSize,
+                                  image.get<uint32_t>(offset));
+    const uint32_t wordCount = image.get<uint32_t>(offset + 4);
+    object.size = image.get<uint64_t>(offset + 8);
+    const uint64_t firstWord = image.get<uint64_t>(offset + 16);
+    if (firstWord > dataCount || wordCount > dataCount - firstWord ||
+        wordCount > object.size / sizeof(uint64_t))
+      throw ImageError("Malformed image: bad static " + object.name);
+    object.data.resize(wordCount);
+    std::memcpy(object.data.data(),
+                image.data + dataOffset + firstWord * sizeof(uint64_t),
+                wordCount * sizeof(uint64_t));
+    module.statics.push_back(std::move(object));
+  }
+  return module;
+}
+
+} // namespace descartes
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <Bytecode.h>
+
+#include <ostream>
+
+namespace descartes {
+
+// A compiled bytecode module saved to a file so that it can be run again
+// without going through the front end.
+//
+// The image is a header followed by the code, the function and static tables,
+// the registers that every function takes its arguments in, a pool of the
+// strings they refer to and the words that statics start out with.
+// Everything is little endian and at its natural alignment, so loading one is
+// a matter of mapping the file and checking the offsets in it.
+class ImageWriter {
+public:
+  explicit ImageWriter(std::ostream &out);
+  virtual ~ImageWriter() = default;
+  void write(const bytecode::Module &module);
+
+private:
+  uint32_t addString(const std::string &string);
+  void align(uint64_t alignment);
+  template <typename T> void append(std::vector<uint8_t> &data, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i)
+      data.push_back(static_cast<uint64_t>(value) >> (i * 8));
+  }
+  std::ostream &out;
+  std::vector<uint8_t> buffer;
+  std::vector<uint8_t> strings;
+};
+
+// Maps an image and checks that it's well formed before handing back the
+// module. The bytecode itself is trusted once it decodes.
+class ImageReader {
+public:
+  ImageReader();
+  virtual ~ImageReader() = default;
+  bytecode::Module read(const std::string &fileName);
+};
+
+} // namespace descartes
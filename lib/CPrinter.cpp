@@ -0,0 +1,523 @@
+#include "CPrinter.h"
+
+#include <Runtime.h>
+
+#include <algorithm>
+#include <cassert>
+#include <set>
+
+namespace descartes {
+
+namespace {
+
+// Signed overflow is undefined in C so anything that can overflow is done on
+// unsigned values. Shift counts are masked like the machine does and the upper
+// half of a product comes from a 128 bit one. Narrow array elements live
+// inside frame words, so they're read and written with `memcpy` rather than
+// through a pointer of another type.
+const char *const prelude =
+    "#include <stdint.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "static inline int64_t descartes_add(int64_t lhs, int64_t rhs) {\n"
+    "  return (int64_t)((uint64_t)lhs + (uint64_t)rhs);\n"
+    "}\n"
+    "static inline int64_t descartes_sub(int64_t lhs, int64_t rhs) {\n"
+    "  return (int64_t)((uint64_t)lhs - (uint64_t)rhs);\n"
+    "}\n"
+    "static inline int64_t descartes_mul(int64_t lhs, int64_t rhs) {\n"
+    "  return (int64_t)((uint64_t)lhs * (uint64_t)rhs);\n"
+    "}\n"
+    "static inline int64_t descartes_shl(int64_t lhs, int64_t rhs) {\n"
+    "  return (int64_t)((uint64_t)lhs << (rhs & 63));\n"
+    "}\n"
+    "static inline int64_t descartes_sar(int64_t lhs, int64_t rhs) {\n"
+    "  return lhs >> (rhs & 63);\n"
+    "}\n"
+    "static inline int64_t descartes_mulh(int64_t lhs, int64_t rhs) {\n"
+    "  return (int64_t)(((__int128)lhs * rhs) >> 64);\n"
+    "}\n"
+    "#define DESCARTES_LOAD(name, type) \\\n"
+    "  static inline int64_t descartes_load_##name(int64_t address) { \\\n"
+    "    type value; \\\n"
+    "    memcpy(&value, (const void *)(intptr_t)address, sizeof value); \\\n"
+    "    return value; \\\n"
+    "  }\n"
+    "DESCARTES_LOAD(i8, int8_t)\n"
+    "DESCARTES_LOAD(u8, uint8_t)\n"
+    "DESCARTES_LOAD(i16, int16_t)\n"
+    "DESCARTES_LOAD(u16, uint16_t)\n"
+    "DESCARTES_LOAD(i32, int32_t)\n"
+    "DESCARTES_LOAD(u32, uint32_t)\n"
+    "#define DESCARTES_STORE(name, type) \\\n"
+    "  static inline void descartes_store_##name(int64_t address, \\\n"
+    "                                            int64_t value) { \\\n"
+    "    type narrow = (type)value; \\\n"
+    "    memcpy((void *)(intptr_t)address, &narrow, sizeof narrow); \\\n"
+    "  }\n"
+    "DESCARTES_STORE(8, uint8_t)\n"
+    "DESCARTES_STORE(16, uint16_t)\n"
+    "DESCARTES_STORE(32, uint32_t)\n";
+
+// The suffixes of the prelude's helpers for narrow loads and stores.
+const char *getLoadSuffix(ir::MemType type) {
+  switch (type) {
+  case ir::MemType::Int8:
+    return "i8";
+  case ir::MemType::Uint8:
+    return "u8";
+  case ir::MemType::Int16:
+    return "i16";
+  case ir::MemType::Uint16:
+    return "u16";
+  case ir::MemType::Int32:
+    return "i32";
+  case ir::MemType::Uint32:
+    return "u32";
+  case ir::MemType::Word:
+    break;
+  }
+  return nullptr;
+}
+
+const char *getHelper(ir::ArithOpKind kind) {
+  switch (kind) {
+  case ir::ArithOpKind::Add:
+    return "descartes_add";
+  case ir::ArithOpKind::Subtract:
+    return "descartes_sub";
+  case ir::ArithOpKind::Multiply:
+    return "descartes_mul";
+  case ir::ArithOpKind::ShiftLeft:
+    return "descartes_shl";
+  case ir::ArithOpKind::ShiftRight:
+    return "descartes_sar";
+  case ir::ArithOpKind::MultiplyHigh:
+    return "descartes_mulh";
+  case ir::ArithOpKind::Divide:
+  case ir::ArithOpKind::And:
+    break;
+  }
+  return nullptr;
+}
+
+const char *getOperator(ir::RelOpKind kind) {
+  switch (kind) {
+  case ir::RelOpKind::Equal:
+    return "==";
+  case ir::RelOpKind::NotEqual:
+    return "!=";
+  case ir::RelOpKind::LessThan:
+    return "<";
+  case ir::RelOpKind::GreaterThan:
+    return ">";
+  case ir::RelOpKind::LessThanEqual:
+    return "<=";
+  case ir::RelOpKind::GreaterThanEqual:
+    return ">=";
+  }
+  return "";
+}
+
+// The runtime keeps its own names.
+std::string getName(Symbol symbol) {
+  if (runtime::findFunction(symbol.getName()))
+    return symbol.getName();
+  return "pascal_" + symbol.getName();
+}
+
+bool isRuntimeCall(const ir::Expr &expr) {
+  return expr.getKind() == ir::ExprKind::Call &&
+         runtime::findFunction(
+             static_cast<const ir::Call &>(expr).functionName.getName());
+}
+
+bool callsRuntime(const ir::Fragment &frag) {
+  const auto &statements =
+      static_cast<const ir::Sequence &>(*frag.second).statements;
+  return std::any_of(statements.begin(), statements.end(),
+                     [](const ir::StatementPtr &statement) {
+                       if (statement->getKind() == ir::StatementKind::Move)
+                         return isRuntimeCall(
+                             *static_cast<const ir::Move &>(*statement).src);
+                       return statement->getKind() ==
+                                  ir::StatementKind::CallStatement &&
+                              isRuntimeCall(
+                                  *static_cast<const ir::CallStatement &>(
+                                       *statement)
+                                       .call);
+                     });
+}
+
+// The index of the frame slot at `offset` when the frame pointer is the
+// address of the last one.
+size_t getSlot(const ir::Level &level, int offset) {
+  return std::max<size_t>(level.locals.size(), 1) - 1 + offset / ir::wordSize;
+}
+
+// The else label normally comes next so there's nothing to do on false.
+bool fallsThrough(const ir::CondJump &condJump, const ir::Statement *next) {
+  return next && next->getKind() == ir::StatementKind::Label &&
+         static_cast<const ir::Label *>(next)->label == condJump.elseLabel;
+}
+
+void collectTemps(const ir::Expr &expr, std::set<int> &temps) {
+  switch (expr.getKind()) {
+  case ir::ExprKind::ArithOp:
+    collectTemps(*static_cast<const ir::ArithOp &>(expr).lhs, temps);
+    collectTemps(*static_cast<const ir::ArithOp &>(expr).rhs, temps);
+    break;
+  case ir::ExprKind::Mem:
+    collectTemps(*static_cast<const ir::Mem &>(expr).expr, temps);
+    break;
+  case ir::ExprKind::Call:
+    for (const ir::ExprPtr &arg : static_cast<const ir::Call &>(expr).args)
+      collectTemps(*arg, temps);
+    break;
+  case ir::ExprKind::Temp:
+    temps.insert(static_cast<const ir::Temp &>(expr).id);
+    break;
+  default:
+    break;
+  }
+}
+
+void collectStrings(const ir::Expr &expr, std::vector<Symbol> &strings) {
+  switch (expr.getKind()) {
+  case ir::ExprKind::ArithOp:
+    collectStrings(*static_cast<const ir::ArithOp &>(expr).lhs, strings);
+    collectStrings(*static_cast<const ir::ArithOp &>(expr).rhs, strings);
+    break;
+  case ir::ExprKind::Mem:
+    collectStrings(*static_cast<const ir::Mem &>(expr).expr, strings);
+    break;
+  case ir::ExprKind::Call:
+    for (const ir::ExprPtr &arg : static_cast<const ir::Call &>(expr).args)
+      collectStrings(*arg, strings);
+    break;
+  case ir::ExprKind::Name: {
+    const Symbol name = static_cast<const ir::Name &>(expr).value;
+    if (ir::isString(name) &&
+        std::find(strings.begin(), strings.end(), name) == strings.end())
+      strings.push_back(name);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// The string literals that the program refers to, each once.
+std::vector<Symbol> collectStrings(const std::vector<ir::Fragment> &frags) {
+  std::vector<Symbol> strings;
+  for (const ir::Fragment &frag : frags) {
+    for (const ir::StatementPtr &statement :
+         static_cast<const ir::Sequence &>(*frag.second).statements) {
+      switch (statement->getKind()) {
+      case ir::StatementKind::CondJump:
+        collectStrings(*static_cast<const ir::CondJump &>(*statement).lhs,
+                       strings);
+        collectStrings(*static_cast<const ir::CondJump &>(*statement).rhs,
+                       strings);
+        break;
+      case ir::StatementKind::JumpTable:
+        collectStrings(*static_cast<const ir::JumpTable &>(*statement).index,
+                       strings);
+        break;
+      case ir::StatementKind::Move:
+        collectStrings(*static_cast<const ir::Move &>(*statement).dst,
+                       strings);
+        collectStrings(*static_cast<const ir::Move &>(*statement).src,
+                       strings);
+        break;
+      case ir::StatementKind::CallStatement:
+        collectStrings(
+            *static_cast<const ir::CallStatement &>(*statement).call,
+            strings);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+  return strings;
+}
+
+// The temporaries that a function uses, so that it only declares those, and
+// the labels that it jumps to, so that it only defines those.
+std::set<int>
+collectUses(const std::vector<ir::StatementPtr> &statements,
+            std::unordered_set<Symbol, SymbolHash> &targets) {
+  std::set<int> temps = {ir::returnValue};
+  targets.clear();
+  for (size_t i = 0; i < statements.size(); ++i) {
+    const ir::StatementPtr &statement = statements.at(i);
+    switch (statement->getKind()) {
+    case ir::StatementKind::Jump:
+      targets.insert(static_cast<const ir::Jump &>(*statement).jumpLabel);
+      break;
+    case ir::StatementKind::CondJump: {
+      const auto &condJump = static_cast<const ir::CondJump &>(*statement);
+      collectTemps(*condJump.lhs, temps);
+      collectTemps(*condJump.rhs, temps);
+      targets.insert(condJump.thenLabel);
+      if (!fallsThrough(condJump, i + 1 < statements.size()
+                                      ? statements.at(i + 1).get()
+                                      : nullptr))
+        targets.insert(condJump.elseLabel);
+      break;
+    }
+    case ir::StatementKind::JumpTable: {
+      const auto &jumpTable = static_cast<const ir::JumpTable &>(*statement);
+      collectTemps(*jumpTable.index, temps);
+      targets.insert(jumpTable.labels.begin(), jumpTable.labels.end());
+      break;
+    }
+    case ir::StatementKind::Move:
+      collectTemps(*static_cast<const ir::Move &>(*statement).dst, temps);
+      collectTemps(*static_cast<const ir::Move &>(*statement).src, temps);
+      break;
+    case ir::StatementKind::CallStatement:
+      collectTemps(*static_cast<const ir::CallStatement &>(*statement).call,
+                   temps);
+      break;
+    default:
+      break;
+    }
+  }
+  return temps;
+}
+
+} // namespace
+
+CPrinter::CPrinter(std::ostream &out) : out(out) {}
+
+void CPrinter::print(const std::vector<ir::Fragment> &frags) {
+  assert(!frags.empty());
+  out << prelude;
+  int depth = -1;
+  for (const ir::Fragment &frag : frags) {
+    if (frag.first->isDisplayed)
+      depth = std::max(depth, frag.first->depth);
+  }
+  if (depth >= 0)
+    out << "\nstatic int64_t pascal_" << ir::displayName << "[" << depth + 1
+        << "];\n";
+  strings.clear();
+  for (Symbol string : collectStrings(frags)) {
+    const size_t index = strings.size();
+    strings.emplace(string, index);
+    out << (index ? "" : "\n") << "static const uint64_t descartes_string"
+        << index << "[] = {";
+    const std::vector<uint64_t> words = ir::getStringWords(string);
+    for (size_t i = 0; i < words.size(); ++i)
+      out << (i ? ", " : "") << words.at(i) << "ull";
+    out << "};\n";
+  }
+  // Programs that do input or output get linked against the runtime.
+  if (std::any_of(frags.begin(), frags.end(), callsRuntime)) {
+    out << "\n";
+    for (size_t i = 0; i < runtime::functionCount; ++i) {
+      const runtime::Function &function = runtime::functions[i];
+      out << "int64_t " << function.name << "(";
+      if (function.argumentCount == 0)
+        out << "void";
+      for (size_t j = 0; j < function.argumentCount; ++j)
+        out << (j ? ", " : "") << "int64_t a" << j;
+      out << ");\n";
+    }
+  }
+  // Calls can go to functions that come later.
+  out << "\n";
+  for (const ir::Fragment &frag : frags) {
+    printSignature(*frag.first);
+    out << ";\n";
+  }
+  for (const ir::Fragment &frag : frags)
+    printFunction(frag);
+  // The main program comes last.
+  out << "\nint main(void) {\n"
+      << "  " << getName(frags.back().first->name) << "();\n"
+      << "  return 0;\n"
+      << "}\n";
+}
+
+void CPrinter::printFunction(const ir::Fragment &frag) {
+  const ir::Level &level = *frag.first;
+  out << "\n";
+  printSignature(level);
+  out << " {\n";
+  assert(frag.second->getKind() == ir::StatementKind::Sequence);
+  const auto &statements =
+      static_cast<const ir::Sequence &>(*frag.second).statements;
+  const std::set<int> temps = collectUses(statements, targets);
+  // Formals only need to go in the frame if something reads them from it.
+  if (temps.count(ir::framePointer)) {
+    const size_t slotCount = std::max<size_t>(level.locals.size(), 1);
+    out << "  int64_t frame[" << slotCount << "];\n"
+        << "  int64_t t" << ir::framePointer
+        << " = (int64_t)(intptr_t)&frame[" << slotCount - 1 << "];\n";
+    for (size_t i = 0; i < level.formals.size(); ++i)
+      out << "  frame[" << getSlot(level, level.formals.at(i).offset)
+          << "] = a" << i << ";\n";
+  }
+  for (int temp : temps) {
+    if (temp != ir::framePointer)
+      out << "  int64_t t" << temp << " = 0;\n";
+  }
+  for (size_t i = 0; i < statements.size(); ++i)
+    printStatement(*statements.at(i), i + 1 < statements.size()
+                                          ? statements.at(i + 1).get()
+                                          : nullptr);
+  out << "  return t" << ir::returnValue << ";\n"
+      << "}\n";
+}
+
+void CPrinter::printSignature(const ir::Level &level) {
+  out << "int64_t " << getName(level.name) << "(";
+  if (level.formals.empty())
+    out << "void";
+  for (size_t i = 0; i < level.formals.size(); ++i)
+    out << (i ? ", " : "") << "int64_t a" << i;
+  out << ")";
+}
+
+void CPrinter::printStatement(const ir::Statement &statement,
+                              const ir::Statement *next) {
+  switch (statement.getKind()) {
+  case ir::StatementKind::Label: {
+    // A label has to be followed by a statement even at the end.
+    const Symbol label = static_cast<const ir::Label &>(statement).label;
+    if (targets.count(label))
+      out << label.getName() << ":;\n";
+    break;
+  }
+  case ir::StatementKind::Jump:
+    out << "  goto "
+        << static_cast<const ir::Jump &>(statement).jumpLabel.getName()
+        << ";\n";
+    break;
+  case ir::StatementKind::CondJump: {
+    const auto &condJump = static_cast<const ir::CondJump &>(statement);
+    out << "  if (";
+    printExpr(*condJump.lhs);
+    out << " " << getOperator(condJump.op) << " ";
+    printExpr(*condJump.rhs);
+    out << ")\n"
+        << "    goto " << condJump.thenLabel.getName() << ";\n";
+    if (!fallsThrough(condJump, next))
+      out << "  goto " << condJump.elseLabel.getName() << ";\n";
+    break;
+  }
+  case ir::StatementKind::JumpTable: {
+    // The C compiler turns this back into a table.
+    const auto &jumpTable = static_cast<const ir::JumpTable &>(statement);
+    out << "  switch (";
+    printExpr(*jumpTable.index);
+    out << ") {\n";
+    for (size_t i = 0; i < jumpTable.labels.size(); ++i)
+      out << "  case " << i << ":\n"
+          << "    goto " << jumpTable.labels.at(i).getName() << ";\n";
+    out << "  }\n";
+    break;
+  }
+  case ir::StatementKind::Move: {
+    const auto &move = static_cast<const ir::Move &>(statement);
+    if (move.dst->getKind() == ir::ExprKind::Mem) {
+      const auto &dst = static_cast<const ir::Mem &>(*move.dst);
+      if (dst.type != ir::MemType::Word) {
+        out << "  descartes_store_" << ir::getMemSize(dst.type) * 8 << "(";
+        printExpr(*dst.expr);
+        out << ", ";
+        printExpr(*move.src);
+        out << ");\n";
+        break;
+      }
+    }
+    out << "  ";
+    printExpr(*move.dst);
+    out << " = ";
+    printExpr(*move.src);
+    out << ";\n";
+    break;
+  }
+  case ir::StatementKind::CallStatement: {
+    const auto &call = static_cast<const ir::CallStatement &>(statement).call;
+    assert(call->getKind() == ir::ExprKind::Call);
+    out << "  ";
+    printCall(static_cast<const ir::Call &>(*call));
+    out << ";\n";
+    break;
+  }
+  case ir::StatementKind::Sequence:
+    assert(!"Canonical IR has no nested sequences");
+    break;
+  }
+}
+
+void CPrinter::printExpr(const ir::Expr &expr) {
+  switch (expr.getKind()) {
+  case ir::ExprKind::ArithOp: {
+    const auto &arithOp = static_cast<const ir::ArithOp &>(expr);
+    if (const char *helper = getHelper(arithOp.op)) {
+      out << helper << "(";
+      printExpr(*arithOp.lhs);
+      out << ", ";
+      printExpr(*arithOp.rhs);
+      out << ")";
+      break;
+    }
+    out << "(";
+    printExpr(*arithOp.lhs);
+    out << (arithOp.op == ir::ArithOpKind::Divide ? " / " : " & ");
+    printExpr(*arithOp.rhs);
+    out << ")";
+    break;
+  }
+  case ir::ExprKind::Mem: {
+    const auto &mem = static_cast<const ir::Mem &>(expr);
+    if (const char *suffix = getLoadSuffix(mem.type)) {
+      out << "descartes_load_" << suffix << "(";
+      printExpr(*mem.expr);
+      out << ")";
+      break;
+    }
+    out << "(*(int64_t *)(intptr_t)";
+    printExpr(*mem.expr);
+    out << ")";
+    break;
+  }
+  case ir::ExprKind::Name: {
+    const Symbol name = static_cast<const ir::Name &>(expr).value;
+    out << "(int64_t)(intptr_t)";
+    if (ir::isString(name))
+      out << "descartes_string" << strings.at(name);
+    else
+      out << getName(name);
+    break;
+  }
+  case ir::ExprKind::Const:
+    out << static_cast<const ir::Const &>(expr).value;
+    break;
+  case ir::ExprKind::Call:
+    printCall(static_cast<const ir::Call &>(expr));
+    break;
+  case ir::ExprKind::Temp:
+    out << "t" << static_cast<const ir::Temp &>(expr).id;
+    break;
+  case ir::ExprKind::CondExpr:
+    assert(!"Canonical IR has no conditional expressions");
+    break;
+  }
+}
+
+void CPrinter::printCall(const ir::Call &call) {
+  out << getName(call.functionName) << "(";
+  for (size_t i = 0; i < call.args.size(); ++i) {
+    out << (i ? ", " : "");
+    printExpr(*call.args.at(i));
+  }
+  out << ")";
+}
+
+} // namespace descartes
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Ir.h>
+
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace descartes {
+
+// Writes canonical IR out as C for the system compiler to optimise and build,
+// so that programs can run at full speed whatever state the native backend is
+// in.
+//
+// Every fragment becomes a function taking its formals, static link first if
+// it has one, and returning a 64 bit integer. The frame is an array of words
+// on the C stack that the frame pointer points into, so addresses into it and
+// the display behave just like they do in native code. Arithmetic wraps the
+// way the machine does. Everything the program defines is prefixed with
+// `pascal_`, which can't clash with anything else since Pascal identifiers
+// don't have underscores. String literals are arrays of words laid out the
+// way the runtime expects.
+class CPrinter {
+public:
+  explicit CPrinter(std::ostream &out);
+  virtual ~CPrinter() = default;
+  void print(const std::vector<ir::Fragment> &frags);
+
+private:
+  void printFunction(const ir::Fragment &frag);
+  void printSignature(const ir::Level &level);
+  void printStatement(const ir::Statement &statement,
+                      const ir::Statement *next);
+  void printExpr(const ir::Expr &expr);
+  void printCall(const ir::Call &call);
+  std::ostream &out;
+  std::unordered_set<Symbol, SymbolHash> targets;
+  // The number of each string literal's array.
+  std::unordered_map<Symbol, size_t, SymbolHash> strings;
+};
+
+} // namespace descartes
@@ -0,0 +1,99 @@
+#include "CallGraph.h"
+
+#include <algorithm>
+
+namespace descartes::ssa {
+
+CallGraph::CallGraph(const std::vector<std::unique_ptr<Function>> &functions) {
+  for (const auto &function : functions) {
+    const int name = function->level.name.id;
+    // Shared names are ambiguous.
+    if (!functionsByName.emplace(name, function.get()).second)
+      functionsByName.at(name) = nullptr;
+  }
+  for (const auto &function : functions) {
+    auto &functionCallees = callees[function.get()];
+    for (const auto &block : function->blocks) {
+      for (const auto &instruction : block->instructions) {
+        if (instruction->op != Opcode::Call)
+          continue;
+        Function *callee = getCallee(*instruction);
+        if (!callee)
+          continue;
+        callSites[callee].push_back(instruction.get());
+        if (std::find(functionCallees.begin(), functionCallees.end(),
+                      callee) == functionCallees.end())
+          functionCallees.push_back(callee);
+      }
+    }
+  }
+  for (const auto &function : functions) {
+    if (!visitIndices.count(function.get()))
+      findComponent(function.get());
+  }
+  visitIndices.clear();
+  lowLinks.clear();
+  onStack.clear();
+}
+
+Function *CallGraph::getCallee(const Instruction &call) const {
+  const auto iter = functionsByName.find(call.symbol->id);
+  if (iter == functionsByName.end())
+    return nullptr;
+  return iter->second;
+}
+
+const std::vector<Instruction *> &
+CallGraph::getCallSites(const Function *callee) const {
+  static const std::vector<Instruction *> none;
+  const auto iter = callSites.find(callee);
+  if (iter == callSites.end())
+    return none;
+  return iter->second;
+}
+
+const std::vector<std::vector<Function *>> &CallGraph::getComponents() const {
+  return components;
+}
+
+bool CallGraph::isRecursive(const Function *function) const {
+  const auto &component = components.at(componentIndices.at(function));
+  if (component.size() > 1)
+    return true;
+  const auto &functionCallees = callees.at(function);
+  return std::find(functionCallees.begin(), functionCallees.end(), function) !=
+         functionCallees.end();
+}
+
+void CallGraph::findComponent(Function *function) {
+  // Tarjan's algorithm finds components in reverse topological order, which
+  // puts callees first.
+  const size_t index = visitIndices.size();
+  visitIndices[function] = index;
+  lowLinks[function] = index;
+  stack.push_back(function);
+  onStack[function] = true;
+  for (Function *callee : callees.at(function)) {
+    if (!visitIndices.count(callee)) {
+      findComponent(callee);
+      lowLinks[function] = std::min(lowLinks.at(function), lowLinks.at(callee));
+    } else if (onStack.at(callee)) {
+      lowLinks[function] =
+          std::min(lowLinks.at(function), visitIndices.at(callee));
+    }
+  }
+  if (lowLinks.at(function) != index)
+    return;
+  std::vector<Function *> component;
+  Function *member;
+  do {
+    member = stack.back();
+    stack.pop_back();
+    onStack[member] = false;
+    componentIndices[member] = components.size();
+    component.push_back(member);
+  } while (member != function);
+  components.push_back(std::move(component));
+}
+
+} // namespace descartes::ssa
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Ssa.h>
+
+#include <unordered_map>
+
+namespace descartes::ssa {
+
+// The calls between the functions of a program. Calls name their callee by
+// symbol so a name that more than one function shares stays unresolved, as do
+// calls to functions without a body such as those of the runtime.
+class CallGraph {
+public:
+  explicit CallGraph(const std::vector<std::unique_ptr<Function>> &functions);
+  virtual ~CallGraph() = default;
+  Function *getCallee(const Instruction &call) const;
+  const std::vector<Instruction *> &getCallSites(const Function *callee) const;
+  // Strongly connected components of the graph with callees before their
+  // callers.
+  const std::vector<std::vector<Function *>> &getComponents() const;
+  // Whether the function can end up calling itself.
+  bool isRecursive(const Function *function) const;
+
+private:
+  void findComponent(Function *function);
+  std::unordered_map<int, Function *> functionsByName;
+  std::unordered_map<const Function *, std::vector<Instruction *>> callSites;
+  std::unordered_map<const Function *, std::vector<Function *>> callees;
+  std::vector<std::vector<Function *>> components;
+  std::unordered_map<const Function *, size_t> componentIndices;
+  // State for Tarjan's algorithm.
+  std::unordered_map<const Function *, size_t> visitIndices, lowLinks;
+  std::vector<Function *> stack;
+  std::unordered_map<const Function *, bool> onStack;
+};
+
+} // namespace descartes::ssa
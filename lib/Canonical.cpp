@@ -0,0 +1,379 @@
+#include "Canonical.h"
+
+#include <cassert>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace descartes {
+
+namespace {
+
+bool isCall(const ir::Statement &statement) {
+  if (statement.getKind() == ir::StatementKind::CallStatement)
+    return true;
+  if (statement.getKind() == ir::StatementKind::Move)
+    return static_cast<const ir::Move &>(statement).src->getKind() ==
+           ir::ExprKind::Call;
+  return false;
+}
+
+bool readsMemory(const ir::Expr &expr) {
+  switch (expr.getKind()) {
+  case ir::ExprKind::Mem:
+  case ir::ExprKind::Call:
+  case ir::ExprKind::CondExpr:
+    return true;
+  case ir::ExprKind::ArithOp: {
+    const auto &arithOp = static_cast<const ir::ArithOp &>(expr);
+    return readsMemory(*arithOp.lhs) || readsMemory(*arithOp.rhs);
+  }
+  case ir::ExprKind::Name:
+  case ir::ExprKind::Const:
+  case ir::ExprKind::Temp:
+    return false;
+  }
+  return true;
+}
+
+// Whether `expr` evaluates to the same value before and after `statements`.
+// The statements produced while linearising only ever assign fresh temporaries
+// so only calls, which may write to memory, can interfere.
+bool commutes(const std::vector<ir::StatementPtr> &statements,
+              const ir::Expr &expr) {
+  if (!readsMemory(expr))
+    return true;
+  for (const auto &statement : statements) {
+    if (isCall(*statement))
+      return false;
+  }
+  return true;
+}
+
+bool isJump(const ir::Statement &statement) {
+  const auto kind = statement.getKind();
+  return kind == ir::StatementKind::Jump ||
+         kind == ir::StatementKind::CondJump ||
+         kind == ir::StatementKind::JumpTable;
+}
+
+std::vector<Symbol> getJumpTargets(const ir::Statement &statement) {
+  switch (statement.getKind()) {
+  case ir::StatementKind::Jump:
+    return {static_cast<const ir::Jump &>(statement).jumpLabel};
+  case ir::StatementKind::CondJump: {
+    const auto &condJump = static_cast<const ir::CondJump &>(statement);
+    return {condJump.thenLabel, condJump.elseLabel};
+  }
+  case ir::StatementKind::JumpTable:
+    return static_cast<const ir::JumpTable &>(statement).labels;
+  default:
+    return {};
+  }
+}
+
+} // namespace
+
+Canonicaliser::Canonicaliser(SymbolTable &symbols)
+    : symbols(symbols), level(nullptr) {}
+
+void Canonicaliser::canonicalise(ir::Fragment &frag) {
+  level = frag.first.get();
+  std::vector<ir::StatementPtr> statements;
+  lineariseStatement(std::move(frag.second), statements);
+  const Symbol exitLabel = makeLabel();
+  auto blocks = makeBasicBlocks(std::move(statements), exitLabel);
+  auto scheduled = scheduleTraces(std::move(blocks), exitLabel);
+  frag.second = std::make_unique<ir::Sequence>(std::move(scheduled));
+  level = nullptr;
+}
+
+std::vector<Canonicaliser::BasicBlock>
+Canonicaliser::makeBasicBlocks(std::vector<ir::StatementPtr> &&statements,
+                               Symbol exitLabel) {
+  std::vector<BasicBlock> blocks;
+  BasicBlock current;
+  for (auto &statement : statements) {
+    if (statement->getKind() == ir::StatementKind::Label) {
+      // A label starts a new block so the previous one must explicitly jump
+      // into it.
+      if (!current.empty()) {
+        const Symbol label =
+            static_cast<const ir::Label &>(*statement).label;
+        current.push_back(std::make_unique<ir::Jump>(label));
+        blocks.push_back(std::move(current));
+        current.clear();
+      }
+      current.push_back(std::move(statement));
+      continue;
+    }
+    // Statements following a jump are only reachable through a new label.
+    if (current.empty())
+      current.push_back(std::make_unique<ir::Label>(makeLabel()));
+    const bool endsBlock = isJump(*statement);
+    current.push_back(std::move(statement));
+    if (endsBlock) {
+      blocks.push_back(std::move(current));
+      current.clear();
+    }
+  }
+  if (!current.empty()) {
+    current.push_back(std::make_unique<ir::Jump>(exitLabel));
+    blocks.push_back(std::move(current));
+  }
+  return blocks;
+}
+
+void Canonicaliser::lineariseStatement(ir::StatementPtr statement,
+                                       std::vector<ir::StatementPtr> &out) {
+  switch (statement->getKind()) {
+  case ir::StatementKind::Sequence: {
+    auto &sequence = static_cast<ir::Sequence &>(*statement);
+    for (auto &s : sequence.statements)
+      lineariseStatement(std::move(s), out);
+    return;
+  }
+  case ir::StatementKind::Label:
+  case ir::StatementKind::Jump:
+    break;
+  case ir::StatementKind::CondJump: {
+    auto &condJump = static_cast<ir::CondJump &>(*statement);
+    lineariseExprs({&condJump.lhs, &condJump.rhs}, out);
+    break;
+  }
+  case ir::StatementKind::JumpTable: {
+    auto &jumpTable = static_cast<ir::JumpTable &>(*statement);
+    jumpTable.index = lineariseExpr(std::move(jumpTable.index), out);
+    break;
+  }
+  case ir::StatementKind::Move: {
+    auto &move = static_cast<ir::Move &>(*statement);
+    // Moving a call's result into a temporary is already canonical as long as
+    // its arguments are.
+    if (move.dst->getKind() == ir::ExprKind::Temp &&
+        move.src->getKind() == ir::ExprKind::Call) {
+      auto &call = static_cast<ir::Call &>(*move.src);
+      std::vector<ir::ExprPtr *> args;
+      for (auto &arg : call.args)
+        args.push_back(&arg);
+      lineariseExprs(std::move(args), out);
+      break;
+    }
+    if (move.dst->getKind() == ir::ExprKind::Mem) {
+      // Evaluate the destination address before the source.
+      auto &mem = static_cast<ir::Mem &>(*move.dst);
+      lineariseExprs({&mem.expr, &move.src}, out);
+    } else {
+      move.src = lineariseExpr(std::move(move.src), out);
+    }
+    break;
+  }
+  case ir::StatementKind::CallStatement: {
+    auto &callStatement = static_cast<ir::CallStatement &>(*statement);
+    assert(callStatement.call->getKind() == ir::ExprKind::Call);
+    auto &call = static_cast<ir::Call &>(*callStatement.call);
+    std::vector<ir::ExprPtr *> args;
+    for (auto &arg : call.args)
+      args.push_back(&arg);
+    lineariseExprs(std::move(args), out);
+    break;
+  }
+  }
+  out.push_back(std::move(statement));
+}
+
+ir::ExprPtr Canonicaliser::lineariseExpr(ir::ExprPtr expr,
+                                         std::vector<ir::StatementPtr> &out) {
+  switch (expr->getKind()) {
+  case ir::ExprKind::Name:
+  case ir::ExprKind::Const:
+  case ir::ExprKind::Temp:
+    return expr;
+  case ir::ExprKind::Mem: {
+    auto &mem = static_cast<ir::Mem &>(*expr);
+    mem.expr = lineariseExpr(std::move(mem.expr), out);
+    return expr;
+  }
+  case ir::ExprKind::ArithOp: {
+    auto &arithOp = static_cast<ir::ArithOp &>(*expr);
+    lineariseExprs({&arithOp.lhs, &arithOp.rhs}, out);
+    return expr;
+  }
+  case ir::ExprKind::Call: {
+    // Lift the call into its own statement and use its result through a
+    // temporary.
+    auto &call = static_cast<ir::Call &>(*expr);
+    std::vector<ir::ExprPtr *> args;
+    for (auto &arg : call.args)
+      args.push_back(&arg);
+    lineariseExprs(std::move(args), out);
+    const int temp = level->newTemp();
+    out.push_back(std::make_unique<ir::Move>(std::make_unique<ir::Temp>(temp),
+                                             std::move(expr)));
+    return std::make_unique<ir::Temp>(temp);
+  }
+  case ir::ExprKind::CondExpr: {
+    // Materialise the boolean:
+    //   t := 1; if cond goto then else goto else;
+    //   else: t := 0;
+    //   then: ...
+    auto &condExpr = static_cast<ir::CondExpr &>(*expr);
+    assert(condExpr.condJump->getKind() == ir::StatementKind::CondJump);
+    auto &condJump = static_cast<ir::CondJump &>(*condExpr.condJump);
+    lineariseExprs({&condJump.lhs, &condJump.rhs}, out);
+    const int temp = level->newTemp();
+    const Symbol thenLabel = condJump.thenLabel,
+                 elseLabel = condJump.elseLabel;
+    out.push_back(std::make_unique<ir::Move>(std::make_unique<ir::Temp>(temp),
+                                             std::make_unique<ir::Const>(1)));
+    out.push_back(std::move(condExpr.condJump));
+    out.push_back(std::make_unique<ir::Label>(elseLabel));
+    out.push_back(std::make_unique<ir::Move>(std::make_unique<ir::Temp>(temp),
+                                             std::make_unique<ir::Const>(0)));
+    out.push_back(std::make_unique<ir::Label>(thenLabel));
+    return std::make_unique<ir::Temp>(temp);
+  }
+  }
+  assert(!"Unknown expr kind");
+  return expr;
+}
+
+void Canonicaliser::lineariseExprs(std::vector<ir::ExprPtr *> exprs,
+                                   std::vector<ir::StatementPtr> &out) {
+  // Expressions are evaluated left to right. If evaluating a later expression
+  // requires statements that could change the value of an earlier one, the
+  // earlier one is saved to a temporary first.
+  for (size_t i = 0; i < exprs.size(); ++i) {
+    std::vector<ir::StatementPtr> pre;
+    *exprs.at(i) = lineariseExpr(std::move(*exprs.at(i)), pre);
+    if (pre.empty())
+      continue;
+    for (size_t j = 0; j < i; ++j) {
+      if (!commutes(pre, **exprs.at(j)))
+        *exprs.at(j) = saveToTemp(std::move(*exprs.at(j)), out);
+    }
+    for (auto &s : pre)
+      out.push_back(std::move(s));
+  }
+}
+
+ir::ExprPtr Canonicaliser::saveToTemp(ir::ExprPtr expr,
+                                      std::vector<ir::StatementPtr> &out) {
+  const int temp = level->newTemp();
+  out.push_back(std::make_unique<ir::Move>(std::make_unique<ir::Temp>(temp),
+                                           std::move(expr)));
+  return std::make_unique<ir::Temp>(temp);
+}
+
+std::vector<ir::StatementPtr>
+Canonicaliser::scheduleTraces(std::vector<BasicBlock> &&blocks,
+                              Symbol exitLabel) {
+  std::unordered_map<Symbol, size_t, SymbolHash> blockIndices;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const auto &label = static_cast<const ir::Label &>(*blocks.at(i).front());
+    blockIndices.emplace(label.label, i);
+  }
+  // Blocks that can't be reached from the entry are dropped by treating them as
+  // already visited.
+  std::vector<bool> visited(blocks.size(), true);
+  std::vector<size_t> worklist;
+  if (!blocks.empty()) {
+    visited.front() = false;
+    worklist.push_back(0);
+  }
+  while (!worklist.empty()) {
+    const size_t current = worklist.back();
+    worklist.pop_back();
+    for (Symbol label : getJumpTargets(*blocks.at(current).back())) {
+      const auto iter = blockIndices.find(label);
+      if (iter != blockIndices.end() && visited.at(iter->second)) {
+        visited.at(iter->second) = false;
+        worklist.push_back(iter->second);
+      }
+    }
+  }
+  // Grow traces by following unvisited successors, preferring the false
+  // target of a conditional jump so that it can fall through.
+  std::vector<ir::StatementPtr> scheduled;
+  const auto findUnvisited = [&](Symbol label) -> std::optional<size_t> {
+    const auto iter = blockIndices.find(label);
+    if (iter == blockIndices.end() || visited.at(iter->second))
+      return std::nullopt;
+    return iter->second;
+  };
+  for (size_t start = 0; start < blocks.size(); ++start) {
+    std::optional<size_t> next = start;
+    while (next && !visited.at(*next)) {
+      const size_t current = *next;
+      visited.at(current) = true;
+      auto &block = blocks.at(current);
+      const ir::Statement &last = *block.back();
+      next.reset();
+      if (last.getKind() == ir::StatementKind::Jump) {
+        next = findUnvisited(static_cast<const ir::Jump &>(last).jumpLabel);
+      } else if (last.getKind() == ir::StatementKind::CondJump) {
+        const auto &condJump = static_cast<const ir::CondJump &>(last);
+        next = findUnvisited(condJump.elseLabel);
+        if (!next)
+          next = findUnvisited(condJump.thenLabel);
+      }
+      for (auto &statement : block)
+        scheduled.push_back(std::move(statement));
+    }
+  }
+  scheduled.push_back(std::make_unique<ir::Label>(exitLabel));
+  // Fix up the jumps now that the final order is known.
+  std::vector<ir::StatementPtr> fixed;
+  for (size_t i = 0; i < scheduled.size(); ++i) {
+    auto &statement = scheduled.at(i);
+    const ir::Statement *following =
+        i + 1 < scheduled.size() ? scheduled.at(i + 1).get() : nullptr;
+    const auto isLabel = [following](Symbol label) {
+      return following &&
+             following->getKind() == ir::StatementKind::Label &&
+             static_cast<const ir::Label *>(following)->label == label;
+    };
+    if (statement->getKind() == ir::StatementKind::Jump) {
+      // Jumping to the next statement is redundant.
+      if (isLabel(static_cast<const ir::Jump &>(*statement).jumpLabel))
+        continue;
+    } else if (statement->getKind() == ir::StatementKind::CondJump) {
+      auto &condJump = static_cast<ir::CondJump &>(*statement);
+      if (isLabel(condJump.thenLabel)) {
+        // Invert the condition so that the false case falls through.
+        condJump.op = ir::notRelOp(condJump.op);
+        std::swap(condJump.thenLabel, condJump.elseLabel);
+      } else if (!isLabel(condJump.elseLabel)) {
+        // Neither target follows so add a false label that jumps onwards.
+        const Symbol falseLabel = makeLabel(), elseLabel = condJump.elseLabel;
+        condJump.elseLabel = falseLabel;
+        fixed.push_back(std::move(statement));
+        fixed.push_back(std::make_unique<ir::Label>(falseLabel));
+        fixed.push_back(std::make_unique<ir::Jump>(elseLabel));
+        continue;
+      }
+    }
+    fixed.push_back(std::move(statement));
+  }
+  // Drop labels that are no longer the target of any jump. Labels that fall
+  // straight after a conditional jump are still targets of it so they stay.
+  std::unordered_set<Symbol, SymbolHash> targets;
+  for (const auto &statement : fixed) {
+    for (Symbol label : getJumpTargets(*statement))
+      targets.insert(label);
+  }
+  std::vector<ir::StatementPtr> result;
+  for (auto &statement : fixed) {
+    if (statement->getKind() == ir::StatementKind::Label &&
+        targets.find(static_cast<const ir::Label &>(*statement).label) ==
+            targets.end())
+      continue;
+    result.push_back(std::move(statement));
+  }
+  return result;
+}
+
+// Canonical labels are unique across every fragment and every canonicaliser
+// so they can't clash with the labels made during translation.
+Symbol Canonicaliser::makeLabel() { return symbols.makeUnique("C"); }
+
+} // namespace descartes
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Ir.h>
+#include <SymbolTable.h>
+
+namespace descartes {
+
+// Rewrites the tree IR of a fragment into canonical form:
+// - The body is a single flat `ir::Sequence`.
+// - Calls only appear directly beneath a `CallStatement` or as the source of a
+//   `Move` into a temporary, and never within the arguments of another call.
+// - `CondExpr`s used as values are replaced with explicit jumps.
+// - Every `CondJump` is immediately followed by its else label so that backends
+//   can fall through on false, and jumps to the next statement are removed.
+class Canonicaliser {
+public:
+  explicit Canonicaliser(SymbolTable &symbols);
+  virtual ~Canonicaliser() = default;
+  void canonicalise(ir::Fragment &frag);
+  // A basic block starts with a label, ends with a jump and contains no other
+  // labels or jumps.
+  using BasicBlock = std::vector<ir::StatementPtr>;
+  std::vector<BasicBlock>
+  makeBasicBlocks(std::vector<ir::StatementPtr> &&statements,
+                  Symbol exitLabel);
+
+private:
+  void lineariseStatement(ir::StatementPtr statement,
+                          std::vector<ir::StatementPtr> &out);
+  ir::ExprPtr lineariseExpr(ir::ExprPtr expr,
+                            std::vector<ir::StatementPtr> &out);
+  void lineariseExprs(std::vector<ir::ExprPtr *> exprs,
+                      std::vector<ir::StatementPtr> &out);
+  ir::ExprPtr saveToTemp(ir::ExprPtr expr, std::vector<ir::StatementPtr> &out);
+  std::vector<ir::StatementPtr> scheduleTraces(std::vector<BasicBlock> &&blocks,
+                                               Symbol exitLabel);
+  Symbol makeLabel();
+  SymbolTable &symbols;
+  ir::Level *level;
+};
+
+} // namespace descartes
@@ -0,0 +1,137 @@
+#include "ConstEval.h"
+
+#include <cassert>
+#include <limits>
+
+namespace descartes {
+
+namespace {
+
+int checkedResult(long long result) {
+  if (result < std::numeric_limits<int>::min() ||
+      result > std::numeric_limits<int>::max())
+    throw SemanticError("Overflow in constant expression");
+  return static_cast<int>(result);
+}
+
+} // namespace
+
+ConstEvaluator::ConstEvaluator(SymbolTable &symbols, const Environment &env)
+    : symbols(symbols), env(env) {}
+
+ConstEntry ConstEvaluator::evaluate(Expr &expr) const {
+  switch (expr.getKind()) {
+  case ExprKind::NumberLiteral: {
+    auto *numberLiteral = exprCast<NumberLiteral *>(expr);
+    assert(numberLiteral);
+    return ConstEntry(getPrimitiveType("integer"), numberLiteral->val);
+  }
+  case ExprKind::StringLiteral: {
+    auto *stringLiteral = exprCast<StringLiteral *>(expr);
+    assert(stringLiteral);
+    return ConstEntry(getPrimitiveType("string"), stringLiteral->val);
+  }
+  case ExprKind::VarRef: {
+    auto *varRef = exprCast<VarRef *>(expr);
+    assert(varRef);
+    const ConstEntry *constEntry = env.getConstValue(varRef->identifier);
+    if (!constEntry)
+      throw SemanticError("Expected constant expression");
+    return *constEntry;
+  }
+  case ExprKind::BinaryOp: {
+    auto *binaryOp = exprCast<BinaryOp *>(expr);
+    assert(binaryOp);
+    return evaluateBinaryOp(*binaryOp);
+  }
+  case ExprKind::Call:
+  case ExprKind::MemberRef:
+  case ExprKind::IndexRef:
+    break;
+  }
+  throw SemanticError("Expected constant expression");
+}
+
+ConstEntry ConstEvaluator::evaluateBinaryOp(BinaryOp &binaryOp) const {
+  const ConstEntry lhs = evaluate(*binaryOp.lhs), rhs = evaluate(*binaryOp.rhs);
+  const TypeKind lhsKind = lhs.constType->getKind(),
+                 rhsKind = rhs.constType->getKind();
+  const Type *boolType = getPrimitiveType("boolean");
+  switch (binaryOp.kind) {
+  case BinaryOpKind::Add:
+    // Strings can be concatenated at compile time too.
+    if (lhsKind == TypeKind::String && rhsKind == TypeKind::String) {
+      const Symbol concat =
+          symbols.make(std::get<Symbol>(lhs.value).getName() +
+                       std::get<Symbol>(rhs.value).getName());
+      return ConstEntry(lhs.constType, concat);
+    }
+    [[fallthrough]];
+  case BinaryOpKind::Subtract:
+  case BinaryOpKind::Multiply:
+  case BinaryOpKind::Divide: {
+    if (lhsKind != TypeKind::Integer || rhsKind != TypeKind::Integer)
+      throw SemanticError("Expected integer in binary op");
+    const long long l = std::get<int>(lhs.value), r = std::get<int>(rhs.value);
+    long long result = 0;
+    switch (binaryOp.kind) {
+    case BinaryOpKind::Add:
+      result = l + r;
+      break;
+    case BinaryOpKind::Subtract:
+      result = l - r;
+      break;
+    case BinaryOpKind::Multiply:
+      result = l * r;
+      break;
+    default:
+      if (r == 0)
+        throw SemanticError("Division by zero in constant expression");
+      result = l / r;
+      break;
+    }
+    return ConstEntry(lhs.constType, checkedResult(result));
+  }
+  case BinaryOpKind::LessThan:
+  case BinaryOpKind::GreaterThan:
+  case BinaryOpKind::LessThanEqual:
+  case BinaryOpKind::GreaterThanEqual: {
+    // Integers and values of the same enum are ordered.
+    const bool ordinal =
+        (lhsKind == TypeKind::Integer && rhsKind == TypeKind::Integer) ||
+        (lhsKind == TypeKind::Enum && lhs.constType == rhs.constType);
+    if (!ordinal)
+      throw SemanticError("Expected integer in binary op");
+    const int l = std::get<int>(lhs.value), r = std::get<int>(rhs.value);
+    bool result = false;
+    if (binaryOp.kind == BinaryOpKind::LessThan)
+      result = l < r;
+    else if (binaryOp.kind == BinaryOpKind::GreaterThan)
+      result = l > r;
+    else if (binaryOp.kind == BinaryOpKind::LessThanEqual)
+      result = l <= r;
+    else
+      result = l >= r;
+    return ConstEntry(boolType, result);
+  }
+  case BinaryOpKind::Equal:
+  case BinaryOpKind::NotEqual: {
+    if (lhsKind != rhsKind ||
+        (lhsKind == TypeKind::Enum && lhs.constType != rhs.constType))
+      throw SemanticError("Mismatching types in equality");
+    // Symbols are interned so comparing them compares the underlying strings.
+    const bool equal = lhs.value == rhs.value;
+    return ConstEntry(boolType, binaryOp.kind == BinaryOpKind::Equal ? equal
+                                                                     : !equal);
+  }
+  }
+  throw SemanticError("Unknown binary op");
+}
+
+const Type *ConstEvaluator::getPrimitiveType(const std::string &name) const {
+  const Type *type = env.getResolvedType(*symbols.lookup(name));
+  assert(type);
+  return type;
+}
+
+} // namespace descartes
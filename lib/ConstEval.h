@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Environment.h>
+#include <SymbolTable.h>
+
+namespace descartes {
+
+// Evaluates constant expressions at compile time. Anything that isn't a
+// literal, a previously defined constant or an operator applied to constants
+// is rejected with a `SemanticError`.
+class ConstEvaluator {
+public:
+  ConstEvaluator(SymbolTable &symbols, const Environment &env);
+  virtual ~ConstEvaluator() = default;
+  ConstEntry evaluate(Expr &expr) const;
+
+private:
+  ConstEntry evaluateBinaryOp(BinaryOp &binaryOp) const;
+  const Type *getPrimitiveType(const std::string &name) const;
+  SymbolTable &symbols;
+  const Environment &env;
+};
+
+} // namespace descartes
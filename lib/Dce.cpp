@@ -0,0 +1,331 @@
+#include "Dce.h"
+
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
+
+namespace descartes {
+
+Dce::Dce() : function(nullptr) {}
+
+void Dce::run(ssa::Function &function) {
+  this->function = &function;
+  function.removeUnreachableBlocks();
+  removeDeadStores();
+  computePostDominators();
+  live.clear();
+  liveBlocks.assign(function.blockCount, false);
+  worklist.clear();
+  for (const auto &block : function.blocks) {
+    for (const auto &instruction : block->instructions) {
+      if (isRoot(*instruction))
+        markLive(instruction.get());
+    }
+  }
+  bool changed = true;
+  while (changed) {
+    while (!worklist.empty()) {
+      ssa::Instruction *instruction = worklist.back();
+      worklist.pop_back();
+      markLiveBlock(instruction->parent);
+      for (ssa::Instruction *operand : instruction->operands)
+        markLive(operand);
+      // The value of a phi depends on the edge that was taken.
+      if (instruction->op == ssa::Opcode::Phi) {
+        for (ssa::Block *pred : instruction->parent->preds) {
+          markLiveBlock(pred);
+          markLive(pred->getTerminator());
+        }
+      }
+    }
+    // A dead branch becomes a jump to its post dominator, which mustn't need
+    // to know where control came from.
+    changed = false;
+    for (const auto &block : function.blocks) {
+      ssa::Instruction *terminator = block->getTerminator();
+      if (terminator->op == ssa::Opcode::Jump || live.count(terminator))
+        continue;
+      const int ipdom = ipdoms.at(block->id);
+      const auto &postDominator = *std::find_if(
+          function.blocks.begin(), function.blocks.end(),
+          [ipdom](const ssa::BlockPtr &other) { return other->id == ipdom; });
+      const auto phis = postDominator->getPhis();
+      if (std::any_of(phis.begin(), phis.end(),
+                      [this](const ssa::Instruction *phi) {
+                        return live.count(phi) > 0;
+                      })) {
+        markLive(terminator);
+        changed = true;
+      }
+    }
+  }
+  sweep();
+  this->function = nullptr;
+}
+
+void Dce::removeDeadStores() {
+  std::unordered_map<const ssa::Instruction *, size_t> slotIndices;
+  std::vector<const ssa::Instruction *> slots;
+  for (const auto &instruction : function->getEntry()->instructions) {
+    if (instruction->op == ssa::Opcode::Local) {
+      slotIndices.emplace(instruction.get(), slots.size());
+      slots.push_back(instruction.get());
+    }
+  }
+  if (slots.empty())
+    return;
+  // Finds the slots that may be read before they are next written, walking
+  // backwards from the end of the block. The frame goes away on return so
+  // nothing is read after that.
+  std::vector<ssa::Instruction *> deadStores;
+  const auto transfer = [&](const ssa::Block &block, std::vector<bool> read,
+                            bool collect) {
+    for (auto iter = block.instructions.rbegin();
+         iter != block.instructions.rend(); ++iter) {
+      ssa::Instruction *instruction = iter->get();
+      switch (instruction->op) {
+      case ssa::Opcode::Return:
+        read.assign(slots.size(), false);
+        break;
+      case ssa::Opcode::Call:
+        read.assign(slots.size(), true);
+        break;
+      case ssa::Opcode::Load:
+        for (size_t i = 0; i < slots.size(); ++i) {
+          if (ssa::mayAlias(*slots.at(i), ir::wordSize,
+                            *instruction->operands.front(),
+                            ir::getMemSize(instruction->memType)))
+            read.at(i) = true;
+        }
+        break;
+      case ssa::Opcode::Store: {
+        // Only a store of a whole word replaces what the slot held.
+        const auto slotIter = slotIndices.find(instruction->operands.front());
+        if (slotIter == slotIndices.end() ||
+            instruction->memType != ir::MemType::Word)
+          break;
+        if (collect && !read.at(slotIter->second))
+          deadStores.push_back(instruction);
+        read.at(slotIter->second) = false;
+        break;
+      }
+      default:
+        break;
+      }
+    }
+    return read;
+  };
+  std::vector<std::vector<bool>> readOnEntry(
+      function->blockCount, std::vector<bool>(slots.size(), false));
+  const auto getReadOnExit = [&](const ssa::Block &block) {
+    std::vector<bool> read(slots.size(), false);
+    for (const ssa::Block *succ : block.succs) {
+      const auto &succRead = readOnEntry.at(succ->id);
+      for (size_t i = 0; i < slots.size(); ++i)
+        read.at(i) = read.at(i) || succRead.at(i);
+    }
+    return read;
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto iter = function->blocks.rbegin(); iter != function->blocks.rend();
+         ++iter) {
+      const ssa::Block &block = **iter;
+      auto read = transfer(block, getReadOnExit(block), false);
+      if (read != readOnEntry.at(block.id)) {
+        readOnEntry.at(block.id) = std::move(read);
+        changed = true;
+      }
+    }
+  }
+  for (const auto &block : function->blocks)
+    transfer(*block, getReadOnExit(*block), true);
+  for (ssa::Instruction *store : deadStores)
+    store->parent->erase(store);
+}
+
+void Dce::computePostDominators() {
+  // The iterative algorithm from "A Simple, Fast Dominance Algorithm" on the
+  // reversed CFG.
+  const int exit = function->blockCount;
+  std::vector<ssa::Block *> blocksById(exit, nullptr);
+  std::vector<ssa::Block *> returns;
+  for (const auto &block : function->blocks) {
+    blocksById.at(block->id) = block.get();
+    if (block->getTerminator()->op == ssa::Opcode::Return)
+      returns.push_back(block.get());
+  }
+  const auto getReversedSuccs =
+      [&](int id) -> const std::vector<ssa::Block *> & {
+    return id == exit ? returns : blocksById.at(id)->preds;
+  };
+  std::vector<int> postOrder;
+  std::vector<bool> visited(exit + 1, false);
+  std::vector<std::pair<int, size_t>> stack = {{exit, 0}};
+  visited.at(exit) = true;
+  while (!stack.empty()) {
+    auto &[id, succIndex] = stack.back();
+    const auto &succs = getReversedSuccs(id);
+    if (succIndex < succs.size()) {
+      const int succ = succs.at(succIndex++)->id;
+      if (!visited.at(succ)) {
+        visited.at(succ) = true;
+        stack.emplace_back(succ, 0);
+      }
+      continue;
+    }
+    postOrder.push_back(id);
+    stack.pop_back();
+  }
+  std::vector<int> postOrderIndices(exit + 1, -1);
+  for (size_t i = 0; i < postOrder.size(); ++i)
+    postOrderIndices.at(postOrder.at(i)) = i;
+  ipdoms.assign(exit + 1, -1);
+  ipdoms.at(exit) = exit;
+  const auto intersect = [&](int lhs, int rhs) {
+    while (lhs != rhs) {
+      while (postOrderIndices.at(lhs) < postOrderIndices.at(rhs))
+        lhs = ipdoms.at(lhs);
+      while (postOrderIndices.at(rhs) < postOrderIndices.at(lhs))
+        rhs = ipdoms.at(rhs);
+    }
+    return lhs;
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto iter = postOrder.rbegin() + 1; iter != postOrder.rend();
+         ++iter) {
+      const ssa::Block *block = blocksById.at(*iter);
+      int newIpdom = block->getTerminator()->op == ssa::Opcode::Return ? exit
+                                                                       : -1;
+      for (const ssa::Block *succ : block->succs) {
+        if (ipdoms.at(succ->id) < 0)
+          continue;
+        newIpdom = newIpdom < 0 ? succ->id : intersect(succ->id, newIpdom);
+      }
+      if (ipdoms.at(*iter) != newIpdom) {
+        ipdoms.at(*iter) = newIpdom;
+        changed = true;
+      }
+    }
+  }
+  // A block is control dependent on a branch when it post dominates one of
+  // the successors of the branch but not the branch itself.
+  controlDependences.assign(exit, {});
+  for (const auto &block : function->blocks) {
+    if (block->succs.size() < 2 || ipdoms.at(block->id) < 0)
+      continue;
+    for (const ssa::Block *succ : block->succs) {
+      for (int runner = succ->id; runner >= 0 && runner != ipdoms.at(block->id);
+           runner = ipdoms.at(runner)) {
+        auto &dependences = controlDependences.at(runner);
+        if (std::find(dependences.begin(), dependences.end(), block.get()) ==
+            dependences.end())
+          dependences.push_back(block.get());
+      }
+    }
+  }
+}
+
+void Dce::markLive(ssa::Instruction *instruction) {
+  if (live.insert(instruction).second)
+    worklist.push_back(instruction);
+}
+
+void Dce::markLiveBlock(const ssa::Block *block) {
+  if (liveBlocks.at(block->id))
+    return;
+  liveBlocks.at(block->id) = true;
+  for (ssa::Block *branch : controlDependences.at(block->id))
+    markLive(branch->getTerminator());
+}
+
+void Dce::sweep() {
+  std::vector<ssa::Instruction *> dead, deadTerminators;
+  for (const auto &block : function->blocks) {
+    for (const auto &instruction : block->instructions) {
+      if (instruction->op == ssa::Opcode::Jump || live.count(instruction.get()))
+        continue;
+      if (instruction->isTerminator())
+        deadTerminators.push_back(instruction.get());
+      else
+        dead.push_back(instruction.get());
+    }
+  }
+  // Dead values are only used by other dead instructions.
+  for (ssa::Instruction *instruction : dead)
+    instruction->dropOperands();
+  for (ssa::Instruction *terminator : deadTerminators)
+    terminator->dropOperands();
+  for (ssa::Instruction *instruction : dead)
+    instruction->parent->erase(instruction);
+  std::vector<ssa::Block *> blocksById(function->blockCount, nullptr);
+  for (const auto &block : function->blocks)
+    blocksById.at(block->id) = block.get();
+  for (ssa::Instruction *terminator : deadTerminators) {
+    ssa::Block *block = terminator->parent;
+    ssa::Block *postDominator = blocksById.at(ipdoms.at(block->id));
+    block->erase(terminator);
+    while (!block->succs.empty())
+      function->removeEdge(block, block->succs.size() - 1);
+    block->append(function->makeInstruction(ssa::Opcode::Jump));
+    function->addEdge(block, postDominator);
+  }
+  function->removeUnreachableBlocks();
+}
+
+bool Dce::isRoot(const ssa::Instruction &instruction) const {
+  switch (instruction.op) {
+  case ssa::Opcode::Store:
+  case ssa::Opcode::Call:
+  case ssa::Opcode::Return:
+    return true;
+  case ssa::Opcode::CondJump:
+  case ssa::Opcode::JumpTable:
+    return !canSkip(instruction.parent);
+  case ssa::Opcode::ArithOp: {
+    // Division traps at runtime unless the divisor is known to be safe.
+    if (instruction.arithOp != ir::ArithOpKind::Divide)
+      return false;
+    const ssa::Instruction &divisor = *instruction.operands.at(1);
+    return divisor.op != ssa::Opcode::Const || divisor.value == 0 ||
+           divisor.value == -1;
+  }
+  default:
+    return false;
+  }
+}
+
+bool Dce::canSkip(const ssa::Block *block) const {
+  // Every successor has to reach the post dominator without coming back
+  // through the branch. Otherwise the branch decides whether a cycle keeps
+  // going.
+  const int ipdom = ipdoms.at(block->id);
+  if (ipdom < 0 || ipdom == function->blockCount)
+    return false;
+  for (const ssa::Block *succ : block->succs) {
+    if (ipdoms.at(succ->id) < 0 && succ->id != ipdom)
+      return false;
+    std::vector<bool> visited(function->blockCount, false);
+    std::vector<const ssa::Block *> blocks = {succ};
+    bool found = false;
+    while (!blocks.empty() && !found) {
+      const ssa::Block *current = blocks.back();
+      blocks.pop_back();
+      if (current->id == ipdom) {
+        found = true;
+      } else if (current != block && !visited.at(current->id)) {
+        visited.at(current->id) = true;
+        blocks.insert(blocks.end(), current->succs.begin(),
+                      current->succs.end());
+      }
+    }
+    if (!found)
+      return false;
+  }
+  return true;
+}
+
+} // namespace descartes
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Ssa.h>
+
+#include <unordered_set>
+
+namespace descartes {
+
+// Aggressive dead code elimination in the style of Cytron et al.'s "Efficiently
+// Computing Static Single Assignment Form and the Control Dependence Graph".
+// Everything is assumed dead until it is needed by a store, a call, a return
+// or a division that could trap. A branch is only needed when a live
+// instruction is control dependent on it or a live phi picks its value based
+// on it, so branches around code that turned out to be dead become jumps to
+// their immediate post dominator. That is only done when every successor gets
+// there without coming back to the branch, so branches that decide whether a
+// loop keeps going always stay and a loop that never terminates still
+// doesn't.
+//
+// Before that, stores to frame slots that are overwritten or go out of scope
+// before anything can read them are removed. Calls might read any slot that
+// is still in the frame since those are the ones nested functions reach or
+// whose address is passed on.
+class Dce {
+public:
+  Dce();
+  virtual ~Dce() = default;
+  void run(ssa::Function &function);
+
+private:
+  void removeDeadStores();
+  void computePostDominators();
+  void markLive(ssa::Instruction *instruction);
+  void markLiveBlock(const ssa::Block *block);
+  void sweep();
+  bool isRoot(const ssa::Instruction &instruction) const;
+  bool canSkip(const ssa::Block *block) const;
+  ssa::Function *function;
+  // Post dominators are indexed by block id with a virtual exit after the
+  // last id that every return flows into. Blocks that can't reach a return
+  // have no immediate post dominator.
+  std::vector<int> ipdoms;
+  std::vector<std::vector<ssa::Block *>> controlDependences;
+  std::unordered_set<const ssa::Instruction *> live;
+  std::vector<bool> liveBlocks;
+  std::vector<ssa::Instruction *> worklist;
+};
+
+} // namespace descartes
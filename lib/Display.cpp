@@ -0,0 +1,286 @@
+#include "Display.h"
+
+#include <CallGraph.h>
+
+#include <algorithm>
+#include <cassert>
+#include <unordered_set>
+
+namespace descartes {
+
+namespace {
+
+// Removes a value that is no longer needed along with the frame addresses that
+// only it used. Values in the entry stay where the other passes expect them.
+void eraseIfDead(ssa::Instruction *value) {
+  if (!value->users.empty())
+    return;
+  switch (value->op) {
+  case ssa::Opcode::Const:
+  case ssa::Opcode::Name:
+  case ssa::Opcode::ArithOp:
+  case ssa::Opcode::Load:
+    break;
+  default:
+    return;
+  }
+  const std::vector<ssa::Instruction *> operands = value->operands;
+  value->parent->erase(value);
+  for (ssa::Instruction *operand : operands)
+    eraseIfDead(operand);
+}
+
+ssa::Instruction *findEntryValue(const ssa::Function &function, ssa::Opcode op,
+                                 int value) {
+  for (const auto &instruction : function.getEntry()->instructions) {
+    if (instruction->op == op && instruction->value == value)
+      return instruction.get();
+  }
+  return nullptr;
+}
+
+} // namespace
+
+Display::Display(SymbolTable &symbols)
+    : display(symbols.make(ir::displayName)), function(nullptr) {}
+
+void Display::run(std::vector<std::unique_ptr<ssa::Function>> &functions) {
+  for (auto &f : functions) {
+    function = f.get();
+    convertFrameAccesses();
+  }
+  for (auto &f : functions) {
+    function = f.get();
+    if (function->level.isDisplayed)
+      addDisplayUpdates();
+  }
+  function = nullptr;
+  // Static links are only read by their own function now.
+  for (auto &f : functions) {
+    ir::Level &level = f->level;
+    if (level.hasStaticLink &&
+        level.escapes.erase(level.formals.front().offset) > 0)
+      mem2Reg.run(*f);
+  }
+  removeStaticLinks(functions);
+}
+
+void Display::convertFrameAccesses() {
+  frameDepths.clear();
+  const int depth = function->level.depth;
+  std::vector<std::pair<ssa::Instruction *, int>> outerFrames;
+  for (const auto &block : function->blocks) {
+    for (const auto &instruction : block->instructions) {
+      if (instruction->op != ssa::Opcode::Load)
+        continue;
+      const auto frameDepth = getFrameDepth(*instruction);
+      if (frameDepth && *frameDepth < depth - 1)
+        outerFrames.emplace_back(instruction.get(), *frameDepth);
+    }
+  }
+  for (const auto &[frame, frameDepth] : outerFrames) {
+    ssa::Block *block = frame->parent;
+    auto load = function->makeInstruction(ssa::Opcode::Load);
+    load->addOperand(makeDisplayAddress(block, frame, frameDepth));
+    frame->replaceAllUsesWith(block->insertBefore(frame, std::move(load)));
+    getAncestor(frameDepth)->isDisplayed = true;
+  }
+  // The loads that walked the static links are all unused now.
+  for (const auto &[frame, frameDepth] : outerFrames)
+    eraseIfDead(frame);
+}
+
+std::optional<int> Display::getFrameDepth(const ssa::Instruction &value) {
+  const auto iter = frameDepths.find(&value);
+  if (iter != frameDepths.end())
+    return iter->second;
+  const ir::Level &level = function->level;
+  std::optional<int> depth;
+  switch (value.op) {
+  case ssa::Opcode::FramePointer:
+    depth = level.depth;
+    break;
+  case ssa::Opcode::Param:
+    if (value.value == 0 && level.hasStaticLink)
+      depth = level.depth - 1;
+    break;
+  case ssa::Opcode::Load: {
+    // The static link is the first slot of a frame.
+    const auto slot = getFrameSlot(*value.operands.front());
+    if (slot && slot->second == 0 && getAncestor(slot->first)->hasStaticLink)
+      depth = slot->first - 1;
+    break;
+  }
+  default:
+    break;
+  }
+  frameDepths.emplace(&value, depth);
+  return depth;
+}
+
+std::optional<std::pair<int, int>>
+Display::getFrameSlot(const ssa::Instruction &address) {
+  if (address.op == ssa::Opcode::Local)
+    return std::make_pair(function->level.depth, address.value);
+  if (address.op == ssa::Opcode::ArithOp &&
+      address.arithOp == ir::ArithOpKind::Add) {
+    const ssa::Instruction &lhs = *address.operands.at(0);
+    const ssa::Instruction &rhs = *address.operands.at(1);
+    if (rhs.op == ssa::Opcode::Const) {
+      if (const auto depth = getFrameDepth(lhs))
+        return std::make_pair(*depth, rhs.value);
+    }
+    if (lhs.op == ssa::Opcode::Const) {
+      if (const auto depth = getFrameDepth(rhs))
+        return std::make_pair(*depth, lhs.value);
+    }
+    return std::nullopt;
+  }
+  if (const auto depth = getFrameDepth(address))
+    return std::make_pair(*depth, 0);
+  return std::nullopt;
+}
+
+ir::Level *Display::getAncestor(int depth) const {
+  ir::Level *level = &function->level;
+  while (level->depth > depth)
+    level = level->parent;
+  assert(level && level->depth == depth);
+  return level;
+}
+
+void Display::addDisplayUpdates() {
+  const int depth = function->level.depth;
+  // The entry only holds values so the frame goes in the display just after.
+  ssa::Block *entry = function->getEntry();
+  assert(entry->succs.size() == 1);
+  ssa::Block *prologue = function->splitEdge(entry, 0);
+  const ssa::Instruction *jump = prologue->getTerminator();
+  auto saved = function->makeInstruction(ssa::Opcode::Load);
+  saved->addOperand(makeDisplayAddress(prologue, jump, depth));
+  ssa::Instruction *previous = prologue->insertBefore(jump, std::move(saved));
+  auto store = function->makeInstruction(ssa::Opcode::Store);
+  store->addOperand(makeDisplayAddress(prologue, jump, depth));
+  store->addOperand(getFramePointer());
+  prologue->insertBefore(jump, std::move(store));
+  for (const auto &block : function->blocks) {
+    const ssa::Instruction *terminator = block->getTerminator();
+    if (terminator->op != ssa::Opcode::Return)
+      continue;
+    auto restore = function->makeInstruction(ssa::Opcode::Store);
+    restore->addOperand(makeDisplayAddress(block.get(), terminator, depth));
+    restore->addOperand(previous);
+    block->insertBefore(terminator, std::move(restore));
+  }
+}
+
+void Display::removeStaticLinks(
+    std::vector<std::unique_ptr<ssa::Function>> &functions) {
+  const ssa::CallGraph callGraph(functions);
+  // Start with every function that could go without and drop those with a use
+  // other than passing it to a function that is still going without, until
+  // nothing changes.
+  std::unordered_set<const ssa::Function *> unused;
+  for (const auto &callee : functions) {
+    const ir::Level &level = callee->level;
+    // The static link is always at offset zero.
+    const ssa::Instruction *slot =
+        findEntryValue(*callee, ssa::Opcode::Local, 0);
+    const bool isUnique =
+        std::count_if(functions.begin(), functions.end(),
+                      [&level](const auto &other) {
+                        return other->level.name == level.name;
+                      }) == 1;
+    if (level.hasStaticLink && isUnique && !(slot && !slot->users.empty()))
+      unused.insert(callee.get());
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const auto &callee : functions) {
+      if (!unused.count(callee.get()))
+        continue;
+      const ssa::Instruction *link =
+          findEntryValue(*callee, ssa::Opcode::Param, 0);
+      if (!link)
+        continue;
+      const bool isPassedOn = std::all_of(
+          link->users.begin(), link->users.end(),
+          [&](const ssa::Instruction *user) {
+            return user->op == ssa::Opcode::Call &&
+                   unused.count(callGraph.getCallee(*user)) &&
+                   std::count(user->operands.begin() + 1, user->operands.end(),
+                              link) == 0;
+          });
+      if (!isPassedOn) {
+        unused.erase(callee.get());
+        changed = true;
+      }
+    }
+  }
+  for (const auto &callee : functions) {
+    if (!unused.count(callee.get()))
+      continue;
+    for (ssa::Instruction *call : callGraph.getCallSites(callee.get())) {
+      ssa::Instruction *link = call->operands.front();
+      call->removeOperand(0);
+      eraseIfDead(link);
+    }
+  }
+  for (const auto &callee : functions) {
+    if (!unused.count(callee.get()))
+      continue;
+    ssa::Block *entry = callee->getEntry();
+    std::vector<ssa::Instruction *> params;
+    for (const auto &instruction : entry->instructions) {
+      if (instruction->op == ssa::Opcode::Param)
+        params.push_back(instruction.get());
+    }
+    for (ssa::Instruction *param : params) {
+      if (param->value == 0)
+        entry->erase(param);
+      else
+        --param->value;
+    }
+    ir::Level &level = callee->level;
+    level.formals.erase(level.formals.begin());
+    level.hasStaticLink = false;
+  }
+  // Callers that only handed their frame to the functions that no longer
+  // take it don't need one for their slots.
+  for (auto &caller : functions) {
+    const ssa::Instruction *framePointer =
+        findEntryValue(*caller, ssa::Opcode::FramePointer, 0);
+    if (framePointer && framePointer->users.empty() &&
+        !caller->level.escapes.empty()) {
+      caller->level.escapes.clear();
+      mem2Reg.run(*caller);
+    }
+  }
+}
+
+ssa::Instruction *Display::makeDisplayAddress(ssa::Block *block,
+                                              const ssa::Instruction *position,
+                                              int depth) {
+  auto name = function->makeInstruction(ssa::Opcode::Name);
+  name->symbol = display;
+  auto offset = function->makeInstruction(ssa::Opcode::Const);
+  offset->value = depth * ir::wordSize;
+  auto address = function->makeInstruction(ssa::Opcode::ArithOp);
+  address->arithOp = ir::ArithOpKind::Add;
+  address->addOperand(block->insertBefore(position, std::move(name)));
+  address->addOperand(block->insertBefore(position, std::move(offset)));
+  return block->insertBefore(position, std::move(address));
+}
+
+ssa::Instruction *Display::getFramePointer() {
+  if (ssa::Instruction *framePointer =
+          findEntryValue(*function, ssa::Opcode::FramePointer, 0))
+    return framePointer;
+  ssa::Block *entry = function->getEntry();
+  return entry->insertBefore(entry->getTerminator(),
+                             function->makeInstruction(
+                                 ssa::Opcode::FramePointer));
+}
+
+} // namespace descartes
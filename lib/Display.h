@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Mem2Reg.h>
+#include <SymbolTable.h>
+
+#include <optional>
+#include <unordered_map>
+
+namespace descartes {
+
+// Decides how each function reaches the frames of the levels it is nested in
+// once inlining has settled which functions are left.
+//
+// A function reaches its parent's frame through its static link with a single
+// load. Anything further out would take a load for every level in between so
+// those frames are read from the display instead, a static array with the
+// frame pointer of the latest activation at each depth. Only the levels that
+// something reaches that way put their frame in the display, saving the
+// previous entry on the way in and restoring it on the way out, which is
+// enough since there are no procedure parameters that could call a function
+// from outside of its parent. With the chains gone nothing reads another
+// level's static link any more so those slots can be promoted.
+//
+// Functions that don't use their static link, other than to pass it on to
+// calls that don't need it either, stop taking one at all. Callers that then
+// have nothing left reaching their frame get their slots promoted too.
+class Display {
+public:
+  explicit Display(SymbolTable &symbols);
+  virtual ~Display() = default;
+  void run(std::vector<std::unique_ptr<ssa::Function>> &functions);
+
+private:
+  void convertFrameAccesses();
+  // The depth of the level whose frame the value points to, if it is one.
+  std::optional<int> getFrameDepth(const ssa::Instruction &value);
+  // The depth and offset of the frame slot that the address points to.
+  std::optional<std::pair<int, int>>
+  getFrameSlot(const ssa::Instruction &address);
+  ir::Level *getAncestor(int depth) const;
+  void addDisplayUpdates();
+  void
+  removeStaticLinks(std::vector<std::unique_ptr<ssa::Function>> &functions);
+  ssa::Instruction *makeDisplayAddress(ssa::Block *block,
+                                       const ssa::Instruction *position,
+                                       int depth);
+  ssa::Instruction *getFramePointer();
+  const Symbol display;
+  ssa::Function *function;
+  std::unordered_map<const ssa::Instruction *, std::optional<int>> frameDepths;
+  Mem2Reg mem2Reg;
+};
+
+} // namespace descartes
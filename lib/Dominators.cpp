@@ -0,0 +1,175 @@
+#include "Dominators.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace descartes::ssa {
+
+DominatorTree::DominatorTree(const Function &function)
+    : rpoIndices(function.blockCount, -1),
+      idoms(function.blockCount, nullptr), children(function.blockCount),
+      frontiers(function.blockCount), preNumbers(function.blockCount, -1),
+      postNumbers(function.blockCount, -1) {
+  // Iterative depth first search to find the reverse post order.
+  std::vector<bool> visited(function.blockCount, false);
+  std::vector<std::pair<Block *, size_t>> stack;
+  Block *entry = function.getEntry();
+  visited.at(entry->id) = true;
+  stack.emplace_back(entry, 0);
+  while (!stack.empty()) {
+    auto &[block, succIndex] = stack.back();
+    if (succIndex < block->succs.size()) {
+      Block *succ = block->succs.at(succIndex++);
+      if (!visited.at(succ->id)) {
+        visited.at(succ->id) = true;
+        stack.emplace_back(succ, 0);
+      }
+      continue;
+    }
+    reversePostOrder.push_back(block);
+    stack.pop_back();
+  }
+  std::reverse(reversePostOrder.begin(), reversePostOrder.end());
+  for (size_t i = 0; i < reversePostOrder.size(); ++i)
+    rpoIndices.at(reversePostOrder.at(i)->id) = i;
+  computeIdoms();
+  computeFrontiers();
+  numberTree();
+}
+
+const std::vector<Block *> &DominatorTree::getReversePostOrder() const {
+  return reversePostOrder;
+}
+
+bool DominatorTree::isReachable(const Block *block) const {
+  return rpoIndices.at(block->id) >= 0;
+}
+
+Block *DominatorTree::getIdom(const Block *block) const {
+  return idoms.at(block->id);
+}
+
+const std::vector<Block *> &
+DominatorTree::getChildren(const Block *block) const {
+  return children.at(block->id);
+}
+
+const std::vector<Block *> &
+DominatorTree::getFrontier(const Block *block) const {
+  return frontiers.at(block->id);
+}
+
+bool DominatorTree::dominates(const Block *dominator,
+                              const Block *block) const {
+  if (!isReachable(dominator) || !isReachable(block))
+    return false;
+  return preNumbers.at(dominator->id) <= preNumbers.at(block->id) &&
+         postNumbers.at(block->id) <= postNumbers.at(dominator->id);
+}
+
+bool DominatorTree::dominates(const Instruction *def,
+                              const Instruction *user) const {
+  // A phi uses its incoming values at the end of the matching predecessors.
+  if (user->op == Opcode::Phi) {
+    const Block *block = user->parent;
+    for (size_t i = 0; i < user->operands.size(); ++i) {
+      if (user->operands.at(i) == def &&
+          !dominates(def->parent, block->preds.at(i)))
+        return false;
+    }
+    return true;
+  }
+  if (def->parent != user->parent)
+    return dominates(def->parent, user->parent);
+  for (const auto &instruction : def->parent->instructions) {
+    if (instruction.get() == def)
+      return true;
+    if (instruction.get() == user)
+      return false;
+  }
+  return false;
+}
+
+void DominatorTree::computeIdoms() {
+  if (reversePostOrder.empty())
+    return;
+  Block *entry = reversePostOrder.front();
+  idoms.at(entry->id) = entry;
+  const auto intersect = [this](Block *lhs, Block *rhs) {
+    while (lhs != rhs) {
+      while (rpoIndices.at(lhs->id) > rpoIndices.at(rhs->id))
+        lhs = idoms.at(lhs->id);
+      while (rpoIndices.at(rhs->id) > rpoIndices.at(lhs->id))
+        rhs = idoms.at(rhs->id);
+    }
+    return lhs;
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 1; i < reversePostOrder.size(); ++i) {
+      Block *block = reversePostOrder.at(i);
+      Block *newIdom = nullptr;
+      for (Block *pred : block->preds) {
+        if (!isReachable(pred) || !idoms.at(pred->id))
+          continue;
+        newIdom = newIdom ? intersect(pred, newIdom) : pred;
+      }
+      if (idoms.at(block->id) != newIdom) {
+        idoms.at(block->id) = newIdom;
+        changed = true;
+      }
+    }
+  }
+  // The entry is its own dominator only while computing.
+  idoms.at(entry->id) = nullptr;
+  for (Block *block : reversePostOrder) {
+    if (Block *idom = idoms.at(block->id))
+      children.at(idom->id).push_back(block);
+  }
+}
+
+void DominatorTree::computeFrontiers() {
+  // A join point is in the frontier of every block that dominates one of its
+  // predecessors but not the join point itself.
+  for (Block *block : reversePostOrder) {
+    if (block->preds.size() < 2)
+      continue;
+    for (Block *pred : block->preds) {
+      if (!isReachable(pred))
+        continue;
+      for (Block *runner = pred; runner && runner != idoms.at(block->id);
+           runner = idoms.at(runner->id)) {
+        auto &frontier = frontiers.at(runner->id);
+        if (std::find(frontier.begin(), frontier.end(), block) ==
+            frontier.end())
+          frontier.push_back(block);
+      }
+    }
+  }
+}
+
+void DominatorTree::numberTree() {
+  if (reversePostOrder.empty())
+    return;
+  int counter = 0;
+  std::vector<std::pair<Block *, size_t>> stack;
+  Block *entry = reversePostOrder.front();
+  preNumbers.at(entry->id) = counter++;
+  stack.emplace_back(entry, 0);
+  while (!stack.empty()) {
+    auto &[block, childIndex] = stack.back();
+    const auto &blockChildren = children.at(block->id);
+    if (childIndex < blockChildren.size()) {
+      Block *child = blockChildren.at(childIndex++);
+      preNumbers.at(child->id) = counter++;
+      stack.emplace_back(child, 0);
+      continue;
+    }
+    postNumbers.at(block->id) = counter++;
+    stack.pop_back();
+  }
+  assert(static_cast<size_t>(counter) == reversePostOrder.size() * 2);
+}
+
+} // namespace descartes::ssa
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Ssa.h>
+
+namespace descartes::ssa {
+
+// Immediate dominators are computed with the iterative algorithm from Cooper,
+// Harvey and Kennedy's "A Simple, Fast Dominance Algorithm". Blocks that are
+// unreachable from the entry have no dominator and aren't in the tree.
+class DominatorTree {
+public:
+  explicit DominatorTree(const Function &function);
+  virtual ~DominatorTree() = default;
+  const std::vector<Block *> &getReversePostOrder() const;
+  bool isReachable(const Block *block) const;
+  Block *getIdom(const Block *block) const;
+  const std::vector<Block *> &getChildren(const Block *block) const;
+  const std::vector<Block *> &getFrontier(const Block *block) const;
+  bool dominates(const Block *dominator, const Block *block) const;
+  bool dominates(const Instruction *def, const Instruction *user) const;
+
+private:
+  void computeIdoms();
+  void computeFrontiers();
+  void numberTree();
+  std::vector<Block *> reversePostOrder;
+  std::vector<int> rpoIndices;
+  std::vector<Block *> idoms;
+  std::vector<std::vector<Block *>> children;
+  std::vector<std::vector<Block *>> frontiers;
+  // Pre and post order numbers of the dominator tree make dominance queries
+  // constant time.
+  std::vector<int> preNumbers, postNumbers;
+};
+
+} // namespace descartes::ssa
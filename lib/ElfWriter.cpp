@@ -0,0 +1,245 @@
+#include "ElfWriter.h"
+
+#include <cassert>
+
+namespace descartes {
+
+namespace {
+
+const uint32_t sectionTypeProgramBits = 1;
+const uint32_t sectionTypeSymbolTable = 2;
+const uint32_t sectionTypeStringTable = 3;
+const uint32_t sectionTypeRela = 4;
+const uint32_t sectionTypeNoBits = 8;
+
+const uint64_t sectionFlagWrite = 0x1;
+const uint64_t sectionFlagAlloc = 0x2;
+const uint64_t sectionFlagExecute = 0x4;
+const uint64_t sectionFlagInfoLink = 0x40;
+
+const uint8_t symbolBindLocal = 0;
+const uint8_t symbolBindGlobal = 1;
+
+const uint32_t relocation64 = 1;
+const uint32_t relocationPc32 = 2;
+const uint32_t relocationPlt32 = 4;
+
+const size_t headerSize = 64;
+const size_t sectionHeaderSize = 64;
+const size_t symbolSize = 24;
+const size_t relaSize = 24;
+
+// Sections are written in this order after the null one.
+enum SectionIndex : uint16_t {
+  Text = 1,
+  Rodata,
+  Bss,
+  RelaText,
+  RelaRodata,
+  SymbolTable,
+  StringTable,
+  GnuStack,
+  SectionNames,
+  SectionCount,
+};
+
+uint16_t getSectionIndex(x86::Section section) {
+  switch (section) {
+  case x86::Section::Text:
+    return Text;
+  case x86::Section::Rodata:
+    return Rodata;
+  case x86::Section::Bss:
+    return Bss;
+  }
+  return 0;
+}
+
+uint8_t getSymbolType(x86::SymbolType type) {
+  switch (type) {
+  case x86::SymbolType::None:
+    return 0;
+  case x86::SymbolType::Object:
+    return 1;
+  case x86::SymbolType::Function:
+    return 2;
+  case x86::SymbolType::Section:
+    return 3;
+  }
+  return 0;
+}
+
+uint32_t getRelocationType(x86::RelocationType type) {
+  switch (type) {
+  case x86::RelocationType::Absolute64:
+    return relocation64;
+  case x86::RelocationType::Relative32:
+    return relocationPc32;
+  case x86::RelocationType::Call32:
+    return relocationPlt32;
+  }
+  return 0;
+}
+
+} // namespace
+
+ElfWriter::ElfWriter(std::ostream &out) : out(out) {}
+
+void ElfWriter::write(const x86::ObjectCode &code) {
+  buffer.assign(headerSize, 0);
+  sectionNames.assign(1, 0);
+  // Local symbols have to come before global ones.
+  std::vector<size_t> order;
+  for (bool isGlobal : {false, true}) {
+    for (size_t i = 0; i < code.symbols.size(); ++i) {
+      if (code.symbols.at(i).isGlobal == isGlobal)
+        order.push_back(i);
+    }
+  }
+  std::vector<uint32_t> symbolIndices(code.symbols.size());
+  std::vector<uint8_t> symbols(symbolSize, 0), strings(1, 0);
+  uint32_t firstGlobal = 0;
+  for (size_t i : order) {
+    const x86::ObjectSymbol &symbol = code.symbols.at(i);
+    symbolIndices.at(i) = symbols.size() / symbolSize;
+    if (symbol.isGlobal && !firstGlobal)
+      firstGlobal = symbolIndices.at(i);
+    // Section symbols are named after their section.
+    uint32_t name = 0;
+    if (symbol.type != x86::SymbolType::Section) {
+      name = strings.size();
+      strings.insert(strings.end(), symbol.name.begin(), symbol.name.end());
+      strings.push_back(0);
+    }
+    append<uint32_t>(symbols, name);
+    append<uint8_t>(symbols,
+                    (symbol.isGlobal ? symbolBindGlobal : symbolBindLocal)
+                            << 4 |
+                        getSymbolType(symbol.type));
+    append<uint8_t>(symbols, 0);
+    append<uint16_t>(symbols,
+                     symbol.section ? getSectionIndex(*symbol.section) : 0);
+    append<uint64_t>(symbols, symbol.offset);
+    append<uint64_t>(symbols, symbol.size);
+  }
+  if (!firstGlobal)
+    firstGlobal = symbols.size() / symbolSize;
+  std::vector<uint8_t> textRelocations, rodataRelocations;
+  for (const x86::Relocation &relocation : code.relocations) {
+    assert(relocation.section != x86::Section::Bss);
+    auto &data = relocation.section == x86::Section::Text ? textRelocations
+                                                          : rodataRelocations;
+    append<uint64_t>(data, relocation.offset);
+    append<uint64_t>(data,
+                     static_cast<uint64_t>(symbolIndices.at(relocation.symbol))
+                             << 32 |
+                         getRelocationType(relocation.type));
+    append<int64_t>(data, relocation.addend);
+  }
+
+  std::vector<SectionHeader> headers(1, SectionHeader{});
+  headers.push_back(addSection(".text", sectionTypeProgramBits,
+                               sectionFlagAlloc | sectionFlagExecute,
+                               code.text, 16, 0));
+  headers.push_back(addSection(".rodata", sectionTypeProgramBits,
+                               sectionFlagAlloc, code.rodata, 8, 0));
+  headers.push_back(addSection(".bss", sectionTypeNoBits,
+                               sectionFlagAlloc | sectionFlagWrite, {}, 8, 0));
+  headers.back().size = code.bssSize;
+  headers.push_back(addSection(".rela.text", sectionTypeRela,
+                               sectionFlagInfoLink, textRelocations, 8,
+                               relaSize));
+  headers.back().link = SymbolTable;
+  headers.back().info = Text;
+  headers.push_back(addSection(".rela.rodata", sectionTypeRela,
+                               sectionFlagInfoLink, rodataRelocations, 8,
+                               relaSize));
+  headers.back().link = SymbolTable;
+  headers.back().info = Rodata;
+  headers.push_back(addSection(".symtab", sectionTypeSymbolTable, 0, symbols,
+                               8, symbolSize));
+  headers.back().link = StringTable;
+  headers.back().info = firstGlobal;
+  headers.push_back(
+      addSection(".strtab", sectionTypeStringTable, 0, strings, 1, 0));
+  // Nothing needs an executable stack.
+  headers.push_back(
+      addSection(".note.GNU-stack", sectionTypeProgramBits, 0, {}, 1, 0));
+  // The section names are complete once this one has its own.
+  const uint32_t namesName = addSectionName(".shstrtab");
+  const std::vector<uint8_t> names = sectionNames;
+  headers.push_back(addSection("", sectionTypeStringTable, 0, names, 1, 0));
+  headers.back().name = namesName;
+  assert(headers.size() == SectionCount);
+
+  align(8);
+  const uint64_t sectionHeaderOffset = buffer.size();
+  for (const SectionHeader &header : headers) {
+    append<uint32_t>(buffer, header.name);
+    append<uint32_t>(buffer, header.type);
+    append<uint64_t>(buffer, header.flags);
+    append<uint64_t>(buffer, 0);
+    append<uint64_t>(buffer, header.offset);
+    append<uint64_t>(buffer, header.size);
+    append<uint32_t>(buffer, header.link);
+    append<uint32_t>(buffer, header.info);
+    append<uint64_t>(buffer, header.alignment);
+    append<uint64_t>(buffer, header.entrySize);
+  }
+
+  std::vector<uint8_t> header = {0x7f, 'E', 'L', 'F',
+                                 // 64 bit, little endian, version 1, System V
+                                 2, 1, 1, 0};
+  header.resize(16, 0);
+  // A relocatable file for x86-64.
+  append<uint16_t>(header, 1);
+  append<uint16_t>(header, 62);
+  append<uint32_t>(header, 1);
+  // No entry point or program headers.
+  append<uint64_t>(header, 0);
+  append<uint64_t>(header, 0);
+  append<uint64_t>(header, sectionHeaderOffset);
+  append<uint32_t>(header, 0);
+  append<uint16_t>(header, headerSize);
+  append<uint16_t>(header, 0);
+  append<uint16_t>(header, 0);
+  append<uint16_t>(header, sectionHeaderSize);
+  append<uint16_t>(header, SectionCount);
+  append<uint16_t>(header, SectionNames);
+  assert(header.size() == headerSize);
+  std::copy(header.begin(), header.end(), buffer.begin());
+  out.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+}
+
+ElfWriter::SectionHeader
+ElfWriter::addSection(const std::string &name, uint32_t type, uint64_t flags,
+                      const std::vector<uint8_t> &data, uint64_t alignment,
+                      uint64_t entrySize) {
+  align(alignment);
+  SectionHeader header{addSectionName(name),
+                       type,
+                       flags,
+                       buffer.size(),
+                       data.size(),
+                       0,
+                       0,
+                       alignment,
+                       entrySize};
+  buffer.insert(buffer.end(), data.begin(), data.end());
+  return header;
+}
+
+uint32_t ElfWriter::addSectionName(const std::string &name) {
+  if (name.empty())
+    return 0;
+  const uint32_t offset = sectionNames.size();
+  sectionNames.insert(sectionNames.end(), name.begin(), name.end());
+  sectionNames.push_back(0);
+  return offset;
+}
+
+void ElfWriter::align(uint64_t alignment) {
+  buffer.resize((buffer.size() + alignment - 1) / alignment * alignment, 0);
+}
+
+} // namespace descartes
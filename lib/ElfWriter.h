@@ -0,0 +1,44 @@
+#pragma once
+
+#include <ObjectCode.h>
+
+#include <ostream>
+
+namespace descartes {
+
+// Writes object code as a relocatable ELF64 file for x86-64 Linux. The whole
+// file is put together in memory and written out in one go.
+class ElfWriter {
+public:
+  explicit ElfWriter(std::ostream &out);
+  virtual ~ElfWriter() = default;
+  void write(const x86::ObjectCode &code);
+
+private:
+  struct SectionHeader {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t alignment;
+    uint64_t entrySize;
+  };
+  // Adds the contents of a section at its alignment and returns its header.
+  SectionHeader addSection(const std::string &name, uint32_t type,
+                           uint64_t flags, const std::vector<uint8_t> &data,
+                           uint64_t alignment, uint64_t entrySize);
+  uint32_t addSectionName(const std::string &name);
+  void align(uint64_t alignment);
+  template <typename T> void append(std::vector<uint8_t> &data, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i)
+      data.push_back(static_cast<uint64_t>(value) >> (i * 8));
+  }
+  std::ostream &out;
+  std::vector<uint8_t> buffer;
+  std::vector<uint8_t> sectionNames;
+};
+
+} // namespace descartes
@@ -0,0 +1,424 @@
+#include "Encoder.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace descartes {
+
+namespace {
+
+// The low three bits of a register go in the instruction and the high one in
+// the REX prefix.
+uint8_t getLowBits(int reg) { return reg & 7; }
+bool isExtended(int reg) { return reg >= 8; }
+
+bool fitsInByte(int value) { return value >= -128 && value <= 127; }
+
+uint8_t getConditionCode(x86::Condition condition) {
+  switch (condition) {
+  case x86::Condition::Equal:
+    return 0x4;
+  case x86::Condition::NotEqual:
+    return 0x5;
+  case x86::Condition::Less:
+    return 0xc;
+  case x86::Condition::GreaterEqual:
+    return 0xd;
+  case x86::Condition::LessEqual:
+    return 0xe;
+  case x86::Condition::Greater:
+    return 0xf;
+  }
+  return 0;
+}
+
+uint8_t getScaleBits(int scale) {
+  switch (scale) {
+  case 1:
+    return 0;
+  case 2:
+    return 1;
+  case 4:
+    return 2;
+  default:
+    assert(scale == 8);
+    return 3;
+  }
+}
+
+const char *const sectionNames[] = {".text", ".rodata", ".bss"};
+
+} // namespace
+
+Encoder::Encoder() : code{{}, {}, 0, {}, {}} {}
+
+x86::ObjectCode Encoder::encode(const std::vector<x86::Function> &functions) {
+  assert(!functions.empty());
+  code = x86::ObjectCode{{}, {}, 0, {}, {}};
+  labelOffsets.clear();
+  rodataOffsets.clear();
+  branchFixups.clear();
+  // Relocations between sections are relative to where each one starts.
+  for (size_t i = 0; i < std::size(sectionNames); ++i)
+    code.symbols.push_back({sectionNames[i], x86::SymbolType::Section,
+                            static_cast<x86::Section>(i), 0, 0, false});
+  for (const x86::Function &function : functions) {
+    for (const x86::JumpTable &table : function.jumpTables) {
+      rodataOffsets.emplace(table.label, code.rodata.size());
+      code.rodata.resize(code.rodata.size() +
+                         table.targets.size() * ir::wordSize);
+    }
+  }
+  // Everything in `.rodata` is a whole number of words so strings stay
+  // aligned.
+  for (Symbol string : x86::getStrings(functions)) {
+    rodataOffsets.emplace(string, code.rodata.size());
+    for (uint64_t word : ir::getStringWords(string)) {
+      for (int i = 0; i < ir::wordSize; ++i)
+        code.rodata.push_back(word >> (i * 8));
+    }
+  }
+  if ((code.bssSize = x86::getDisplaySize(functions)))
+    code.symbols.push_back({ir::displayName, x86::SymbolType::Object,
+                            x86::Section::Bss, 0, code.bssSize, false});
+  // The main program comes last.
+  code.symbols.push_back({"_start", x86::SymbolType::Function,
+                          x86::Section::Text, 0, 0, true});
+  encodeCall(functions.back().level.name);
+  // movl $60, %eax
+  emitByte(0xb8);
+  emitInt32(60);
+  // xorl %edi, %edi
+  emitByte(0x31);
+  emitByte(0xff);
+  // syscall
+  emitByte(0x0f);
+  emitByte(0x05);
+  code.symbols.back().size = code.text.size();
+  for (const x86::Function &function : functions) {
+    const size_t start = code.text.size();
+    for (const x86::Instruction &instruction : function.instructions)
+      encodeInstruction(instruction);
+    code.symbols.push_back({function.level.name.getName(),
+                            x86::SymbolType::Function, x86::Section::Text,
+                            start, code.text.size() - start, false});
+  }
+  for (const BranchFixup &fixup : branchFixups) {
+    const auto iter = labelOffsets.find(fixup.label);
+    if (iter == labelOffsets.end()) {
+      // A call to something defined elsewhere.
+      code.relocations.push_back({x86::Section::Text, fixup.offset,
+                                  x86::RelocationType::Call32,
+                                  getSymbol(fixup.label.getName()), -4});
+      continue;
+    }
+    const int32_t distance = iter->second - (fixup.offset + 4);
+    for (size_t i = 0; i < 4; ++i)
+      code.text.at(fixup.offset + i) = distance >> (i * 8);
+  }
+  for (const x86::Function &function : functions) {
+    for (const x86::JumpTable &table : function.jumpTables) {
+      const size_t offset = rodataOffsets.at(table.label);
+      for (size_t i = 0; i < table.targets.size(); ++i)
+        code.relocations.push_back(
+            {x86::Section::Rodata, offset + i * ir::wordSize,
+             x86::RelocationType::Absolute64,
+             static_cast<size_t>(x86::Section::Text),
+             static_cast<int64_t>(labelOffsets.at(table.targets.at(i)))});
+    }
+  }
+  return std::move(code);
+}
+
+void Encoder::encodeInstruction(const x86::Instruction &instruction) {
+  const auto &operands = instruction.operands;
+  switch (instruction.op) {
+  case x86::Opcode::Label:
+    labelOffsets.emplace(*operands.front().symbol, code.text.size());
+    return;
+  case x86::Opcode::Mov: {
+    const x86::Operand &source = operands.front();
+    const x86::Operand &dest = operands.back();
+    if (source.kind == x86::OperandKind::Immediate) {
+      emitRex(true, 0, dest);
+      emitByte(0xc7);
+      emitModRm(0, dest);
+      emitImmediate(source.value, false);
+    } else if (source.kind == x86::OperandKind::Register) {
+      // Narrow stores write the low bytes of the register. The 16 bit form
+      // takes an operand size prefix ahead of REX.
+      const int size = instruction.size;
+      if (size == 2)
+        emitByte(0x66);
+      emitRex(size == ir::wordSize, *source.reg, dest, size == 1);
+      emitByte(size == 1 ? 0x88 : 0x89);
+      emitModRm(*source.reg, dest);
+    } else {
+      emitRex(true, *dest.reg, source);
+      emitByte(0x8b);
+      emitModRm(*dest.reg, source);
+    }
+    break;
+  }
+  case x86::Opcode::Movsx:
+  case x86::Opcode::Movzx: {
+    const int dest = *operands.back().reg;
+    const bool isSigned = instruction.op == x86::Opcode::Movsx;
+    if (instruction.size == 4) {
+      // Writing a 32 bit register clears the upper half, so zero extension
+      // is just a plain `mov`.
+      emitRex(isSigned, dest, operands.front());
+      emitByte(isSigned ? 0x63 : 0x8b);
+    } else {
+      emitRex(true, dest, operands.front());
+      emitByte(0x0f);
+      emitByte((isSigned ? 0xbe : 0xb6) | (instruction.size == 2 ? 1 : 0));
+    }
+    emitModRm(dest, operands.front());
+    break;
+  }
+  case x86::Opcode::Lea:
+    emitRex(true, *operands.back().reg, operands.front());
+    emitByte(0x8d);
+    emitModRm(*operands.back().reg, operands.front());
+    break;
+  case x86::Opcode::Add:
+    encodeArithmetic(instruction, 0x01, 0x03, 0);
+    return;
+  case x86::Opcode::Sub:
+    encodeArithmetic(instruction, 0x29, 0x2b, 5);
+    return;
+  case x86::Opcode::And:
+    encodeArithmetic(instruction, 0x21, 0x23, 4);
+    return;
+  case x86::Opcode::Cmp:
+    encodeArithmetic(instruction, 0x39, 0x3b, 7);
+    return;
+  case x86::Opcode::Imul: {
+    if (operands.size() == 1) {
+      emitRex(true, 0, operands.front());
+      emitByte(0xf7);
+      emitModRm(5, operands.front());
+      break;
+    }
+    const int dest = *operands.back().reg;
+    if (operands.size() == 3) {
+      const bool isByte = fitsInByte(operands.front().value);
+      emitRex(true, dest, operands.at(1));
+      emitByte(isByte ? 0x6b : 0x69);
+      emitModRm(dest, operands.at(1));
+      emitImmediate(operands.front().value, isByte);
+      break;
+    }
+    emitRex(true, dest, operands.front());
+    emitByte(0x0f);
+    emitByte(0xaf);
+    emitModRm(dest, operands.front());
+    break;
+  }
+  case x86::Opcode::Shl:
+  case x86::Opcode::Sar: {
+    const int extension = instruction.op == x86::Opcode::Shl ? 4 : 7;
+    const x86::Operand &count = operands.front();
+    emitRex(true, 0, operands.back());
+    if (count.kind == x86::OperandKind::Immediate) {
+      emitByte(0xc1);
+      emitModRm(extension, operands.back());
+      emitImmediate(count.value, true);
+      break;
+    }
+    assert(count.isRegister(x86::rcx));
+    emitByte(0xd3);
+    emitModRm(extension, operands.back());
+    break;
+  }
+  case x86::Opcode::Cqo:
+    emitByte(0x48);
+    emitByte(0x99);
+    break;
+  case x86::Opcode::Idiv:
+    emitRex(true, 0, operands.front());
+    emitByte(0xf7);
+    emitModRm(7, operands.front());
+    break;
+  case x86::Opcode::Jmp:
+    if (operands.front().kind == x86::OperandKind::Label) {
+      emitByte(0xe9);
+      encodeBranch(*operands.front().symbol);
+      break;
+    }
+    emitRex(false, 0, operands.front());
+    emitByte(0xff);
+    emitModRm(4, operands.front());
+    break;
+  case x86::Opcode::Jcc:
+    emitByte(0x0f);
+    emitByte(0x80 | getConditionCode(instruction.condition));
+    encodeBranch(*operands.front().symbol);
+    break;
+  case x86::Opcode::Call:
+    encodeCall(*operands.front().symbol);
+    break;
+  case x86::Opcode::Push: {
+    const x86::Operand &source = operands.front();
+    if (source.kind == x86::OperandKind::Immediate) {
+      const bool isByte = fitsInByte(source.value);
+      emitByte(isByte ? 0x6a : 0x68);
+      emitImmediate(source.value, isByte);
+    } else if (source.kind == x86::OperandKind::Register) {
+      emitRex(false, 0, source);
+      emitByte(0x50 | getLowBits(*source.reg));
+    } else {
+      emitRex(false, 0, source);
+      emitByte(0xff);
+      emitModRm(6, source);
+    }
+    break;
+  }
+  case x86::Opcode::Pop:
+    emitRex(false, 0, operands.front());
+    emitByte(0x58 | getLowBits(*operands.front().reg));
+    break;
+  case x86::Opcode::Leave:
+    emitByte(0xc9);
+    break;
+  case x86::Opcode::Ret:
+    emitByte(0xc3);
+    break;
+  }
+  finishInstruction();
+}
+
+void Encoder::encodeArithmetic(const x86::Instruction &instruction,
+                               uint8_t opRmReg, uint8_t opRegRm,
+                               uint8_t extension) {
+  const x86::Operand &source = instruction.operands.front();
+  const x86::Operand &dest = instruction.operands.back();
+  if (source.kind == x86::OperandKind::Immediate) {
+    const bool isByte = fitsInByte(source.value);
+    emitRex(true, 0, dest);
+    emitByte(isByte ? 0x83 : 0x81);
+    emitModRm(extension, dest);
+    emitImmediate(source.value, isByte);
+  } else if (source.kind == x86::OperandKind::Register) {
+    emitRex(true, *source.reg, dest);
+    emitByte(opRmReg);
+    emitModRm(*source.reg, dest);
+  } else {
+    assert(dest.kind == x86::OperandKind::Register);
+    emitRex(true, *dest.reg, source);
+    emitByte(opRegRm);
+    emitModRm(*dest.reg, source);
+  }
+  finishInstruction();
+}
+
+void Encoder::encodeBranch(Symbol label) {
+  branchFixups.push_back({code.text.size(), label});
+  emitInt32(0);
+}
+
+void Encoder::encodeCall(Symbol function) {
+  emitByte(0xe8);
+  encodeBranch(function);
+}
+
+void Encoder::emitRex(bool isWide, int reg, const x86::Operand &rm,
+                      bool isByte) {
+  uint8_t rex = 0x40;
+  if (isWide)
+    rex |= 0x8;
+  if (isExtended(reg))
+    rex |= 0x4;
+  if (rm.index && isExtended(*rm.index))
+    rex |= 0x2;
+  if (rm.reg && isExtended(*rm.reg))
+    rex |= 0x1;
+  // Without REX the byte registers 4 to 7 are %ah, %ch, %dh and %bh.
+  if (rex != 0x40 || (isByte && reg >= x86::rsp && reg <= x86::rdi))
+    emitByte(rex);
+}
+
+void Encoder::emitModRm(int reg, const x86::Operand &rm) {
+  const uint8_t regBits = getLowBits(reg) << 3;
+  if (rm.kind == x86::OperandKind::Register) {
+    emitByte(0xc0 | regBits | getLowBits(*rm.reg));
+    return;
+  }
+  assert(rm.kind == x86::OperandKind::Memory);
+  if (!rm.reg) {
+    emitByte(0x05 | regBits);
+    staticFixup = StaticFixup{code.text.size(), *rm.symbol, rm.value};
+    emitInt32(0);
+    return;
+  }
+  // %rsp and %r12 as a base need a SIB byte and %rbp and %r13 a displacement
+  // since those encodings mean something else.
+  const int base = *rm.reg;
+  const bool hasSib = rm.index || getLowBits(base) == x86::rsp;
+  uint8_t mod = 0x80;
+  if (rm.value == 0 && getLowBits(base) != x86::rbp)
+    mod = 0x00;
+  else if (fitsInByte(rm.value))
+    mod = 0x40;
+  emitByte(mod | regBits | (hasSib ? 0x4 : getLowBits(base)));
+  if (hasSib) {
+    const uint8_t index = rm.index ? getLowBits(*rm.index) : 0x4;
+    emitByte(getScaleBits(rm.scale) << 6 | index << 3 | getLowBits(base));
+  }
+  if (mod == 0x40)
+    emitByte(rm.value);
+  else if (mod == 0x80)
+    emitInt32(rm.value);
+}
+
+void Encoder::emitImmediate(int value, bool isByte) {
+  if (isByte)
+    emitByte(value);
+  else
+    emitInt32(value);
+}
+
+void Encoder::emitByte(uint8_t value) { code.text.push_back(value); }
+
+void Encoder::emitInt32(int32_t value) {
+  for (size_t i = 0; i < 4; ++i)
+    emitByte(value >> (i * 8));
+}
+
+void Encoder::finishInstruction() {
+  if (!staticFixup)
+    return;
+  // %rip points past the end of the instruction, which can have an immediate
+  // after the field.
+  const auto [offset, symbol, displacement] = *staticFixup;
+  staticFixup.reset();
+  const int64_t addend =
+      displacement - static_cast<int64_t>(code.text.size() - offset);
+  const auto rodata = rodataOffsets.find(symbol);
+  if (rodata != rodataOffsets.end()) {
+    code.relocations.push_back(
+        {x86::Section::Text, offset, x86::RelocationType::Relative32,
+         static_cast<size_t>(x86::Section::Rodata),
+         addend + static_cast<int64_t>(rodata->second)});
+    return;
+  }
+  code.relocations.push_back({x86::Section::Text, offset,
+                              x86::RelocationType::Relative32,
+                              getSymbol(symbol.getName()), addend});
+}
+
+size_t Encoder::getSymbol(const std::string &name) {
+  const auto iter = std::find_if(
+      code.symbols.begin(), code.symbols.end(),
+      [&name](const x86::ObjectSymbol &symbol) {
+        return symbol.type != x86::SymbolType::Section && symbol.name == name;
+      });
+  if (iter != code.symbols.end())
+    return iter - code.symbols.begin();
+  code.symbols.push_back(
+      {name, x86::SymbolType::None, std::nullopt, 0, 0, true});
+  return code.symbols.size() - 1;
+}
+
+} // namespace descartes
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <ObjectCode.h>
+#include <X86.h>
+
+#include <unordered_map>
+
+namespace descartes {
+
+// Encodes allocated machine code into bytes. Jumps and calls within the
+// program are resolved here once every label has an offset, so the only
+// relocations left are between sections and to symbols defined elsewhere.
+// Jump tables and string literals go in `.rodata` and the display in `.bss`.
+//
+// The program starts at `_start`, which calls the main program and exits,
+// so the object links on its own without any C runtime.
+class Encoder {
+public:
+  Encoder();
+  virtual ~Encoder() = default;
+  x86::ObjectCode encode(const std::vector<x86::Function> &functions);
+
+private:
+  // A rel32 field that has to point at a label.
+  struct BranchFixup {
+    size_t offset;
+    Symbol label;
+  };
+  // A %rip relative field that can only be filled in once the rest of the
+  // instruction is known.
+  struct StaticFixup {
+    size_t offset;
+    Symbol symbol;
+    int displacement;
+  };
+  void encodeInstruction(const x86::Instruction &instruction);
+  void encodeArithmetic(const x86::Instruction &instruction, uint8_t opRmReg,
+                        uint8_t opRegRm, uint8_t extension);
+  void encodeBranch(Symbol label);
+  void encodeCall(Symbol function);
+  // `isByte` when `reg` names a byte register, which always takes a prefix
+  // past %bl.
+  void emitRex(bool isWide, int reg, const x86::Operand &rm,
+               bool isByte = false);
+  void emitModRm(int reg, const x86::Operand &rm);
+  void emitImmediate(int value, bool isByte);
+  void emitByte(uint8_t value);
+  void emitInt32(int32_t value);
+  void finishInstruction();
+  // The index of a symbol that isn't a section, added if it's new.
+  size_t getSymbol(const std::string &name);
+  x86::ObjectCode code;
+  std::unordered_map<Symbol, size_t, SymbolHash> labelOffsets;
+  // Where jump tables and strings start within `.rodata`.
+  std::unordered_map<Symbol, size_t, SymbolHash> rodataOffsets;
+  std::vector<BranchFixup> branchFixups;
+  std::optional<StaticFixup> staticFixup;
+};
+
+} // namespace descartes
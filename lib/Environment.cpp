@@ -3,9 +3,10 @@
 namespace descartes {
 
 FunctionEntry::FunctionEntry(const Function *function, const Type *returnType,
-                             std::vector<const Type *> &&argTypes)
+                             std::vector<const Type *> &&argTypes,
+                             const ir::Level *parent)
     : function(function), returnType(returnType),
-      argTypes(std::move(argTypes)) {}
+      argTypes(std::move(argTypes)), parent(parent) {}
 
 Environment::Environment(SymbolTable &symbols) {
   // Define primitive types.
@@ -14,11 +15,21 @@ Environment::Environment(SymbolTable &symbols) {
   setResolvedType(symbols.make("integer"), integerType.get());
   primitiveTypes.push_back(std::move(integerType));
   auto booleanType = std::make_unique<Boolean>();
-  setResolvedType(symbols.make("boolean"), booleanType.get());
+  const Type *boolType = booleanType.get();
+  setResolvedType(symbols.make("boolean"), boolType);
   primitiveTypes.push_back(std::move(booleanType));
   auto stringType = std::make_unique<String>();
   setResolvedType(symbols.make("string"), stringType.get());
   primitiveTypes.push_back(std::move(stringType));
+  // Define the predeclared boolean constants.
+  setConstValue(symbols.make("false"), ConstEntry(boolType, 0));
+  setConstValue(symbols.make("true"), ConstEntry(boolType, 1));
+  // Define the intrinsics in the outermost scope so the program can declare
+  // its own functions with the same names.
+  setIntrinsic(symbols.make("write"), Intrinsic::Write);
+  setIntrinsic(symbols.make("writeln"), Intrinsic::Writeln);
+  setIntrinsic(symbols.make("read"), Intrinsic::Read);
+  setIntrinsic(symbols.make("readln"), Intrinsic::Readln);
 }
 
 void Environment::enterScope() { scopes.emplace_back(); }
@@ -31,13 +42,24 @@ void Environment::exitScope() {
 bool Environment::setVarType(Symbol name, VarEntry var) {
   assert(!scopes.empty());
   auto &currentScope = scopes.back();
-  auto iter = currentScope.varEntries.find(name);
-  if (iter != currentScope.varEntries.end())
+  // Variables and constants share a namespace.
+  if (currentScope.varEntries.find(name) != currentScope.varEntries.end() ||
+      currentScope.constEntries.find(name) != currentScope.constEntries.end())
     return false;
   currentScope.varEntries.emplace(name, var);
   return true;
 }
 
+bool Environment::setConstValue(Symbol name, ConstEntry value) {
+  assert(!scopes.empty());
+  auto &currentScope = scopes.back();
+  if (currentScope.varEntries.find(name) != currentScope.varEntries.end() ||
+      currentScope.constEntries.find(name) != currentScope.constEntries.end())
+    return false;
+  currentScope.constEntries.emplace(name, value);
+  return true;
+}
+
 bool Environment::setFunctionType(Symbol name, FunctionEntry &&function) {
   assert(!scopes.empty());
   auto &currentScope = scopes.back();
@@ -58,6 +80,11 @@ bool Environment::setResolvedType(Symbol name, const Type *type) {
   return true;
 }
 
+bool Environment::setIntrinsic(Symbol name, Intrinsic intrinsic) {
+  assert(!scopes.empty());
+  return scopes.back().intrinsics.emplace(name, intrinsic).second;
+}
+
 const VarEntry *Environment::getVarType(Symbol name) const {
   assert(!scopes.empty());
   // Iterate backwards.
@@ -66,6 +93,23 @@ const VarEntry *Environment::getVarType(Symbol name) const {
     const auto varIter = scope.varEntries.find(name);
     if (varIter != scope.varEntries.end())
       return &varIter->second;
+    // An inner constant shadows any outer variable of the same name.
+    if (scope.constEntries.find(name) != scope.constEntries.end())
+      return nullptr;
+  }
+  return nullptr;
+}
+
+const ConstEntry *Environment::getConstValue(Symbol name) const {
+  assert(!scopes.empty());
+  // Iterate backwards.
+  for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+    const auto &scope = *it;
+    const auto constIter = scope.constEntries.find(name);
+    if (constIter != scope.constEntries.end())
+      return &constIter->second;
+    if (scope.varEntries.find(name) != scope.varEntries.end())
+      return nullptr;
   }
   return nullptr;
 }
@@ -94,4 +138,19 @@ const Type *Environment::getResolvedType(Symbol name) const {
   return nullptr;
 }
 
+const Intrinsic *Environment::getIntrinsic(Symbol name) const {
+  assert(!scopes.empty());
+  // Iterate backwards.
+  for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+    const auto &scope = *it;
+    // A function of the same name hides the intrinsic.
+    if (scope.functionEntries.find(name) != scope.functionEntries.end())
+      return nullptr;
+    const auto intrinsicIter = scope.intrinsics.find(name);
+    if (intrinsicIter != scope.intrinsics.end())
+      return &intrinsicIter->second;
+  }
+  return nullptr;
+}
+
 } // namespace descartes
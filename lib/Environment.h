@@ -5,6 +5,7 @@
 #include <SymbolTable.h>
 
 #include <cassert>
+#include <variant>
 
 namespace descartes {
 
@@ -17,12 +18,38 @@ struct VarEntry {
   ir::Access access;
 };
 
+// Constants are evaluated at compile time so they never occupy a frame slot.
+// Integers, booleans and enum values are stored as ordinals and strings as the
+// symbol of their literal.
+struct ConstEntry {
+  ConstEntry(const Type *constType, int value)
+      : constType(constType), value(value) {}
+  ConstEntry(const Type *constType, Symbol value)
+      : constType(constType), value(value) {}
+  const Type *constType;
+  std::variant<int, Symbol> value;
+};
+
 struct FunctionEntry {
   FunctionEntry(const Function *function, const Type *returnType,
-                std::vector<const Type *> &&argTypes);
+                std::vector<const Type *> &&argTypes,
+                const ir::Level *parent);
   const Function *function;
   const Type *returnType;
   const std::vector<const Type *> argTypes;
+  // The level the function is declared in. Calls pass its frame as the static
+  // link.
+  const ir::Level *parent;
+};
+
+// Procedures built into the language. They take any number of arguments of
+// several types so they can't be described by a `FunctionEntry`, and the
+// semantic analyser lowers each call into calls to the runtime.
+enum class Intrinsic {
+  Write,
+  Writeln,
+  Read,
+  Readln,
 };
 
 class Environment {
@@ -34,17 +61,23 @@ public:
   void enterScope();
   void exitScope();
   bool setVarType(Symbol name, VarEntry var);
+  bool setConstValue(Symbol name, ConstEntry value);
   bool setFunctionType(Symbol name, FunctionEntry &&function);
   bool setResolvedType(Symbol name, const Type *type);
+  bool setIntrinsic(Symbol name, Intrinsic intrinsic);
   const VarEntry *getVarType(Symbol name) const;
+  const ConstEntry *getConstValue(Symbol name) const;
   const FunctionEntry *getFunctionType(Symbol name) const;
   const Type *getResolvedType(Symbol name) const;
+  const Intrinsic *getIntrinsic(Symbol name) const;
 
 private:
   struct Scope {
     std::unordered_map<Symbol, const VarEntry, SymbolHash> varEntries;
+    std::unordered_map<Symbol, const ConstEntry, SymbolHash> constEntries;
     std::unordered_map<Symbol, const FunctionEntry, SymbolHash> functionEntries;
     std::unordered_map<Symbol, const Type *, SymbolHash> resolvedTypes;
+    std::unordered_map<Symbol, Intrinsic, SymbolHash> intrinsics;
   };
   std::vector<Scope> scopes;
   std::vector<TypePtr> primitiveTypes;
@@ -0,0 +1,49 @@
+#include "FrameCompaction.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+namespace descartes {
+
+void FrameCompaction::run(ssa::Function &function) {
+  ir::Level &level = function.level;
+  std::set<int> fixed(level.escapes.begin(), level.escapes.end());
+  fixed.insert(level.arrays.begin(), level.arrays.end());
+  for (const ir::Access &formal : level.formals)
+    fixed.insert(formal.offset);
+  std::vector<ssa::Instruction *> slots;
+  std::set<int, std::greater<int>> movable;
+  for (const auto &instruction : function.getEntry()->instructions) {
+    if (instruction->op != ssa::Opcode::Local)
+      continue;
+    slots.push_back(instruction.get());
+    if (!fixed.count(instruction->value))
+      movable.insert(instruction->value);
+  }
+  // Offsets grow downwards from zero.
+  std::map<int, int> offsets;
+  int next = 0;
+  for (int offset : movable) {
+    while (fixed.count(next))
+      next -= ir::wordSize;
+    offsets.emplace(offset, next);
+    next -= ir::wordSize;
+  }
+  for (ssa::Instruction *slot : slots) {
+    const auto iter = offsets.find(slot->value);
+    if (iter != offsets.end())
+      slot->value = iter->second;
+  }
+  int lowest = 0;
+  for (const auto &[offset, newOffset] : offsets)
+    lowest = std::min(lowest, newOffset);
+  if (!fixed.empty())
+    lowest = std::min(lowest, *fixed.begin());
+  const bool isEmpty = offsets.empty() && fixed.empty();
+  level.locals.clear();
+  for (int offset = 0; !isEmpty && offset >= lowest; offset -= ir::wordSize)
+    level.locals.emplace_back(&level, offset);
+}
+
+} // namespace descartes
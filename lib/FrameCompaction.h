@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Ssa.h>
+
+namespace descartes {
+
+// Drops the frame slots of a level that nothing refers to any more and packs
+// the rest together. Formals stay where callers put the arguments, escaping
+// locals stay where nested functions expect them and arrays stay whole, so
+// only the remaining locals of the function itself move into the gaps. Slots
+// that are left between fixed ones stay in the level so that the frame size is
+// still one word per local.
+class FrameCompaction {
+public:
+  virtual ~FrameCompaction() = default;
+  void run(ssa::Function &function);
+};
+
+} // namespace descartes
@@ -0,0 +1,239 @@
+#include "Gvn.h"
+
+#include <algorithm>
+
+namespace descartes {
+
+namespace {
+
+bool isPure(const ssa::Instruction &instruction) {
+  switch (instruction.op) {
+  case ssa::Opcode::Const:
+  case ssa::Opcode::Name:
+  case ssa::Opcode::FramePointer:
+  case ssa::Opcode::Param:
+  case ssa::Opcode::Local:
+  case ssa::Opcode::Phi:
+  case ssa::Opcode::ArithOp:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool isCommutative(ir::ArithOpKind kind) {
+  return kind == ir::ArithOpKind::Add || kind == ir::ArithOpKind::Multiply ||
+         kind == ir::ArithOpKind::And || kind == ir::ArithOpKind::MultiplyHigh;
+}
+
+bool isConst(const ssa::Instruction &instruction, int value) {
+  return instruction.op == ssa::Opcode::Const && instruction.value == value;
+}
+
+} // namespace
+
+Gvn::Gvn() : function(nullptr) {}
+
+void Gvn::run(ssa::Function &function) {
+  this->function = &function;
+  leaders.clear();
+  function.removeUnreachableBlocks();
+  const ssa::DominatorTree domTree(function);
+  findClobberedBlocks(domTree);
+  numberBlock(function.getEntry(), {}, domTree);
+  this->function = nullptr;
+}
+
+void Gvn::findClobberedBlocks(const ssa::DominatorTree &domTree) {
+  std::vector<bool> writesMemory(function->blockCount, false);
+  for (const auto &block : function->blocks) {
+    writesMemory.at(block->id) =
+        std::any_of(block->instructions.begin(), block->instructions.end(),
+                    [](const ssa::InstructionPtr &instruction) {
+                      return instruction->op == ssa::Opcode::Store ||
+                             instruction->op == ssa::Opcode::Call;
+                    });
+  }
+  // Memory on entry to a block is the same as at the end of its immediate
+  // dominator unless a block on some path between them writes to it. Those
+  // are the blocks that reach the block backwards without going through the
+  // dominator, which includes the block itself when it is in a loop.
+  clobberedBlocks.assign(function->blockCount, false);
+  for (const auto &block : function->blocks) {
+    const ssa::Block *idom = domTree.getIdom(block.get());
+    if (!idom)
+      continue;
+    std::vector<bool> visited(function->blockCount, false);
+    std::vector<const ssa::Block *> worklist;
+    for (const ssa::Block *pred : block->preds) {
+      if (pred != idom && !visited.at(pred->id)) {
+        visited.at(pred->id) = true;
+        worklist.push_back(pred);
+      }
+    }
+    while (!worklist.empty()) {
+      const ssa::Block *current = worklist.back();
+      worklist.pop_back();
+      if (writesMemory.at(current->id)) {
+        clobberedBlocks.at(block->id) = true;
+        break;
+      }
+      for (const ssa::Block *pred : current->preds) {
+        if (pred != idom && !visited.at(pred->id)) {
+          visited.at(pred->id) = true;
+          worklist.push_back(pred);
+        }
+      }
+    }
+  }
+}
+
+void Gvn::numberBlock(ssa::Block *block, AvailableLoads loads,
+                      const ssa::DominatorTree &domTree) {
+  if (clobberedBlocks.at(block->id))
+    loads.clear();
+  std::vector<ValueKey> scope;
+  std::vector<ssa::Instruction *> instructions;
+  for (const auto &instruction : block->instructions)
+    instructions.push_back(instruction.get());
+  for (ssa::Instruction *instruction : instructions) {
+    if (isPure(*instruction)) {
+      numberPure(instruction, scope);
+      continue;
+    }
+    switch (instruction->op) {
+    case ssa::Opcode::Load:
+      numberLoad(instruction, loads);
+      break;
+    case ssa::Opcode::Store:
+      numberStore(instruction, loads);
+      break;
+    case ssa::Opcode::Call:
+      loads.clear();
+      break;
+    default:
+      break;
+    }
+  }
+  for (ssa::Block *child : domTree.getChildren(block))
+    numberBlock(child, loads, domTree);
+  // Values from this block don't dominate its siblings.
+  for (const ValueKey &key : scope)
+    leaders.erase(key);
+}
+
+bool Gvn::numberPure(ssa::Instruction *instruction,
+                     std::vector<ValueKey> &scope) {
+  ssa::Block *block = instruction->parent;
+  if (ssa::Instruction *simpler = simplify(*instruction)) {
+    instruction->replaceAllUsesWith(simpler);
+    block->erase(instruction);
+    return true;
+  }
+  // Phis are only equivalent to phis in the same block.
+  ValueKey key = {
+      static_cast<int>(instruction->op),
+      instruction->op == ssa::Opcode::ArithOp
+          ? static_cast<int>(instruction->arithOp)
+          : -1,
+      instruction->value,
+      instruction->symbol ? instruction->symbol->id : -1,
+      instruction->op == ssa::Opcode::Phi ? block->id : -1,
+  };
+  std::vector<int> operands;
+  for (const ssa::Instruction *operand : instruction->operands)
+    operands.push_back(operand->id);
+  if (instruction->op == ssa::Opcode::ArithOp &&
+      isCommutative(instruction->arithOp))
+    std::sort(operands.begin(), operands.end());
+  key.insert(key.end(), operands.begin(), operands.end());
+  const auto iter = leaders.find(key);
+  if (iter != leaders.end()) {
+    instruction->replaceAllUsesWith(iter->second);
+    block->erase(instruction);
+    return true;
+  }
+  leaders.emplace(key, instruction);
+  scope.push_back(std::move(key));
+  return false;
+}
+
+void Gvn::numberLoad(ssa::Instruction *load, AvailableLoads &loads) {
+  ssa::Instruction *address = load->operands.front();
+  const auto iter = loads.find(address->id);
+  if (iter != loads.end() && iter->second.memType == load->memType) {
+    load->replaceAllUsesWith(iter->second.value);
+    load->parent->erase(load);
+    return;
+  }
+  loads.insert_or_assign(address->id,
+                         AvailableLoad{address, load, load->memType});
+}
+
+void Gvn::numberStore(ssa::Instruction *store, AvailableLoads &loads) {
+  ssa::Instruction *address = store->operands.at(0);
+  const int size = ir::getMemSize(store->memType);
+  for (auto iter = loads.begin(); iter != loads.end();) {
+    if (ssa::mayAlias(*iter->second.address,
+                      ir::getMemSize(iter->second.memType), *address, size))
+      iter = loads.erase(iter);
+    else
+      ++iter;
+  }
+  // Later loads of the same address get the stored value, unless it was cut
+  // down to fit.
+  if (store->memType == ir::MemType::Word)
+    loads.emplace(address->id, AvailableLoad{address, store->operands.at(1),
+                                              ir::MemType::Word});
+}
+
+ssa::Instruction *Gvn::simplify(ssa::Instruction &instruction) {
+  if (instruction.op == ssa::Opcode::Phi) {
+    ssa::Instruction *same = nullptr;
+    for (ssa::Instruction *operand : instruction.operands) {
+      if (operand == &instruction || operand == same)
+        continue;
+      if (same)
+        return nullptr;
+      same = operand;
+    }
+    return same;
+  }
+  if (instruction.op != ssa::Opcode::ArithOp)
+    return nullptr;
+  ssa::Instruction *lhs = instruction.operands.at(0);
+  ssa::Instruction *rhs = instruction.operands.at(1);
+  switch (instruction.arithOp) {
+  case ir::ArithOpKind::Add:
+    if (isConst(*rhs, 0))
+      return lhs;
+    if (isConst(*lhs, 0))
+      return rhs;
+    break;
+  case ir::ArithOpKind::Subtract:
+  case ir::ArithOpKind::ShiftLeft:
+  case ir::ArithOpKind::ShiftRight:
+    if (isConst(*rhs, 0))
+      return lhs;
+    break;
+  case ir::ArithOpKind::Multiply:
+    if (isConst(*rhs, 1))
+      return lhs;
+    if (isConst(*lhs, 1))
+      return rhs;
+    break;
+  case ir::ArithOpKind::Divide:
+    if (isConst(*rhs, 1))
+      return lhs;
+    break;
+  case ir::ArithOpKind::And:
+    if (lhs == rhs)
+      return lhs;
+    break;
+  case ir::ArithOpKind::MultiplyHigh:
+    break;
+  }
+  return nullptr;
+}
+
+} // namespace descartes
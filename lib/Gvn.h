@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Dominators.h>
+
+#include <map>
+
+namespace descartes {
+
+// Dominator based global value numbering. The function is walked down the
+// dominator tree with a scoped table of the pure values seen so far, so any
+// value that is recomputed where an identical one dominates it is replaced
+// with the dominating one.
+//
+// Loads are merged with a conservative memory model. Two accesses only differ
+// when they are the same base plus constant offsets that keep them apart or
+// different frame slots. Loads are only merged with loads of the same width. A
+// store of a whole word makes its value available to later loads of the same
+// address, while a narrower one only keeps some of it, and either forgets any
+// loads it may alias. Calls can write anywhere so they forget every load. A
+// block only inherits the loads of its immediate dominator if nothing on any
+// path between them writes to memory.
+class Gvn {
+public:
+  Gvn();
+  virtual ~Gvn() = default;
+  void run(ssa::Function &function);
+
+private:
+  // The address and value of a load, or of a store that can be forwarded.
+  struct AvailableLoad {
+    ssa::Instruction *address;
+    ssa::Instruction *value;
+    ir::MemType memType;
+  };
+  using AvailableLoads = std::map<int, AvailableLoad>;
+  using ValueKey = std::vector<int>;
+  void findClobberedBlocks(const ssa::DominatorTree &domTree);
+  void numberBlock(ssa::Block *block, AvailableLoads loads,
+                   const ssa::DominatorTree &domTree);
+  bool numberPure(ssa::Instruction *instruction, std::vector<ValueKey> &scope);
+  void numberLoad(ssa::Instruction *load, AvailableLoads &loads);
+  void numberStore(ssa::Instruction *store, AvailableLoads &loads);
+  ssa::Instruction *simplify(ssa::Instruction &instruction);
+  ssa::Function *function;
+  std::map<ValueKey, ssa::Instruction *> leaders;
+  std::vector<bool> clobberedBlocks;
+};
+
+} // namespace descartes
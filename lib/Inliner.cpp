@@ -0,0 +1,293 @@
+#include "Inliner.h"
+
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace descartes {
+
+namespace {
+
+// Callees up to this many instructions are inlined anywhere.
+constexpr size_t inlineThreshold = 30;
+// Every constant argument is worth this many instructions on top of that.
+constexpr size_t constantArgumentBonus = 8;
+// A callee with a single call site disappears once inlined so it only has to
+// fit in this.
+constexpr size_t singleCallSiteThreshold = 200;
+// Callers stop growing at this size.
+constexpr size_t callerSizeLimit = 2000;
+
+// A rough measure of the code a function turns into. The entry only holds
+// constants and slots, and jumps and phis mostly disappear when lowering.
+size_t getSize(const ssa::Function &function) {
+  size_t size = 0;
+  for (const auto &block : function.blocks) {
+    if (block.get() == function.getEntry())
+      continue;
+    for (const auto &instruction : block->instructions) {
+      if (instruction->op != ssa::Opcode::Phi &&
+          instruction->op != ssa::Opcode::Jump)
+        ++size;
+    }
+  }
+  return size;
+}
+
+// The callee's frame must not be needed, either because it has slots that
+// weren't promoted or because it hands its frame pointer to nested functions.
+bool needsFrame(const ssa::Function &function) {
+  const auto &instructions = function.getEntry()->instructions;
+  return std::any_of(
+      instructions.begin(), instructions.end(), [](const auto &instruction) {
+        return instruction->op == ssa::Opcode::Local ||
+               instruction->op == ssa::Opcode::Temp ||
+               (instruction->op == ssa::Opcode::FramePointer &&
+                !instruction->users.empty());
+      });
+}
+
+} // namespace
+
+Inliner::Inliner() : function(nullptr) {}
+
+void Inliner::run(std::vector<std::unique_ptr<ssa::Function>> &functions) {
+  const ssa::CallGraph callGraph(functions);
+  std::unordered_set<const ssa::Function *> calledFunctions;
+  for (const auto &callee : functions) {
+    if (!callGraph.getCallSites(callee.get()).empty())
+      calledFunctions.insert(callee.get());
+  }
+  for (const auto &component : callGraph.getComponents()) {
+    for (ssa::Function *caller : component) {
+      function = caller;
+      bool inlined = false, changed = true;
+      // Calls that come with an inlined body get their turn on the next pass.
+      while (changed) {
+        changed = false;
+        std::vector<ssa::Instruction *> calls;
+        for (const auto &block : caller->blocks) {
+          for (const auto &instruction : block->instructions) {
+            if (instruction->op == ssa::Opcode::Call)
+              calls.push_back(instruction.get());
+          }
+        }
+        for (ssa::Instruction *call : calls) {
+          const ssa::Function *callee = callGraph.getCallee(*call);
+          if (!callee || !shouldInline(*call, *callee, callGraph))
+            continue;
+          inlineCall(call, *callee);
+          inlined = changed = true;
+        }
+      }
+      if (inlined)
+        promoteFrameAccesses();
+    }
+  }
+  function = nullptr;
+  // Removing a function can leave the functions it called unused too.
+  bool removed = true;
+  while (removed) {
+    const ssa::CallGraph remaining(functions);
+    const auto iter = std::remove_if(
+        functions.begin(), functions.end(),
+        [&calledFunctions, &remaining](const auto &callee) {
+          return calledFunctions.count(callee.get()) &&
+                 remaining.getCallSites(callee.get()).empty();
+        });
+    removed = iter != functions.end();
+    functions.erase(iter, functions.end());
+  }
+}
+
+bool Inliner::shouldInline(const ssa::Instruction &call,
+                           const ssa::Function &callee,
+                           const ssa::CallGraph &callGraph) const {
+  if (callGraph.isRecursive(&callee) || needsFrame(callee))
+    return false;
+  const size_t size = getSize(callee);
+  if (getSize(*function) + size > callerSizeLimit)
+    return false;
+  if (callGraph.getCallSites(&callee).size() == 1)
+    return size <= singleCallSiteThreshold;
+  // The static link doesn't count since there's nothing to fold with it.
+  const auto constants = std::count_if(
+      call.operands.begin() + std::min<size_t>(1, call.operands.size()),
+      call.operands.end(), [](const ssa::Instruction *argument) {
+        return argument->op == ssa::Opcode::Const;
+      });
+  return size <= inlineThreshold + constants * constantArgumentBonus;
+}
+
+void Inliner::inlineCall(ssa::Instruction *call, const ssa::Function &callee) {
+  ssa::Block *block = call->parent;
+  ssa::Block *continuation = splitAfter(call);
+  const size_t blockCount = function->blocks.size();
+  std::unordered_map<const ssa::Instruction *, ssa::Instruction *> values;
+  std::unordered_map<const ssa::Block *, ssa::Block *> blocks;
+  // The entry of the callee only holds values that are available before the
+  // call.
+  const ssa::Block *calleeEntry = callee.getEntry();
+  blocks.emplace(calleeEntry, block);
+  for (const auto &instruction : calleeEntry->instructions) {
+    if (instruction->isTerminator() ||
+        instruction->op == ssa::Opcode::FramePointer)
+      continue;
+    if (instruction->op == ssa::Opcode::Param) {
+      const auto index = static_cast<size_t>(instruction->value);
+      assert(index < call->operands.size());
+      values.emplace(instruction.get(), call->operands.at(index));
+      continue;
+    }
+    assert(instruction->operands.empty());
+    auto copy = function->makeInstruction(instruction->op);
+    copy->value = instruction->value;
+    copy->symbol = instruction->symbol;
+    values.emplace(instruction.get(), block->append(std::move(copy)));
+  }
+  block->append(function->makeInstruction(ssa::Opcode::Jump));
+  for (const auto &calleeBlock : callee.blocks) {
+    if (calleeBlock.get() != calleeEntry)
+      blocks.emplace(calleeBlock.get(), function->makeBlock());
+  }
+  // Copy the instructions first and fill in their operands once every value
+  // has its copy.
+  std::vector<ssa::Block *> returns;
+  std::vector<ssa::Instruction *> returnValues;
+  for (const auto &calleeBlock : callee.blocks) {
+    if (calleeBlock.get() == calleeEntry)
+      continue;
+    ssa::Block *copyBlock = blocks.at(calleeBlock.get());
+    for (const auto &instruction : calleeBlock->instructions) {
+      if (instruction->op == ssa::Opcode::Return) {
+        returns.push_back(copyBlock);
+        if (!instruction->operands.empty())
+          returnValues.push_back(instruction->operands.front());
+        copyBlock->append(function->makeInstruction(ssa::Opcode::Jump));
+        continue;
+      }
+      auto copy = function->makeInstruction(instruction->op);
+      copy->value = instruction->value;
+      copy->symbol = instruction->symbol;
+      copy->arithOp = instruction->arithOp;
+      copy->relOp = instruction->relOp;
+      copy->memType = instruction->memType;
+      values.emplace(instruction.get(), copyBlock->append(std::move(copy)));
+    }
+    for (const ssa::Block *pred : calleeBlock->preds)
+      copyBlock->preds.push_back(blocks.at(pred));
+    for (const ssa::Block *succ : calleeBlock->succs)
+      copyBlock->succs.push_back(blocks.at(succ));
+  }
+  for (const auto &calleeBlock : callee.blocks) {
+    if (calleeBlock.get() == calleeEntry)
+      continue;
+    for (const auto &instruction : calleeBlock->instructions) {
+      if (instruction->op == ssa::Opcode::Return)
+        continue;
+      ssa::Instruction *copy = values.at(instruction.get());
+      for (const ssa::Instruction *operand : instruction->operands)
+        copy->addOperand(values.at(operand));
+    }
+  }
+  for (const ssa::Block *succ : calleeEntry->succs)
+    block->succs.push_back(blocks.at(succ));
+  for (ssa::Block *returnBlock : returns)
+    function->addEdge(returnBlock, continuation);
+  // Several returns merge their values in the continuation.
+  if (!call->users.empty()) {
+    assert(!returnValues.empty() && returnValues.size() == returns.size());
+    ssa::Instruction *result;
+    if (returnValues.size() == 1) {
+      result = values.at(returnValues.front());
+    } else {
+      auto phi = function->makeInstruction(ssa::Opcode::Phi);
+      for (const ssa::Instruction *returnValue : returnValues)
+        phi->addOperand(values.at(returnValue));
+      result = continuation->insertPhi(std::move(phi));
+    }
+    call->replaceAllUsesWith(result);
+  }
+  block->erase(call);
+  // Lay the body out between the call and its continuation.
+  auto &functionBlocks = function->blocks;
+  const auto blockIter = std::find_if(
+      functionBlocks.begin(), functionBlocks.end(),
+      [block](const ssa::BlockPtr &other) { return other.get() == block; });
+  std::rotate(blockIter + 1, functionBlocks.begin() + blockCount,
+              functionBlocks.end());
+}
+
+ssa::Block *Inliner::splitAfter(ssa::Instruction *call) {
+  ssa::Block *block = call->parent;
+  ssa::Block *continuation = function->makeBlock();
+  std::vector<ssa::Instruction *> moving;
+  for (auto iter = std::next(call->position); iter != block->instructions.end();
+       ++iter)
+    moving.push_back(iter->get());
+  for (ssa::Instruction *instruction : moving)
+    continuation->append(block->remove(instruction));
+  continuation->succs = std::move(block->succs);
+  block->succs.clear();
+  for (ssa::Block *succ : continuation->succs)
+    std::replace(succ->preds.begin(), succ->preds.end(), block, continuation);
+  return continuation;
+}
+
+void Inliner::promoteFrameAccesses() {
+  ssa::Block *entry = function->getEntry();
+  const auto framePointerIter = std::find_if(
+      entry->instructions.begin(), entry->instructions.end(),
+      [](const ssa::InstructionPtr &instruction) {
+        return instruction->op == ssa::Opcode::FramePointer;
+      });
+  if (framePointerIter == entry->instructions.end())
+    return;
+  ssa::Instruction *framePointer = framePointerIter->get();
+  const auto isLocal = [this](int offset) {
+    const auto &locals = function->level.locals;
+    return std::any_of(
+        locals.begin(), locals.end(),
+        [offset](const ir::Access &local) { return local.offset == offset; });
+  };
+  const std::vector<ssa::Instruction *> users = framePointer->users;
+  for (ssa::Instruction *user : users) {
+    if (std::find(framePointer->users.begin(), framePointer->users.end(),
+                  user) == framePointer->users.end())
+      continue;
+    if ((user->op == ssa::Opcode::Load || user->op == ssa::Opcode::Store) &&
+        user->operands.front() == framePointer && isLocal(0)) {
+      user->setOperand(0, getLocal(0));
+      continue;
+    }
+    if (user->op != ssa::Opcode::ArithOp ||
+        user->arithOp != ir::ArithOpKind::Add)
+      continue;
+    const ssa::Instruction *offset = user->operands.at(0) == framePointer
+                                         ? user->operands.at(1)
+                                         : user->operands.at(0);
+    if (offset->op != ssa::Opcode::Const || !isLocal(offset->value))
+      continue;
+    user->replaceAllUsesWith(getLocal(offset->value));
+    user->parent->erase(user);
+  }
+  // With nothing left that could reach the frame the slots can be promoted.
+  if (framePointer->users.empty()) {
+    function->level.escapes.clear();
+    mem2Reg.run(*function);
+  }
+}
+
+ssa::Instruction *Inliner::getLocal(int offset) {
+  ssa::Block *entry = function->getEntry();
+  for (const auto &instruction : entry->instructions) {
+    if (instruction->op == ssa::Opcode::Local && instruction->value == offset)
+      return instruction.get();
+  }
+  auto local = function->makeInstruction(ssa::Opcode::Local);
+  local->value = offset;
+  return entry->insertBefore(entry->getTerminator(), std::move(local));
+}
+
+} // namespace descartes
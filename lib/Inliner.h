@@ -0,0 +1,41 @@
+#pragma once
+
+#include <CallGraph.h>
+#include <Mem2Reg.h>
+
+namespace descartes {
+
+// Replaces calls to small functions with a copy of their body. Functions are
+// visited callees first so that a callee has already had its own calls
+// inlined, and calls to functions that can reach themselves are left alone so
+// that recursion is never unrolled.
+//
+// A call is inlined when the callee is cheap enough or has a single caller,
+// with constant arguments making it cheaper since they fold away afterwards.
+// Only callees that don't need a frame qualify, which rules out any that pass
+// their frame to nested functions. The arguments, including the static link,
+// take the place of the parameters so variables of an outer level that the
+// callee reaches through the static link are reached from the caller instead.
+// Those that turn out to be the caller's own slots are promoted once nothing
+// else needs its frame, and functions whose calls were all inlined are
+// removed.
+class Inliner {
+public:
+  Inliner();
+  virtual ~Inliner() = default;
+  void run(std::vector<std::unique_ptr<ssa::Function>> &functions);
+
+private:
+  bool shouldInline(const ssa::Instruction &call, const ssa::Function &callee,
+                    const ssa::CallGraph &callGraph) const;
+  void inlineCall(ssa::Instruction *call, const ssa::Function &callee);
+  ssa::Block *splitAfter(ssa::Instruction *call);
+  // Accesses to the caller's frame through a static link become accesses to
+  // its slots.
+  void promoteFrameAccesses();
+  ssa::Instruction *getLocal(int offset);
+  ssa::Function *function;
+  Mem2Reg mem2Reg;
+};
+
+} // namespace descartes
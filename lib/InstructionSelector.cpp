@@ -0,0 +1,478 @@
+#include "InstructionSelector.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace descartes {
+
+namespace {
+
+const ir::Const *getConst(const ir::Expr &expr) {
+  if (expr.getKind() != ir::ExprKind::Const)
+    return nullptr;
+  return static_cast<const ir::Const *>(&expr);
+}
+
+bool isFramePointer(const ir::Expr &expr) {
+  return expr.getKind() == ir::ExprKind::Temp &&
+         static_cast<const ir::Temp &>(expr).id == ir::framePointer;
+}
+
+x86::Opcode toOpcode(ir::ArithOpKind kind) {
+  switch (kind) {
+  case ir::ArithOpKind::Add:
+    return x86::Opcode::Add;
+  case ir::ArithOpKind::Subtract:
+    return x86::Opcode::Sub;
+  case ir::ArithOpKind::Multiply:
+  case ir::ArithOpKind::MultiplyHigh:
+    return x86::Opcode::Imul;
+  case ir::ArithOpKind::ShiftLeft:
+    return x86::Opcode::Shl;
+  case ir::ArithOpKind::ShiftRight:
+    return x86::Opcode::Sar;
+  case ir::ArithOpKind::And:
+    return x86::Opcode::And;
+  case ir::ArithOpKind::Divide:
+    break;
+  }
+  assert(!"Division has its own pattern");
+  return x86::Opcode::Idiv;
+}
+
+// Displacements are 32 bits and the frame pointer adds one of its own. Sums of
+// constants can go past that since values are whole words.
+bool fitsDisplacement(int64_t displacement) {
+  return displacement + x86::frameBase >= std::numeric_limits<int>::min() &&
+         displacement <= std::numeric_limits<int>::max();
+}
+
+// Matches an index multiplied by a scale that addressing can apply, folding
+// a constant added to or subtracted from the index into `displacement`.
+bool matchScaledIndex(const ir::Expr &expr, const ir::Expr *&index, int &scale,
+                      int64_t &displacement) {
+  if (expr.getKind() != ir::ExprKind::ArithOp)
+    return false;
+  const auto &arithOp = static_cast<const ir::ArithOp &>(expr);
+  const auto *rhsConst = getConst(*arithOp.rhs);
+  if (!rhsConst)
+    return false;
+  if (arithOp.op == ir::ArithOpKind::Multiply &&
+      (rhsConst->value == 1 || rhsConst->value == 2 || rhsConst->value == 4 ||
+       rhsConst->value == 8))
+    scale = rhsConst->value;
+  else if (arithOp.op == ir::ArithOpKind::ShiftLeft && rhsConst->value >= 0 &&
+           rhsConst->value <= 3)
+    scale = 1 << rhsConst->value;
+  else
+    return false;
+  index = arithOp.lhs.get();
+  displacement = 0;
+  if (index->getKind() == ir::ExprKind::ArithOp) {
+    const auto &offset = static_cast<const ir::ArithOp &>(*index);
+    const auto *offsetConst = getConst(*offset.rhs);
+    std::optional<int64_t> scaled;
+    if (offsetConst && offset.op == ir::ArithOpKind::Add)
+      scaled = static_cast<int64_t>(offsetConst->value) * scale;
+    else if (offsetConst && offset.op == ir::ArithOpKind::Subtract)
+      scaled = -static_cast<int64_t>(offsetConst->value) * scale;
+    if (scaled && fitsDisplacement(*scaled)) {
+      displacement = *scaled;
+      index = offset.lhs.get();
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+InstructionSelector::InstructionSelector(SymbolTable &symbols)
+    : symbols(symbols), function(nullptr) {}
+
+x86::Function InstructionSelector::select(const ir::Fragment &frag) {
+  const ir::Level &level = *frag.first;
+  x86::Function result(level);
+  function = &result;
+  tempRegisters.clear();
+  emit(x86::Opcode::Label, {x86::Operand::makeLabel(level.name)});
+  // The caller leaves the arguments past the sixth above the return address
+  // and the saved %rbp.
+  const auto &formals = level.formals;
+  for (size_t i = 0; i < formals.size(); ++i) {
+    const x86::Operand slot = x86::Operand::makeMemory(
+        x86::rbp, x86::frameBase + formals.at(i).offset);
+    if (i < x86::argumentRegisterCount) {
+      emit(x86::Opcode::Mov,
+           {x86::Operand::makeRegister(x86::argumentRegisters[i]), slot});
+      continue;
+    }
+    const int reg = function->makeRegister();
+    const int offset = 16 + (i - x86::argumentRegisterCount) * ir::wordSize;
+    emit(x86::Opcode::Mov, {x86::Operand::makeMemory(x86::rbp, offset),
+                            x86::Operand::makeRegister(reg)});
+    emit(x86::Opcode::Mov, {x86::Operand::makeRegister(reg), slot});
+  }
+  assert(frag.second->getKind() == ir::StatementKind::Sequence);
+  for (const auto &statement :
+       static_cast<const ir::Sequence &>(*frag.second).statements)
+    selectStatement(*statement);
+  // Everything falls through to the end of the body.
+  const auto returnValue = tempRegisters.find(ir::returnValue);
+  const bool returnsValue = returnValue != tempRegisters.end();
+  if (returnsValue)
+    emit(x86::Opcode::Mov, {x86::Operand::makeRegister(returnValue->second),
+                            x86::Operand::makeRegister(x86::rax)});
+  emit(x86::Opcode::Ret, {});
+  result.instructions.back().returnsValue = returnsValue;
+  function = nullptr;
+  return result;
+}
+
+void InstructionSelector::selectStatement(const ir::Statement &statement) {
+  switch (statement.getKind()) {
+  case ir::StatementKind::Label:
+    emit(x86::Opcode::Label,
+         {x86::Operand::makeLabel(
+             static_cast<const ir::Label &>(statement).label)});
+    break;
+  case ir::StatementKind::Jump:
+    emit(x86::Opcode::Jmp,
+         {x86::Operand::makeLabel(
+             static_cast<const ir::Jump &>(statement).jumpLabel)});
+    break;
+  case ir::StatementKind::CondJump:
+    selectCondJump(static_cast<const ir::CondJump &>(statement));
+    break;
+  case ir::StatementKind::JumpTable: {
+    const auto &jumpTable = static_cast<const ir::JumpTable &>(statement);
+    const int index = selectRegister(*jumpTable.index);
+    const Symbol label = symbols.makeUnique("T");
+    const int table = function->makeRegister();
+    emit(x86::Opcode::Lea, {x86::Operand::makeStatic(label, 0),
+                            x86::Operand::makeRegister(table)});
+    emit(x86::Opcode::Jmp,
+         {x86::Operand::makeMemory(table, index, ir::wordSize)});
+    function->instructions.back().targets = jumpTable.labels;
+    function->jumpTables.push_back({label, jumpTable.labels});
+    break;
+  }
+  case ir::StatementKind::Move: {
+    const auto &move = static_cast<const ir::Move &>(statement);
+    if (move.dst->getKind() == ir::ExprKind::Temp) {
+      const int temp = static_cast<const ir::Temp &>(*move.dst).id;
+      assert(temp != ir::framePointer);
+      const int dst = getTempRegister(temp);
+      if (move.src->getKind() == ir::ExprKind::Call) {
+        selectCall(static_cast<const ir::Call &>(*move.src));
+        emit(x86::Opcode::Mov, {x86::Operand::makeRegister(x86::rax),
+                                x86::Operand::makeRegister(dst)});
+        break;
+      }
+      emit(x86::Opcode::Mov,
+           {selectOperand(*move.src), x86::Operand::makeRegister(dst)});
+      break;
+    }
+    assert(move.dst->getKind() == ir::ExprKind::Mem);
+    const auto &dst = static_cast<const ir::Mem &>(*move.dst);
+    const int size = ir::getMemSize(dst.type);
+    // Only one side of a `mov` can be in memory, and narrow stores take the
+    // low bytes of a register.
+    x86::Operand src = selectOperand(*move.src);
+    if (src.kind == x86::OperandKind::Memory ||
+        (size != ir::wordSize && src.kind == x86::OperandKind::Immediate)) {
+      const int reg = function->makeRegister();
+      emit(x86::Opcode::Mov, {src, x86::Operand::makeRegister(reg)});
+      src = x86::Operand::makeRegister(reg);
+    }
+    emit(x86::Opcode::Mov, {src, selectAddress(*dst.expr)});
+    function->instructions.back().size = size;
+    break;
+  }
+  case ir::StatementKind::CallStatement:
+    selectCall(static_cast<const ir::Call &>(
+        *static_cast<const ir::CallStatement &>(statement).call));
+    break;
+  case ir::StatementKind::Sequence:
+    for (const auto &s :
+         static_cast<const ir::Sequence &>(statement).statements)
+      selectStatement(*s);
+    break;
+  }
+}
+
+void InstructionSelector::selectCondJump(const ir::CondJump &condJump) {
+  x86::Condition condition = x86::toCondition(condJump.op);
+  const ir::Expr *lhs = condJump.lhs.get(), *rhs = condJump.rhs.get();
+  // `cmp` only takes an immediate as the first operand.
+  if (getConst(*lhs) && !getConst(*rhs)) {
+    std::swap(lhs, rhs);
+    condition = x86::swapCondition(condition);
+  }
+  x86::Operand right = selectOperand(*rhs);
+  x86::Operand left = selectOperand(*lhs);
+  if (left.kind == x86::OperandKind::Immediate ||
+      (left.kind == x86::OperandKind::Memory &&
+       right.kind == x86::OperandKind::Memory)) {
+    const int reg = function->makeRegister();
+    emit(x86::Opcode::Mov, {left, x86::Operand::makeRegister(reg)});
+    left = x86::Operand::makeRegister(reg);
+  }
+  emit(x86::Opcode::Cmp, {right, left});
+  emit(x86::Opcode::Jcc, {x86::Operand::makeLabel(condJump.thenLabel)});
+  function->instructions.back().condition = condition;
+}
+
+void InstructionSelector::selectCall(const ir::Call &call) {
+  std::vector<x86::Operand> args;
+  for (const auto &arg : call.args) {
+    x86::Operand operand = selectOperand(*arg);
+    // Loads happen before any argument register is written.
+    if (operand.kind == x86::OperandKind::Memory) {
+      const int reg = function->makeRegister();
+      emit(x86::Opcode::Mov, {operand, x86::Operand::makeRegister(reg)});
+      operand = x86::Operand::makeRegister(reg);
+    }
+    args.push_back(operand);
+  }
+  // The stack has to be 16 byte aligned at the call.
+  const size_t stackArgs =
+      args.size() > x86::argumentRegisterCount
+          ? args.size() - x86::argumentRegisterCount
+          : 0;
+  const int padding = stackArgs % 2 == 0 ? 0 : ir::wordSize;
+  if (padding > 0)
+    emit(x86::Opcode::Sub, {x86::Operand::makeImmediate(padding),
+                            x86::Operand::makeRegister(x86::rsp)});
+  for (size_t i = args.size(); i > x86::argumentRegisterCount; --i)
+    emit(x86::Opcode::Push, {args.at(i - 1)});
+  const size_t registerArgs = std::min(args.size(), x86::argumentRegisterCount);
+  for (size_t i = 0; i < registerArgs; ++i)
+    emit(x86::Opcode::Mov,
+         {args.at(i), x86::Operand::makeRegister(x86::argumentRegisters[i])});
+  emit(x86::Opcode::Call, {x86::Operand::makeLabel(call.functionName)});
+  function->instructions.back().argumentCount = registerArgs;
+  const int popped = stackArgs * ir::wordSize + padding;
+  if (popped > 0)
+    emit(x86::Opcode::Add, {x86::Operand::makeImmediate(popped),
+                            x86::Operand::makeRegister(x86::rsp)});
+}
+
+x86::Operand InstructionSelector::selectOperand(const ir::Expr &expr) {
+  if (const auto *constant = getConst(expr))
+    return x86::Operand::makeImmediate(constant->value);
+  if (expr.getKind() != ir::ExprKind::Mem)
+    return x86::Operand::makeRegister(selectRegister(expr));
+  const auto &mem = static_cast<const ir::Mem &>(expr);
+  const x86::Operand address = selectAddress(*mem.expr);
+  if (mem.type == ir::MemType::Word)
+    return address;
+  // Narrow values are widened into a register before anything uses them.
+  const int reg = function->makeRegister();
+  emit(ir::isSignExtended(mem.type) ? x86::Opcode::Movsx : x86::Opcode::Movzx,
+       {address, x86::Operand::makeRegister(reg)});
+  function->instructions.back().size = ir::getMemSize(mem.type);
+  return x86::Operand::makeRegister(reg);
+}
+
+int InstructionSelector::selectRegister(const ir::Expr &expr) {
+  if (expr.getKind() == ir::ExprKind::Temp && !isFramePointer(expr))
+    return getTempRegister(static_cast<const ir::Temp &>(expr).id);
+  return selectCopy(expr);
+}
+
+int InstructionSelector::selectCopy(const ir::Expr &expr) {
+  const int result = function->makeRegister();
+  const x86::Operand dst = x86::Operand::makeRegister(result);
+  switch (expr.getKind()) {
+  case ir::ExprKind::Const:
+  case ir::ExprKind::Mem:
+    emit(x86::Opcode::Mov, {selectOperand(expr), dst});
+    return result;
+  case ir::ExprKind::Name:
+    emit(x86::Opcode::Lea,
+         {x86::Operand::makeStatic(static_cast<const ir::Name &>(expr).value,
+                                   0),
+          dst});
+    return result;
+  case ir::ExprKind::Temp:
+    if (isFramePointer(expr)) {
+      emit(x86::Opcode::Lea,
+           {x86::Operand::makeMemory(x86::rbp, x86::frameBase), dst});
+    } else {
+      emit(x86::Opcode::Mov, {selectOperand(expr), dst});
+    }
+    return result;
+  case ir::ExprKind::ArithOp:
+    break;
+  case ir::ExprKind::Call:
+  case ir::ExprKind::CondExpr:
+    assert(!"Expression isn't canonical");
+    return result;
+  }
+  const auto &arithOp = static_cast<const ir::ArithOp &>(expr);
+  const auto *lhsConst = getConst(*arithOp.lhs);
+  const auto *rhsConst = getConst(*arithOp.rhs);
+  switch (arithOp.op) {
+  case ir::ArithOpKind::Add:
+    // Sums are addresses often enough that `lea` is the natural fit and it
+    // leaves both operands alone.
+    if (lhsConst || rhsConst) {
+      emit(x86::Opcode::Lea, {selectAddress(expr), dst});
+      return result;
+    }
+    emit(x86::Opcode::Lea,
+         {x86::Operand::makeMemory(selectRegister(*arithOp.lhs),
+                                   selectRegister(*arithOp.rhs), 1),
+          dst});
+    return result;
+  case ir::ArithOpKind::Multiply:
+    if (lhsConst || rhsConst) {
+      const ir::Expr &other = lhsConst ? *arithOp.rhs : *arithOp.lhs;
+      const int factor = lhsConst ? lhsConst->value : rhsConst->value;
+      x86::Operand src = selectOperand(other);
+      if (src.kind == x86::OperandKind::Immediate)
+        src = x86::Operand::makeRegister(selectCopy(other));
+      emit(x86::Opcode::Imul, {x86::Operand::makeImmediate(factor), src, dst});
+    } else {
+      const int lhs = selectRegister(*arithOp.lhs);
+      const x86::Operand rhs = selectOperand(*arithOp.rhs);
+      emit(x86::Opcode::Mov, {x86::Operand::makeRegister(lhs), dst});
+      emit(x86::Opcode::Imul, {rhs, dst});
+    }
+    return result;
+  case ir::ArithOpKind::MultiplyHigh: {
+    // The one operand `imul` leaves the upper half of the product in %rdx.
+    const x86::Operand lhs = selectOperand(*arithOp.lhs);
+    x86::Operand rhs = selectOperand(*arithOp.rhs);
+    if (rhs.kind == x86::OperandKind::Immediate)
+      rhs = x86::Operand::makeRegister(selectCopy(*arithOp.rhs));
+    emit(x86::Opcode::Mov, {lhs, x86::Operand::makeRegister(x86::rax)});
+    emit(x86::Opcode::Imul, {rhs});
+    emit(x86::Opcode::Mov, {x86::Operand::makeRegister(x86::rdx), dst});
+    return result;
+  }
+  case ir::ArithOpKind::Divide: {
+    // `idiv` divides %rdx:%rax and leaves the quotient in %rax. Both operands
+    // are ready before either register is touched.
+    const x86::Operand dividend = selectOperand(*arithOp.lhs);
+    x86::Operand divisor = selectOperand(*arithOp.rhs);
+    if (divisor.kind == x86::OperandKind::Immediate)
+      divisor = x86::Operand::makeRegister(selectCopy(*arithOp.rhs));
+    emit(x86::Opcode::Mov, {dividend, x86::Operand::makeRegister(x86::rax)});
+    emit(x86::Opcode::Cqo, {});
+    emit(x86::Opcode::Idiv, {divisor});
+    emit(x86::Opcode::Mov, {x86::Operand::makeRegister(x86::rax), dst});
+    return result;
+  }
+  default:
+    break;
+  }
+  // Everything else works on a copy of the left operand. Shifts by a variable
+  // amount take it in %cl.
+  const x86::Operand lhs = selectOperand(*arithOp.lhs);
+  x86::Operand rhs = selectOperand(*arithOp.rhs);
+  const bool isShift = arithOp.op == ir::ArithOpKind::ShiftLeft ||
+                       arithOp.op == ir::ArithOpKind::ShiftRight;
+  emit(x86::Opcode::Mov, {lhs, dst});
+  if (isShift && !rhsConst) {
+    emit(x86::Opcode::Mov, {rhs, x86::Operand::makeRegister(x86::rcx)});
+    rhs = x86::Operand::makeRegister(x86::rcx);
+  }
+  emit(toOpcode(arithOp.op), {rhs, dst});
+  return result;
+}
+
+x86::Operand InstructionSelector::selectAddress(const ir::Expr &address) {
+  int64_t displacement = 0;
+  const ir::Expr *base = &address;
+  // Constant offsets fold into the displacement for as long as it fits.
+  // Whatever is left over is computed into the base.
+  const auto stripConstants = [&displacement, &base]() {
+    while (base->getKind() == ir::ExprKind::ArithOp) {
+      const auto &arithOp = static_cast<const ir::ArithOp &>(*base);
+      const auto *lhsConst = getConst(*arithOp.lhs);
+      const auto *rhsConst = getConst(*arithOp.rhs);
+      int64_t next = displacement;
+      const ir::Expr *rest = nullptr;
+      if (arithOp.op == ir::ArithOpKind::Add && rhsConst) {
+        next += rhsConst->value;
+        rest = arithOp.lhs.get();
+      } else if (arithOp.op == ir::ArithOpKind::Add && lhsConst) {
+        next += lhsConst->value;
+        rest = arithOp.rhs.get();
+      } else if (arithOp.op == ir::ArithOpKind::Subtract && rhsConst) {
+        next -= rhsConst->value;
+        rest = arithOp.lhs.get();
+      }
+      if (!rest || !fitsDisplacement(next))
+        break;
+      displacement = next;
+      base = rest;
+    }
+  };
+  stripConstants();
+  // Array elements are a base plus a scaled index, which addressing does
+  // without any arithmetic of its own.
+  const ir::Expr *index = nullptr;
+  int scale = 1;
+  if (base->getKind() == ir::ExprKind::ArithOp &&
+      static_cast<const ir::ArithOp &>(*base).op == ir::ArithOpKind::Add) {
+    const auto &sum = static_cast<const ir::ArithOp &>(*base);
+    int64_t indexDisplacement = 0;
+    const ir::Expr *sumBase = nullptr;
+    if (matchScaledIndex(*sum.rhs, index, scale, indexDisplacement))
+      sumBase = sum.lhs.get();
+    else if (matchScaledIndex(*sum.lhs, index, scale, indexDisplacement))
+      sumBase = sum.rhs.get();
+    if (sumBase && fitsDisplacement(displacement + indexDisplacement)) {
+      base = sumBase;
+      displacement += indexDisplacement;
+      stripConstants();
+    } else {
+      index = nullptr;
+      scale = 1;
+    }
+  }
+  const int offset = static_cast<int>(displacement);
+  if (!index) {
+    if (isFramePointer(*base))
+      return x86::Operand::makeMemory(x86::rbp, x86::frameBase + offset);
+    if (base->getKind() == ir::ExprKind::Name)
+      return x86::Operand::makeStatic(
+          static_cast<const ir::Name &>(*base).value, offset);
+    return x86::Operand::makeMemory(selectRegister(*base), offset);
+  }
+  const int indexRegister = selectRegister(*index);
+  // The frame pointer doesn't take a register so the element can be addressed
+  // directly. Anything else would need two registers in a single operand,
+  // which is more than spilling can cope with, so the base and index are
+  // added up front.
+  if (isFramePointer(*base)) {
+    x86::Operand operand =
+        x86::Operand::makeMemory(x86::rbp, indexRegister, scale);
+    operand.value = x86::frameBase + offset;
+    return operand;
+  }
+  const int sum = function->makeRegister();
+  emit(x86::Opcode::Lea,
+       {x86::Operand::makeMemory(selectRegister(*base), indexRegister, scale),
+        x86::Operand::makeRegister(sum)});
+  return x86::Operand::makeMemory(sum, offset);
+}
+
+int InstructionSelector::getTempRegister(int temp) {
+  const auto iter = tempRegisters.find(temp);
+  if (iter != tempRegisters.end())
+    return iter->second;
+  const int reg = function->makeRegister();
+  tempRegisters.emplace(temp, reg);
+  return reg;
+}
+
+void InstructionSelector::emit(x86::Opcode op,
+                               std::vector<x86::Operand> operands) {
+  function->instructions.emplace_back(op, std::move(operands));
+}
+
+} // namespace descartes
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <SymbolTable.h>
+#include <X86.h>
+
+#include <unordered_map>
+
+namespace descartes {
+
+// Tiles the canonical IR of a fragment with x86-64 instructions by maximal
+// munch: each node takes the largest instruction pattern that matches at it
+// and its children are tiled the same way. Frame slots, static data and
+// constant offsets from either fold into the addressing mode of the
+// instruction that uses them, address arithmetic goes through `lea`, and a
+// `CondJump` becomes a compare followed by a conditional jump since the else
+// label always comes next.
+//
+// Every IR temporary gets a virtual register. Arguments arrive in registers
+// or above the return address and are copied into the frame slots of the
+// formals on entry, which is where the rest of the backend expects them.
+class InstructionSelector {
+public:
+  explicit InstructionSelector(SymbolTable &symbols);
+  virtual ~InstructionSelector() = default;
+  x86::Function select(const ir::Fragment &frag);
+
+private:
+  void selectStatement(const ir::Statement &statement);
+  void selectCondJump(const ir::CondJump &condJump);
+  void selectCall(const ir::Call &call);
+  // The value of the expression as an immediate, a memory operand or a
+  // register, whichever fits without extra instructions.
+  x86::Operand selectOperand(const ir::Expr &expr);
+  // The value of the expression in a register. The register might belong to an
+  // IR temporary so it mustn't be modified.
+  int selectRegister(const ir::Expr &expr);
+  // A register holding the value of the expression that can be modified.
+  int selectCopy(const ir::Expr &expr);
+  x86::Operand selectAddress(const ir::Expr &address);
+  int getTempRegister(int temp);
+  void emit(x86::Opcode op, std::vector<x86::Operand> operands);
+  SymbolTable &symbols;
+  x86::Function *function;
+  std::unordered_map<int, int> tempRegisters;
+};
+
+} // namespace descartes
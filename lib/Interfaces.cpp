@@ -182,4 +182,12 @@ SemanticError::operator std::string() const {
   return std::runtime_error::what();
 }
 
+JitError::operator std::string() const { return std::runtime_error::what(); }
+
+InterpreterError::operator std::string() const {
+  return std::runtime_error::what();
+}
+
+ImageError::operator std::string() const { return std::runtime_error::what(); }
+
 } // namespace descartes
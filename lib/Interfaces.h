@@ -123,4 +123,29 @@ public:
   operator std::string() const;
 };
 
+class JitError : public std::runtime_error {
+public:
+  template <typename T>
+  explicit JitError(T &&msg) : std::runtime_error(std::forward<T>(msg)) {}
+  virtual ~JitError() = default;
+  operator std::string() const;
+};
+
+class InterpreterError : public std::runtime_error {
+public:
+  template <typename T>
+  explicit InterpreterError(T &&msg)
+      : std::runtime_error(std::forward<T>(msg)) {}
+  virtual ~InterpreterError() = default;
+  operator std::string() const;
+};
+
+class ImageError : public std::runtime_error {
+public:
+  template <typename T>
+  explicit ImageError(T &&msg) : std::runtime_error(std::forward<T>(msg)) {}
+  virtual ~ImageError() = default;
+  operator std::string() const;
+};
+
 } // namespace descartes
@@ -0,0 +1,435 @@
+#include "Interpreter.h"
+
+#include <Interfaces.h>
+#include <Runtime.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#if defined(__GNUC__)
+#define DESCARTES_COMPUTED_GOTO
+#endif
+
+namespace descartes {
+
+namespace {
+
+// Enough for the same depth of recursion as a native stack of 8MB. It's left
+// uninitialised like a native stack so that starting up doesn't touch every
+// page of it.
+const size_t stackSize = 1 << 20;
+
+// Integers wrap like they do in native code.
+int64_t add(int64_t lhs, int64_t rhs) {
+  return static_cast<uint64_t>(lhs) + static_cast<uint64_t>(rhs);
+}
+
+int64_t subtract(int64_t lhs, int64_t rhs) {
+  return static_cast<uint64_t>(lhs) - static_cast<uint64_t>(rhs);
+}
+
+int64_t multiply(int64_t lhs, int64_t rhs) {
+  return static_cast<uint64_t>(lhs) * static_cast<uint64_t>(rhs);
+}
+
+int64_t divide(int64_t lhs, int64_t rhs) {
+  if (rhs == 0)
+    throw InterpreterError("Division by zero");
+  if (rhs == -1)
+    return subtract(0, lhs);
+  return lhs / rhs;
+}
+
+int64_t shiftLeft(int64_t lhs, int64_t rhs) {
+  return static_cast<uint64_t>(lhs) << (rhs & 63);
+}
+
+int64_t shiftRight(int64_t lhs, int64_t rhs) { return lhs >> (rhs & 63); }
+
+int64_t bitwiseAnd(int64_t lhs, int64_t rhs) { return lhs & rhs; }
+
+int64_t multiplyHigh(int64_t lhs, int64_t rhs) {
+  return static_cast<int64_t>((static_cast<__int128>(lhs) * rhs) >> 64);
+}
+
+const size_t nativeArgumentCount = 6;
+
+int64_t callNative(void *entry, const int64_t *args, size_t count) {
+  using Arg = int64_t;
+  switch (count) {
+  case 0:
+    return reinterpret_cast<Arg (*)()>(entry)();
+  case 1:
+    return reinterpret_cast<Arg (*)(Arg)>(entry)(args[0]);
+  case 2:
+    return reinterpret_cast<Arg (*)(Arg, Arg)>(entry)(args[0], args[1]);
+  case 3:
+    return reinterpret_cast<Arg (*)(Arg, Arg, Arg)>(entry)(args[0], args[1],
+                                                           args[2]);
+  case 4:
+    return reinterpret_cast<Arg (*)(Arg, Arg, Arg, Arg)>(entry)(
+        args[0], args[1], args[2], args[3]);
+  case 5:
+    return reinterpret_cast<Arg (*)(Arg, Arg, Arg, Arg, Arg)>(entry)(
+        args[0], args[1], args[2], args[3], args[4]);
+  default:
+    assert(count == nativeArgumentCount);
+    return reinterpret_cast<Arg (*)(Arg, Arg, Arg, Arg, Arg, Arg)>(entry)(
+        args[0], args[1], args[2], args[3], args[4], args[5]);
+  }
+}
+
+} // namespace
+
+Interpreter::Interpreter(const bytecode::Module &module)
+    : module(module), stack(new int64_t[stackSize]),
+      nativeEntries(module.functions.size(), nullptr),
+      hotCounts(module.functions.size(), 0),
+      isSafePointRequested(false) {
+  for (const bytecode::Static &object : module.statics) {
+    statics.emplace_back((object.size + sizeof(int64_t) - 1) /
+                         sizeof(int64_t));
+    std::copy(object.data.begin(), object.data.end(), statics.back().begin());
+    staticAddresses.push_back(statics.back().data());
+  }
+}
+
+int64_t Interpreter::call(const std::string &name,
+                          const std::vector<int64_t> &args) {
+  const auto iter =
+      std::find_if(module.functions.begin(), module.functions.end(),
+                   [&name](const bytecode::Function &function) {
+                     return function.name == name;
+                   });
+  if (iter == module.functions.end())
+    throw InterpreterError("Unknown function: " + name);
+  if (args.size() != iter->formals.size())
+    throw InterpreterError("Wrong number of arguments for " + name);
+  // Calls from outside are safe points and count towards getting hot too.
+  if (isSafePointRequested.exchange(false))
+    onSafePoint();
+  countHot(iter - module.functions.begin());
+  if (void *entry = nativeEntries.at(iter - module.functions.begin()))
+    return callNative(entry, args.data(), args.size());
+  return execute(*iter, args);
+}
+
+void Interpreter::run() { call("main", {}); }
+
+void Interpreter::setHotThreshold(uint32_t threshold,
+                                  std::function<void(size_t)> onHot) {
+  hotCounts.assign(module.functions.size(), threshold);
+  this->onHot = std::move(onHot);
+}
+
+void Interpreter::setNativeEntry(size_t function, void *entry) {
+  assert(!entry || canCallNative(module.functions.at(function)));
+  nativeEntries.at(function) = entry;
+}
+
+bool Interpreter::canCallNative(const bytecode::Function &function) {
+  return function.formals.size() <= nativeArgumentCount;
+}
+
+void Interpreter::bindStatic(size_t index, int64_t *address) {
+  assert(activations.empty());
+  staticAddresses.at(index) = address;
+}
+
+void Interpreter::setSafePointHandler(std::function<void()> onSafePoint) {
+  this->onSafePoint = std::move(onSafePoint);
+}
+
+void Interpreter::requestSafePoint() { isSafePointRequested = true; }
+
+void Interpreter::countHot(size_t function) {
+  uint32_t &count = hotCounts[function];
+  if (count && !--count)
+    onHot(function);
+}
+
+int64_t Interpreter::execute(const bytecode::Function &entry,
+                             const std::vector<int64_t> &args) {
+  const int32_t *const code = module.code.data();
+  const int64_t *const stackEnd = stack.get() + stackSize;
+  const int32_t *pc = code + entry.entry;
+  int64_t *registers = stack.get();
+  const bytecode::Function *function = &entry;
+  // Counts down to the function getting hot, or stays at zero.
+  uint32_t *hotCount = &hotCounts[function - module.functions.data()];
+  if (registers + function->registerCount > stackEnd)
+    throw InterpreterError("Stack overflow");
+  for (size_t i = 0; i < args.size(); ++i)
+    registers[function->formals.at(i)] = args.at(i);
+  activations.clear();
+
+#ifdef DESCARTES_COMPUTED_GOTO
+  // In the same order as the opcodes.
+  static const void *const handlers[] = {
+      &&ConstHandler,
+      &&MoveHandler,
+      &&FramePointerHandler,
+      &&AddressHandler,
+      &&AddHandler,
+      &&SubtractHandler,
+      &&MultiplyHandler,
+      &&DivideHandler,
+      &&ShiftLeftHandler,
+      &&ShiftRightHandler,
+      &&AndHandler,
+      &&MultiplyHighHandler,
+      &&AddImmediateHandler,
+      &&MultiplyImmediateHandler,
+      &&DivideImmediateHandler,
+      &&ShiftLeftImmediateHandler,
+      &&ShiftRightImmediateHandler,
+      &&AndImmediateHandler,
+      &&MultiplyHighImmediateHandler,
+      &&LoadHandler,
+      &&LoadInt8Handler,
+      &&LoadUint8Handler,
+      &&LoadInt16Handler,
+      &&LoadUint16Handler,
+      &&LoadInt32Handler,
+      &&LoadUint32Handler,
+      &&StoreHandler,
+      &&Store8Handler,
+      &&Store16Handler,
+      &&Store32Handler,
+      &&JumpHandler,
+      &&JumpIfEqualHandler,
+      &&JumpIfNotEqualHandler,
+      &&JumpIfLessHandler,
+      &&JumpIfGreaterHandler,
+      &&JumpIfLessEqualHandler,
+      &&JumpIfGreaterEqualHandler,
+      &&JumpIfEqualImmediateHandler,
+      &&JumpIfNotEqualImmediateHandler,
+      &&JumpIfLessImmediateHandler,
+      &&JumpIfGreaterImmediateHandler,
+      &&JumpIfLessEqualImmediateHandler,
+      &&JumpIfGreaterEqualImmediateHandler,
+      &&JumpTableHandler,
+      &&CallHandler,
+      &&CallRuntimeHandler,
+      &&ReturnHandler,
+  };
+  static_assert(std::size(handlers) ==
+                static_cast<size_t>(bytecode::Opcode::OpcodeCount));
+#define TARGET(op) op##Handler:
+#define DISPATCH() goto *handlers[*pc]
+  DISPATCH();
+#else
+#define TARGET(op) case bytecode::Opcode::op:
+#define DISPATCH() continue
+  for (;;) {
+    switch (static_cast<bytecode::Opcode>(*pc)) {
+#endif
+
+#define BINARY(op, function)                                                   \
+  TARGET(op) {                                                                 \
+    registers[pc[1]] = function(registers[pc[2]], registers[pc[3]]);           \
+    pc += 4;                                                                   \
+    DISPATCH();                                                                \
+  }
+#define IMMEDIATE(op, function)                                                \
+  TARGET(op) {                                                                 \
+    registers[pc[1]] = function(registers[pc[2]], pc[3]);                      \
+    pc += 4;                                                                   \
+    DISPATCH();                                                                \
+  }
+// Narrow accesses go through `memcpy` since the frame is made of words.
+#define LOAD(op, type)                                                         \
+  TARGET(op) {                                                                 \
+    type value;                                                                \
+    std::memcpy(&value, reinterpret_cast<const void *>(registers[pc[2]] +      \
+                                                       pc[3]),                 \
+                sizeof(value));                                                \
+    registers[pc[1]] = value;                                                  \
+    pc += 4;                                                                   \
+    DISPATCH();                                                                \
+  }
+#define STORE(op, type)                                                        \
+  TARGET(op) {                                                                 \
+    const type value = registers[pc[3]];                                       \
+    std::memcpy(reinterpret_cast<void *>(registers[pc[1]] + pc[2]), &value,    \
+                sizeof(value));                                                \
+    pc += 4;                                                                   \
+    DISPATCH();                                                                \
+  }
+// Loops count towards making a function hot each time they go round.
+#define JUMP(target)                                                           \
+  do {                                                                         \
+    const int32_t *const next = code + (target);                               \
+    if (next <= pc && *hotCount && !--*hotCount)                               \
+      onHot(function - module.functions.data());                               \
+    pc = next;                                                                 \
+  } while (false)
+#define COMPARE(op, compare)                                                   \
+  TARGET(op) {                                                                 \
+    if (registers[pc[1]] compare registers[pc[2]])                             \
+      JUMP(pc[3]);                                                             \
+    else                                                                       \
+      pc += 4;                                                                 \
+    DISPATCH();                                                                \
+  }
+#define COMPARE_IMMEDIATE(op, compare)                                         \
+  TARGET(op) {                                                                 \
+    if (registers[pc[1]] compare pc[2])                                        \
+      JUMP(pc[3]);                                                             \
+    else                                                                       \
+      pc += 4;                                                                 \
+    DISPATCH();                                                                \
+  }
+
+  TARGET(Const) {
+    registers[pc[1]] = pc[2];
+    pc += 3;
+    DISPATCH();
+  }
+  TARGET(Move) {
+    registers[pc[1]] = registers[pc[2]];
+    pc += 3;
+    DISPATCH();
+  }
+  TARGET(FramePointer) {
+    registers[pc[1]] = reinterpret_cast<int64_t>(
+        registers + function->frameSlotCount - 1);
+    pc += 2;
+    DISPATCH();
+  }
+  TARGET(Address) {
+    registers[pc[1]] = reinterpret_cast<int64_t>(staticAddresses[pc[2]]);
+    pc += 3;
+    DISPATCH();
+  }
+  BINARY(Add, add)
+  BINARY(Subtract, subtract)
+  BINARY(Multiply, multiply)
+  BINARY(Divide, divide)
+  BINARY(ShiftLeft, shiftLeft)
+  BINARY(ShiftRight, shiftRight)
+  BINARY(And, bitwiseAnd)
+  BINARY(MultiplyHigh, multiplyHigh)
+  IMMEDIATE(AddImmediate, add)
+  IMMEDIATE(MultiplyImmediate, multiply)
+  IMMEDIATE(DivideImmediate, divide)
+  IMMEDIATE(ShiftLeftImmediate, shiftLeft)
+  IMMEDIATE(ShiftRightImmediate, shiftRight)
+  IMMEDIATE(AndImmediate, bitwiseAnd)
+  IMMEDIATE(MultiplyHighImmediate, multiplyHigh)
+  TARGET(Load) {
+    registers[pc[1]] = *reinterpret_cast<const int64_t *>(registers[pc[2]] +
+                                                          pc[3]);
+    pc += 4;
+    DISPATCH();
+  }
+  LOAD(LoadInt8, int8_t)
+  LOAD(LoadUint8, uint8_t)
+  LOAD(LoadInt16, int16_t)
+  LOAD(LoadUint16, uint16_t)
+  LOAD(LoadInt32, int32_t)
+  LOAD(LoadUint32, uint32_t)
+  TARGET(Store) {
+    *reinterpret_cast<int64_t *>(registers[pc[1]] + pc[2]) = registers[pc[3]];
+    pc += 4;
+    DISPATCH();
+  }
+  STORE(Store8, uint8_t)
+  STORE(Store16, uint16_t)
+  STORE(Store32, uint32_t)
+  TARGET(Jump) {
+    JUMP(pc[1]);
+    DISPATCH();
+  }
+  COMPARE(JumpIfEqual, ==)
+  COMPARE(JumpIfNotEqual, !=)
+  COMPARE(JumpIfLess, <)
+  COMPARE(JumpIfGreater, >)
+  COMPARE(JumpIfLessEqual, <=)
+  COMPARE(JumpIfGreaterEqual, >=)
+  COMPARE_IMMEDIATE(JumpIfEqualImmediate, ==)
+  COMPARE_IMMEDIATE(JumpIfNotEqualImmediate, !=)
+  COMPARE_IMMEDIATE(JumpIfLessImmediate, <)
+  COMPARE_IMMEDIATE(JumpIfGreaterImmediate, >)
+  COMPARE_IMMEDIATE(JumpIfLessEqualImmediate, <=)
+  COMPARE_IMMEDIATE(JumpIfGreaterEqualImmediate, >=)
+  TARGET(JumpTable) {
+    // The index is known to be in range.
+    JUMP(pc[3 + registers[pc[1]]]);
+    DISPATCH();
+  }
+  TARGET(Call) {
+    if (isSafePointRequested.exchange(false))
+      onSafePoint();
+    countHot(pc[2]);
+    if (void *entry = nativeEntries[pc[2]]) {
+      int64_t args[nativeArgumentCount];
+      for (int32_t i = 0; i < pc[3]; ++i)
+        args[i] = registers[pc[4 + i]];
+      const int64_t result = callNative(entry, args, pc[3]);
+      if (pc[1] >= 0)
+        registers[pc[1]] = result;
+      pc += 4 + pc[3];
+      DISPATCH();
+    }
+    const bytecode::Function &callee = module.functions[pc[2]];
+    int64_t *const calleeRegisters = registers + function->registerCount;
+    if (calleeRegisters + callee.registerCount > stackEnd)
+      throw InterpreterError("Stack overflow");
+    for (int32_t i = 0; i < pc[3]; ++i)
+      calleeRegisters[callee.formals[i]] = registers[pc[4 + i]];
+    activations.push_back({pc + 4 + pc[3], registers, function, pc[1]});
+    pc = code + callee.entry;
+    registers = calleeRegisters;
+    function = &callee;
+    hotCount = &hotCounts[function - module.functions.data()];
+    DISPATCH();
+  }
+  TARGET(CallRuntime) {
+    int64_t args[nativeArgumentCount];
+    for (int32_t i = 0; i < pc[3]; ++i)
+      args[i] = registers[pc[4 + i]];
+    const int64_t result =
+        callNative(runtime::functions[pc[2]].address, args, pc[3]);
+    if (pc[1] >= 0)
+      registers[pc[1]] = result;
+    pc += 4 + pc[3];
+    DISPATCH();
+  }
+  TARGET(Return) {
+    const int64_t value = registers[function->returnRegister];
+    if (activations.empty())
+      return value;
+    const Activation &caller = activations.back();
+    pc = caller.returnPc;
+    registers = caller.registers;
+    function = caller.function;
+    hotCount = &hotCounts[function - module.functions.data()];
+    if (caller.result >= 0)
+      registers[caller.result] = value;
+    activations.pop_back();
+    DISPATCH();
+  }
+
+#undef COMPARE_IMMEDIATE
+#undef COMPARE
+#undef JUMP
+#undef STORE
+#undef LOAD
+#undef IMMEDIATE
+#undef BINARY
+#undef DISPATCH
+#undef TARGET
+#ifndef DESCARTES_COMPUTED_GOTO
+    case bytecode::Opcode::OpcodeCount:
+      break;
+    }
+    assert(!"Unknown opcode");
+    return 0;
+  }
+#endif
+}
+
+} // namespace descartes
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Bytecode.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace descartes {
+
+// Runs bytecode. Register files are stacked in one block of memory that is
+// set aside up front, so frame pointers are real addresses that the program
+// can store and load through like native code does.
+//
+// Dispatch is threaded: each handler ends with its own indirect jump to the
+// next one, which lets the branch predictor learn which instructions tend to
+// follow which. Compilers without computed gotos fall back to a switch.
+//
+// Functions can be handed over to native code while the program runs. Native
+// code shares the frame layout and the statics with the interpreter but never
+// calls back into it, so nothing native is running whenever the interpreter
+// is.
+class Interpreter {
+public:
+  explicit Interpreter(const bytecode::Module &module);
+  virtual ~Interpreter() = default;
+  // Calls a function with the given arguments and returns its result.
+  int64_t call(const std::string &name, const std::vector<int64_t> &args);
+  // Runs the main program.
+  void run();
+  // Counts the calls and backward jumps of every function and calls `onHot`
+  // with its index once the count reaches `threshold`.
+  void setHotThreshold(uint32_t threshold, std::function<void(size_t)> onHot);
+  // Calls to the function go to native code from now on, or back to the
+  // interpreter if there's no entry. Only functions with their arguments all
+  // in registers can be called this way.
+  void setNativeEntry(size_t function, void *entry);
+  static bool canCallNative(const bytecode::Function &function);
+  // Keeps a static in memory that's set aside elsewhere instead, which has to
+  // happen before anything runs since programs hold on to its address.
+  void bindStatic(size_t index, int64_t *address);
+  // Asks for `onSafePoint` to be called at the next call from any thread.
+  void setSafePointHandler(std::function<void()> onSafePoint);
+  void requestSafePoint();
+
+private:
+  int64_t execute(const bytecode::Function &entry,
+                  const std::vector<int64_t> &args);
+  void countHot(size_t function);
+  struct Activation {
+    const int32_t *returnPc;
+    int64_t *registers;
+    const bytecode::Function *function;
+    // Where the caller wants the result, if anywhere.
+    int32_t result;
+  };
+  const bytecode::Module &module;
+  std::unique_ptr<int64_t[]> stack;
+  std::vector<std::vector<int64_t>> statics;
+  std::vector<int64_t *> staticAddresses;
+  std::vector<Activation> activations;
+  std::vector<void *> nativeEntries;
+  std::vector<uint32_t> hotCounts;
+  std::function<void(size_t)> onHot;
+  std::function<void()> onSafePoint;
+  std::atomic<bool> isSafePointRequested;
+};
+
+} // namespace descartes
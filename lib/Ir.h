@@ -2,32 +2,137 @@
 
 #include "SymbolTable.h"
 
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <set>
+#include <vector>
+
 namespace descartes::ir {
 
 // TODO: Abstract out ARM specific details.
 static int wordSize = 8;
 
-// TODO: Implement escape detection and use registers for non-escaping args.
+// Temporaries with a fixed meaning in every level. The frame pointer of the
+// current level and the value returned by a function.
+static const int framePointer = 0;
+static const int returnValue = 1;
+
+// The display holds the frame pointer of the latest activation at each depth
+// for the levels that functions more than one level deeper reach. Pascal
+// identifiers can't start with an underscore so this can't clash.
+static const char *const displayName = "_display";
+
+// String literals are constant data named by their characters after this
+// prefix. Every use of the same literal then refers to the same data, wherever
+// inlining moves it, and each backend can pool them.
+static const char *const stringPrefix = "_string:";
+
+inline bool isString(Symbol name) {
+  return name.getName().compare(0, std::strlen(stringPrefix), stringPrefix) ==
+         0;
+}
+
+inline std::string getStringValue(Symbol name) {
+  assert(isString(name));
+  return name.getName().substr(std::strlen(stringPrefix));
+}
+
+// A string is the address of its length in a word followed by its characters,
+// padded with zeros to a whole number of words so that they can be compared a
+// word at a time.
+inline std::vector<uint64_t> getStringWords(Symbol name) {
+  const std::string value = getStringValue(name);
+  std::vector<uint64_t> words(1 + (value.size() + wordSize - 1) / wordSize, 0);
+  words.front() = value.size();
+  for (size_t i = 0; i < value.size(); ++i)
+    words.at(1 + i / wordSize) |= static_cast<uint64_t>(
+                                      static_cast<unsigned char>(value.at(i)))
+                                  << (i % wordSize * 8);
+  return words;
+}
+
 struct Level;
+// Every variable has a word in the frame of its level. Those that can only be
+// reached from the level's own code can live in a temporary instead.
 struct Access {
   explicit Access(Level *level, int offset) : level(level), offset(offset) {}
+  bool isInRegister() const { return temp.has_value(); }
   Level *level;
   int offset;
+  std::optional<int> temp;
 };
 
 struct Level {
-  explicit Level(Symbol name) : name(name) {}
+  explicit Level(Symbol name, Level *parent)
+      : name(name), parent(parent), depth(parent ? parent->depth + 1 : 0),
+        tempCount(returnValue + 1), hasStaticLink(false), isDisplayed(false) {}
   Access allocLocal() {
     int offset = locals.size() * wordSize;
     locals.emplace_back(this, -offset);
     return locals.back();
   }
+  // Formals are passed by the caller in order. The static link, if any, is
+  // always the first formal and the first local.
+  Access allocFormal() {
+    formals.push_back(allocLocal());
+    return formals.back();
+  }
+  Access allocStaticLink() {
+    hasStaticLink = true;
+    return allocFormal();
+  }
+  // Arrays take consecutive words and start at the lowest of them so that
+  // their elements are at increasing addresses.
+  Access allocArray(int wordCount) {
+    assert(wordCount > 0);
+    for (int i = 0; i < wordCount; ++i) {
+      allocLocal();
+      arrays.insert(locals.back().offset);
+    }
+    return locals.back();
+  }
+  bool isArray(int offset) const { return arrays.count(offset) > 0; }
+  // Temporaries are numbered per level since they never outlive a frame.
+  int newTemp() { return tempCount++; }
+  // Locals that nested functions reach through the static link have to stay in
+  // the frame. The rest can be promoted to temporaries.
+  void setEscapes(const Access &access) { escapes.insert(access.offset); }
+  bool isEscaping(int offset) const { return escapes.count(offset) > 0; }
+  // Gives a local that doesn't escape a temporary, the same one every time.
+  // Escapes are only known once the nested functions of the level have been
+  // translated so this mustn't be called any earlier. Formals still arrive in
+  // the frame and have to be copied into their temporary on entry.
+  Access resolve(const Access &access) {
+    if (isEscaping(access.offset) || isArray(access.offset))
+      return access;
+    for (Access &local : locals) {
+      if (local.offset != access.offset)
+        continue;
+      if (!local.temp)
+        local.temp = newTemp();
+      return local;
+    }
+    return access;
+  }
   const Symbol name;
+  // The level that this one is nested in. The main program has none and is at
+  // depth zero.
+  Level *const parent;
+  const int depth;
   std::vector<Access> locals;
+  std::vector<Access> formals;
+  int tempCount;
+  std::set<int> escapes;
+  // Every word of every array. Elements are reached through computed addresses
+  // so these always stay where they are in the frame.
+  std::set<int> arrays;
+  bool hasStaticLink;
+  // Whether the level puts its frame in the display while it runs.
+  bool isDisplayed;
 };
 
-using Fragment = std::pair<Level, StatementPtr>;
-
 enum class StatementKind {
   Sequence,
   Label,
@@ -35,6 +140,7 @@ enum class StatementKind {
   CondJump,
   Move,
   CallStatement,
+  JumpTable,
 };
 struct Statement {
   virtual ~Statement() = default;
@@ -42,6 +148,9 @@ struct Statement {
 };
 using StatementPtr = std::unique_ptr<Statement>;
 
+// Each fragment owns the level that its accesses point into.
+using Fragment = std::pair<std::unique_ptr<Level>, StatementPtr>;
+
 enum class ExprKind {
   ArithOp,
   Mem,
@@ -49,6 +158,7 @@ enum class ExprKind {
   Const,
   Call,
   CondExpr,
+  Temp,
 };
 struct Expr {
   virtual ~Expr() = default;
@@ -60,13 +170,13 @@ struct Sequence : public Statement {
   explicit Sequence(std::vector<StatementPtr> &&statements)
       : statements(std::move(statements)) {}
   StatementKind getKind() const override { return StatementKind::Sequence; }
-  const std::vector<StatementPtr> statements;
+  std::vector<StatementPtr> statements;
 };
 
 struct Label : public Statement {
   explicit Label(Symbol label) : label(label) {}
   StatementKind getKind() const override { return StatementKind::Label; }
-  const Symbol label;
+  Symbol label;
 };
 
 enum class RelOpKind {
@@ -83,10 +193,45 @@ enum class RelOpKind {
   // GreaterThanEqualUnsigned,
 };
 
+// Returns the relation that holds exactly when `kind` doesn't.
+inline RelOpKind notRelOp(RelOpKind kind) {
+  switch (kind) {
+  case RelOpKind::Equal:
+    return RelOpKind::NotEqual;
+  case RelOpKind::NotEqual:
+    return RelOpKind::Equal;
+  case RelOpKind::LessThan:
+    return RelOpKind::GreaterThanEqual;
+  case RelOpKind::GreaterThan:
+    return RelOpKind::LessThanEqual;
+  case RelOpKind::LessThanEqual:
+    return RelOpKind::GreaterThan;
+  case RelOpKind::GreaterThanEqual:
+    return RelOpKind::LessThan;
+  }
+  return kind;
+}
+
+// Returns the relation that holds with the operands the other way around.
+inline RelOpKind swapRelOp(RelOpKind kind) {
+  switch (kind) {
+  case RelOpKind::LessThan:
+    return RelOpKind::GreaterThan;
+  case RelOpKind::GreaterThan:
+    return RelOpKind::LessThan;
+  case RelOpKind::LessThanEqual:
+    return RelOpKind::GreaterThanEqual;
+  case RelOpKind::GreaterThanEqual:
+    return RelOpKind::LessThanEqual;
+  default:
+    return kind;
+  }
+}
+
 struct Jump : public Statement {
   Jump(Symbol jumpLabel) : jumpLabel(jumpLabel) {}
   StatementKind getKind() const override { return StatementKind::Jump; }
-  const Symbol jumpLabel;
+  Symbol jumpLabel;
 };
 
 struct CondJump : public Statement {
@@ -95,15 +240,24 @@ struct CondJump : public Statement {
       : op(op), lhs(std::move(lhs)), rhs(std::move(rhs)), thenLabel(thenLabel),
         elseLabel(elseLabel) {}
   StatementKind getKind() const override { return StatementKind::CondJump; }
-  const RelOpKind op;
-  const ExprPtr lhs, rhs;
-  const Symbol thenLabel, elseLabel;
+  RelOpKind op;
+  ExprPtr lhs, rhs;
+  Symbol thenLabel, elseLabel;
+};
+
+// Jumps to `labels[index]`. The index must already be known to be in range.
+struct JumpTable : public Statement {
+  JumpTable(ExprPtr index, std::vector<Symbol> &&labels)
+      : index(std::move(index)), labels(std::move(labels)) {}
+  StatementKind getKind() const override { return StatementKind::JumpTable; }
+  ExprPtr index;
+  std::vector<Symbol> labels;
 };
 
 struct Move : public Statement {
   Move(ExprPtr dst, ExprPtr src) : dst(std::move(dst)), src(std::move(src)) {}
   StatementKind getKind() const override { return StatementKind::Move; }
-  const ExprPtr dst, src;
+  ExprPtr dst, src;
 };
 
 struct CallStatement : public Statement {
@@ -111,7 +265,7 @@ struct CallStatement : public Statement {
   StatementKind getKind() const override {
     return StatementKind::CallStatement;
   }
-  const ExprPtr call;
+  ExprPtr call;
 };
 
 enum class ArithOpKind {
@@ -119,20 +273,125 @@ enum class ArithOpKind {
   Subtract,
   Multiply,
   Divide,
+  ShiftLeft,
+  // Arithmetic shift that keeps the sign.
+  ShiftRight,
+  And,
+  // The upper half of the double width signed product.
+  MultiplyHigh,
 };
 
+// Returns the folded value of `lhs op rhs`, or nothing if the operation must be
+// left for runtime (division by zero or an overflowing result).
+inline std::optional<int> foldArithOp(ArithOpKind kind, int lhs, int rhs) {
+  const long long l = lhs, r = rhs;
+  long long result = 0;
+  switch (kind) {
+  case ArithOpKind::Add:
+    result = l + r;
+    break;
+  case ArithOpKind::Subtract:
+    result = l - r;
+    break;
+  case ArithOpKind::Multiply:
+    result = l * r;
+    break;
+  case ArithOpKind::Divide:
+    if (r == 0)
+      return std::nullopt;
+    result = l / r;
+    break;
+  case ArithOpKind::ShiftLeft:
+    if (r < 0 || r >= 32)
+      return std::nullopt;
+    result = l << r;
+    break;
+  case ArithOpKind::ShiftRight:
+    if (r < 0 || r >= 32)
+      return std::nullopt;
+    result = l >> r;
+    break;
+  case ArithOpKind::And:
+    result = l & r;
+    break;
+  case ArithOpKind::MultiplyHigh:
+    // The product of two 32 bit values leaves only its sign in the upper
+    // half of the 128 bit one.
+    result = l * r < 0 ? -1 : 0;
+    break;
+  }
+  if (result < std::numeric_limits<int>::min() ||
+      result > std::numeric_limits<int>::max())
+    return std::nullopt;
+  return static_cast<int>(result);
+}
+
+inline bool foldRelOp(RelOpKind kind, int lhs, int rhs) {
+  switch (kind) {
+  case RelOpKind::Equal:
+    return lhs == rhs;
+  case RelOpKind::NotEqual:
+    return lhs != rhs;
+  case RelOpKind::LessThan:
+    return lhs < rhs;
+  case RelOpKind::GreaterThan:
+    return lhs > rhs;
+  case RelOpKind::LessThanEqual:
+    return lhs <= rhs;
+  case RelOpKind::GreaterThanEqual:
+    return lhs >= rhs;
+  }
+  return false;
+}
+
 struct ArithOp : public Expr {
   ArithOp(ArithOpKind op, ExprPtr lhs, ExprPtr rhs)
       : op(op), lhs(std::move(lhs)), rhs(std::move(rhs)) {}
   ExprKind getKind() const override { return ExprKind::ArithOp; }
   ArithOpKind op;
-  const ExprPtr lhs, rhs;
+  ExprPtr lhs, rhs;
 };
 
+// How much memory an access covers. Narrow loads extend the value to a word,
+// with its sign or with zeros, and narrow stores keep its low bytes.
+enum class MemType {
+  Word,
+  Int8,
+  Uint8,
+  Int16,
+  Uint16,
+  Int32,
+  Uint32,
+};
+
+inline int getMemSize(MemType type) {
+  switch (type) {
+  case MemType::Int8:
+  case MemType::Uint8:
+    return 1;
+  case MemType::Int16:
+  case MemType::Uint16:
+    return 2;
+  case MemType::Int32:
+  case MemType::Uint32:
+    return 4;
+  case MemType::Word:
+    break;
+  }
+  return wordSize;
+}
+
+inline bool isSignExtended(MemType type) {
+  return type == MemType::Int8 || type == MemType::Int16 ||
+         type == MemType::Int32;
+}
+
 struct Mem : public Expr {
-  explicit Mem(ExprPtr expr) : expr(std::move(expr)) {}
+  explicit Mem(ExprPtr expr, MemType type = MemType::Word)
+      : expr(std::move(expr)), type(type) {}
   ExprKind getKind() const override { return ExprKind::Mem; }
-  const ExprPtr expr;
+  ExprPtr expr;
+  MemType type;
 };
 
 struct Name : public Expr {
@@ -155,6 +414,13 @@ struct Call : public Expr {
   std::vector<ExprPtr> args;
 };
 
+// A value held in a register rather than in the frame.
+struct Temp : public Expr {
+  explicit Temp(int id) : id(id) {}
+  ExprKind getKind() const override { return ExprKind::Temp; }
+  int id;
+};
+
 struct CondExpr : public Expr {
   explicit CondExpr(StatementPtr condJump) : condJump(std::move(condJump)) {}
   ExprKind getKind() const override { return ExprKind::CondExpr; }
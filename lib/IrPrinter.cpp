@@ -0,0 +1,211 @@
+#include "IrPrinter.h"
+
+#include <cassert>
+#include <iostream>
+
+namespace descartes {
+
+using json = nlohmann::json;
+
+namespace {
+
+const size_t indentWidth = 4;
+
+const char *relOpKindToString(ir::RelOpKind kind) {
+  switch (kind) {
+  case ir::RelOpKind::Equal:
+    return "Equal";
+  case ir::RelOpKind::NotEqual:
+    return "NotEqual";
+  case ir::RelOpKind::LessThan:
+    return "LessThan";
+  case ir::RelOpKind::GreaterThan:
+    return "GreaterThan";
+  case ir::RelOpKind::LessThanEqual:
+    return "LessThanEqual";
+  case ir::RelOpKind::GreaterThanEqual:
+    return "GreaterThanEqual";
+  }
+  return "";
+}
+
+const char *arithOpKindToString(ir::ArithOpKind kind) {
+  switch (kind) {
+  case ir::ArithOpKind::Add:
+    return "Add";
+  case ir::ArithOpKind::Subtract:
+    return "Subtract";
+  case ir::ArithOpKind::Multiply:
+    return "Multiply";
+  case ir::ArithOpKind::Divide:
+    return "Divide";
+  case ir::ArithOpKind::ShiftLeft:
+    return "ShiftLeft";
+  case ir::ArithOpKind::ShiftRight:
+    return "ShiftRight";
+  case ir::ArithOpKind::And:
+    return "And";
+  case ir::ArithOpKind::MultiplyHigh:
+    return "MultiplyHigh";
+  }
+  return "";
+}
+
+const char *memTypeToString(ir::MemType type) {
+  switch (type) {
+  case ir::MemType::Word:
+    return "Word";
+  case ir::MemType::Int8:
+    return "Int8";
+  case ir::MemType::Uint8:
+    return "Uint8";
+  case ir::MemType::Int16:
+    return "Int16";
+  case ir::MemType::Uint16:
+    return "Uint16";
+  case ir::MemType::Int32:
+    return "Int32";
+  case ir::MemType::Uint32:
+    return "Uint32";
+  }
+  return "";
+}
+
+} // namespace
+
+void IrPrinter::printFragments(const std::vector<ir::Fragment> &frags) {
+  json fragsObj = json::array();
+  for (const auto &frag : frags)
+    fragsObj.emplace_back(convertFragment(frag));
+  std::cout << fragsObj.dump(indentWidth) << "\n";
+}
+
+json IrPrinter::convertFragment(const ir::Fragment &frag) {
+  json fragObj;
+  fragObj["Name"] = frag.first->name.getName();
+  json formals = json::array();
+  for (const auto &formal : frag.first->formals)
+    formals.emplace_back(formal.offset);
+  fragObj["Formals"] = formals;
+  json locals = json::array();
+  for (const auto &local : frag.first->locals)
+    locals.emplace_back(local.offset);
+  fragObj["Locals"] = locals;
+  fragObj["Body"] = convertStatement(*frag.second);
+  return fragObj;
+}
+
+json IrPrinter::convertStatement(const ir::Statement &statement) {
+  json statementObj;
+  switch (statement.getKind()) {
+  case ir::StatementKind::Sequence: {
+    const auto &sequence = static_cast<const ir::Sequence &>(statement);
+    json body = json::array();
+    for (const auto &s : sequence.statements)
+      body.emplace_back(convertStatement(*s));
+    return body;
+  }
+  case ir::StatementKind::Label:
+    statementObj["Type"] = "Label";
+    statementObj["Label"] =
+        static_cast<const ir::Label &>(statement).label.getName();
+    break;
+  case ir::StatementKind::Jump:
+    statementObj["Type"] = "Jump";
+    statementObj["Label"] =
+        static_cast<const ir::Jump &>(statement).jumpLabel.getName();
+    break;
+  case ir::StatementKind::CondJump: {
+    const auto &condJump = static_cast<const ir::CondJump &>(statement);
+    statementObj["Type"] = "CondJump";
+    statementObj["Operator"] = relOpKindToString(condJump.op);
+    statementObj["Left"] = convertExpr(*condJump.lhs);
+    statementObj["Right"] = convertExpr(*condJump.rhs);
+    statementObj["Then"] = condJump.thenLabel.getName();
+    statementObj["Else"] = condJump.elseLabel.getName();
+    break;
+  }
+  case ir::StatementKind::Move: {
+    const auto &move = static_cast<const ir::Move &>(statement);
+    statementObj["Type"] = "Move";
+    statementObj["Dst"] = convertExpr(*move.dst);
+    statementObj["Src"] = convertExpr(*move.src);
+    break;
+  }
+  case ir::StatementKind::CallStatement:
+    statementObj["Type"] = "CallStatement";
+    statementObj["Call"] =
+        convertExpr(*static_cast<const ir::CallStatement &>(statement).call);
+    break;
+  case ir::StatementKind::JumpTable: {
+    const auto &jumpTable = static_cast<const ir::JumpTable &>(statement);
+    statementObj["Type"] = "JumpTable";
+    statementObj["Index"] = convertExpr(*jumpTable.index);
+    json labels = json::array();
+    for (const auto &label : jumpTable.labels)
+      labels.emplace_back(label.getName());
+    statementObj["Labels"] = labels;
+    break;
+  }
+  }
+  return statementObj;
+}
+
+json IrPrinter::convertExpr(const ir::Expr &expr) {
+  json exprObj;
+  switch (expr.getKind()) {
+  case ir::ExprKind::ArithOp: {
+    const auto &arithOp = static_cast<const ir::ArithOp &>(expr);
+    exprObj["Type"] = "ArithOp";
+    exprObj["Operator"] = arithOpKindToString(arithOp.op);
+    exprObj["Left"] = convertExpr(*arithOp.lhs);
+    exprObj["Right"] = convertExpr(*arithOp.rhs);
+    break;
+  }
+  case ir::ExprKind::Mem: {
+    const auto &mem = static_cast<const ir::Mem &>(expr);
+    exprObj["Type"] = "Mem";
+    exprObj["Addr"] = convertExpr(*mem.expr);
+    if (mem.type != ir::MemType::Word)
+      exprObj["Width"] = memTypeToString(mem.type);
+    break;
+  }
+  case ir::ExprKind::Name:
+    exprObj["Type"] = "Name";
+    exprObj["Value"] = static_cast<const ir::Name &>(expr).value.getName();
+    break;
+  case ir::ExprKind::Const:
+    exprObj["Type"] = "Const";
+    exprObj["Value"] = static_cast<const ir::Const &>(expr).value;
+    break;
+  case ir::ExprKind::Call: {
+    const auto &call = static_cast<const ir::Call &>(expr);
+    exprObj["Type"] = "Call";
+    exprObj["Name"] = call.functionName.getName();
+    json args = json::array();
+    for (const auto &arg : call.args)
+      args.emplace_back(convertExpr(*arg));
+    exprObj["Args"] = args;
+    break;
+  }
+  case ir::ExprKind::CondExpr:
+    exprObj["Type"] = "CondExpr";
+    exprObj["CondJump"] = convertStatement(
+        *static_cast<const ir::CondExpr &>(expr).condJump);
+    break;
+  case ir::ExprKind::Temp: {
+    const int id = static_cast<const ir::Temp &>(expr).id;
+    exprObj["Type"] = "Temp";
+    if (id == ir::framePointer)
+      exprObj["Id"] = "fp";
+    else if (id == ir::returnValue)
+      exprObj["Id"] = "rv";
+    else
+      exprObj["Id"] = id;
+    break;
+  }
+  }
+  return exprObj;
+}
+
+} // namespace descartes
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <Ir.h>
+
+#include <nlohmann/json.hpp>
+
+namespace descartes {
+
+class IrPrinter {
+public:
+  virtual ~IrPrinter() = default;
+  void printFragments(const std::vector<ir::Fragment> &frags);
+
+private:
+  using json = nlohmann::json;
+  json convertFragment(const ir::Fragment &frag);
+  json convertStatement(const ir::Statement &statement);
+  json convertExpr(const ir::Expr &expr);
+};
+
+} // namespace descartes
@@ -0,0 +1,147 @@
+#include "Jit.h"
+
+#include <Interfaces.h>
+#include <Runtime.h>
+
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <limits>
+
+namespace descartes {
+
+namespace {
+
+const size_t stubSize = 16;
+
+size_t alignTo(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// movabs $address, %r11; jmp *%r11
+void writeStub(uint8_t *stub, uint64_t address) {
+  std::memset(stub, 0xcc, stubSize);
+  stub[0] = 0x49;
+  stub[1] = 0xbb;
+  std::memcpy(stub + 2, &address, sizeof(address));
+  stub[10] = 0x41;
+  stub[11] = 0xff;
+  stub[12] = 0xe3;
+}
+
+} // namespace
+
+Jit::Jit() : memory(nullptr), memorySize(0) {
+  for (size_t i = 0; i < runtime::functionCount; ++i)
+    addSymbol(runtime::functions[i].name, runtime::functions[i].address);
+}
+
+Jit::~Jit() { unload(); }
+
+void Jit::addSymbol(const std::string &name, void *address) {
+  symbols[name] = address;
+}
+
+void Jit::load(const x86::ObjectCode &code) {
+  unload();
+  const size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t stubCount = 0;
+  for (const x86::ObjectSymbol &symbol : code.symbols) {
+    if (!symbol.section)
+      ++stubCount;
+  }
+  const size_t stubsOffset = alignTo(code.text.size(), stubSize);
+  const size_t textSize =
+      alignTo(stubsOffset + stubCount * stubSize, pageSize);
+  const size_t rodataSize = alignTo(code.rodata.size(), pageSize);
+  const size_t bssSize = alignTo(code.bssSize, pageSize);
+  memorySize = textSize + rodataSize + bssSize;
+  void *pages = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pages == MAP_FAILED) {
+    memorySize = 0;
+    throw JitError("Could not map memory for the program");
+  }
+  memory = static_cast<uint8_t *>(pages);
+  std::copy(code.text.begin(), code.text.end(), memory);
+  std::copy(code.rodata.begin(), code.rodata.end(), memory + textSize);
+  const uint8_t *const sections[] = {memory, memory + textSize,
+                                     memory + textSize + rodataSize};
+
+  // Calls to a symbol go to its stub when it has one.
+  std::vector<uint64_t> addresses, callAddresses;
+  uint8_t *stub = memory + stubsOffset;
+  for (const x86::ObjectSymbol &symbol : code.symbols) {
+    if (symbol.section) {
+      addresses.push_back(reinterpret_cast<uint64_t>(
+          sections[static_cast<size_t>(*symbol.section)] + symbol.offset));
+      callAddresses.push_back(addresses.back());
+      if (symbol.type != x86::SymbolType::Section)
+        loadedSymbols.emplace(symbol.name,
+                              reinterpret_cast<void *>(addresses.back()));
+      continue;
+    }
+    addresses.push_back(reinterpret_cast<uint64_t>(resolve(symbol.name)));
+    writeStub(stub, addresses.back());
+    callAddresses.push_back(reinterpret_cast<uint64_t>(stub));
+    stub += stubSize;
+  }
+  for (const x86::Relocation &relocation : code.relocations) {
+    uint8_t *const field = const_cast<uint8_t *>(
+        sections[static_cast<size_t>(relocation.section)] + relocation.offset);
+    if (relocation.type == x86::RelocationType::Absolute64) {
+      const uint64_t value =
+          addresses.at(relocation.symbol) + relocation.addend;
+      std::memcpy(field, &value, sizeof(value));
+      continue;
+    }
+    const uint64_t target =
+        relocation.type == x86::RelocationType::Call32
+            ? callAddresses.at(relocation.symbol)
+            : addresses.at(relocation.symbol);
+    const int64_t distance = static_cast<int64_t>(target) + relocation.addend -
+                             reinterpret_cast<int64_t>(field);
+    if (distance < std::numeric_limits<int32_t>::min() ||
+        distance > std::numeric_limits<int32_t>::max())
+      throw JitError("Symbol out of range: " +
+                     code.symbols.at(relocation.symbol).name);
+    const int32_t value = distance;
+    std::memcpy(field, &value, sizeof(value));
+  }
+
+  if (mprotect(memory, textSize, PROT_READ | PROT_EXEC) != 0 ||
+      (rodataSize && mprotect(memory + textSize, rodataSize, PROT_READ) != 0))
+    throw JitError("Could not protect memory for the program");
+}
+
+void *Jit::getAddress(const std::string &name) const {
+  const auto iter = loadedSymbols.find(name);
+  if (iter == loadedSymbols.end())
+    throw JitError("Unknown symbol: " + name);
+  return iter->second;
+}
+
+void Jit::run() const {
+  reinterpret_cast<void (*)()>(getAddress("main"))();
+}
+
+void *Jit::resolve(const std::string &name) const {
+  const auto iter = symbols.find(name);
+  if (iter != symbols.end())
+    return iter->second;
+  if (void *address = dlsym(RTLD_DEFAULT, name.c_str()))
+    return address;
+  throw JitError("Undefined symbol: " + name);
+}
+
+void Jit::unload() {
+  if (memory)
+    munmap(memory, memorySize);
+  memory = nullptr;
+  memorySize = 0;
+  loadedSymbols.clear();
+}
+
+} // namespace descartes
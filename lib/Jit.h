@@ -0,0 +1,39 @@
+#pragma once
+
+#include <ObjectCode.h>
+
+#include <unordered_map>
+
+namespace descartes {
+
+// Loads object code into executable memory in this process so that it can run
+// without writing a file or going through an assembler and linker. Each
+// section gets its own pages and relocations are applied in place.
+//
+// Symbols that the program doesn't define are looked up in the runtime, the
+// ones added here and then in the process itself. Calls to them go through a
+// stub next to the code since they can be further away than a 32 bit
+// displacement reaches.
+class Jit {
+public:
+  Jit();
+  virtual ~Jit();
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+  void addSymbol(const std::string &name, void *address);
+  void load(const x86::ObjectCode &code);
+  // The address of a function or object in the loaded program.
+  void *getAddress(const std::string &name) const;
+  // Calls the main program and returns once it does.
+  void run() const;
+
+private:
+  void *resolve(const std::string &name) const;
+  void unload();
+  std::unordered_map<std::string, void *> symbols;
+  std::unordered_map<std::string, void *> loadedSymbols;
+  uint8_t *memory;
+  size_t memorySize;
+};
+
+} // namespace descartes
@@ -0,0 +1,171 @@
+#include "Licm.h"
+
+#include <algorithm>
+
+namespace descartes {
+
+namespace {
+
+// Whether the value is the address of a frame. Loads of those come from the
+// static link and reference parameters.
+bool isFramePointer(const ssa::Instruction &value) {
+  return value.op == ssa::Opcode::FramePointer ||
+         value.op == ssa::Opcode::Param || value.op == ssa::Opcode::Load;
+}
+
+} // namespace
+
+Licm::Licm() : function(nullptr), hasCall(false) {}
+
+void Licm::run(ssa::Function &function) {
+  this->function = &function;
+  function.removeUnreachableBlocks();
+  {
+    const ssa::DominatorTree domTree(function);
+    const ssa::LoopInfo loopInfo(function, domTree);
+    for (const auto &loop : loopInfo.getLoops()) {
+      if (!loop->getPreheader())
+        makePreheader(*loop);
+    }
+  }
+  // Find the loops again so that they include the new preheaders of the loops
+  // nested in them.
+  const ssa::DominatorTree domTree(function);
+  const ssa::LoopInfo loopInfo(function, domTree);
+  for (const auto &loop : loopInfo.getLoops()) {
+    if (ssa::Block *preheader = loop->getPreheader())
+      hoist(*loop, preheader);
+  }
+  this->function = nullptr;
+}
+
+ssa::Block *Licm::makePreheader(const ssa::Loop &loop) {
+  ssa::Block *header = loop.header;
+  ssa::Block *preheader = function->makeBlock();
+  std::vector<size_t> entryIndices;
+  for (size_t i = 0; i < header->preds.size(); ++i) {
+    if (!loop.contains(header->preds.at(i)))
+      entryIndices.push_back(i);
+  }
+  // Values coming into the loop are merged in the preheader first.
+  for (ssa::Instruction *phi : header->getPhis()) {
+    ssa::Instruction *incoming;
+    if (entryIndices.size() == 1) {
+      incoming = phi->operands.at(entryIndices.front());
+    } else {
+      auto entryPhi = function->makeInstruction(ssa::Opcode::Phi);
+      for (size_t i : entryIndices)
+        entryPhi->addOperand(phi->operands.at(i));
+      incoming = preheader->insertPhi(std::move(entryPhi));
+    }
+    for (auto iter = entryIndices.rbegin(); iter != entryIndices.rend();
+         ++iter)
+      phi->removeOperand(*iter);
+    phi->addOperand(incoming);
+  }
+  for (size_t i : entryIndices) {
+    ssa::Block *entry = header->preds.at(i);
+    // An entry with several edges into the header gets one edge per use.
+    *std::find(entry->succs.begin(), entry->succs.end(), header) = preheader;
+    preheader->preds.push_back(entry);
+  }
+  for (auto iter = entryIndices.rbegin(); iter != entryIndices.rend(); ++iter)
+    header->preds.erase(header->preds.begin() + *iter);
+  preheader->append(function->makeInstruction(ssa::Opcode::Jump));
+  function->addEdge(preheader, header);
+  // Lay the preheader out so that it falls through into the header.
+  auto &blocks = function->blocks;
+  const auto headerIter = std::find_if(
+      blocks.begin(), blocks.end(),
+      [header](const ssa::BlockPtr &block) { return block.get() == header; });
+  std::rotate(headerIter, blocks.end() - 1, blocks.end());
+  return preheader;
+}
+
+void Licm::hoist(const ssa::Loop &loop, ssa::Block *preheader) {
+  stores.clear();
+  hasCall = false;
+  for (const ssa::Block *block : loop.blocks) {
+    for (const auto &instruction : block->instructions) {
+      if (instruction->op == ssa::Opcode::Store)
+        stores.push_back(instruction.get());
+      else if (instruction->op == ssa::Opcode::Call)
+        hasCall = true;
+    }
+  }
+  ssa::Instruction *terminator = preheader->getTerminator();
+  // Blocks are visited in reverse post order so the operands of an instruction
+  // have already been moved if they could be.
+  for (ssa::Block *block : loop.blocks) {
+    std::vector<ssa::Instruction *> instructions;
+    for (const auto &instruction : block->instructions)
+      instructions.push_back(instruction.get());
+    for (ssa::Instruction *instruction : instructions) {
+      if (isInvariant(*instruction, loop))
+        preheader->insertBefore(terminator, block->remove(instruction));
+    }
+  }
+}
+
+bool Licm::isInvariant(const ssa::Instruction &instruction,
+                       const ssa::Loop &loop) const {
+  const bool operandsInvariant = std::none_of(
+      instruction.operands.begin(), instruction.operands.end(),
+      [&loop](const ssa::Instruction *operand) {
+        return loop.contains(operand->parent);
+      });
+  if (!operandsInvariant)
+    return false;
+  switch (instruction.op) {
+  case ssa::Opcode::Const:
+  case ssa::Opcode::Name:
+    return true;
+  case ssa::Opcode::ArithOp: {
+    if (instruction.arithOp != ir::ArithOpKind::Divide)
+      return true;
+    const ssa::Instruction &divisor = *instruction.operands.at(1);
+    return divisor.op == ssa::Opcode::Const && divisor.value != 0 &&
+           divisor.value != -1;
+  }
+  case ssa::Opcode::Load: {
+    const ssa::Instruction &address = *instruction.operands.front();
+    if (hasCall || !isSafeToLoad(address))
+      return false;
+    const int size = ir::getMemSize(instruction.memType);
+    return std::none_of(stores.begin(), stores.end(),
+                        [&address, size](const ssa::Instruction *store) {
+                          return ssa::mayAlias(
+                              *store->operands.at(0),
+                              ir::getMemSize(store->memType), address, size);
+                        });
+  }
+  default:
+    return false;
+  }
+}
+
+bool Licm::isSafeToLoad(const ssa::Instruction &address) const {
+  switch (address.op) {
+  case ssa::Opcode::Local:
+  case ssa::Opcode::FramePointer:
+  case ssa::Opcode::Param:
+    return true;
+  case ssa::Opcode::Load:
+    return isSafeToLoad(*address.operands.front());
+  case ssa::Opcode::ArithOp: {
+    if (address.arithOp != ir::ArithOpKind::Add)
+      return false;
+    const ssa::Instruction &lhs = *address.operands.at(0);
+    const ssa::Instruction &rhs = *address.operands.at(1);
+    if (rhs.op == ssa::Opcode::Const)
+      return isFramePointer(lhs) && isSafeToLoad(lhs);
+    if (lhs.op == ssa::Opcode::Const)
+      return isFramePointer(rhs) && isSafeToLoad(rhs);
+    return false;
+  }
+  default:
+    return false;
+  }
+}
+
+} // namespace descartes
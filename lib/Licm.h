@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Loops.h>
+
+namespace descartes {
+
+// Loop invariant code motion. Every loop is given a preheader, a block outside
+// of it that only jumps to its header, and instructions whose operands don't
+// change between iterations are moved there so that they are only evaluated
+// once. Inner loops are done first so invariants can move out more than one
+// level.
+//
+// Arithmetic is always safe to evaluate early apart from division, which is
+// only moved when the divisor is a constant that can't trap. Loads are moved
+// when nothing in the loop may write to the address and the address is a
+// constant offset into a frame, whether the level's own, one reached through
+// the static link or one that a reference parameter points into, since those
+// can be read even if the loop would never have done so.
+class Licm {
+public:
+  Licm();
+  virtual ~Licm() = default;
+  void run(ssa::Function &function);
+
+private:
+  ssa::Block *makePreheader(const ssa::Loop &loop);
+  void hoist(const ssa::Loop &loop, ssa::Block *preheader);
+  bool isInvariant(const ssa::Instruction &instruction,
+                   const ssa::Loop &loop) const;
+  bool isSafeToLoad(const ssa::Instruction &address) const;
+  ssa::Function *function;
+  std::vector<const ssa::Instruction *> stores;
+  bool hasCall;
+};
+
+} // namespace descartes
@@ -0,0 +1,249 @@
+#include "LiveIntervals.h"
+
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
+
+namespace descartes::x86 {
+
+namespace {
+
+bool isTerminator(const Instruction &instruction) {
+  return instruction.op == Opcode::Jmp || instruction.op == Opcode::Jcc ||
+         instruction.op == Opcode::Ret;
+}
+
+// The stack and frame pointers are never allocated or tracked.
+bool isTracked(int reg) { return reg != rsp && reg != rbp; }
+
+} // namespace
+
+LiveInterval::LiveInterval(int reg) : reg(reg) {}
+
+bool LiveInterval::covers(int position) const {
+  const auto iter = std::upper_bound(
+      ranges.begin(), ranges.end(), position,
+      [](int position, const LiveRange &range) {
+        return position < range.end;
+      });
+  return iter != ranges.end() && iter->start <= position;
+}
+
+std::optional<int>
+LiveInterval::findIntersection(const LiveInterval &other) const {
+  // Skip the ranges of the other interval that end before this one starts so
+  // that checking against a long fixed interval stays cheap.
+  auto otherIter = std::upper_bound(
+      other.ranges.begin(), other.ranges.end(), getStart(),
+      [](int position, const LiveRange &range) {
+        return position < range.end;
+      });
+  auto iter = ranges.begin();
+  while (iter != ranges.end() && otherIter != other.ranges.end()) {
+    const int start = std::max(iter->start, otherIter->start);
+    if (start < std::min(iter->end, otherIter->end))
+      return start;
+    if (iter->end < otherIter->end)
+      ++iter;
+    else
+      ++otherIter;
+  }
+  return std::nullopt;
+}
+
+std::optional<int> LiveInterval::getNextUse(int from) const {
+  const auto iter = std::lower_bound(uses.begin(), uses.end(), from);
+  if (iter == uses.end())
+    return std::nullopt;
+  return *iter;
+}
+
+std::unique_ptr<LiveInterval> LiveInterval::splitAt(int position) {
+  assert(position > getStart() && position < getEnd());
+  auto child = std::make_unique<LiveInterval>(reg);
+  auto iter = std::upper_bound(ranges.begin(), ranges.end(), position,
+                               [](int position, const LiveRange &range) {
+                                 return position < range.end;
+                               });
+  // Split a range that straddles the position.
+  if (iter->start < position) {
+    child->ranges.push_back({position, iter->end});
+    iter->end = position;
+    ++iter;
+  }
+  child->ranges.insert(child->ranges.end(), iter, ranges.end());
+  ranges.erase(iter, ranges.end());
+  const auto useIter = std::lower_bound(uses.begin(), uses.end(), position);
+  child->uses.assign(useIter, uses.end());
+  uses.erase(useIter, uses.end());
+  return child;
+}
+
+void LiveInterval::addRange(int start, int end) {
+  if (!ranges.empty() && ranges.front().start <= end) {
+    ranges.front().start = std::min(ranges.front().start, start);
+    ranges.front().end = std::max(ranges.front().end, end);
+    return;
+  }
+  ranges.insert(ranges.begin(), {start, end});
+}
+
+LiveIntervals::LiveIntervals(const Function &function)
+    : function(function), intervals(function.registerCount) {
+  findBlocks();
+  computeLiveness();
+  buildIntervals();
+}
+
+void LiveIntervals::findBlocks() {
+  const auto &instructions = function.instructions;
+  std::unordered_map<Symbol, size_t, SymbolHash> labelBlocks;
+  for (size_t i = 0; i < instructions.size(); ++i) {
+    const bool startsBlock =
+        i == 0 || instructions.at(i).op == Opcode::Label ||
+        isTerminator(instructions.at(i - 1));
+    if (startsBlock) {
+      if (!blocks.empty())
+        blocks.back().end = i;
+      blocks.push_back({i, instructions.size(), {}, {}, {}, {}});
+    }
+    if (instructions.at(i).op == Opcode::Label)
+      labelBlocks.emplace(*instructions.at(i).operands.front().symbol,
+                          blocks.size() - 1);
+  }
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    MachineBlock &block = blocks.at(i);
+    const Instruction &last = instructions.at(block.end - 1);
+    const auto addSucc = [&](size_t succ) {
+      if (std::find(block.succs.begin(), block.succs.end(), succ) !=
+          block.succs.end())
+        return;
+      block.succs.push_back(succ);
+      blocks.at(succ).preds.push_back(i);
+    };
+    switch (last.op) {
+    case Opcode::Jmp:
+      if (last.operands.front().kind == OperandKind::Label) {
+        addSucc(labelBlocks.at(*last.operands.front().symbol));
+        break;
+      }
+      for (Symbol target : last.targets)
+        addSucc(labelBlocks.at(target));
+      break;
+    case Opcode::Jcc:
+      addSucc(labelBlocks.at(*last.operands.front().symbol));
+      if (i + 1 < blocks.size())
+        addSucc(i + 1);
+      break;
+    case Opcode::Ret:
+      break;
+    default:
+      if (i + 1 < blocks.size())
+        addSucc(i + 1);
+      break;
+    }
+  }
+}
+
+void LiveIntervals::computeLiveness() {
+  // The blocks that read each register before writing it and the ones that
+  // write it.
+  std::vector<std::vector<size_t>> genBlocks(function.registerCount),
+      defBlocks(function.registerCount);
+  std::vector<int> lastDefBlock(function.registerCount, -1);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    for (size_t j = blocks.at(i).begin; j < blocks.at(i).end; ++j) {
+      const Instruction &instruction = function.instructions.at(j);
+      for (int reg : getUses(instruction)) {
+        if (lastDefBlock.at(reg) != static_cast<int>(i) &&
+            (genBlocks.at(reg).empty() || genBlocks.at(reg).back() != i))
+          genBlocks.at(reg).push_back(i);
+      }
+      for (int reg : getDefs(instruction)) {
+        if (lastDefBlock.at(reg) != static_cast<int>(i))
+          defBlocks.at(reg).push_back(i);
+        lastDefBlock.at(reg) = i;
+      }
+    }
+  }
+  // Walk backwards from the reads of each register until reaching the writes,
+  // which only visits the blocks where the register is live. Going through
+  // the registers in order keeps the live sets sorted.
+  std::vector<int> liveInMarks(blocks.size(), -1),
+      liveOutMarks(blocks.size(), -1), defMarks(blocks.size(), -1);
+  std::vector<size_t> worklist;
+  for (int reg = 0; reg < function.registerCount; ++reg) {
+    if (!isTracked(reg))
+      continue;
+    for (size_t block : defBlocks.at(reg))
+      defMarks.at(block) = reg;
+    for (size_t block : genBlocks.at(reg)) {
+      liveInMarks.at(block) = reg;
+      blocks.at(block).liveIn.push_back(reg);
+      worklist.push_back(block);
+    }
+    while (!worklist.empty()) {
+      const size_t block = worklist.back();
+      worklist.pop_back();
+      for (size_t pred : blocks.at(block).preds) {
+        if (liveOutMarks.at(pred) == reg)
+          continue;
+        liveOutMarks.at(pred) = reg;
+        blocks.at(pred).liveOut.push_back(reg);
+        if (defMarks.at(pred) == reg || liveInMarks.at(pred) == reg)
+          continue;
+        liveInMarks.at(pred) = reg;
+        blocks.at(pred).liveIn.push_back(reg);
+        worklist.push_back(pred);
+      }
+    }
+  }
+}
+
+void LiveIntervals::buildIntervals() {
+  const auto getOrMake = [this](int reg) -> LiveInterval & {
+    auto &interval = intervals.at(reg);
+    if (!interval)
+      interval = std::make_unique<LiveInterval>(reg);
+    return *interval;
+  };
+  for (size_t i = blocks.size(); i-- > 0;) {
+    const MachineBlock &block = blocks.at(i);
+    const int blockStart = getUsePosition(block.begin);
+    const int blockEnd = getUsePosition(block.end);
+    for (int reg : block.liveOut)
+      getOrMake(reg).addRange(blockStart, blockEnd);
+    for (size_t j = block.end; j-- > block.begin;) {
+      const Instruction &instruction = function.instructions.at(j);
+      for (int reg : getDefs(instruction)) {
+        if (!isTracked(reg))
+          continue;
+        LiveInterval &interval = getOrMake(reg);
+        const int position = getDefPosition(j);
+        // A result that's never read still needs somewhere to go.
+        if (interval.ranges.empty() || interval.getStart() > position)
+          interval.addRange(position, position + 1);
+        else
+          interval.ranges.front().start = position;
+        interval.uses.push_back(position);
+      }
+      for (int reg : getUses(instruction)) {
+        if (!isTracked(reg))
+          continue;
+        LiveInterval &interval = getOrMake(reg);
+        interval.addRange(blockStart, getDefPosition(j));
+        interval.uses.push_back(getUsePosition(j));
+      }
+    }
+  }
+  for (auto &interval : intervals) {
+    if (!interval)
+      continue;
+    std::sort(interval->uses.begin(), interval->uses.end());
+    interval->uses.erase(
+        std::unique(interval->uses.begin(), interval->uses.end()),
+        interval->uses.end());
+  }
+}
+
+} // namespace descartes::x86
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <X86.h>
+
+#include <memory>
+
+namespace descartes::x86 {
+
+// Instructions are numbered in order and each gets two positions: operands are
+// read at the even one and results written at the odd one after it.
+inline int getUsePosition(size_t index) { return index * 2; }
+inline int getDefPosition(size_t index) { return index * 2 + 1; }
+
+// A basic block is the instructions in `[begin, end)`. Blocks start at labels
+// and after jumps.
+struct MachineBlock {
+  size_t begin, end;
+  std::vector<size_t> succs, preds;
+  // The registers live on entry and on exit in ascending order.
+  std::vector<int> liveIn, liveOut;
+};
+
+// Positions `[start, end)`.
+struct LiveRange {
+  int start, end;
+};
+
+// The positions where a register holds a value that's still needed. There can
+// be holes between the ranges where the value isn't needed yet or any more,
+// such as the rest of a loop after the last use of something defined inside
+// it. Splitting the interval lets each part live in a different place.
+struct LiveInterval {
+  explicit LiveInterval(int reg);
+  int getStart() const { return ranges.front().start; }
+  int getEnd() const { return ranges.back().end; }
+  bool covers(int position) const;
+  // The first position where both intervals are live.
+  std::optional<int> findIntersection(const LiveInterval &other) const;
+  // The first position at or after `from` that reads or writes the register.
+  std::optional<int> getNextUse(int from) const;
+  // Moves the ranges and uses from `position` onwards into a new interval.
+  std::unique_ptr<LiveInterval> splitAt(int position);
+  // Ranges have to be added from the last to the first.
+  void addRange(int start, int end);
+  const int reg;
+  std::vector<LiveRange> ranges;
+  std::vector<int> uses;
+  // The hardware register that holds the value. Parts without one live in
+  // the spill slot of the register.
+  std::optional<int> location;
+};
+
+// Splits a function into blocks, finds out which registers are live between
+// them and builds an interval for every register from that. Hardware registers
+// get intervals too so that the allocator knows where they're taken.
+class LiveIntervals {
+public:
+  explicit LiveIntervals(const Function &function);
+  virtual ~LiveIntervals() = default;
+  const std::vector<MachineBlock> &getBlocks() const { return blocks; }
+  // Nothing if the register is never used.
+  LiveInterval *getInterval(int reg) const { return intervals.at(reg).get(); }
+
+private:
+  void findBlocks();
+  void computeLiveness();
+  void buildIntervals();
+  const Function &function;
+  std::vector<MachineBlock> blocks;
+  std::vector<std::unique_ptr<LiveInterval>> intervals;
+};
+
+} // namespace descartes::x86
@@ -0,0 +1,139 @@
+#include "Loops.h"
+
+#include <algorithm>
+
+namespace descartes::ssa {
+
+Loop::Loop(Block *header) : header(header), parent(nullptr), depth(0) {}
+
+bool Loop::contains(const Block *block) const {
+  return static_cast<size_t>(block->id) < members.size() &&
+         members.at(block->id);
+}
+
+std::vector<Block *> Loop::getEntries() const {
+  std::vector<Block *> entries;
+  for (Block *pred : header->preds) {
+    if (!contains(pred) &&
+        std::find(entries.begin(), entries.end(), pred) == entries.end())
+      entries.push_back(pred);
+  }
+  return entries;
+}
+
+Block *Loop::getPreheader() const {
+  const std::vector<Block *> entries = getEntries();
+  if (entries.size() != 1)
+    return nullptr;
+  Block *entry = entries.front();
+  if (entry->preds.empty() || entry->succs.size() != 1)
+    return nullptr;
+  return entry;
+}
+
+std::vector<Block *> Loop::getLatches() const {
+  std::vector<Block *> latches;
+  for (Block *pred : header->preds) {
+    if (contains(pred) &&
+        std::find(latches.begin(), latches.end(), pred) == latches.end())
+      latches.push_back(pred);
+  }
+  return latches;
+}
+
+std::vector<Block *> Loop::getExits() const {
+  std::vector<Block *> exits;
+  for (const Block *block : blocks) {
+    for (Block *succ : block->succs) {
+      if (!contains(succ) &&
+          std::find(exits.begin(), exits.end(), succ) == exits.end())
+        exits.push_back(succ);
+    }
+  }
+  return exits;
+}
+
+LoopInfo::LoopInfo(const Function &function, const DominatorTree &domTree) {
+  for (Block *block : domTree.getReversePostOrder()) {
+    std::vector<Block *> latches;
+    for (Block *pred : block->preds) {
+      if (domTree.isReachable(pred) && domTree.dominates(block, pred))
+        latches.push_back(pred);
+    }
+    if (latches.empty())
+      continue;
+    auto loop = std::make_unique<Loop>(block);
+    findBlocks(*loop, latches, function, domTree);
+    loops.push_back(std::move(loop));
+  }
+  // Natural loops with different headers are either disjoint or one is nested
+  // in the other, so a loop is always smaller than the ones containing it.
+  std::stable_sort(loops.begin(), loops.end(),
+                   [](const std::unique_ptr<Loop> &lhs,
+                      const std::unique_ptr<Loop> &rhs) {
+                     return lhs->blocks.size() < rhs->blocks.size();
+                   });
+  for (size_t i = 0; i < loops.size(); ++i) {
+    Loop &loop = *loops.at(i);
+    for (size_t j = i + 1; j < loops.size(); ++j) {
+      Loop &outer = *loops.at(j);
+      if (outer.contains(loop.header)) {
+        loop.parent = &outer;
+        outer.children.push_back(&loop);
+        break;
+      }
+    }
+  }
+  for (auto iter = loops.rbegin(); iter != loops.rend(); ++iter) {
+    Loop &loop = **iter;
+    loop.depth = loop.parent ? loop.parent->depth + 1 : 1;
+  }
+  innermost.assign(function.blockCount, nullptr);
+  for (const auto &loop : loops) {
+    for (const Block *block : loop->blocks) {
+      if (!innermost.at(block->id))
+        innermost.at(block->id) = loop.get();
+    }
+  }
+}
+
+const std::vector<std::unique_ptr<Loop>> &LoopInfo::getLoops() const {
+  return loops;
+}
+
+Loop *LoopInfo::getLoopFor(const Block *block) const {
+  if (static_cast<size_t>(block->id) >= innermost.size())
+    return nullptr;
+  return innermost.at(block->id);
+}
+
+void LoopInfo::findBlocks(Loop &loop, const std::vector<Block *> &latches,
+                          const Function &function,
+                          const DominatorTree &domTree) {
+  loop.members.assign(function.blockCount, false);
+  loop.members.at(loop.header->id) = true;
+  std::vector<Block *> worklist;
+  for (Block *latch : latches) {
+    if (!loop.members.at(latch->id)) {
+      loop.members.at(latch->id) = true;
+      worklist.push_back(latch);
+    }
+  }
+  while (!worklist.empty()) {
+    Block *block = worklist.back();
+    worklist.pop_back();
+    for (Block *pred : block->preds) {
+      if (domTree.isReachable(pred) && !loop.members.at(pred->id)) {
+        loop.members.at(pred->id) = true;
+        worklist.push_back(pred);
+      }
+    }
+  }
+  // The header dominates every block in the loop so it comes first.
+  for (Block *block : domTree.getReversePostOrder()) {
+    if (loop.members.at(block->id))
+      loop.blocks.push_back(block);
+  }
+}
+
+} // namespace descartes::ssa
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Dominators.h>
+
+namespace descartes::ssa {
+
+// A natural loop is the set of blocks that can reach one of its latches
+// without going through its header, where a latch is a block with an edge
+// back to a header that dominates it. Latches that share a header make up a
+// single loop.
+struct Loop {
+  explicit Loop(Block *header);
+  bool contains(const Block *block) const;
+  // The blocks outside of the loop that branch into its header.
+  std::vector<Block *> getEntries() const;
+  // The only entry, if it doesn't branch anywhere other than the header.
+  // The function's entry block never counts since it holds the slots of the
+  // level.
+  Block *getPreheader() const;
+  std::vector<Block *> getLatches() const;
+  // The blocks outside of the loop that it branches to.
+  std::vector<Block *> getExits() const;
+  Block *header;
+  // The header comes first and the rest are in reverse post order.
+  std::vector<Block *> blocks;
+  Loop *parent;
+  std::vector<Loop *> children;
+  int depth;
+
+private:
+  friend class LoopInfo;
+  std::vector<bool> members;
+};
+
+// Finds the natural loops of a function and how they nest. Loops only exist
+// for reducible control flow, which is all that the structured statements of
+// the language produce.
+class LoopInfo {
+public:
+  LoopInfo(const Function &function, const DominatorTree &domTree);
+  virtual ~LoopInfo() = default;
+  // Inner loops come before the loops that contain them.
+  const std::vector<std::unique_ptr<Loop>> &getLoops() const;
+  // The innermost loop containing the block, if any.
+  Loop *getLoopFor(const Block *block) const;
+
+private:
+  void findBlocks(Loop &loop, const std::vector<Block *> &latches,
+                  const Function &function, const DominatorTree &domTree);
+  std::vector<std::unique_ptr<Loop>> loops;
+  std::vector<Loop *> innermost;
+};
+
+} // namespace descartes::ssa
@@ -0,0 +1,198 @@
+#include "Mem2Reg.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <unordered_set>
+
+namespace descartes {
+
+Mem2Reg::Mem2Reg() : function(nullptr), undefined(nullptr) {}
+
+void Mem2Reg::run(ssa::Function &function) {
+  this->function = &function;
+  slots.clear();
+  slotIndices.clear();
+  phiSlots.clear();
+  function.removeUnreachableBlocks();
+  ssa::Block *entry = function.getEntry();
+  for (const auto &instruction : entry->instructions) {
+    if ((instruction->op == ssa::Opcode::Local ||
+         instruction->op == ssa::Opcode::Temp) &&
+        isPromotable(*instruction)) {
+      slotIndices.emplace(instruction.get(), slots.size());
+      slots.push_back(instruction.get());
+    }
+  }
+  if (slots.empty())
+    return;
+  // Reading a slot before anything is stored to it gives an undefined value.
+  // Pascal doesn't define it either so zero is as good as anything.
+  auto zero = function.makeInstruction(ssa::Opcode::Const);
+  undefined = entry->insertBefore(entry->getTerminator(), std::move(zero));
+  const ssa::DominatorTree domTree(function);
+  insertPhis(domTree);
+  rename(domTree);
+  for (ssa::Instruction *slot : slots)
+    entry->erase(slot);
+  removeDeadPhis();
+  if (undefined->users.empty())
+    entry->erase(undefined);
+  undefined = nullptr;
+  this->function = nullptr;
+}
+
+bool Mem2Reg::isPromotable(const ssa::Instruction &slot) const {
+  if (slot.op == ssa::Opcode::Local &&
+      (function->level.isEscaping(slot.value) ||
+       function->level.isArray(slot.value)))
+    return false;
+  // The address must not be used for anything but loading and storing a whole
+  // value.
+  return std::all_of(
+      slot.users.begin(), slot.users.end(), [&slot](const auto *user) {
+        if (user->memType != ir::MemType::Word)
+          return false;
+        if (user->op == ssa::Opcode::Load)
+          return true;
+        return user->op == ssa::Opcode::Store &&
+               user->operands.at(0) == &slot && user->operands.at(1) != &slot;
+      });
+}
+
+void Mem2Reg::insertPhis(const ssa::DominatorTree &domTree) {
+  for (size_t slotIndex = 0; slotIndex < slots.size(); ++slotIndex) {
+    std::vector<ssa::Block *> worklist;
+    std::unordered_set<ssa::Block *> hasPhi, defines;
+    for (ssa::Instruction *user : slots.at(slotIndex)->users) {
+      if (user->op == ssa::Opcode::Store && defines.insert(user->parent).second)
+        worklist.push_back(user->parent);
+    }
+    while (!worklist.empty()) {
+      ssa::Block *block = worklist.back();
+      worklist.pop_back();
+      for (ssa::Block *frontier : domTree.getFrontier(block)) {
+        if (!hasPhi.insert(frontier).second)
+          continue;
+        ssa::Instruction *phi = frontier->insertPhi(
+            function->makeInstruction(ssa::Opcode::Phi));
+        // The incoming values are filled in while renaming. Referring to the
+        // phi itself until then keeps the users of any other value short.
+        for (size_t i = 0; i < frontier->preds.size(); ++i)
+          phi->addOperand(phi);
+        phiSlots.emplace(phi, slotIndex);
+        // The phi is a new definition of the slot.
+        if (defines.insert(frontier).second)
+          worklist.push_back(frontier);
+      }
+    }
+  }
+}
+
+void Mem2Reg::rename(const ssa::DominatorTree &domTree) {
+  std::vector<std::vector<ssa::Instruction *>> stacks;
+  for (ssa::Instruction *slot : slots)
+    stacks.push_back({getInitialValue(*slot)});
+  const auto getSlot = [this](const ssa::Instruction &instruction)
+      -> std::optional<size_t> {
+    if (instruction.operands.empty())
+      return std::nullopt;
+    const auto iter = slotIndices.find(instruction.operands.front());
+    if (iter == slotIndices.end())
+      return std::nullopt;
+    return iter->second;
+  };
+  const std::function<void(ssa::Block *)> renameBlock =
+      [&](ssa::Block *block) {
+        std::vector<size_t> pushed;
+        std::vector<ssa::Instruction *> instructions;
+        for (const auto &instruction : block->instructions)
+          instructions.push_back(instruction.get());
+        for (ssa::Instruction *instruction : instructions) {
+          if (instruction->op == ssa::Opcode::Phi) {
+            const auto iter = phiSlots.find(instruction);
+            if (iter != phiSlots.end()) {
+              stacks.at(iter->second).push_back(instruction);
+              pushed.push_back(iter->second);
+            }
+          } else if (instruction->op == ssa::Opcode::Load) {
+            if (const auto slot = getSlot(*instruction)) {
+              instruction->replaceAllUsesWith(stacks.at(*slot).back());
+              block->erase(instruction);
+            }
+          } else if (instruction->op == ssa::Opcode::Store) {
+            if (const auto slot = getSlot(*instruction)) {
+              stacks.at(*slot).push_back(instruction->operands.at(1));
+              pushed.push_back(*slot);
+              block->erase(instruction);
+            }
+          }
+        }
+        for (ssa::Block *succ : block->succs) {
+          for (size_t predIndex = 0; predIndex < succ->preds.size();
+               ++predIndex) {
+            if (succ->preds.at(predIndex) != block)
+              continue;
+            for (ssa::Instruction *phi : succ->getPhis()) {
+              const auto iter = phiSlots.find(phi);
+              if (iter != phiSlots.end())
+                phi->setOperand(predIndex, stacks.at(iter->second).back());
+            }
+          }
+        }
+        for (ssa::Block *child : domTree.getChildren(block))
+          renameBlock(child);
+        for (size_t slot : pushed)
+          stacks.at(slot).pop_back();
+      };
+  renameBlock(function->getEntry());
+}
+
+ssa::Instruction *Mem2Reg::getInitialValue(const ssa::Instruction &slot) {
+  if (slot.op != ssa::Opcode::Local)
+    return undefined;
+  const auto &formals = function->level.formals;
+  for (size_t i = 0; i < formals.size(); ++i) {
+    if (formals.at(i).offset != slot.value)
+      continue;
+    ssa::Block *entry = function->getEntry();
+    auto param = function->makeInstruction(ssa::Opcode::Param);
+    param->value = i;
+    return entry->insertBefore(entry->getTerminator(), std::move(param));
+  }
+  return undefined;
+}
+
+void Mem2Reg::removeDeadPhis() {
+  // Phis are live if anything other than a dead phi uses them. Start from the
+  // phis with other users and propagate through the incoming values.
+  std::unordered_set<ssa::Instruction *> live;
+  std::vector<ssa::Instruction *> worklist;
+  for (const auto &[phi, slot] : phiSlots) {
+    if (std::any_of(phi->users.begin(), phi->users.end(),
+                    [](const ssa::Instruction *user) {
+                      return user->op != ssa::Opcode::Phi;
+                    }) &&
+        live.insert(phi).second)
+      worklist.push_back(phi);
+  }
+  while (!worklist.empty()) {
+    ssa::Instruction *phi = worklist.back();
+    worklist.pop_back();
+    for (ssa::Instruction *operand : phi->operands) {
+      if (operand->op == ssa::Opcode::Phi && live.insert(operand).second)
+        worklist.push_back(operand);
+    }
+  }
+  std::vector<ssa::Instruction *> dead;
+  for (const auto &[phi, slot] : phiSlots) {
+    if (live.find(phi) == live.end()) {
+      phi->dropOperands();
+      dead.push_back(phi);
+    }
+  }
+  for (ssa::Instruction *phi : dead)
+    phi->parent->erase(phi);
+}
+
+} // namespace descartes
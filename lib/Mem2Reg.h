@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Dominators.h>
+
+#include <unordered_map>
+
+namespace descartes {
+
+// Promotes the frame slots and temporaries of a function that are only ever
+// loaded from and stored to directly into SSA values. Phis are placed at the
+// iterated dominance frontier of the stores to each slot and loads are then
+// renamed with a walk of the dominator tree.
+//
+// Locals that escape to nested functions stay in the frame. Formals that are
+// promoted take the incoming argument as their initial value.
+class Mem2Reg {
+public:
+  Mem2Reg();
+  virtual ~Mem2Reg() = default;
+  void run(ssa::Function &function);
+
+private:
+  bool isPromotable(const ssa::Instruction &slot) const;
+  void insertPhis(const ssa::DominatorTree &domTree);
+  void rename(const ssa::DominatorTree &domTree);
+  ssa::Instruction *getInitialValue(const ssa::Instruction &slot);
+  void removeDeadPhis();
+  ssa::Function *function;
+  std::vector<ssa::Instruction *> slots;
+  std::unordered_map<ssa::Instruction *, size_t> slotIndices;
+  std::unordered_map<ssa::Instruction *, size_t> phiSlots;
+  ssa::Instruction *undefined;
+};
+
+} // namespace descartes
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Encoded machine code for a whole program along with what's needed to place
+// it in memory, independent of the file format it ends up in.
+namespace descartes::x86 {
+
+enum class Section {
+  Text,
+  Rodata,
+  Bss,
+};
+
+enum class SymbolType {
+  // Stands for the start of a section.
+  Section,
+  Function,
+  Object,
+  None,
+};
+
+struct ObjectSymbol {
+  std::string name;
+  SymbolType type;
+  // Nothing for a symbol that's defined elsewhere.
+  std::optional<Section> section;
+  size_t offset;
+  size_t size;
+  bool isGlobal;
+};
+
+enum class RelocationType {
+  // The address of the symbol in 64 bits.
+  Absolute64,
+  // The signed 32 bit distance from the field to the symbol.
+  Relative32,
+  // The same for the target of a call, which can go through a stub.
+  Call32,
+};
+
+// A field that has to be patched with the address of `symbols[symbol] +
+// addend` once it's known where everything goes.
+struct Relocation {
+  Section section;
+  size_t offset;
+  RelocationType type;
+  size_t symbol;
+  int64_t addend;
+};
+
+struct ObjectCode {
+  std::vector<uint8_t> text;
+  std::vector<uint8_t> rodata;
+  size_t bssSize;
+  std::vector<ObjectSymbol> symbols;
+  std::vector<Relocation> relocations;
+};
+
+} // namespace descartes::x86
@@ -96,7 +96,9 @@ std::vector<ConstDef> Parser::parseConstDefs() {
   return constDefs;
 }
 
-ExprPtr Parser::parseConstExpr() { return parsePrimaryExpr(); }
+// Constant expressions share the grammar of ordinary expressions. Whether an
+// expression is actually constant is checked during semantic analysis.
+ExprPtr Parser::parseConstExpr() { return parseExpr(); }
 
 std::vector<TypeDef> Parser::parseTypeDefs() {
   expectToken(TokenKind::Type);
@@ -117,21 +119,35 @@ std::vector<TypeDef> Parser::parseTypeDefs() {
 
 TypePtr Parser::parseType() {
   const bool isPointer = checkToken(TokenKind::Hat);
-  const auto typeString = currentToken.val;
+  const bool isPacked = checkToken(TokenKind::Packed);
   TypePtr type = nullptr;
-  if (checkToken(TokenKind::Identifier))
-    type = std::make_unique<Alias>(symbols.make(typeString));
+  if (checkToken(TokenKind::Record))
+    type = parseRecord();
+  else if (checkToken(TokenKind::Array))
+    type = parseArray(isPacked);
+  else if (isPacked)
+    throw ParserError("Only arrays and records can be packed");
   else if (checkToken(TokenKind::OpenParen))
     type = parseEnum();
-  else if (checkToken(TokenKind::Record))
-    type = parseRecord();
   else
-    assert(!"Unknown type spec");
+    type = parseSubrangeOrAlias();
   assert(type);
   type->isPointer = isPointer;
+  type->isPacked = isPacked;
   return type;
 }
 
+TypePtr Parser::parseSubrangeOrAlias() {
+  // A subrange starts with a constant, which might just be a type name.
+  auto low = parseConstExpr();
+  if (checkToken(TokenKind::DoublePeriod))
+    return std::make_unique<Subrange>(std::move(low), parseConstExpr());
+  auto *varRef = exprCast<VarRef *>(*low);
+  if (!varRef)
+    throw ParserError("Expected a type");
+  return std::make_unique<Alias>(varRef->identifier);
+}
+
 TypePtr Parser::parseEnum() {
   std::vector<Symbol> enums;
   while (!checkToken(TokenKind::CloseParen)) {
@@ -161,6 +177,35 @@ TypePtr Parser::parseRecord() {
   return std::make_unique<Record>(std::move(fields));
 }
 
+TypePtr Parser::parseArray(bool isPacked) {
+  expectToken(TokenKind::OpenBracket);
+  std::vector<ArrayIndex> indices;
+  do {
+    indices.push_back(parseArrayIndex());
+  } while (checkToken(TokenKind::Comma));
+  expectToken(TokenKind::CloseBracket);
+  expectToken(TokenKind::Of);
+  TypePtr type = parseType();
+  // Every index but the last one is an array of what the rest make up, and
+  // packing applies to all of them.
+  for (auto iter = indices.rbegin(); iter != indices.rend(); ++iter) {
+    type = std::make_unique<Array>(std::move(*iter), std::move(type));
+    type->isPacked = isPacked;
+  }
+  return type;
+}
+
+ArrayIndex Parser::parseArrayIndex() {
+  auto low = parseConstExpr();
+  if (checkToken(TokenKind::DoublePeriod))
+    return ArrayIndex(std::move(low), parseConstExpr());
+  // Without a range it has to name an ordinal type.
+  auto *varRef = exprCast<VarRef *>(*low);
+  if (!varRef)
+    throw ParserError("Expected an index range or type");
+  return ArrayIndex(varRef->identifier);
+}
+
 std::vector<VarDecl> Parser::parseVarDecls() {
   expectToken(TokenKind::Var);
   std::vector<VarDecl> varDecls;
@@ -320,6 +365,12 @@ ExprPtr Parser::parsePostfix() {
       expectToken(TokenKind::Identifier);
       expr = std::make_unique<MemberRef>(std::move(expr),
                                          symbols.make(memberIdentifier));
+    } else if (checkToken(TokenKind::OpenBracket)) {
+      // `a[i, j]` is short for `a[i][j]`.
+      do {
+        expr = std::make_unique<IndexRef>(std::move(expr), parseExpr());
+      } while (checkToken(TokenKind::Comma));
+      expectToken(TokenKind::CloseBracket);
     } else
       return expr;
   }
@@ -359,6 +410,29 @@ ExprPtr Parser::parsePrimaryExpr() {
     }
     return std::make_unique<VarRef>(symbols.make(identifier));
   }
+  case TokenKind::OpenParen: {
+    expectToken(TokenKind::OpenParen);
+    auto expr = parseExpr();
+    expectToken(TokenKind::CloseParen);
+    return expr;
+  }
+  case TokenKind::Add:
+  case TokenKind::Subtract: {
+    // Unary sign. Negating a literal yields a negative literal, otherwise it's
+    // treated as subtraction from zero.
+    const bool negate = currentToken.kind == TokenKind::Subtract;
+    readToken();
+    auto operand = parsePostfix();
+    if (!negate)
+      return operand;
+    if (auto *numberLiteral = exprCast<NumberLiteral *>(*operand)) {
+      numberLiteral->val = -numberLiteral->val;
+      return operand;
+    }
+    return std::make_unique<BinaryOp>(BinaryOpKind::Subtract,
+                                      std::make_unique<NumberLiteral>(0),
+                                      std::move(operand));
+  }
   default:
 #ifndef NDEBUG
     assert(!"Invalid primary expr");
@@ -393,15 +467,33 @@ StatementPtr Parser::parseCase() {
   auto expr = parseExpr();
   expectToken(TokenKind::Of);
   std::vector<CaseArm> arms;
+  StatementPtr elseStatement;
   while (!checkToken(TokenKind::End)) {
-    if (!arms.empty())
+    // The else arm may follow the last arm with or without a semicolon.
+    if ((!arms.empty() || elseStatement) &&
+        currentToken.kind != TokenKind::Else) {
       expectToken(TokenKind::SemiColon);
-    auto value = parseExpr();
+      // Allow a trailing semicolon after the last arm.
+      if (checkToken(TokenKind::End))
+        break;
+    }
+    if (elseStatement)
+      throw ParserError("Case else must be the last arm");
+    if (checkToken(TokenKind::Else)) {
+      elseStatement = parseStatement();
+      continue;
+    }
+    // Each arm may be labelled with several comma separated constants.
+    std::vector<ExprPtr> values;
+    do {
+      values.push_back(parseConstExpr());
+    } while (checkToken(TokenKind::Comma));
     expectToken(TokenKind::Colon);
     auto statement = parseStatement();
-    arms.emplace_back(std::move(value), std::move(statement));
+    arms.emplace_back(std::move(values), std::move(statement));
   }
-  return std::make_unique<Case>(std::move(expr), std::move(arms));
+  return std::make_unique<Case>(std::move(expr), std::move(arms),
+                                std::move(elseStatement));
 }
 
 StatementPtr Parser::parseRepeat() {
@@ -459,6 +551,9 @@ StatementPtr Parser::parseIdentifierStatement() {
     auto rhs = parseExpr();
     return std::make_unique<Assignment>(std::move(expr), std::move(rhs));
   }
+  // Procedures without any arguments can be called without the parentheses.
+  if (auto *varRef = exprCast<VarRef *>(*expr))
+    expr = std::make_unique<Call>(varRef->identifier, std::vector<ExprPtr>());
   assert(expr->getKind() == ExprKind::Call);
   return std::make_unique<CallStatement>(std::move(expr));
 }
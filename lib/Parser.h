@@ -25,8 +25,11 @@ private:
   ExprPtr parseConstExpr();
   std::vector<TypeDef> parseTypeDefs();
   TypePtr parseType();
+  TypePtr parseSubrangeOrAlias();
   TypePtr parseEnum();
   TypePtr parseRecord();
+  TypePtr parseArray(bool isPacked);
+  ArrayIndex parseArrayIndex();
   std::vector<VarDecl> parseVarDecls();
   std::vector<std::unique_ptr<Function>> parseFunctions();
   std::unique_ptr<Function> parseProcedure();
@@ -0,0 +1,381 @@
+#include "RangePropagation.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace descartes {
+
+namespace {
+
+const int64_t intMin = std::numeric_limits<int>::min(),
+              intMax = std::numeric_limits<int>::max();
+
+// The comparison that decides whether `block` is reached, if its only
+// predecessor branches to it on one side of one. `holds` is whether the
+// comparison held on the way.
+const ssa::Instruction *getGuard(const ssa::Block &block, bool &holds) {
+  if (block.preds.size() != 1)
+    return nullptr;
+  const ssa::Block *pred = block.preds.front();
+  const ssa::Instruction *terminator = pred->getTerminator();
+  if (terminator->op != ssa::Opcode::CondJump ||
+      pred->succs.at(0) == pred->succs.at(1))
+    return nullptr;
+  holds = pred->succs.at(0) == &block;
+  return terminator;
+}
+
+// The relation that held between the operand of `guard` at `side` and the
+// other one.
+ir::RelOpKind getHeldRelation(const ssa::Instruction &guard, bool holds,
+                              size_t side) {
+  const ir::RelOpKind relOp =
+      side == 0 ? guard.relOp : ir::swapRelOp(guard.relOp);
+  return holds ? relOp : ir::notRelOp(relOp);
+}
+
+} // namespace
+
+RangePropagation::Range RangePropagation::Range::getFull() {
+  return {std::numeric_limits<int64_t>::min(),
+          std::numeric_limits<int64_t>::max()};
+}
+
+RangePropagation::Range RangePropagation::Range::makeInt(int64_t low,
+                                                         int64_t high) {
+  if (low < intMin || high > intMax)
+    return getFull();
+  return {low, high};
+}
+
+bool RangePropagation::Range::isInt() const {
+  return low >= intMin && high <= intMax;
+}
+
+RangePropagation::RangePropagation() : function(nullptr), domTree(nullptr) {}
+
+void RangePropagation::run(ssa::Function &function) {
+  this->function = &function;
+  const ssa::DominatorTree domTree(function);
+  this->domTree = &domTree;
+  ranges.clear();
+  pending.clear();
+  // Every branch is decided before anything changes since the facts that
+  // decide them come from the branches as they are now.
+  std::vector<std::pair<ssa::Block *, size_t>> taken;
+  for (const auto &block : function.blocks) {
+    if (!domTree.isReachable(block.get()))
+      continue;
+    const ssa::Instruction *terminator = block->getTerminator();
+    if (terminator->op != ssa::Opcode::CondJump)
+      continue;
+    if (const auto holds = decide(*terminator))
+      taken.emplace_back(block.get(), *holds ? 0 : 1);
+  }
+  for (const auto &[block, succIndex] : taken) {
+    for (size_t i = block->succs.size(); i-- > 0;) {
+      if (i != succIndex)
+        function.removeEdge(block, i);
+    }
+    block->erase(block->getTerminator());
+    block->append(function.makeInstruction(ssa::Opcode::Jump));
+  }
+  if (!taken.empty()) {
+    function.removeUnreachableBlocks();
+    function.removeTrivialPhis();
+  }
+  this->domTree = nullptr;
+  this->function = nullptr;
+}
+
+RangePropagation::Range
+RangePropagation::getRange(const ssa::Instruction *value) {
+  const auto iter = ranges.find(value);
+  if (iter != ranges.end())
+    return iter->second;
+  if (pending.count(value))
+    return Range::getFull();
+  pending.insert(value);
+  const Range range = evaluate(*value);
+  pending.erase(value);
+  ranges.emplace(value, range);
+  return range;
+}
+
+RangePropagation::Range
+RangePropagation::getRangeAt(const ssa::Instruction *value,
+                             const ssa::Block *block) {
+  Range range = getRange(value);
+  for (const ssa::Block *dominator = block;;
+       dominator = domTree->getIdom(dominator)) {
+    bool holds = false;
+    const ssa::Instruction *guard = getGuard(*dominator, holds);
+    for (size_t side = 0; guard && side < 2; ++side) {
+      if (guard->operands.at(side) != value)
+        continue;
+      const Range other = getRange(guard->operands.at(1 - side));
+      switch (getHeldRelation(*guard, holds, side)) {
+      case ir::RelOpKind::Equal:
+        range.low = std::max(range.low, other.low);
+        range.high = std::min(range.high, other.high);
+        break;
+      case ir::RelOpKind::NotEqual:
+        // Only a single value can be taken off either end.
+        if (other.low == other.high && range.low == other.low)
+          ++range.low;
+        else if (other.low == other.high && range.high == other.high)
+          --range.high;
+        break;
+      case ir::RelOpKind::LessThan:
+        range.high = std::min(range.high, other.high - 1);
+        break;
+      case ir::RelOpKind::LessThanEqual:
+        range.high = std::min(range.high, other.high);
+        break;
+      case ir::RelOpKind::GreaterThan:
+        range.low = std::max(range.low, other.low + 1);
+        break;
+      case ir::RelOpKind::GreaterThanEqual:
+        range.low = std::max(range.low, other.low);
+        break;
+      }
+    }
+    if (dominator == function->getEntry())
+      break;
+  }
+  return range;
+}
+
+RangePropagation::Range
+RangePropagation::evaluate(const ssa::Instruction &instruction) {
+  switch (instruction.op) {
+  case ssa::Opcode::Const:
+    return {instruction.value, instruction.value};
+  case ssa::Opcode::Phi:
+    return evaluatePhi(instruction);
+  case ssa::Opcode::Load: {
+    // A narrow load can only produce what fits in the bytes it reads.
+    if (instruction.memType == ir::MemType::Word)
+      return Range::getFull();
+    const int bits = ir::getMemSize(instruction.memType) * 8;
+    if (ir::isSignExtended(instruction.memType))
+      return {-(int64_t(1) << (bits - 1)), (int64_t(1) << (bits - 1)) - 1};
+    return {0, (int64_t(1) << bits) - 1};
+  }
+  case ssa::Opcode::ArithOp:
+    break;
+  default:
+    return Range::getFull();
+  }
+  const Range lhs = getRange(instruction.operands.at(0)),
+              rhs = getRange(instruction.operands.at(1));
+  if (!lhs.isInt() || !rhs.isInt())
+    return Range::getFull();
+  switch (instruction.arithOp) {
+  case ir::ArithOpKind::Add:
+    return Range::makeInt(lhs.low + rhs.low, lhs.high + rhs.high);
+  case ir::ArithOpKind::Subtract:
+    return Range::makeInt(lhs.low - rhs.high, lhs.high - rhs.low);
+  case ir::ArithOpKind::Multiply: {
+    // The extremes of a product are at the corners.
+    const int64_t corners[] = {lhs.low * rhs.low, lhs.low * rhs.high,
+                               lhs.high * rhs.low, lhs.high * rhs.high};
+    return Range::makeInt(*std::min_element(std::begin(corners),
+                                            std::end(corners)),
+                          *std::max_element(std::begin(corners),
+                                            std::end(corners)));
+  }
+  case ir::ArithOpKind::Divide:
+    // Division truncates so it keeps the order of the dividends.
+    if (rhs.low == rhs.high && rhs.low > 0)
+      return Range::makeInt(lhs.low / rhs.low, lhs.high / rhs.low);
+    return Range::getFull();
+  case ir::ArithOpKind::And:
+    // Masking with a value that isn't negative can only clear bits of it.
+    if (lhs.low >= 0 && rhs.low >= 0)
+      return {0, std::min(lhs.high, rhs.high)};
+    if (lhs.low >= 0 || rhs.low >= 0)
+      return {0, lhs.low >= 0 ? lhs.high : rhs.high};
+    return Range::getFull();
+  default:
+    return Range::getFull();
+  }
+}
+
+RangePropagation::Range
+RangePropagation::evaluatePhi(const ssa::Instruction &phi) {
+  if (const auto induction = evaluateInduction(phi))
+    return *induction;
+  // Otherwise it's anything that comes in, as it is where it comes from.
+  Range range = {std::numeric_limits<int64_t>::max(),
+                 std::numeric_limits<int64_t>::min()};
+  for (size_t i = 0; i < phi.operands.size(); ++i) {
+    const Range incoming =
+        getRangeAt(phi.operands.at(i), phi.parent->preds.at(i));
+    range.low = std::min(range.low, incoming.low);
+    range.high = std::max(range.high, incoming.high);
+  }
+  return range;
+}
+
+std::optional<RangePropagation::Range>
+RangePropagation::evaluateInduction(const ssa::Instruction &phi) {
+  if (phi.operands.size() != 2)
+    return std::nullopt;
+  const ssa::Block *header = phi.parent;
+  for (size_t back = 0; back < 2; ++back) {
+    const ssa::Block *latch = header->preds.at(back),
+                     *entry = header->preds.at(1 - back);
+    if (!domTree->dominates(header, latch) ||
+        domTree->dominates(header, entry))
+      continue;
+    // The value around the loop has to step the phi by a constant.
+    const ssa::Instruction *step = phi.operands.at(back),
+                           *first = phi.operands.at(1 - back);
+    if (step->op != ssa::Opcode::ArithOp)
+      continue;
+    const ssa::Instruction *lhs = step->operands.at(0),
+                           *rhs = step->operands.at(1);
+    int64_t increment = 0;
+    if (step->arithOp == ir::ArithOpKind::Add && lhs == &phi &&
+        rhs->op == ssa::Opcode::Const)
+      increment = rhs->value;
+    else if (step->arithOp == ir::ArithOpKind::Add && rhs == &phi &&
+             lhs->op == ssa::Opcode::Const)
+      increment = lhs->value;
+    else if (step->arithOp == ir::ArithOpKind::Subtract && lhs == &phi &&
+             rhs->op == ssa::Opcode::Const)
+      increment = -static_cast<int64_t>(rhs->value);
+    if (increment == 0)
+      continue;
+    const Range start = getRangeAt(first, entry);
+    // A loop that tests against a bound before stepping never goes further
+    // than one step past it, as long as that doesn't wrap.
+    const Range beforeStep = getRangeAt(&phi, latch);
+    if (increment > 0 && beforeStep.high <= intMax - increment)
+      return Range{start.low,
+                   std::max(start.high, beforeStep.high + increment)};
+    if (increment < 0 && beforeStep.low >= intMin - increment)
+      return Range{std::min(start.low, beforeStep.low + increment), start.high};
+    // A loop that steps by one until it reaches its last value stays between
+    // that and its first value, if the first doesn't start past the last.
+    if (increment != 1 && increment != -1)
+      continue;
+    const ssa::Instruction *last = findLast(phi, latch);
+    if (!last)
+      continue;
+    const Range end = getRange(last);
+    const bool isInOrder = increment > 0 ? start.high <= end.low
+                                         : start.low >= end.high;
+    if (!isInOrder && !isEntryChecked(*first, *last, increment > 0, header))
+      continue;
+    return increment > 0 ? Range{start.low, end.high}
+                         : Range{end.low, start.high};
+  }
+  return std::nullopt;
+}
+
+const ssa::Instruction *
+RangePropagation::findLast(const ssa::Instruction &phi,
+                           const ssa::Block *latch) const {
+  const ssa::Block *header = phi.parent;
+  for (const ssa::Block *dominator = latch; dominator != header;
+       dominator = domTree->getIdom(dominator)) {
+    bool holds = false;
+    const ssa::Instruction *guard = getGuard(*dominator, holds);
+    for (size_t side = 0; guard && side < 2; ++side) {
+      if (guard->operands.at(side) != &phi ||
+          getHeldRelation(*guard, holds, side) != ir::RelOpKind::NotEqual)
+        continue;
+      // The last value mustn't change while the loop runs.
+      const ssa::Instruction *last = guard->operands.at(1 - side);
+      if (last->op == ssa::Opcode::Const ||
+          (last->parent != header &&
+           domTree->dominates(last->parent, header)))
+        return last;
+    }
+  }
+  return nullptr;
+}
+
+bool RangePropagation::isEntryChecked(const ssa::Instruction &first,
+                                      const ssa::Instruction &last,
+                                      bool isUpward,
+                                      const ssa::Block *header) const {
+  for (const ssa::Block *dominator = header;;
+       dominator = domTree->getIdom(dominator)) {
+    bool holds = false;
+    const ssa::Instruction *guard = getGuard(*dominator, holds);
+    for (size_t side = 0; guard && side < 2; ++side) {
+      if (guard->operands.at(side) != &first ||
+          guard->operands.at(1 - side) != &last)
+        continue;
+      switch (getHeldRelation(*guard, holds, side)) {
+      case ir::RelOpKind::Equal:
+        return true;
+      case ir::RelOpKind::LessThan:
+      case ir::RelOpKind::LessThanEqual:
+        if (isUpward)
+          return true;
+        break;
+      case ir::RelOpKind::GreaterThan:
+      case ir::RelOpKind::GreaterThanEqual:
+        if (!isUpward)
+          return true;
+        break;
+      case ir::RelOpKind::NotEqual:
+        break;
+      }
+    }
+    if (dominator == function->getEntry())
+      return false;
+  }
+}
+
+std::optional<bool>
+RangePropagation::decide(const ssa::Instruction &condJump) {
+  const Range lhs = getRangeAt(condJump.operands.at(0), condJump.parent),
+              rhs = getRangeAt(condJump.operands.at(1), condJump.parent);
+  const bool isSingle = lhs.low == lhs.high && rhs.low == rhs.high;
+  switch (condJump.relOp) {
+  case ir::RelOpKind::Equal:
+  case ir::RelOpKind::NotEqual: {
+    std::optional<bool> isEqual;
+    if (isSingle && lhs.low == rhs.low)
+      isEqual = true;
+    else if (lhs.high < rhs.low || rhs.high < lhs.low)
+      isEqual = false;
+    if (isEqual && condJump.relOp == ir::RelOpKind::NotEqual)
+      return !*isEqual;
+    return isEqual;
+  }
+  case ir::RelOpKind::LessThan:
+    if (lhs.high < rhs.low)
+      return true;
+    if (lhs.low >= rhs.high)
+      return false;
+    break;
+  case ir::RelOpKind::LessThanEqual:
+    if (lhs.high <= rhs.low)
+      return true;
+    if (lhs.low > rhs.high)
+      return false;
+    break;
+  case ir::RelOpKind::GreaterThan:
+    if (lhs.low > rhs.high)
+      return true;
+    if (lhs.high <= rhs.low)
+      return false;
+    break;
+  case ir::RelOpKind::GreaterThanEqual:
+    if (lhs.low >= rhs.high)
+      return true;
+    if (lhs.high < rhs.low)
+      return false;
+    break;
+  }
+  return std::nullopt;
+}
+
+} // namespace descartes
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Dominators.h>
+
+#include <optional>
+#include <set>
+#include <unordered_map>
+
+namespace descartes {
+
+// Value range propagation, mostly to remove the bounds checks on array indices
+// that loops already keep in range.
+//
+// Every value gets an interval from its definition, and each use narrows it
+// with the comparisons that must have gone a certain way to reach its block:
+// a block whose only predecessor branches to it on one side of a comparison
+// knows which side. Induction variables are bounded by the loop test that
+// guards their step, both the `while` kind that compares against a bound and
+// the `for` kind that stops once the variable reaches its last value.
+// Arithmetic wraps at 32 bits so an interval that could leave them covers
+// every value instead, and narrow loads can't produce more than their width
+// holds. Branches that the intervals of their operands decide become jumps
+// and whatever they no longer reach is removed.
+class RangePropagation {
+public:
+  RangePropagation();
+  virtual ~RangePropagation() = default;
+  void run(ssa::Function &function);
+
+private:
+  struct Range {
+    static Range getFull();
+    // The interval of a 32 bit result, which is full if it could wrap.
+    static Range makeInt(int64_t low, int64_t high);
+    bool isInt() const;
+    int64_t low, high;
+  };
+  Range getRange(const ssa::Instruction *value);
+  Range getRangeAt(const ssa::Instruction *value, const ssa::Block *block);
+  Range evaluate(const ssa::Instruction &instruction);
+  Range evaluatePhi(const ssa::Instruction &phi);
+  std::optional<Range> evaluateInduction(const ssa::Instruction &phi);
+  const ssa::Instruction *findLast(const ssa::Instruction &phi,
+                                   const ssa::Block *latch) const;
+  bool isEntryChecked(const ssa::Instruction &first,
+                      const ssa::Instruction &last, bool isUpward,
+                      const ssa::Block *header) const;
+  std::optional<bool> decide(const ssa::Instruction &condJump);
+  ssa::Function *function;
+  const ssa::DominatorTree *domTree;
+  std::unordered_map<const ssa::Instruction *, Range> ranges;
+  // Values whose range is being worked out. They count as full in the meantime
+  // so that cycles through phis end.
+  std::set<const ssa::Instruction *> pending;
+};
+
+} // namespace descartes
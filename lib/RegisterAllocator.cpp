@@ -0,0 +1,747 @@
+#include "RegisterAllocator.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <climits>
+#include <unordered_map>
+
+namespace descartes {
+
+namespace {
+
+// Caller saved registers come first since they cost nothing to use unless
+// there's a call in the way.
+const int allocatableRegisters[] = {x86::rax, x86::rcx, x86::rdx, x86::rsi,
+                                    x86::rdi, x86::r8,  x86::r9,  x86::rbx,
+                                    x86::r12, x86::r13, x86::r14, x86::r15};
+
+const int calleeSavedRegisters[] = {x86::rbx, x86::r12, x86::r13, x86::r14,
+                                    x86::r15};
+
+const int scratchRegisters[] = {x86::r10, x86::r11};
+
+int alignFrame(int size) { return (size + 15) / 16 * 16; }
+
+// Moves can only go in between instructions.
+int getInstructionStart(int position) { return position & ~1; }
+
+bool canRematerialise(const x86::Instruction &instruction) {
+  if (instruction.operands.back().kind != x86::OperandKind::Register)
+    return false;
+  const x86::Operand &source = instruction.operands.front();
+  switch (instruction.op) {
+  case x86::Opcode::Mov:
+    return source.kind == x86::OperandKind::Immediate;
+  case x86::Opcode::Lea:
+    return !source.index && (!source.reg || *source.reg == x86::rbp);
+  default:
+    return false;
+  }
+}
+
+bool isCopy(const x86::Instruction &instruction) {
+  return instruction.op == x86::Opcode::Mov &&
+         instruction.operands.front().kind == x86::OperandKind::Register &&
+         instruction.operands.back().kind == x86::OperandKind::Register;
+}
+
+// The operand that can be read from memory instead of a register, if any.
+std::optional<size_t> getFoldableOperand(const x86::Instruction &instruction) {
+  const auto &operands = instruction.operands;
+  switch (instruction.op) {
+  case x86::Opcode::Imul:
+    if (operands.size() == 3)
+      return 1;
+    if (operands.size() == 1)
+      return 0;
+    [[fallthrough]];
+  case x86::Opcode::Mov:
+  case x86::Opcode::Add:
+  case x86::Opcode::Sub:
+  case x86::Opcode::And:
+  case x86::Opcode::Cmp:
+    // Only one operand can be in memory.
+    if (operands.back().kind == x86::OperandKind::Register)
+      return 0;
+    return std::nullopt;
+  case x86::Opcode::Idiv:
+  case x86::Opcode::Push:
+    return 0;
+  default:
+    return std::nullopt;
+  }
+}
+
+x86::Instruction makeMove(x86::Operand from, x86::Operand to) {
+  return x86::Instruction(x86::Opcode::Mov,
+                          std::vector<x86::Operand>{from, to});
+}
+
+} // namespace
+
+RegisterAllocator::RegisterAllocator(SymbolTable &symbols)
+    : symbols(symbols), function(nullptr), position(0), spillSlotCount(0) {}
+
+void RegisterAllocator::run(x86::Function &function) {
+  this->function = &function;
+  liveIntervals = std::make_unique<x86::LiveIntervals>(function);
+  blockStarts.clear();
+  for (const x86::MachineBlock &block : liveIntervals->getBlocks())
+    blockStarts.push_back(x86::getUsePosition(block.begin));
+  parts.assign(function.registerCount, {});
+  splitParts.clear();
+  active.clear();
+  for (auto &intervals : inactive)
+    intervals.clear();
+  for (auto &ranges : assigned)
+    ranges.clear();
+  rematerialisable.assign(function.registerCount, std::nullopt);
+  std::vector<int> defCounts(function.registerCount, 0);
+  for (const x86::Instruction &instruction : function.instructions) {
+    for (int reg : x86::getDefs(instruction)) {
+      if (!x86::isVirtual(reg))
+        continue;
+      if (++defCounts.at(reg) == 1 && canRematerialise(instruction))
+        rematerialisable.at(reg) = instruction;
+      else
+        rematerialisable.at(reg).reset();
+    }
+  }
+  allocate();
+  assignSpillSlots();
+  calleeSaved.clear();
+  for (int reg : calleeSavedRegisters) {
+    const bool isUsed = std::any_of(
+        parts.begin(), parts.end(),
+        [reg](const std::vector<x86::LiveInterval *> &regParts) {
+          return std::any_of(regParts.begin(), regParts.end(),
+                             [reg](const x86::LiveInterval *part) {
+                               return part->location == reg;
+                             });
+        });
+    if (isUsed)
+      calleeSaved.push_back(reg);
+  }
+  rewrite();
+  function.frameSize =
+      alignFrame(function.level.locals.size() * ir::wordSize +
+                 (spillSlotCount + calleeSaved.size()) * ir::wordSize);
+  insertPrologueAndEpilogue(function);
+  liveIntervals.reset();
+}
+
+void RegisterAllocator::allocate() {
+  for (int reg = x86::physicalRegisterCount; reg < function->registerCount;
+       ++reg) {
+    x86::LiveInterval *interval = liveIntervals->getInterval(reg);
+    if (!interval)
+      continue;
+    parts.at(reg).push_back(interval);
+    unhandled.emplace(interval->getStart(), reg, interval);
+  }
+  while (!unhandled.empty()) {
+    x86::LiveInterval &current = *std::get<2>(unhandled.top());
+    unhandled.pop();
+    position = current.getStart();
+    // Intervals that have ended are done with and the ones in a hole don't
+    // need their register until they come out of it.
+    std::vector<x86::LiveInterval *> nowActive;
+    const auto sort = [&](x86::LiveInterval *interval) {
+      if (interval->getEnd() <= position)
+        return;
+      if (interval->covers(position))
+        nowActive.push_back(interval);
+      else
+        deactivate(*interval);
+    };
+    std::for_each(active.begin(), active.end(), sort);
+    for (auto &intervals : inactive) {
+      while (!intervals.empty() &&
+             std::get<0>(*intervals.begin()) <= position) {
+        x86::LiveInterval *interval = std::get<2>(*intervals.begin());
+        intervals.erase(intervals.begin());
+        sort(interval);
+      }
+    }
+    active = std::move(nowActive);
+    if (!tryAllocateFreeRegister(current))
+      allocateBlockedRegister(current);
+    if (current.location) {
+      active.push_back(&current);
+      assign(current);
+    }
+  }
+  for (auto &regParts : parts) {
+    std::sort(regParts.begin(), regParts.end(),
+              [](const x86::LiveInterval *lhs, const x86::LiveInterval *rhs) {
+                return lhs->getStart() < rhs->getStart();
+              });
+  }
+}
+
+void RegisterAllocator::deactivate(x86::LiveInterval &interval) {
+  const auto iter = std::upper_bound(
+      interval.ranges.begin(), interval.ranges.end(), position,
+      [](int position, const x86::LiveRange &range) {
+        return position < range.end;
+      });
+  assert(iter != interval.ranges.end() && iter->start > position);
+  inactive.at(*interval.location).emplace(iter->start, interval.reg, &interval);
+}
+
+void RegisterAllocator::assign(const x86::LiveInterval &interval) {
+  auto &ranges = assigned.at(*interval.location);
+  for (const x86::LiveRange &range : interval.ranges)
+    ranges.emplace(range.start, std::make_pair(range.end, &interval));
+}
+
+void RegisterAllocator::unassign(const x86::LiveInterval &interval) {
+  auto &ranges = assigned.at(*interval.location);
+  for (const x86::LiveRange &range : interval.ranges) {
+    const auto iter = ranges.find(range.start);
+    assert(iter != ranges.end() && iter->second.second == &interval);
+    ranges.erase(iter);
+  }
+}
+
+std::optional<int>
+RegisterAllocator::findAssigned(const x86::LiveInterval &interval, int reg,
+                                int limit) const {
+  const auto &ranges = assigned.at(reg);
+  for (const x86::LiveRange &range : interval.ranges) {
+    if (range.start >= limit)
+      break;
+    // Only the last range starting at or before this one can reach into it.
+    const auto iter = ranges.upper_bound(range.start);
+    if (iter != ranges.begin() && std::prev(iter)->second.first > range.start)
+      return range.start;
+    if (iter != ranges.end() && iter->first < range.end)
+      return iter->first;
+  }
+  return std::nullopt;
+}
+
+bool RegisterAllocator::tryAllocateFreeRegister(x86::LiveInterval &current) {
+  std::array<int, x86::physicalRegisterCount> freeUntil;
+  freeUntil.fill(0);
+  for (int reg : allocatableRegisters) {
+    freeUntil.at(reg) = INT_MAX;
+    if (const x86::LiveInterval *fixed = liveIntervals->getInterval(reg)) {
+      if (const auto intersection = current.findIntersection(*fixed))
+        freeUntil.at(reg) = *intersection;
+    }
+  }
+  for (const x86::LiveInterval *interval : active)
+    freeUntil.at(*interval->location) = 0;
+  // How long a register stays free only matters up to the end of the
+  // interval.
+  const int end = current.getEnd();
+  for (int reg : allocatableRegisters) {
+    int &until = freeUntil.at(reg);
+    if (const auto intersection =
+            findAssigned(current, reg, std::min(until, end)))
+      until = std::min(until, *intersection);
+  }
+  // Take the first register that's free for the whole interval, or failing
+  // that the one that's free for longest.
+  int reg = allocatableRegisters[0];
+  for (int candidate : allocatableRegisters) {
+    if (freeUntil.at(reg) >= end)
+      break;
+    if (freeUntil.at(candidate) > freeUntil.at(reg))
+      reg = candidate;
+  }
+  // Using the register a value is copied from or to saves the copy.
+  if (const auto hint = getHint(current); hint && freeUntil.at(*hint) >= end)
+    reg = *hint;
+  if (freeUntil.at(reg) < end) {
+    const auto splitPosition =
+        findSplitPosition(current.getStart(), freeUntil.at(reg));
+    if (!splitPosition)
+      return false;
+    x86::LiveInterval &rest = split(current, *splitPosition);
+    unhandled.emplace(rest.getStart(), rest.reg, &rest);
+  }
+  current.location = reg;
+  return true;
+}
+
+void RegisterAllocator::allocateBlockedRegister(x86::LiveInterval &current) {
+  // How soon each register is needed by what's in it and where a fixed
+  // interval takes it.
+  std::array<int, x86::physicalRegisterCount> nextUse, blockedFrom;
+  for (int reg : allocatableRegisters) {
+    nextUse.at(reg) = blockedFrom.at(reg) = INT_MAX;
+    if (const x86::LiveInterval *fixed = liveIntervals->getInterval(reg)) {
+      if (const auto intersection = current.findIntersection(*fixed))
+        nextUse.at(reg) = blockedFrom.at(reg) = *intersection;
+    }
+  }
+  for (const x86::LiveInterval *interval : active) {
+    int &use = nextUse.at(*interval->location);
+    use = std::min(use, interval->getNextUse(position).value_or(INT_MAX));
+  }
+  // Nothing in a hole is used before it comes out of it.
+  for (int reg : allocatableRegisters) {
+    int &use = nextUse.at(reg);
+    for (const auto &[holeEnd, id, interval] : inactive.at(reg)) {
+      if (holeEnd >= std::min(use, current.getEnd()))
+        break;
+      if (current.findIntersection(*interval))
+        use = std::min(use, interval->getNextUse(position).value_or(INT_MAX));
+    }
+  }
+  std::optional<int> reg;
+  for (int candidate : allocatableRegisters) {
+    if (getInstructionStart(blockedFrom.at(candidate)) <= position)
+      continue;
+    if (!reg || nextUse.at(candidate) > nextUse.at(*reg))
+      reg = candidate;
+  }
+  // Everything else is needed sooner.
+  if (!reg ||
+      nextUse.at(*reg) < current.getNextUse(position).value_or(INT_MAX)) {
+    spill(current, position);
+    return;
+  }
+  current.location = reg;
+  if (blockedFrom.at(*reg) < current.getEnd()) {
+    x86::LiveInterval &rest =
+        split(current, *findSplitPosition(position, blockedFrom.at(*reg)));
+    unhandled.emplace(rest.getStart(), rest.reg, &rest);
+  }
+  // Whatever holds the register has to give it up.
+  std::vector<x86::LiveInterval *> evicted;
+  const auto iter = std::remove_if(
+      active.begin(), active.end(), [&](x86::LiveInterval *interval) {
+        if (interval->location != reg || !current.findIntersection(*interval))
+          return false;
+        evicted.push_back(interval);
+        return true;
+      });
+  active.erase(iter, active.end());
+  auto &holes = inactive.at(*reg);
+  for (auto hole = holes.begin();
+       hole != holes.end() && std::get<0>(*hole) < current.getEnd();) {
+    x86::LiveInterval *interval = std::get<2>(*hole);
+    if (current.findIntersection(*interval)) {
+      evicted.push_back(interval);
+      hole = holes.erase(hole);
+    } else {
+      ++hole;
+    }
+  }
+  for (x86::LiveInterval *interval : evicted) {
+    unassign(*interval);
+    spill(*interval, getInstructionStart(position));
+    if (interval->location)
+      assign(*interval);
+  }
+}
+
+void RegisterAllocator::spill(x86::LiveInterval &interval, int position) {
+  x86::LiveInterval *spilled = &interval;
+  if (position > interval.getStart())
+    spilled = &split(interval, position);
+  spilled->location.reset();
+  for (int use : spilled->uses) {
+    const int reload = getInstructionStart(use);
+    if (reload > this->position && reload > spilled->getStart()) {
+      x86::LiveInterval &rest = split(*spilled, reload);
+      unhandled.emplace(rest.getStart(), rest.reg, &rest);
+      return;
+    }
+  }
+}
+
+x86::LiveInterval &RegisterAllocator::split(x86::LiveInterval &interval,
+                                            int position) {
+  splitParts.push_back(interval.splitAt(position));
+  x86::LiveInterval &rest = *splitParts.back();
+  parts.at(rest.reg).push_back(&rest);
+  return rest;
+}
+
+std::optional<int> RegisterAllocator::findSplitPosition(int start,
+                                                        int limit) const {
+  // At a block boundary the moves go on the edges instead of in the block.
+  const auto iter =
+      std::upper_bound(blockStarts.begin(), blockStarts.end(), limit);
+  if (iter != blockStarts.begin() && *std::prev(iter) > start)
+    return *std::prev(iter);
+  if (getInstructionStart(limit) > start)
+    return getInstructionStart(limit);
+  return std::nullopt;
+}
+
+std::optional<int>
+RegisterAllocator::getHint(const x86::LiveInterval &interval) const {
+  const auto &instructions = function->instructions;
+  const int start = interval.getStart();
+  if (start % 2 == 1 && isCopy(instructions.at(start / 2))) {
+    const int source = *instructions.at(start / 2).operands.front().reg;
+    if (!x86::isVirtual(source))
+      return source;
+    // Parts aren't sorted until allocation is done.
+    const auto &sourceParts = parts.at(source);
+    const auto iter = std::find_if(
+        sourceParts.begin(), sourceParts.end(),
+        [start](const x86::LiveInterval *part) {
+          return part->covers(start - 1);
+        });
+    return iter == sourceParts.end() ? std::nullopt : (*iter)->location;
+  }
+  const int end = interval.getEnd();
+  if (end % 2 == 1 && isCopy(instructions.at(end / 2))) {
+    const x86::Instruction &copy = instructions.at(end / 2);
+    const int dest = *copy.operands.back().reg;
+    if (copy.operands.front().isRegister(interval.reg) &&
+        !x86::isVirtual(dest))
+      return dest;
+  }
+  return std::nullopt;
+}
+
+const x86::LiveInterval &RegisterAllocator::getPart(int reg,
+                                                    int position) const {
+  const auto &regParts = parts.at(reg);
+  const auto iter = std::upper_bound(
+      regParts.begin(), regParts.end(), position,
+      [](int position, const x86::LiveInterval *part) {
+        return position < part->getStart();
+      });
+  assert(iter != regParts.begin() && (*std::prev(iter))->covers(position));
+  return **std::prev(iter);
+}
+
+void RegisterAllocator::assignSpillSlots() {
+  spillSlots.assign(function->registerCount, -1);
+  spillSlotCount = 0;
+  std::vector<int> spilled;
+  for (int reg = x86::physicalRegisterCount; reg < function->registerCount;
+       ++reg) {
+    const auto &regParts = parts.at(reg);
+    if (!rematerialisable.at(reg) &&
+        std::any_of(regParts.begin(), regParts.end(),
+                    [](const x86::LiveInterval *part) {
+                      return !part->location;
+                    }))
+      spilled.push_back(reg);
+  }
+  std::sort(spilled.begin(), spilled.end(), [this](int lhs, int rhs) {
+    return parts.at(lhs).front()->getStart() <
+           parts.at(rhs).front()->getStart();
+  });
+  // Slots are handed back once their register is dead.
+  std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>,
+                      std::greater<>>
+      ends;
+  std::vector<int> freeSlots;
+  for (int reg : spilled) {
+    const auto &regParts = parts.at(reg);
+    while (!ends.empty() && ends.top().first <= regParts.front()->getStart()) {
+      freeSlots.push_back(ends.top().second);
+      ends.pop();
+    }
+    int slot = spillSlotCount;
+    if (freeSlots.empty()) {
+      ++spillSlotCount;
+    } else {
+      slot = freeSlots.back();
+      freeSlots.pop_back();
+    }
+    spillSlots.at(reg) = slot;
+    ends.emplace(regParts.back()->getEnd(), slot);
+  }
+}
+
+void RegisterAllocator::rewrite() {
+  const auto &blocks = liveIntervals->getBlocks();
+  auto &instructions = function->instructions;
+  // Moves between parts split in the middle of a block.
+  std::vector<std::vector<Move>> splitMoves(instructions.size());
+  for (int reg = x86::physicalRegisterCount; reg < function->registerCount;
+       ++reg) {
+    const auto &regParts = parts.at(reg);
+    for (size_t i = 1; i < regParts.size(); ++i) {
+      const x86::LiveInterval &before = *regParts.at(i - 1);
+      const x86::LiveInterval &after = *regParts.at(i);
+      if (before.getEnd() != after.getStart() ||
+          before.location == after.location ||
+          std::binary_search(blockStarts.begin(), blockStarts.end(),
+                             after.getStart()))
+        continue;
+      splitMoves.at(after.getStart() / 2)
+          .push_back({reg, before.location, after.location});
+    }
+  }
+  // Moves on the edges between blocks go at the end of the predecessor when
+  // it has only the one successor and otherwise at the start of the successor
+  // when it has only the one predecessor. The rest need a block in between,
+  // except for falling through from a conditional jump.
+  std::vector<std::vector<Move>> endMoves(blocks.size()),
+      startMoves(blocks.size()), fallthroughMoves(blocks.size());
+  std::vector<x86::Instruction> edgeBlocks;
+  size_t jumpTableIndex = 0;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const x86::MachineBlock &block = blocks.at(i);
+    x86::Instruction &last = instructions.at(block.end - 1);
+    const bool isTableJump =
+        last.op == x86::Opcode::Jmp &&
+        last.operands.front().kind == x86::OperandKind::Memory;
+    for (size_t succIndex : block.succs) {
+      const x86::MachineBlock &succ = blocks.at(succIndex);
+      std::vector<Move> moves;
+      for (int reg : succ.liveIn) {
+        if (!x86::isVirtual(reg))
+          continue;
+        const auto from =
+            getPart(reg, x86::getDefPosition(block.end - 1)).location;
+        const auto to = getPart(reg, x86::getUsePosition(succ.begin)).location;
+        if (from != to)
+          moves.push_back({reg, from, to});
+      }
+      if (moves.empty())
+        continue;
+      if (block.succs.size() == 1) {
+        endMoves.at(i) = std::move(moves);
+        continue;
+      }
+      if (succ.preds.size() == 1) {
+        startMoves.at(succIndex) = std::move(moves);
+        continue;
+      }
+      if (last.op == x86::Opcode::Jcc && succIndex == i + 1) {
+        fallthroughMoves.at(i) = std::move(moves);
+        continue;
+      }
+      const Symbol label = symbols.makeUnique("E");
+      const Symbol target =
+          *instructions.at(succ.begin).operands.front().symbol;
+      edgeBlocks.emplace_back(
+          x86::Opcode::Label,
+          std::vector<x86::Operand>{x86::Operand::makeLabel(label)});
+      emitMoves(std::move(moves), edgeBlocks);
+      edgeBlocks.emplace_back(
+          x86::Opcode::Jmp,
+          std::vector<x86::Operand>{x86::Operand::makeLabel(target)});
+      if (!isTableJump) {
+        last.operands.front() = x86::Operand::makeLabel(label);
+        continue;
+      }
+      // Tables were made in the same order as the jumps through them.
+      auto &tableTargets = function->jumpTables.at(jumpTableIndex).targets;
+      std::replace(tableTargets.begin(), tableTargets.end(), target, label);
+      std::replace(last.targets.begin(), last.targets.end(), target, label);
+    }
+    if (isTableJump)
+      ++jumpTableIndex;
+  }
+  std::vector<x86::Instruction> rewritten;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const x86::MachineBlock &block = blocks.at(i);
+    for (size_t j = block.begin; j < block.end; ++j) {
+      x86::Instruction &instruction = instructions.at(j);
+      const bool isLabel = instruction.op == x86::Opcode::Label;
+      const bool isJump = instruction.op == x86::Opcode::Jmp ||
+                          instruction.op == x86::Opcode::Jcc;
+      const bool isLast = j + 1 == block.end;
+      emitMoves(std::move(splitMoves.at(j)), rewritten);
+      if (j == block.begin && !isLabel)
+        emitMoves(std::move(startMoves.at(i)), rewritten);
+      if (isLast && isJump)
+        emitMoves(std::move(endMoves.at(i)), rewritten);
+      rewriteInstruction(std::move(instruction), j, rewritten);
+      if (j == block.begin && isLabel)
+        emitMoves(std::move(startMoves.at(i)), rewritten);
+      if (isLast && !isJump)
+        emitMoves(std::move(endMoves.at(i)), rewritten);
+    }
+    emitMoves(std::move(fallthroughMoves.at(i)), rewritten);
+  }
+  std::move(edgeBlocks.begin(), edgeBlocks.end(),
+            std::back_inserter(rewritten));
+  instructions = std::move(rewritten);
+}
+
+void RegisterAllocator::rewriteInstruction(
+    x86::Instruction instruction, size_t index,
+    std::vector<x86::Instruction> &instructions) {
+  std::unordered_map<int, int> assigned;
+  size_t scratchCount = 0;
+  const std::vector<int> uses = x86::getUses(instruction);
+  const auto foldable = getFoldableOperand(instruction);
+  for (int reg : uses) {
+    if (!x86::isVirtual(reg) || assigned.count(reg))
+      continue;
+    const auto location = getPart(reg, x86::getUsePosition(index)).location;
+    if (location) {
+      assigned.emplace(reg, *location);
+      continue;
+    }
+    // A spilled source that's read once can come straight from its slot.
+    if (foldable && instruction.operands.at(*foldable).isRegister(reg) &&
+        std::count(uses.begin(), uses.end(), reg) == 1) {
+      if (const auto folded = getFoldedOperand(reg, instruction)) {
+        instruction.operands.at(*foldable) = *folded;
+        continue;
+      }
+    }
+    assert(scratchCount < std::size(scratchRegisters));
+    const int scratch = scratchRegisters[scratchCount++];
+    emitLoad(reg, scratch, instructions);
+    assigned.emplace(reg, scratch);
+  }
+  // The result is only written once the operands have been read.
+  std::vector<int> stores;
+  for (int reg : x86::getDefs(instruction)) {
+    if (!x86::isVirtual(reg))
+      continue;
+    const auto location = getPart(reg, x86::getDefPosition(index)).location;
+    if (location) {
+      assigned[reg] = *location;
+      continue;
+    }
+    // It's computed again wherever it's needed.
+    if (rematerialisable.at(reg))
+      return;
+    assigned.emplace(reg, scratchRegisters[0]);
+    stores.push_back(reg);
+  }
+  for (x86::Operand &operand : instruction.operands) {
+    if (operand.reg && x86::isVirtual(*operand.reg))
+      operand.reg = assigned.at(*operand.reg);
+    if (operand.index && x86::isVirtual(*operand.index))
+      operand.index = assigned.at(*operand.index);
+  }
+  if (isCopy(instruction) &&
+      instruction.operands.front().reg == instruction.operands.back().reg)
+    return;
+  instructions.push_back(std::move(instruction));
+  for (int reg : stores)
+    instructions.push_back(makeMove(
+        x86::Operand::makeRegister(assigned.at(reg)), getSpillSlot(reg)));
+}
+
+void RegisterAllocator::emitMoves(
+    std::vector<Move> moves,
+    std::vector<x86::Instruction> &instructions) const {
+  // Stores go first while every register still has its old value and loads
+  // go last once the registers they overwrite have been copied elsewhere.
+  std::vector<Move> copies, loads;
+  for (const Move &move : moves) {
+    if (move.from && move.to) {
+      copies.push_back(move);
+    } else if (move.to) {
+      loads.push_back(move);
+    } else if (!rematerialisable.at(move.reg)) {
+      instructions.push_back(makeMove(x86::Operand::makeRegister(*move.from),
+                                      getSpillSlot(move.reg)));
+    }
+  }
+  while (!copies.empty()) {
+    const auto isRead = [&copies](int reg) {
+      return std::any_of(
+          copies.begin(), copies.end(),
+          [reg](const Move &move) { return move.from == reg; });
+    };
+    auto iter = std::find_if(
+        copies.begin(), copies.end(),
+        [&isRead](const Move &move) { return !isRead(*move.to); });
+    if (iter == copies.end()) {
+      // Every copy overwrites the source of another so they form cycles. Put
+      // one register aside to break one of them.
+      iter = copies.begin();
+      const int reg = *iter->to;
+      instructions.push_back(makeMove(x86::Operand::makeRegister(reg),
+                                      x86::Operand::makeRegister(x86::r10)));
+      for (Move &move : copies) {
+        if (move.from == reg)
+          move.from = x86::r10;
+      }
+    }
+    instructions.push_back(makeMove(x86::Operand::makeRegister(*iter->from),
+                                    x86::Operand::makeRegister(*iter->to)));
+    copies.erase(iter);
+  }
+  for (const Move &move : loads)
+    emitLoad(move.reg, *move.to, instructions);
+}
+
+void RegisterAllocator::emitLoad(
+    int reg, int dest, std::vector<x86::Instruction> &instructions) const {
+  if (const auto &def = rematerialisable.at(reg)) {
+    x86::Instruction instruction = *def;
+    instruction.operands.back() = x86::Operand::makeRegister(dest);
+    instructions.push_back(std::move(instruction));
+    return;
+  }
+  instructions.push_back(
+      makeMove(getSpillSlot(reg), x86::Operand::makeRegister(dest)));
+}
+
+std::optional<x86::Operand>
+RegisterAllocator::getFoldedOperand(int reg,
+                                    const x86::Instruction &instruction) const {
+  const auto &def = rematerialisable.at(reg);
+  if (!def)
+    return getSpillSlot(reg);
+  // Only some instructions take an immediate in place of a register and an
+  // address has to be computed first either way.
+  const bool takesImmediate = instruction.op != x86::Opcode::Imul &&
+                              instruction.op != x86::Opcode::Idiv;
+  if (def->op == x86::Opcode::Mov && takesImmediate)
+    return def->operands.front();
+  return std::nullopt;
+}
+
+x86::Operand RegisterAllocator::getSpillSlot(int reg) const {
+  const int slot = spillSlots.at(reg);
+  assert(slot >= 0);
+  return x86::Operand::makeMemory(
+      x86::rbp, x86::frameBase -
+                    (function->level.locals.size() + slot) * ir::wordSize);
+}
+
+void RegisterAllocator::insertPrologueAndEpilogue(
+    x86::Function &function) const {
+  // Callee saved registers go below the spill slots.
+  std::vector<std::pair<x86::Operand, x86::Operand>> saves;
+  for (size_t i = 0; i < calleeSaved.size(); ++i)
+    saves.emplace_back(
+        x86::Operand::makeRegister(calleeSaved.at(i)),
+        x86::Operand::makeMemory(
+            x86::rbp, x86::frameBase - (function.level.locals.size() +
+                                        spillSlotCount + i) *
+                                           ir::wordSize));
+  std::vector<x86::Instruction> instructions;
+  for (x86::Instruction &instruction : function.instructions) {
+    if (instruction.op == x86::Opcode::Ret) {
+      for (const auto &[reg, slot] : saves)
+        instructions.push_back(makeMove(slot, reg));
+      instructions.emplace_back(x86::Opcode::Leave,
+                                std::vector<x86::Operand>{});
+    }
+    const bool isEntry = instructions.empty();
+    instructions.push_back(std::move(instruction));
+    if (!isEntry)
+      continue;
+    // The function's own label comes first.
+    const auto rbp = x86::Operand::makeRegister(x86::rbp);
+    const auto rsp = x86::Operand::makeRegister(x86::rsp);
+    instructions.emplace_back(x86::Opcode::Push,
+                              std::vector<x86::Operand>{rbp});
+    instructions.push_back(makeMove(rsp, rbp));
+    if (function.frameSize > 0)
+      instructions.emplace_back(
+          x86::Opcode::Sub,
+          std::vector<x86::Operand>{
+              x86::Operand::makeImmediate(function.frameSize), rsp});
+    for (const auto &[reg, slot] : saves)
+      instructions.push_back(makeMove(reg, slot));
+  }
+  function.instructions = std::move(instructions);
+}
+
+} // namespace descartes
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <LiveIntervals.h>
+#include <SymbolTable.h>
+
+#include <array>
+#include <map>
+#include <queue>
+#include <set>
+#include <tuple>
+
+namespace descartes {
+
+// Maps the virtual registers of a function onto the hardware by linear scan
+// over their live intervals in order of where they start. Hardware registers
+// that instructions fix, like the arguments of a call, the registers a call
+// clobbers and %rax and %rdx around a division, have intervals of their own
+// that a virtual register can't overlap while it holds them. That way values
+// that live across a call end up in callee saved registers, which are saved in
+// the frame on entry and restored before the return.
+//
+// When no register is free for all of an interval it gets split, at a block
+// boundary where there is one. The first part keeps the register and the rest
+// is allocated on its own later. When no register is free at all the interval
+// whose next use is furthest away goes to its spill slot until just before
+// that use. Moves between the parts of an interval go where it was split, or
+// on the edges between blocks where the parts disagree. Edges that can't take
+// moves on either end get a block of their own.
+//
+// Spilled values are read into %r10 or %r11 right before each instruction that
+// uses them and written back right after each one that defines them, so
+// neither is ever allocated. Constants and addresses of frame slots or static
+// data are never stored since it's cheaper to compute them again. Spill slots
+// go below the slots of the level and are shared between virtual registers
+// that aren't live at the same time.
+//
+// Once registers are assigned the frame is set up on entry and torn down at
+// the return.
+class RegisterAllocator {
+public:
+  explicit RegisterAllocator(SymbolTable &symbols);
+  virtual ~RegisterAllocator() = default;
+  void run(x86::Function &function);
+
+private:
+  // A value that has to go from one place to another. Missing registers stand
+  // for the spill slot.
+  struct Move {
+    int reg;
+    std::optional<int> from, to;
+  };
+  void allocate();
+  // Sets aside an interval that's in a hole until it comes out of it.
+  void deactivate(x86::LiveInterval &interval);
+  // Keeps track of the ranges that the location of the interval is taken for.
+  void assign(const x86::LiveInterval &interval);
+  void unassign(const x86::LiveInterval &interval);
+  // The first position before `limit` where the interval overlaps anything
+  // assigned to the hardware register.
+  std::optional<int> findAssigned(const x86::LiveInterval &interval, int reg,
+                                  int limit) const;
+  bool tryAllocateFreeRegister(x86::LiveInterval &current);
+  void allocateBlockedRegister(x86::LiveInterval &current);
+  // Moves the part of the interval from `position` onwards into its spill
+  // slot. Whatever comes after its next use is queued up for a register again.
+  void spill(x86::LiveInterval &interval, int position);
+  x86::LiveInterval &split(x86::LiveInterval &interval, int position);
+  // The best position in `(start, limit]` to split an interval at.
+  std::optional<int> findSplitPosition(int start, int limit) const;
+  std::optional<int> getHint(const x86::LiveInterval &interval) const;
+  // The part of the virtual register that's live at the position.
+  const x86::LiveInterval &getPart(int reg, int position) const;
+  void assignSpillSlots();
+  void rewrite();
+  void rewriteInstruction(x86::Instruction instruction, size_t index,
+                          std::vector<x86::Instruction> &instructions);
+  void emitMoves(std::vector<Move> moves,
+                 std::vector<x86::Instruction> &instructions) const;
+  void emitLoad(int reg, int dest,
+                std::vector<x86::Instruction> &instructions) const;
+  // What to use in place of a spilled register read by the instruction
+  // without loading it first.
+  std::optional<x86::Operand>
+  getFoldedOperand(int reg, const x86::Instruction &instruction) const;
+  x86::Operand getSpillSlot(int reg) const;
+  void insertPrologueAndEpilogue(x86::Function &function) const;
+  SymbolTable &symbols;
+  x86::Function *function;
+  std::unique_ptr<x86::LiveIntervals> liveIntervals;
+  std::vector<int> blockStarts;
+  // Every part of each virtual register, sorted by where they start once
+  // allocation is done.
+  std::vector<std::vector<x86::LiveInterval *>> parts;
+  std::vector<std::unique_ptr<x86::LiveInterval>> splitParts;
+  std::priority_queue<std::tuple<int, int, x86::LiveInterval *>,
+                      std::vector<std::tuple<int, int, x86::LiveInterval *>>,
+                      std::greater<>>
+      unhandled;
+  std::vector<x86::LiveInterval *> active;
+  // The intervals in a hole for each hardware register, by where they come
+  // out of it. Only the ones that do so before an interval ends can overlap
+  // it, which keeps values that aren't needed again until much later out of
+  // the way.
+  std::array<std::set<std::tuple<int, int, x86::LiveInterval *>>,
+             x86::physicalRegisterCount>
+      inactive;
+  // The ranges of every interval given each hardware register, by where they
+  // start. They never overlap so finding the first one that overlaps another
+  // interval doesn't mean going through every interval in the register.
+  std::array<std::map<int, std::pair<int, const x86::LiveInterval *>>,
+             x86::physicalRegisterCount>
+      assigned;
+  int position;
+  // The instruction defining each virtual register that can be repeated
+  // instead of spilling its result.
+  std::vector<std::optional<x86::Instruction>> rematerialisable;
+  std::vector<int> spillSlots;
+  int spillSlotCount;
+  std::vector<int> calleeSaved;
+};
+
+} // namespace descartes
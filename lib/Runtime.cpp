@@ -0,0 +1,449 @@
+#include "Runtime.h"
+
+#include <emmintrin.h>
+
+// Nothing here can rely on the C or C++ libraries since native executables
+// link this without them.
+namespace descartes::runtime {
+
+namespace {
+
+const int64_t readCall = 0;
+const int64_t writeCall = 1;
+const int64_t mapCall = 9;
+const int64_t unmapCall = 11;
+const int64_t exitCall = 231;
+const int64_t interrupted = -4;
+const int64_t errorFile = 2;
+// The exit statuses of runtime errors in other Pascal implementations.
+const int64_t inputErrorStatus = 106;
+const int64_t divisionErrorStatus = 200;
+const int64_t rangeErrorStatus = 201;
+// PROT_READ | PROT_WRITE and MAP_PRIVATE | MAP_ANONYMOUS.
+const int64_t readWrite = 0x3;
+const int64_t privateAnonymous = 0x22;
+
+const size_t outputSize = 1 << 16;
+const size_t inputSize = 1 << 16;
+// The longest integer with its sign.
+const size_t integerSize = 20;
+const size_t wordSize = sizeof(uint64_t);
+const size_t chunkSize = 1 << 20;
+
+char output[outputSize];
+size_t outputLength = 0;
+char input[inputSize];
+size_t inputBegin = 0, inputEnd = 0;
+int inputFile = 0, outputFile = 1;
+uint8_t *chunk = nullptr;
+size_t chunkLeft = 0;
+
+// Every pair of decimal digits so that formatting takes one division for two
+// of them.
+const char digitPairs[] = "00010203040506070809"
+                          "10111213141516171819"
+                          "20212223242526272829"
+                          "30313233343536373839"
+                          "40414243444546474849"
+                          "50515253545556575859"
+                          "60616263646566676869"
+                          "70717273747576777879"
+                          "80818283848586878889"
+                          "90919293949596979899";
+
+int64_t systemCall(int64_t number, int64_t first, int64_t second,
+                   int64_t third, int64_t fourth = 0, int64_t fifth = 0,
+                   int64_t sixth = 0) {
+  register int64_t r10 asm("r10") = fourth;
+  register int64_t r8 asm("r8") = fifth;
+  register int64_t r9 asm("r9") = sixth;
+  int64_t result;
+  asm volatile("syscall"
+               : "=a"(result)
+               : "a"(number), "D"(first), "S"(second), "d"(third), "r"(r10),
+                 "r"(r8), "r"(r9)
+               : "rcx", "r11", "memory");
+  return result;
+}
+
+void flushOutput() {
+  const char *data = output;
+  size_t remaining = outputLength;
+  while (remaining > 0) {
+    const int64_t written = systemCall(
+        writeCall, outputFile, reinterpret_cast<int64_t>(data), remaining);
+    if (written == interrupted)
+      continue;
+    // There's nowhere else for the output to go.
+    if (written < 0)
+      break;
+    data += written;
+    remaining -= written;
+  }
+  outputLength = 0;
+}
+
+// Makes room for `size` more bytes of output.
+char *reserve(size_t size) {
+  if (outputSize - outputLength < size)
+    flushOutput();
+  return output + outputLength;
+}
+
+void writeText(const char *text, size_t size) {
+  char *data = reserve(size);
+  for (size_t i = 0; i < size; ++i)
+    data[i] = text[i];
+  outputLength += size;
+}
+
+size_t countDigits(uint64_t value) {
+  size_t count = 1;
+  for (;;) {
+    if (value < 10)
+      return count;
+    if (value < 100)
+      return count + 1;
+    if (value < 1000)
+      return count + 2;
+    if (value < 10000)
+      return count + 3;
+    value /= 10000;
+    count += 4;
+  }
+}
+
+// The next character of input without consuming it, or -1 at the end.
+int peek() {
+  if (inputBegin == inputEnd) {
+    // Whatever has been written so far could be a prompt for this.
+    flushOutput();
+    int64_t count;
+    do {
+      count = systemCall(readCall, inputFile, reinterpret_cast<int64_t>(input),
+                         inputSize);
+    } while (count == interrupted);
+    if (count <= 0)
+      return -1;
+    inputBegin = 0;
+    inputEnd = count;
+  }
+  return static_cast<unsigned char>(input[inputBegin]);
+}
+
+bool isSpace(int c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+// Exits with `message` on standard error after whatever has been written so
+// far.
+void fail(const char *message, size_t size, int64_t status) {
+  flushOutput();
+  systemCall(writeCall, errorFile, reinterpret_cast<int64_t>(message), size);
+  systemCall(exitCall, status, 0, 0);
+}
+
+uint8_t *mapMemory(size_t size) {
+  const int64_t address =
+      systemCall(mapCall, 0, size, readWrite, privateAnonymous, -1, 0);
+  if (address < 0 && address > -4096) {
+    const char message[] = "Out of memory\n";
+    fail(message, sizeof(message) - 1, 1);
+  }
+  return reinterpret_cast<uint8_t *>(address);
+}
+
+size_t getWordCount(uint64_t length) {
+  return 1 + (length + wordSize - 1) / wordSize;
+}
+
+bool isBig(uint64_t length) {
+  return getWordCount(length) * wordSize > chunkSize / 4;
+}
+
+// Makes room for a string of `length` characters. Fresh memory is zeroed, so
+// the padding is too.
+uint64_t *allocateString(uint64_t length) {
+  const size_t size = getWordCount(length) * wordSize;
+  uint64_t *string;
+  // Big strings get memory of their own rather than wasting a chunk.
+  if (isBig(length)) {
+    string = reinterpret_cast<uint64_t *>(mapMemory(size));
+  } else {
+    if (size > chunkLeft) {
+      chunk = mapMemory(chunkSize);
+      chunkLeft = chunkSize;
+    }
+    string = reinterpret_cast<uint64_t *>(chunk);
+    chunk += size;
+    chunkLeft -= size;
+  }
+  string[0] = length;
+  return string;
+}
+
+// Whether a string with room for `capacity` characters is the last thing in
+// the current chunk, so that it can grow or shrink where it is.
+bool isLast(const uint64_t *string, uint64_t capacity) {
+  const uint8_t *end = reinterpret_cast<const uint8_t *>(string) +
+                       getWordCount(capacity) * wordSize;
+  return !isBig(capacity) && end == chunk;
+}
+
+const uint64_t *getString(int64_t value) {
+  return reinterpret_cast<const uint64_t *>(value);
+}
+
+const uint8_t *getCharacters(const uint64_t *string) {
+  return reinterpret_cast<const uint8_t *>(string + 1);
+}
+
+} // namespace
+
+void redirect(int input, int output) {
+  flushOutput();
+  inputFile = input;
+  outputFile = output;
+  inputBegin = inputEnd = 0;
+}
+
+extern const Function functions[] = {
+    {"descartes_write_integer",
+     reinterpret_cast<void *>(&descartes_write_integer), 1},
+    {"descartes_write_boolean",
+     reinterpret_cast<void *>(&descartes_write_boolean), 1},
+    {"descartes_write_string",
+     reinterpret_cast<void *>(&descartes_write_string), 1},
+    {"descartes_write_newline",
+     reinterpret_cast<void *>(&descartes_write_newline), 0},
+    {"descartes_read_integer",
+     reinterpret_cast<void *>(&descartes_read_integer), 0},
+    {"descartes_read_string",
+     reinterpret_cast<void *>(&descartes_read_string), 0},
+    {"descartes_read_newline",
+     reinterpret_cast<void *>(&descartes_read_newline), 0},
+    {"descartes_flush", reinterpret_cast<void *>(&descartes_flush), 0},
+    {"descartes_equal_strings",
+     reinterpret_cast<void *>(&descartes_equal_strings), 2},
+    {"descartes_compare_strings",
+     reinterpret_cast<void *>(&descartes_compare_strings), 2},
+    {"descartes_concat_strings",
+     reinterpret_cast<void *>(&descartes_concat_strings), 2},
+    {"descartes_range_error", reinterpret_cast<void *>(&descartes_range_error),
+     0},
+    {"descartes_division_error",
+     reinterpret_cast<void *>(&descartes_division_error), 0},
+};
+
+} // namespace descartes::runtime
+
+using namespace descartes::runtime;
+
+int64_t descartes_write_integer(int64_t value) {
+  uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : value;
+  const size_t size = countDigits(magnitude) + (value < 0 ? 1 : 0);
+  char *data = reserve(integerSize);
+  // The digits go in from the right two at a time.
+  char *next = data + size;
+  while (magnitude >= 100) {
+    const size_t pair = magnitude % 100 * 2;
+    magnitude /= 100;
+    *--next = digitPairs[pair + 1];
+    *--next = digitPairs[pair];
+  }
+  if (magnitude >= 10) {
+    *--next = digitPairs[magnitude * 2 + 1];
+    *--next = digitPairs[magnitude * 2];
+  } else {
+    *--next = '0' + magnitude;
+  }
+  if (value < 0)
+    *--next = '-';
+  outputLength += size;
+  return 0;
+}
+
+int64_t descartes_write_boolean(int64_t value) {
+  if (value)
+    writeText("TRUE", 4);
+  else
+    writeText("FALSE", 5);
+  return 0;
+}
+
+int64_t descartes_write_string(int64_t value) {
+  const uint64_t *string = getString(value);
+  const uint8_t *characters = getCharacters(string);
+  // Long strings go out a buffer at a time.
+  for (uint64_t written = 0; written < string[0];) {
+    size_t size = string[0] - written;
+    if (size > outputSize)
+      size = outputSize;
+    writeText(reinterpret_cast<const char *>(characters + written), size);
+    written += size;
+  }
+  return 0;
+}
+
+int64_t descartes_write_newline() {
+  writeText("\n", 1);
+  return 0;
+}
+
+int64_t descartes_read_integer() {
+  int c = peek();
+  while (isSpace(c)) {
+    ++inputBegin;
+    c = peek();
+  }
+  const bool isNegative = c == '-';
+  if (c == '-' || c == '+') {
+    ++inputBegin;
+    c = peek();
+  }
+  // Integers are whole words, which have room for one more negative value
+  // than positive ones.
+  const uint64_t limit = (uint64_t(1) << 63) - (isNegative ? 0 : 1);
+  uint64_t value = 0;
+  while (c >= '0' && c <= '9') {
+    const uint64_t digit = c - '0';
+    if (value > (limit - digit) / 10) {
+      const char message[] = "Integer out of range\n";
+      fail(message, sizeof(message) - 1, inputErrorStatus);
+    }
+    value = value * 10 + digit;
+    ++inputBegin;
+    c = peek();
+  }
+  return static_cast<int64_t>(isNegative ? 0 - value : value);
+}
+
+int64_t descartes_read_string() {
+  uint64_t capacity = 3 * wordSize;
+  uint64_t *string = allocateString(capacity);
+  uint64_t length = 0;
+  for (int c = peek(); c >= 0 && c != '\n'; c = peek()) {
+    if (length == capacity) {
+      // Nothing else can have been allocated since the string was, so it can
+      // usually take the room after it. Otherwise start again somewhere
+      // bigger. Memory of its own goes back and the old part of a chunk is
+      // just left behind.
+      const size_t extra =
+          (getWordCount(capacity * 2) - getWordCount(capacity)) * wordSize;
+      if (isLast(string, capacity) && !isBig(capacity * 2) &&
+          extra <= chunkLeft) {
+        chunk += extra;
+        chunkLeft -= extra;
+      } else {
+        uint64_t *bigger = allocateString(capacity * 2);
+        uint8_t *from = reinterpret_cast<uint8_t *>(string + 1),
+                *to = reinterpret_cast<uint8_t *>(bigger + 1);
+        for (uint64_t i = 0; i < length; ++i)
+          to[i] = from[i];
+        if (isBig(capacity))
+          systemCall(unmapCall, reinterpret_cast<int64_t>(string),
+                     getWordCount(capacity) * wordSize, 0);
+        string = bigger;
+      }
+      capacity *= 2;
+    }
+    reinterpret_cast<uint8_t *>(string + 1)[length++] = c;
+    ++inputBegin;
+  }
+  // The unused capacity is already zeroed padding. At the end of the chunk it
+  // goes back for the next string since it was never written.
+  if (isLast(string, capacity)) {
+    const size_t unused =
+        (getWordCount(capacity) - getWordCount(length)) * wordSize;
+    chunk -= unused;
+    chunkLeft += unused;
+  }
+  string[0] = length;
+  return reinterpret_cast<int64_t>(string);
+}
+
+int64_t descartes_read_newline() {
+  for (int c = peek(); c >= 0; c = peek()) {
+    ++inputBegin;
+    if (c == '\n')
+      break;
+  }
+  return 0;
+}
+
+int64_t descartes_flush() {
+  flushOutput();
+  return 0;
+}
+
+int64_t descartes_equal_strings(int64_t lhs, int64_t rhs) {
+  // The same literal is the same data.
+  if (lhs == rhs)
+    return 1;
+  const uint64_t *l = getString(lhs), *r = getString(rhs);
+  if (l[0] != r[0])
+    return 0;
+  // The padding is zero so whole words compare, sixteen characters at a time
+  // and then any word left over.
+  const size_t wordCount = getWordCount(l[0]);
+  size_t i = 1;
+  for (; i + 2 <= wordCount; i += 2) {
+    const __m128i lWords =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(l + i));
+    const __m128i rWords =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(lWords, rWords)) != 0xffff)
+      return 0;
+  }
+  return i == wordCount || l[i] == r[i];
+}
+
+int64_t descartes_compare_strings(int64_t lhs, int64_t rhs) {
+  const uint64_t *l = getString(lhs), *r = getString(rhs);
+  const uint64_t length = l[0] < r[0] ? l[0] : r[0];
+  const uint8_t *lCharacters = getCharacters(l),
+                *rCharacters = getCharacters(r);
+  // Find the first word that differs and then the first character in it,
+  // which is the lowest one since words are little endian.
+  uint64_t i = 0;
+  for (; i + wordSize <= length; i += wordSize) {
+    const uint64_t difference = l[1 + i / wordSize] ^ r[1 + i / wordSize];
+    if (difference) {
+      i += __builtin_ctzll(difference) / 8;
+      return lCharacters[i] < rCharacters[i] ? -1 : 1;
+    }
+  }
+  for (; i < length; ++i) {
+    if (lCharacters[i] != rCharacters[i])
+      return lCharacters[i] < rCharacters[i] ? -1 : 1;
+  }
+  return l[0] < r[0] ? -1 : l[0] > r[0];
+}
+
+int64_t descartes_concat_strings(int64_t lhs, int64_t rhs) {
+  const uint64_t *l = getString(lhs), *r = getString(rhs);
+  // Strings never change so either one can stand for the result.
+  if (r[0] == 0)
+    return lhs;
+  if (l[0] == 0)
+    return rhs;
+  uint64_t *string = allocateString(l[0] + r[0]);
+  uint8_t *characters = reinterpret_cast<uint8_t *>(string + 1);
+  const uint8_t *lCharacters = getCharacters(l),
+                *rCharacters = getCharacters(r);
+  for (uint64_t i = 0; i < l[0]; ++i)
+    characters[i] = lCharacters[i];
+  for (uint64_t i = 0; i < r[0]; ++i)
+    characters[l[0] + i] = rCharacters[i];
+  return reinterpret_cast<int64_t>(string);
+}
+
+int64_t descartes_range_error() {
+  const char message[] = "Range check error\n";
+  fail(message, sizeof(message) - 1, rangeErrorStatus);
+  return 0;
+}
+
+int64_t descartes_division_error() {
+  const char message[] = "Division by zero\n";
+  fail(message, sizeof(message) - 1, divisionErrorStatus);
+  return 0;
+}
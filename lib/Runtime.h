@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// The library that compiled programs call into for input, output, strings and
+// errors.
+//
+// Every function takes and returns 64 bit integers like the functions of the
+// program do, so each backend calls them the same way it calls anything else.
+// Their names have underscores, which Pascal identifiers can't, so they never
+// clash with anything the program defines.
+//
+// Strings are the address of their length in a word followed by their
+// characters, padded with zeros to a whole number of words. They never change
+// once they're made, since another variable can still hold the old value.
+// Literals are constant data in the program and the ones built while it runs
+// go in chunks of memory that are never given back, so a string that grows a
+// character at a time takes memory quadratic in its length. Only the spare
+// room left while reading a line is reused.
+//
+// Output collects in a large buffer that goes out in a single write(2) once
+// it fills up, when the program asks for input or when it finishes. The
+// library talks to the kernel directly and doesn't need anything else, so
+// native executables can link it in without the C library.
+extern "C" {
+int64_t descartes_write_integer(int64_t value);
+int64_t descartes_write_boolean(int64_t value);
+int64_t descartes_write_string(int64_t value);
+int64_t descartes_write_newline();
+int64_t descartes_read_integer();
+// Reads the rest of the current line without the line break.
+int64_t descartes_read_string();
+// Skips the rest of the current line of input.
+int64_t descartes_read_newline();
+int64_t descartes_flush();
+int64_t descartes_equal_strings(int64_t lhs, int64_t rhs);
+// Less than, equal to or greater than zero as `lhs` comes before, is the same
+// as or comes after `rhs`.
+int64_t descartes_compare_strings(int64_t lhs, int64_t rhs);
+int64_t descartes_concat_strings(int64_t lhs, int64_t rhs);
+// Reports an array index that is out of bounds and exits.
+int64_t descartes_range_error();
+// Reports a division by zero and exits.
+int64_t descartes_division_error();
+}
+
+namespace descartes::runtime {
+
+// Bytecode refers to runtime functions by their position here so the order
+// can't change without changing the image version.
+enum class FunctionKind : size_t {
+  WriteInteger,
+  WriteBoolean,
+  WriteString,
+  WriteNewline,
+  ReadInteger,
+  ReadString,
+  ReadNewline,
+  Flush,
+  EqualStrings,
+  CompareStrings,
+  ConcatStrings,
+  RangeError,
+  DivisionError,
+  FunctionCount,
+};
+
+struct Function {
+  const char *name;
+  void *address;
+  size_t argumentCount;
+};
+
+extern const Function functions[];
+const size_t functionCount = static_cast<size_t>(FunctionKind::FunctionCount);
+
+inline const Function &getFunction(FunctionKind kind) {
+  return functions[static_cast<size_t>(kind)];
+}
+
+inline std::optional<size_t> findFunction(std::string_view name) {
+  for (size_t i = 0; i < functionCount; ++i) {
+    if (name == functions[i].name)
+      return i;
+  }
+  return std::nullopt;
+}
+
+// Reads and writes other file descriptors instead of the standard ones, after
+// flushing whatever has been written so far.
+void redirect(int input, int output);
+
+} // namespace descartes::runtime
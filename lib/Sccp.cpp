@@ -0,0 +1,234 @@
+#include "Sccp.h"
+
+#include <cassert>
+
+namespace descartes {
+
+bool Sccp::LatticeValue::operator==(const LatticeValue &other) const {
+  return kind == other.kind && (kind != Kind::Constant || value == other.value);
+}
+
+Sccp::Sccp() : function(nullptr) {}
+
+void Sccp::run(ssa::Function &function) {
+  this->function = &function;
+  values.clear();
+  executableEdges.clear();
+  executableBlocks.clear();
+  blockWorklist.clear();
+  valueWorklist.clear();
+  ssa::Block *entry = function.getEntry();
+  executableBlocks.insert(entry->id);
+  blockWorklist.push_back(entry);
+  while (!blockWorklist.empty() || !valueWorklist.empty()) {
+    while (!valueWorklist.empty()) {
+      ssa::Instruction *instruction = valueWorklist.back();
+      valueWorklist.pop_back();
+      for (ssa::Instruction *user : instruction->users) {
+        if (executableBlocks.count(user->parent->id))
+          visit(user);
+      }
+    }
+    while (!blockWorklist.empty()) {
+      ssa::Block *block = blockWorklist.back();
+      blockWorklist.pop_back();
+      for (const auto &instruction : block->instructions)
+        visit(instruction.get());
+    }
+  }
+  rewrite();
+  this->function = nullptr;
+}
+
+Sccp::LatticeValue Sccp::getValue(const ssa::Instruction *instruction) const {
+  // Constants made while rewriting aren't in the map.
+  if (instruction->op == ssa::Opcode::Const)
+    return {LatticeValue::Kind::Constant, instruction->value};
+  const auto iter = values.find(instruction);
+  if (iter == values.end())
+    return {LatticeValue::Kind::Unknown, 0};
+  return iter->second;
+}
+
+void Sccp::setValue(ssa::Instruction *instruction, LatticeValue value) {
+  const LatticeValue current = getValue(instruction);
+  if (current == value)
+    return;
+  // Values can only move down the lattice.
+  assert(current.kind != LatticeValue::Kind::Overdefined);
+  values[instruction] = value;
+  valueWorklist.push_back(instruction);
+}
+
+void Sccp::markEdgeExecutable(ssa::Block *from, ssa::Block *to) {
+  if (!executableEdges.emplace(from->id, to->id).second)
+    return;
+  if (executableBlocks.insert(to->id).second) {
+    blockWorklist.push_back(to);
+    return;
+  }
+  // The block has already been evaluated but its phis now have another
+  // incoming value.
+  for (ssa::Instruction *phi : to->getPhis())
+    visitPhi(phi);
+}
+
+bool Sccp::isEdgeExecutable(const ssa::Block *from,
+                            const ssa::Block *to) const {
+  return executableEdges.count(std::make_pair(from->id, to->id)) > 0;
+}
+
+void Sccp::visit(ssa::Instruction *instruction) {
+  if (instruction->op == ssa::Opcode::Phi)
+    visitPhi(instruction);
+  else if (instruction->isTerminator())
+    visitTerminator(instruction);
+  else if (instruction->op != ssa::Opcode::Store)
+    setValue(instruction, evaluate(*instruction));
+}
+
+void Sccp::visitPhi(ssa::Instruction *phi) {
+  // Meet the incoming values of the edges that can be taken.
+  LatticeValue result = {LatticeValue::Kind::Unknown, 0};
+  const auto &preds = phi->parent->preds;
+  for (size_t i = 0; i < phi->operands.size(); ++i) {
+    if (!isEdgeExecutable(preds.at(i), phi->parent))
+      continue;
+    const LatticeValue incoming = getValue(phi->operands.at(i));
+    if (incoming.kind == LatticeValue::Kind::Unknown)
+      continue;
+    if (result.kind == LatticeValue::Kind::Unknown) {
+      result = incoming;
+    } else if (!(result == incoming)) {
+      result = {LatticeValue::Kind::Overdefined, 0};
+      break;
+    }
+  }
+  setValue(phi, result);
+}
+
+void Sccp::visitTerminator(ssa::Instruction *terminator) {
+  ssa::Block *block = terminator->parent;
+  if (terminator->op == ssa::Opcode::Return)
+    return;
+  if (const auto taken = getTakenSucc(*terminator)) {
+    markEdgeExecutable(block, block->succs.at(*taken));
+    return;
+  }
+  // Wait until every operand is known before deciding anything.
+  for (const ssa::Instruction *operand : terminator->operands) {
+    if (getValue(operand).kind == LatticeValue::Kind::Unknown)
+      return;
+  }
+  for (ssa::Block *succ : block->succs)
+    markEdgeExecutable(block, succ);
+}
+
+Sccp::LatticeValue Sccp::evaluate(const ssa::Instruction &instruction) const {
+  const LatticeValue overdefined = {LatticeValue::Kind::Overdefined, 0};
+  switch (instruction.op) {
+  case ssa::Opcode::Const:
+    return {LatticeValue::Kind::Constant, instruction.value};
+  case ssa::Opcode::ArithOp: {
+    const LatticeValue lhs = getValue(instruction.operands.at(0));
+    const LatticeValue rhs = getValue(instruction.operands.at(1));
+    if (lhs.kind == LatticeValue::Kind::Constant &&
+        rhs.kind == LatticeValue::Kind::Constant) {
+      // Operations that can't be folded are left to fail at runtime.
+      if (const auto folded =
+              ir::foldArithOp(instruction.arithOp, lhs.value, rhs.value))
+        return {LatticeValue::Kind::Constant, *folded};
+      return overdefined;
+    }
+    // Multiplying by zero is zero whatever the other side is.
+    const auto isZero = [](const LatticeValue &value) {
+      return value.kind == LatticeValue::Kind::Constant && value.value == 0;
+    };
+    if ((instruction.arithOp == ir::ArithOpKind::Multiply ||
+         instruction.arithOp == ir::ArithOpKind::MultiplyHigh ||
+         instruction.arithOp == ir::ArithOpKind::And) &&
+        (isZero(lhs) || isZero(rhs)))
+      return {LatticeValue::Kind::Constant, 0};
+    if (lhs.kind == LatticeValue::Kind::Unknown ||
+        rhs.kind == LatticeValue::Kind::Unknown)
+      return {LatticeValue::Kind::Unknown, 0};
+    return overdefined;
+  }
+  default:
+    // Memory, calls, arguments and addresses are only known at runtime.
+    return overdefined;
+  }
+}
+
+std::optional<size_t>
+Sccp::getTakenSucc(const ssa::Instruction &terminator) const {
+  switch (terminator.op) {
+  case ssa::Opcode::Jump:
+    return 0;
+  case ssa::Opcode::CondJump: {
+    const LatticeValue lhs = getValue(terminator.operands.at(0));
+    const LatticeValue rhs = getValue(terminator.operands.at(1));
+    if (lhs.kind != LatticeValue::Kind::Constant ||
+        rhs.kind != LatticeValue::Kind::Constant)
+      return std::nullopt;
+    return ir::foldRelOp(terminator.relOp, lhs.value, rhs.value) ? 0 : 1;
+  }
+  case ssa::Opcode::JumpTable: {
+    const LatticeValue index = getValue(terminator.operands.at(0));
+    if (index.kind != LatticeValue::Kind::Constant || index.value < 0 ||
+        static_cast<size_t>(index.value) >= terminator.parent->succs.size())
+      return std::nullopt;
+    return index.value;
+  }
+  default:
+    return std::nullopt;
+  }
+}
+
+void Sccp::rewrite() {
+  for (const auto &block : function->blocks) {
+    if (!executableBlocks.count(block->id))
+      continue;
+    std::vector<ssa::Instruction *> instructions;
+    for (const auto &instruction : block->instructions)
+      instructions.push_back(instruction.get());
+    const ssa::Instruction *firstNonPhi =
+        std::next(block->instructions.begin(), block->getPhis().size())->get();
+    for (ssa::Instruction *instruction : instructions) {
+      const LatticeValue value = getValue(instruction);
+      if (instruction->op == ssa::Opcode::Const ||
+          value.kind != LatticeValue::Kind::Constant ||
+          instruction->hasSideEffects())
+        continue;
+      auto constant = function->makeInstruction(ssa::Opcode::Const);
+      constant->value = value.value;
+      // Phis have to stay at the start of the block.
+      ssa::Instruction *replacement = block->insertBefore(
+          instruction->op == ssa::Opcode::Phi ? firstNonPhi : instruction,
+          std::move(constant));
+      if (instruction == firstNonPhi)
+        firstNonPhi = replacement;
+      instruction->replaceAllUsesWith(replacement);
+      block->erase(instruction);
+    }
+    // Branches that always go the same way become jumps.
+    ssa::Instruction *terminator = block->getTerminator();
+    if (terminator->op == ssa::Opcode::Jump)
+      continue;
+    const auto taken = getTakenSucc(*terminator);
+    if (!taken)
+      continue;
+    for (size_t i = block->succs.size(); i-- > 0;) {
+      if (i != *taken)
+        function->removeEdge(block.get(), i);
+    }
+    block->erase(terminator);
+    block->append(function->makeInstruction(ssa::Opcode::Jump));
+  }
+  // Blocks that never became executable can now only be reached from each
+  // other.
+  function->removeUnreachableBlocks();
+  function->removeTrivialPhis();
+}
+
+} // namespace descartes
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Ssa.h>
+
+#include <set>
+#include <unordered_map>
+
+namespace descartes {
+
+// Sparse conditional constant propagation from Wegman and Zadeck's "Constant
+// Propagation with Conditional Branches". Values only ever move down the
+// lattice from unknown to a single constant to overdefined, and a block is only
+// evaluated once an edge into it is known to be taken. Afterwards constant
+// values are replaced, branches on constants become jumps and blocks that can
+// never execute are removed.
+class Sccp {
+public:
+  Sccp();
+  virtual ~Sccp() = default;
+  void run(ssa::Function &function);
+
+private:
+  struct LatticeValue {
+    enum class Kind {
+      Unknown,
+      Constant,
+      Overdefined,
+    };
+    bool operator==(const LatticeValue &other) const;
+    Kind kind;
+    int value;
+  };
+  LatticeValue getValue(const ssa::Instruction *instruction) const;
+  void setValue(ssa::Instruction *instruction, LatticeValue value);
+  void markEdgeExecutable(ssa::Block *from, ssa::Block *to);
+  bool isEdgeExecutable(const ssa::Block *from, const ssa::Block *to) const;
+  void visit(ssa::Instruction *instruction);
+  void visitPhi(ssa::Instruction *phi);
+  void visitTerminator(ssa::Instruction *terminator);
+  LatticeValue evaluate(const ssa::Instruction &instruction) const;
+  std::optional<size_t> getTakenSucc(const ssa::Instruction &terminator) const;
+  void rewrite();
+  ssa::Function *function;
+  std::unordered_map<const ssa::Instruction *, LatticeValue> values;
+  std::set<std::pair<int, int>> executableEdges;
+  std::set<int> executableBlocks;
+  std::vector<ssa::Block *> blockWorklist;
+  std::vector<ssa::Instruction *> valueWorklist;
+};
+
+} // namespace descartes
@@ -1,35 +1,78 @@
 #include <Semantic.h>
 
+#include <algorithm>
 #include <cassert>
+#include <limits>
 
 namespace descartes {
 
-Semantic::Semantic(SymbolTable &symbols)
-    : symbols(symbols), env(symbols), translate(symbols) {}
+namespace {
 
-const std::vector<ir::Fragment> &Semantic::analyse(Block &program) {
+// Arrays live in the frame so they have to fit in it comfortably.
+const int64_t maxArrayWords = 1 << 24;
+
+bool isOrdinal(const Type *type) {
+  return type->getKind() == TypeKind::Integer ||
+         type->getKind() == TypeKind::Enum ||
+         type->getKind() == TypeKind::Boolean;
+}
+
+// The smallest storage that holds every value between the bounds.
+ir::MemType getNarrowestType(int64_t low, int64_t high) {
+  if (low >= 0) {
+    if (high <= std::numeric_limits<uint8_t>::max())
+      return ir::MemType::Uint8;
+    if (high <= std::numeric_limits<uint16_t>::max())
+      return ir::MemType::Uint16;
+    return ir::MemType::Uint32;
+  }
+  if (low >= std::numeric_limits<int8_t>::min() &&
+      high <= std::numeric_limits<int8_t>::max())
+    return ir::MemType::Int8;
+  if (low >= std::numeric_limits<int16_t>::min() &&
+      high <= std::numeric_limits<int16_t>::max())
+    return ir::MemType::Int16;
+  return ir::MemType::Int32;
+}
+
+} // namespace
+
+Semantic::Semantic(SymbolTable &symbols, bool isRangeChecked)
+    : symbols(symbols), env(symbols), constEvaluator(symbols, env),
+      translate(symbols), isRuntimeUsed(false),
+      isRangeChecked(isRangeChecked) {}
+
+std::vector<ir::Fragment> &Semantic::analyse(Block &program) {
   // TODO: Consolidate `enterScope` and `enterLevel`.
   env.enterScope();
   translate.enterLevel(symbols.make("main"));
-  analyseBlock(program);
+  auto body = analyseBlock(program);
+  if (isRuntimeUsed) {
+    std::vector<ir::StatementPtr> seq;
+    seq.push_back(std::move(body));
+    seq.push_back(translate.makeCallStatement(
+        translate.makeRuntimeCall(runtime::FunctionKind::Flush, {})));
+    body = translate.makeSequence(std::move(seq));
+  }
+  translate.pushFrag(std::move(body));
   translate.exitLevel();
   env.exitScope();
   return translate.getFrags();
 }
 
-void Semantic::analyseBlock(Block &block) {
+ir::StatementPtr Semantic::analyseBlock(Block &block) {
   analyseConstDefs(block.constDefs);
   analyseTypeDefs(block.typeDefs);
   analyseVarDecls(block.varDecls);
   analyseFunctions(block.functions);
-  analyseBlockStatements(*block.statements);
+  return analyseBlockStatements(*block.statements);
 }
 
 void Semantic::analyseConstDefs(const std::vector<ConstDef> &constDefs) {
   for (const auto &cd : constDefs) {
-    const auto exprType = analyseExpr(*cd.constExpr);
-    const ir::Access access = translate.getCurrentLevel()->allocLocal();
-    if (!env.setVarType(cd.identifier, VarEntry(exprType.second, access)))
+    // Constants are folded into each use so they don't need a frame slot.
+    ConstEntry constVal = constEvaluator.evaluate(*cd.constExpr);
+    if (!env.setConstValue(cd.identifier, constVal))
       throw SemanticError("Const already defined");
   }
 }
@@ -44,9 +87,135 @@ void Semantic::analyseTypeDefs(const std::vector<TypeDef> &typeDefs) {
     }
     if (!resolvedType)
       throw SemanticError("Could not resolve type");
+    if (resolvedType->getKind() == TypeKind::Array)
+      analyseArray(*static_cast<const Array *>(resolvedType));
+    else if (resolvedType->getKind() == TypeKind::Subrange)
+      analyseSubrange(*static_cast<const Subrange *>(resolvedType));
     if (!env.setResolvedType(td.identifier, resolvedType))
       throw SemanticError("Type already defined");
+    // Enum values are constants holding their ordinal.
+    if (td.type->getKind() == TypeKind::Enum) {
+      const auto *enumType = static_cast<const Enum *>(td.type.get());
+      for (size_t i = 0; i < enumType->enums.size(); ++i) {
+        if (!env.setConstValue(enumType->enums.at(i),
+                               ConstEntry(enumType, static_cast<int>(i))))
+          throw SemanticError("Enum value already defined");
+      }
+    }
+  }
+}
+
+const Semantic::ArrayLayout &Semantic::analyseArray(const Array &array) {
+  // Aliases of an array share its layout.
+  const auto iter = arrayLayouts.find(&array);
+  if (iter != arrayLayouts.end())
+    return iter->second;
+  ArrayLayout layout;
+  std::tie(layout.low, layout.high) =
+      analyseArrayIndex(array.index, layout.indexType);
+  const Type *elementType = array.elementType.get();
+  if (elementType->getKind() == TypeKind::Alias) {
+    elementType = env.getResolvedType(
+        static_cast<const Alias *>(elementType)->typeIdentifier);
+    if (!elementType)
+      throw SemanticError("Could not resolve type");
+  } else if (elementType->getKind() == TypeKind::Subrange) {
+    analyseSubrange(*static_cast<const Subrange *>(elementType));
+  } else if (elementType->getKind() != TypeKind::Array) {
+    throw SemanticError("Array element type must be named");
   }
+  layout.elementType = elementType;
+  layout.isPacked =
+      array.isPacked && elementType->getKind() == TypeKind::Boolean;
+  int64_t elementOffset = 0;
+  if (layout.isPacked) {
+    // Whole words of bits, so that they can be read and written as words.
+    const int64_t words =
+        (static_cast<int64_t>(layout.high) - layout.low + ir::wordSize * 8) /
+        (ir::wordSize * 8);
+    if (words > maxArrayWords)
+      throw SemanticError("Array is too large");
+    layout.elementSize = 0;
+    layout.size = static_cast<int>(words * ir::wordSize);
+    layout.firstOffset = 0;
+    return arrayLayouts.emplace(&array, layout).first->second;
+  }
+  if (elementType->getKind() == TypeKind::Array) {
+    const ArrayLayout &element =
+        analyseArray(*static_cast<const Array *>(elementType));
+    layout.elementSize = element.size;
+    elementOffset = element.firstOffset;
+  } else if (elementType->getKind() == TypeKind::Record) {
+    throw SemanticError("Arrays of records are not supported");
+  } else {
+    layout.elementSize = ir::getMemSize(getMemType(elementType));
+  }
+  const int64_t size = (static_cast<int64_t>(layout.high) - layout.low + 1) *
+                       layout.elementSize;
+  if (size > maxArrayWords * ir::wordSize)
+    throw SemanticError("Array is too large");
+  layout.size = static_cast<int>(size);
+  // Addresses are computed with 32 bit constants.
+  layout.firstOffset =
+      static_cast<int64_t>(layout.low) * layout.elementSize + elementOffset;
+  if (layout.firstOffset < std::numeric_limits<int>::min() ||
+      layout.firstOffset > std::numeric_limits<int>::max())
+    throw SemanticError("Array bounds are too large");
+  return arrayLayouts.emplace(&array, layout).first->second;
+}
+
+std::pair<int, int> Semantic::analyseArrayIndex(const ArrayIndex &index,
+                                                const Type *&indexType) {
+  if (index.typeIdentifier) {
+    indexType = env.getResolvedType(*index.typeIdentifier);
+    if (!indexType)
+      throw SemanticError("Could not resolve type");
+    // Indexing by a whole type covers each of its values.
+    if (indexType->getKind() == TypeKind::Boolean)
+      return {0, 1};
+    if (indexType->getKind() == TypeKind::Enum)
+      return {0,
+              static_cast<int>(
+                  static_cast<const Enum *>(indexType)->enums.size()) -
+                  1};
+    if (indexType->getKind() == TypeKind::Subrange) {
+      const SubrangeLayout &subrange = subrangeLayouts.at(indexType);
+      indexType = subrange.hostType;
+      return {subrange.low, subrange.high};
+    }
+    throw SemanticError("Array index must be an integer or enum range");
+  }
+  const ConstEntry low = constEvaluator.evaluate(*index.low),
+                   high = constEvaluator.evaluate(*index.high);
+  if (!isOrdinal(low.constType) ||
+      !isCompatibleType(low.constType, high.constType))
+    throw SemanticError("Array index must be an integer or enum range");
+  indexType = low.constType;
+  const int lowValue = std::get<int>(low.value),
+            highValue = std::get<int>(high.value);
+  if (lowValue > highValue)
+    throw SemanticError("Array index range is empty");
+  return {lowValue, highValue};
+}
+
+const Semantic::SubrangeLayout &
+Semantic::analyseSubrange(const Subrange &subrange) {
+  const auto iter = subrangeLayouts.find(&subrange);
+  if (iter != subrangeLayouts.end())
+    return iter->second;
+  const ConstEntry low = constEvaluator.evaluate(*subrange.low),
+                   high = constEvaluator.evaluate(*subrange.high);
+  if (!isOrdinal(low.constType) ||
+      !isCompatibleType(low.constType, high.constType))
+    throw SemanticError("Subrange bounds must be integers or enum values");
+  SubrangeLayout layout;
+  layout.low = std::get<int>(low.value);
+  layout.high = std::get<int>(high.value);
+  if (layout.low > layout.high)
+    throw SemanticError("Subrange is empty");
+  layout.hostType = low.constType;
+  layout.memType = getNarrowestType(layout.low, layout.high);
+  return subrangeLayouts.emplace(&subrange, layout).first->second;
 }
 
 void Semantic::analyseVarDecls(const std::vector<VarDecl> &varDecls) {
@@ -54,7 +223,13 @@ void Semantic::analyseVarDecls(const std::vector<VarDecl> &varDecls) {
     const Type *varType = env.getResolvedType(vd.type);
     if (!varType)
       throw SemanticError("Could not find type of variable");
-    const ir::Access access = translate.getCurrentLevel()->allocLocal();
+    ir::Level *level = translate.getCurrentLevel();
+    const ir::Access access =
+        varType->getKind() == TypeKind::Array
+            ? level->allocArray((arrayLayouts.at(varType).size +
+                                 ir::wordSize - 1) /
+                                ir::wordSize)
+            : level->allocLocal();
     if (!env.setVarType(vd.identifier, VarEntry(varType, access)))
       throw SemanticError("Variable already defined");
   }
@@ -70,16 +245,22 @@ void Semantic::analyseFunctions(
       returnType = env.getResolvedType(*f->returnType);
       if (!returnType)
         throw SemanticError("Could not resolve return type");
+      if (returnType->getKind() == TypeKind::Array)
+        throw SemanticError("Functions can't return arrays");
     }
     std::vector<const Type *> argTypes;
     for (const auto &arg : f->args) {
       const Type *argType = env.getResolvedType(arg.type);
       if (!argType)
         throw SemanticError("Could not resolve type of argument");
+      // Arguments are passed by value in a single word.
+      if (argType->getKind() == TypeKind::Array)
+        throw SemanticError("Arrays can't be passed to functions");
       argTypes.push_back(argType);
     }
     // Set the function type so outer callers can use it.
-    FunctionEntry functionType(f.get(), returnType, std::move(argTypes));
+    FunctionEntry functionType(f.get(), returnType, std::move(argTypes),
+                               translate.getCurrentLevel());
     env.setFunctionType(f->name, std::move(functionType));
   }
   // Now analyse each function block.
@@ -87,37 +268,58 @@ void Semantic::analyseFunctions(
     env.enterScope();
     translate.enterLevel(f->name);
     const FunctionEntry *functionType = env.getFunctionType(f->name);
+    // The static link comes first, followed by each param.
+    translate.getCurrentLevel()->allocStaticLink();
+    for (size_t i = 0; i < f->args.size(); ++i) {
+      const ir::Access argAccess = translate.getCurrentLevel()->allocFormal();
+      if (!env.setVarType(f->args.at(i).identifier,
+                          VarEntry(functionType->argTypes.at(i), argAccess)))
+        throw SemanticError("Argument already defined");
+    }
+    std::optional<ir::Access> result;
     if (functionType->returnType) {
-      const ir::Access access = translate.getCurrentLevel()->allocLocal();
+      result = translate.getCurrentLevel()->allocLocal();
       // Is this the right spot here? In Pascal, functions have a variable with
       // the same name as the function itself that is used to capture the return
       // value.
-      if (!env.setVarType(f->name, VarEntry(functionType->returnType, access)))
+      if (!env.setVarType(f->name, VarEntry(functionType->returnType, *result)))
         throw SemanticError("Return value already defined");
     }
-    // Register each param as a variable.
-    for (size_t i = 0; i < f->args.size(); ++i) {
-      const ir::Access argAccess = translate.getCurrentLevel()->allocLocal();
-      if (!env.setVarType(f->args.at(i).identifier,
-                          VarEntry(functionType->argTypes.at(i), argAccess)))
-        throw SemanticError("Argument already defined");
-    }
     // Now semantically analyse the associated nested functions and blocks.
-    analyseBlock(f->block);
+    auto body = analyseBlock(f->block);
+    if (result) {
+      std::vector<ir::StatementPtr> seq;
+      seq.push_back(std::move(body));
+      seq.push_back(translate.makeReturn(*result));
+      body = translate.makeSequence(std::move(seq));
+    }
+    translate.pushFrag(std::move(body));
     translate.exitLevel();
     env.exitScope();
   }
 }
 
-void Semantic::analyseBlockStatements(Statement &statement) {
+ir::StatementPtr Semantic::analyseBlockStatements(Statement &statement) {
   auto *compound = statementCast<Compound *>(statement);
   if (!compound)
     throw SemanticError("Block body must be a compound statement");
-  for (const auto &s : compound->body)
-    analyseStatement(*s);
+  return analyseCompound(*compound);
 }
 
 ir::StatementPtr Semantic::analyseStatement(Statement &statement) {
+  // Nested statements check their own indices.
+  std::vector<ir::StatementPtr> outerChecks = std::move(pendingChecks);
+  pendingChecks.clear();
+  ir::StatementPtr result = analyseStatementKind(statement);
+  if (!pendingChecks.empty()) {
+    pendingChecks.push_back(std::move(result));
+    result = translate.makeSequence(std::move(pendingChecks));
+  }
+  pendingChecks = std::move(outerChecks);
+  return result;
+}
+
+ir::StatementPtr Semantic::analyseStatementKind(Statement &statement) {
   switch (statement.getKind()) {
   case StatementKind::Assignment:
     return analyseAssignment(statement);
@@ -129,6 +331,8 @@ ir::StatementPtr Semantic::analyseStatement(Statement &statement) {
     return analyseCase(statement);
   case StatementKind::While:
     return analyseWhile(statement);
+  case StatementKind::For:
+    return analyseFor(statement);
   case StatementKind::Call:
     return analyseCallStatement(statement);
   default:
@@ -140,10 +344,18 @@ ir::StatementPtr Semantic::analyseAssignment(Statement &statement) {
   // TODO: Handle const.
   auto *assignment = statementCast<Assignment *>(statement);
   assert(assignment);
-  auto lhs = analyseExpr(*assignment->lhs), rhs = analyseExpr(*assignment->rhs);
-  if (!isCompatibleType(lhs.second, rhs.second))
+  if (auto *lhsVarRef = exprCast<VarRef *>(*assignment->lhs))
+    checkAssignable(*lhsVarRef);
+  auto lhs = analyseTarget(*assignment->lhs);
+  auto rhs = analyseExpr(*assignment->rhs);
+  if (!isCompatibleType(lhs.type, rhs.second))
     throw SemanticError("Assignment error");
-  auto moveVal = translate.makeMove(std::move(lhs.first), std::move(rhs.first));
+  if (lhs.type->getKind() == TypeKind::Array)
+    throw SemanticError("Cannot assign whole arrays");
+  auto value = checkRange(std::move(rhs.first), lhs.type);
+  if (lhs.bit)
+    return translate.makePackedStore(*lhs.bit, std::move(value));
+  auto moveVal = translate.makeMove(std::move(lhs.expr), std::move(value));
   return moveVal;
 }
 
@@ -174,9 +386,30 @@ ir::StatementPtr Semantic::analyseIf(Statement &statement) {
 }
 
 ir::StatementPtr Semantic::analyseCase(Statement &statement) {
-  // TODO: Implement case statements.
-  static_cast<void>(statement);
-  throw SemanticError("Case statements not implemented");
+  auto *caseStatement = statementCast<Case *>(statement);
+  assert(caseStatement);
+  auto selector = analyseExpr(*caseStatement->expr);
+  const Type *selectorType = selector.second;
+  if (!selectorType || (selectorType->getKind() != TypeKind::Integer &&
+                        selectorType->getKind() != TypeKind::Enum &&
+                        selectorType->getKind() != TypeKind::Boolean))
+    throw SemanticError("Case selector must be an ordinal type");
+  Translate::CaseArms arms;
+  for (const auto &arm : caseStatement->arms) {
+    std::vector<int> values;
+    for (const auto &value : arm.values) {
+      const ConstEntry label = constEvaluator.evaluate(*value);
+      if (!isCompatibleType(selectorType, label.constType))
+        throw SemanticError("Case label doesn't match selector type");
+      values.push_back(std::get<int>(label.value));
+    }
+    arms.emplace_back(std::move(values), analyseStatement(*arm.statement));
+  }
+  ir::StatementPtr elseVal;
+  if (caseStatement->elseStatement)
+    elseVal = analyseStatement(*caseStatement->elseStatement);
+  return translate.makeCase(std::move(selector.first), std::move(arms),
+                            std::move(elseVal));
 }
 
 ir::StatementPtr Semantic::analyseWhile(Statement &statement) {
@@ -185,23 +418,153 @@ ir::StatementPtr Semantic::analyseWhile(Statement &statement) {
   auto condType = analyseExpr(*whileStatement->cond);
   if (condType.second->getKind() != TypeKind::Boolean)
     throw SemanticError("While condition must be a boolean");
+  // The condition is checked again on every iteration.
+  std::vector<ir::StatementPtr> condChecks = std::move(pendingChecks);
+  pendingChecks.clear();
   auto bodyVal = analyseStatement(*whileStatement->body);
   auto whileVal =
-      translate.makeWhile(std::move(condType.first), std::move(bodyVal));
+      translate.makeWhile(std::move(condChecks), std::move(condType.first),
+                          std::move(bodyVal));
   return whileVal;
 }
 
+ir::StatementPtr Semantic::analyseFor(Statement &statement) {
+  auto *forStatement = statementCast<For *>(statement);
+  assert(forStatement);
+  if (env.getConstValue(forStatement->controlIdentifier))
+    throw SemanticError("Cannot assign to constant");
+  const VarEntry *control = env.getVarType(forStatement->controlIdentifier);
+  if (!control)
+    throw SemanticError("Referencing unknown variable");
+  const Type *controlType = getHostType(control->varType);
+  if (controlType->getKind() != TypeKind::Integer &&
+      controlType->getKind() != TypeKind::Enum &&
+      controlType->getKind() != TypeKind::Boolean)
+    throw SemanticError("For loop control variable must be an ordinal type");
+  for (const auto &controlVariable : controlVariables) {
+    if (controlVariable.first == control)
+      throw SemanticError("Cannot assign to for loop control variable");
+  }
+  auto first = analyseExpr(*forStatement->begin),
+       last = analyseExpr(*forStatement->end);
+  if (!isCompatibleType(controlType, first.second) ||
+      !isCompatibleType(controlType, last.second))
+    throw SemanticError("For loop bounds don't match control variable type");
+  // The bounds of a subrange aren't checked on every step, only the values
+  // that the loop is given, and only if it runs at all.
+  std::optional<std::pair<int, int>> range;
+  if (control->varType->getKind() == TypeKind::Subrange) {
+    if (first.first->getKind() == ir::ExprKind::Const &&
+        last.first->getKind() == ir::ExprKind::Const) {
+      const int firstValue = static_cast<const ir::Const &>(*first.first).value,
+                lastValue = static_cast<const ir::Const &>(*last.first).value;
+      const bool isEmpty = forStatement->to ? firstValue > lastValue
+                                            : firstValue < lastValue;
+      if (!isEmpty) {
+        first.first = checkRange(std::move(first.first), control->varType);
+        last.first = checkRange(std::move(last.first), control->varType);
+      }
+    } else if (isRangeChecked) {
+      const SubrangeLayout &layout = subrangeLayouts.at(control->varType);
+      range.emplace(layout.low, layout.high);
+    }
+  }
+  controlVariables.emplace_back(control, false);
+  auto bodyVal = analyseStatement(*forStatement->body);
+  const bool isRead = controlVariables.back().second;
+  controlVariables.pop_back();
+  // Without any reads in the body the iterations can simply be counted, as
+  // long as nested functions can't see the variable either.
+  const ir::Access access = control->access;
+  const bool countDown = !isRead &&
+                         access.level == translate.getCurrentLevel() &&
+                         !access.level->isEscaping(access.offset);
+  return translate.makeFor(access, std::move(first.first),
+                           std::move(last.first), forStatement->to, countDown,
+                           range, std::move(bodyVal));
+}
+
 ir::StatementPtr Semantic::analyseCallStatement(Statement &statement) {
   auto *callStatement = statementCast<CallStatement *>(statement);
   assert(callStatement);
   auto *call = exprCast<Call *>(*callStatement->call);
   if (!call)
     throw SemanticError("Call statement with a non-call node within");
+  if (const Intrinsic *intrinsic = env.getIntrinsic(call->functionName))
+    return analyseIntrinsic(*call, *intrinsic);
   auto callVal = analyseExpr(*call);
   return translate.makeCallStatement(std::move(callVal.first));
 }
 
+ir::StatementPtr Semantic::analyseIntrinsic(Call &call, Intrinsic intrinsic) {
+  const bool isWrite =
+      intrinsic == Intrinsic::Write || intrinsic == Intrinsic::Writeln;
+  std::vector<ir::StatementPtr> seq;
+  for (const auto &arg : call.args) {
+    // Reading into an argument can change the indices of the next one so each
+    // is checked just before it's used.
+    auto argVal = isWrite ? analyseWriteArg(*arg) : analyseReadArg(*arg);
+    for (auto &check : pendingChecks)
+      seq.push_back(std::move(check));
+    pendingChecks.clear();
+    seq.push_back(std::move(argVal));
+  }
+  if (intrinsic == Intrinsic::Writeln)
+    seq.push_back(translate.makeCallStatement(
+        translate.makeRuntimeCall(runtime::FunctionKind::WriteNewline, {})));
+  else if (intrinsic == Intrinsic::Readln)
+    seq.push_back(translate.makeCallStatement(
+        translate.makeRuntimeCall(runtime::FunctionKind::ReadNewline, {})));
+  isRuntimeUsed = true;
+  return translate.makeSequence(std::move(seq));
+}
+
+ir::StatementPtr Semantic::analyseWriteArg(Expr &arg) {
+  auto value = analyseExpr(arg);
+  // Procedures don't have a type.
+  const Type *valueType = value.second;
+  runtime::FunctionKind kind;
+  if (valueType && valueType->getKind() == TypeKind::Integer)
+    kind = runtime::FunctionKind::WriteInteger;
+  else if (valueType && valueType->getKind() == TypeKind::Boolean)
+    kind = runtime::FunctionKind::WriteBoolean;
+  else if (valueType && valueType->getKind() == TypeKind::String)
+    kind = runtime::FunctionKind::WriteString;
+  else
+    throw SemanticError("Can't write a value of this type");
+  std::vector<ir::ExprPtr> args;
+  args.push_back(std::move(value.first));
+  return translate.makeCallStatement(
+      translate.makeRuntimeCall(kind, std::move(args)));
+}
+
+ir::StatementPtr Semantic::analyseReadArg(Expr &arg) {
+  if (auto *varRef = exprCast<VarRef *>(arg))
+    checkAssignable(*varRef);
+  else if (!exprCast<IndexRef *>(arg))
+    throw SemanticError("Can only read into a variable");
+  auto var = analyseExprKind(arg);
+  // Booleans can't be read so this is never a bit of a packed array.
+  runtime::FunctionKind kind;
+  if (getHostType(var.second)->getKind() == TypeKind::Integer)
+    kind = runtime::FunctionKind::ReadInteger;
+  else if (var.second->getKind() == TypeKind::String)
+    kind = runtime::FunctionKind::ReadString;
+  else
+    throw SemanticError("Can only read integers and strings");
+  auto value = checkRange(translate.makeRuntimeCall(kind, {}), var.second);
+  return translate.makeMove(std::move(var.first), std::move(value));
+}
+
 Semantic::ExprResult Semantic::analyseExpr(Expr &expr) {
+  auto result = analyseExprKind(expr);
+  // Procedures don't have a type.
+  if (result.second)
+    result.second = getHostType(result.second);
+  return result;
+}
+
+Semantic::ExprResult Semantic::analyseExprKind(Expr &expr) {
   switch (expr.getKind()) {
   case ExprKind::StringLiteral:
     return analyseStringLiteral(expr);
@@ -215,6 +578,8 @@ Semantic::ExprResult Semantic::analyseExpr(Expr &expr) {
     return analyseCall(expr);
   case ExprKind::MemberRef:
     return analyseMemberRef(expr);
+  case ExprKind::IndexRef:
+    return analyseIndexRef(expr);
   }
   throw SemanticError("Unknown expr type");
 }
@@ -240,9 +605,21 @@ Semantic::ExprResult Semantic::analyseNumberLiteral(Expr &expr) {
 Semantic::ExprResult Semantic::analyseVarRef(Expr &expr) {
   auto *varRef = exprCast<VarRef *>(expr);
   assert(varRef);
+  // Constants are substituted with their value at every use.
+  if (const auto *constEntry = env.getConstValue(varRef->identifier)) {
+    auto constVal = translate.makeConstValue(*constEntry);
+    return {std::move(constVal), constEntry->constType};
+  }
   const auto *varType = env.getVarType(varRef->identifier);
   if (!varType)
     throw SemanticError("Referencing unknown variable");
+  for (auto &controlVariable : controlVariables) {
+    if (controlVariable.first == varType)
+      controlVariable.second = true;
+  }
+  // Arrays are only ever indexed, which needs their address.
+  if (varType->varType->getKind() == TypeKind::Array)
+    return {translate.makeVarAddress(varType->access), varType->varType};
   auto varRefVal = translate.makeVarRef(varType->access);
   return {std::move(varRefVal), varType->varType};
 }
@@ -255,6 +632,14 @@ Semantic::ExprResult Semantic::analyseBinaryOp(Expr &expr) {
              *boolType = env.getResolvedType(*symbols.lookup("boolean"));
   switch (binaryOp->kind) {
   case BinaryOpKind::Add:
+    // Adding strings joins them together.
+    if (lhs.second->getKind() == TypeKind::String &&
+        rhs.second->getKind() == TypeKind::String) {
+      auto concatVal =
+          translate.makeConcat(std::move(lhs.first), std::move(rhs.first));
+      return {std::move(concatVal), lhs.second};
+    }
+    [[fallthrough]];
   case BinaryOpKind::Subtract:
   case BinaryOpKind::Multiply:
   case BinaryOpKind::Divide: {
@@ -262,17 +647,36 @@ Semantic::ExprResult Semantic::analyseBinaryOp(Expr &expr) {
     if (lhs.second->getKind() != TypeKind::Integer ||
         rhs.second->getKind() != TypeKind::Integer)
       throw SemanticError("Expected integer in binary op");
+    // Dividing by zero is always checked, whether or not indices are.
+    if (binaryOp->kind == BinaryOpKind::Divide &&
+        (rhs.first->getKind() != ir::ExprKind::Const ||
+         static_cast<const ir::Const &>(*rhs.first).value == 0))
+      rhs.first = translate.makeDivisorCheck(std::move(rhs.first),
+                                             pendingChecks);
+    const bool constOperands = lhs.first->getKind() == ir::ExprKind::Const &&
+                               rhs.first->getKind() == ir::ExprKind::Const;
     auto binOpVal = translate.makeArithOp(binaryOp->kind, std::move(lhs.first),
                                           std::move(rhs.first));
+    // Constant operands are held to the same limits as a constant section.
+    if (constOperands && binOpVal->getKind() != ir::ExprKind::Const)
+      throw SemanticError("Overflow in constant expression");
     return {std::move(binOpVal), integerType};
   }
   case BinaryOpKind::LessThan:
   case BinaryOpKind::GreaterThan:
   case BinaryOpKind::LessThanEqual:
   case BinaryOpKind::GreaterThanEqual: {
-    // Must be integers.
-    if (lhs.second->getKind() != TypeKind::Integer ||
-        rhs.second->getKind() != TypeKind::Integer)
+    // Must be integers, strings or values of the same enum.
+    const bool isEnum = lhs.second->getKind() == TypeKind::Enum &&
+                        lhs.second == rhs.second;
+    if (lhs.second->getKind() == TypeKind::String &&
+        rhs.second->getKind() == TypeKind::String) {
+      auto relOpVal = translate.makeStringCompare(
+          binaryOp->kind, std::move(lhs.first), std::move(rhs.first));
+      return {std::move(relOpVal), boolType};
+    }
+    if (!isEnum && (lhs.second->getKind() != TypeKind::Integer ||
+                    rhs.second->getKind() != TypeKind::Integer))
       throw SemanticError("Expected integer in binary op");
     auto relOpVal = translate.makeCondJump(binaryOp->kind, std::move(lhs.first),
                                            std::move(rhs.first));
@@ -284,13 +688,21 @@ Semantic::ExprResult Semantic::analyseBinaryOp(Expr &expr) {
   }
   case BinaryOpKind::Equal:
   case BinaryOpKind::NotEqual:
-    // Can be integers, strings or booleans.
+    // Can be integers, strings, booleans or values of the same enum.
     const auto lhsKind = lhs.second->getKind(), rhsKind = rhs.second->getKind();
-    if (lhsKind != rhsKind)
+    if (lhsKind != rhsKind ||
+        (lhsKind == TypeKind::Enum && lhs.second != rhs.second))
       throw SemanticError("Mismatching types in equality");
     if (lhsKind != TypeKind::Integer && lhsKind != TypeKind::String &&
-        lhsKind != TypeKind::Boolean)
-      throw SemanticError("Expected integer, string or boolean in equality");
+        lhsKind != TypeKind::Boolean && lhsKind != TypeKind::Enum)
+      throw SemanticError(
+          "Expected integer, string, boolean or enum in equality");
+    // Strings are compared by their characters rather than their addresses.
+    if (lhsKind == TypeKind::String) {
+      auto relOpVal = translate.makeStringCompare(
+          binaryOp->kind, std::move(lhs.first), std::move(rhs.first));
+      return {std::move(relOpVal), boolType};
+    }
     auto relOpVal = translate.makeCondJump(binaryOp->kind, std::move(lhs.first),
                                            std::move(rhs.first));
     return {std::move(relOpVal), boolType};
@@ -303,6 +715,8 @@ Semantic::ExprResult Semantic::analyseCall(Expr &expr) {
   assert(call);
   // Get function.
   const FunctionEntry *function = env.getFunctionType(call->functionName);
+  if (!function && env.getIntrinsic(call->functionName))
+    throw SemanticError("Intrinsic procedures don't return a value");
   if (!function)
     throw SemanticError("Unknown function");
   if (function->argTypes.size() != call->args.size())
@@ -313,10 +727,10 @@ Semantic::ExprResult Semantic::analyseCall(Expr &expr) {
     const Type *fArg = function->argTypes[i];
     if (!isCompatibleType(fArg, providedType.second))
       throw SemanticError("Gave function wrong type");
-    argVals.push_back(std::move(providedType.first));
+    argVals.push_back(checkRange(std::move(providedType.first), fArg));
   }
-  auto callVal =
-      std::make_unique<ir::Call>(call->functionName, std::move(argVals));
+  auto callVal = translate.makeCall(call->functionName, function->parent,
+                                    std::move(argVals));
   // Nullptr is fine.
   return {std::move(callVal), function->returnType};
 }
@@ -342,7 +756,88 @@ Semantic::ExprResult Semantic::analyseMemberRef(Expr &expr) {
   throw SemanticError("Can't find the right member on the record type");
 }
 
+Semantic::ExprResult Semantic::analyseIndexRef(Expr &expr) {
+  auto element = analyseElement(expr);
+  if (element.bit)
+    return {translate.makePackedLoad(*element.bit), element.type};
+  return {std::move(element.expr), element.type};
+}
+
+Semantic::Target Semantic::analyseTarget(Expr &expr) {
+  if (exprCast<IndexRef *>(expr))
+    return analyseElement(expr);
+  auto result = analyseExprKind(expr);
+  return {std::move(result.first), result.second, std::nullopt};
+}
+
+Semantic::Target Semantic::analyseElement(Expr &expr) {
+  // Take every index at once so that the address is a single computation.
+  std::vector<Expr *> indexExprs;
+  Expr *arrayExpr = &expr;
+  while (auto *indexRef = exprCast<IndexRef *>(*arrayExpr)) {
+    indexExprs.push_back(indexRef->index.get());
+    arrayExpr = indexRef->expr.get();
+  }
+  std::reverse(indexExprs.begin(), indexExprs.end());
+  auto array = analyseExpr(*arrayExpr);
+  const Type *type = array.second;
+  std::vector<ir::ExprPtr> indices;
+  std::vector<std::pair<int, int>> bounds;
+  int elementSize = ir::wordSize;
+  // The index of the bit if the last array is packed.
+  ir::ExprPtr bitIndex;
+  int bitLow = 0, bitHigh = 0;
+  for (Expr *indexExpr : indexExprs) {
+    if (!type || type->getKind() != TypeKind::Array || bitIndex)
+      throw SemanticError("Indexing something that isn't an array");
+    const ArrayLayout &layout = arrayLayouts.at(type);
+    auto index = analyseExpr(*indexExpr);
+    if (!index.second || !isCompatibleType(layout.indexType, index.second))
+      throw SemanticError("Array index doesn't match index type");
+    if (index.first->getKind() == ir::ExprKind::Const) {
+      const int value = static_cast<const ir::Const &>(*index.first).value;
+      if (value < layout.low || value > layout.high)
+        throw SemanticError("Array index out of range");
+    }
+    type = layout.elementType;
+    if (layout.isPacked) {
+      bitIndex = std::move(index.first);
+      bitLow = layout.low;
+      bitHigh = layout.high;
+      continue;
+    }
+    indices.push_back(std::move(index.first));
+    bounds.emplace_back(layout.low, layout.high);
+    elementSize = layout.elementSize;
+  }
+  ir::ExprPtr address = std::move(array.first);
+  if (!indices.empty())
+    address = translate.makeElementAddress(
+        std::move(address), std::move(indices), bounds, elementSize,
+        isRangeChecked ? &pendingChecks : nullptr);
+  if (bitIndex) {
+    if (isRangeChecked && bitIndex->getKind() != ir::ExprKind::Const)
+      bitIndex = translate.makeRangeCheck(std::move(bitIndex), bitLow,
+                                          bitHigh, pendingChecks);
+    auto position =
+        translate.makeArithOp(BinaryOpKind::Subtract, std::move(bitIndex),
+                              std::make_unique<ir::Const>(bitLow));
+    return {nullptr, type,
+            translate.makePackedBit(std::move(address), std::move(position),
+                                    pendingChecks)};
+  }
+  // Selecting a row leaves an array, which stays an address.
+  if (type->getKind() == TypeKind::Array)
+    return {std::move(address), type, std::nullopt};
+  return {std::make_unique<ir::Mem>(std::move(address), getMemType(type)), type,
+          std::nullopt};
+}
+
 bool Semantic::isCompatibleType(const Type *lhs, const Type *rhs) const {
+  // Subranges take any value of their host type, and range checks catch the
+  // ones outside them.
+  lhs = getHostType(lhs);
+  rhs = getHostType(rhs);
   // Different resolved kinds are always incompatible.
   if (lhs->getKind() != rhs->getKind())
     return false;
@@ -353,11 +848,60 @@ bool Semantic::isCompatibleType(const Type *lhs, const Type *rhs) const {
     return true;
   case TypeKind::Record:
   case TypeKind::Enum:
+  case TypeKind::Array:
     return lhs == rhs;
   case TypeKind::Alias:
+  case TypeKind::Subrange:
     break;
   }
   throw SemanticError("Unreachable");
 }
 
+void Semantic::checkAssignable(const VarRef &varRef) const {
+  if (env.getConstValue(varRef.identifier))
+    throw SemanticError("Cannot assign to constant");
+  const VarEntry *var = env.getVarType(varRef.identifier);
+  for (const auto &controlVariable : controlVariables) {
+    if (controlVariable.first == var)
+      throw SemanticError("Cannot assign to for loop control variable");
+  }
+}
+
+ir::ExprPtr Semantic::checkRange(ir::ExprPtr value, const Type *type) {
+  if (type->getKind() != TypeKind::Subrange)
+    return value;
+  const SubrangeLayout &layout = subrangeLayouts.at(type);
+  if (value->getKind() == ir::ExprKind::Const) {
+    const int64_t constValue = static_cast<const ir::Const &>(*value).value;
+    if (constValue < layout.low || constValue > layout.high)
+      throw SemanticError("Value out of range");
+    return value;
+  }
+  if (!isRangeChecked)
+    return value;
+  return translate.makeRangeCheck(std::move(value), layout.low, layout.high,
+                                  pendingChecks);
+}
+
+const Type *Semantic::getHostType(const Type *type) const {
+  if (type->getKind() == TypeKind::Subrange)
+    return subrangeLayouts.at(type).hostType;
+  return type;
+}
+
+ir::MemType Semantic::getMemType(const Type *type) const {
+  switch (type->getKind()) {
+  case TypeKind::Boolean:
+    return ir::MemType::Uint8;
+  case TypeKind::Enum:
+    return getNarrowestType(
+        0, static_cast<int64_t>(static_cast<const Enum *>(type)->enums.size()) -
+               1);
+  case TypeKind::Subrange:
+    return subrangeLayouts.at(type).memType;
+  default:
+    return ir::MemType::Word;
+  }
+}
+
 } // namespace descartes
@@ -1,45 +1,117 @@
 #pragma once
 
+#include <ConstEval.h>
 #include <Environment.h>
 #include <Interfaces.h>
 #include <SymbolTable.h>
 #include <Translate.h>
 
+#include <unordered_map>
+
 namespace descartes {
 
 class Semantic {
 public:
-  explicit Semantic(SymbolTable &symbols);
+  // `isRangeChecked` stops the program when an array index is out of bounds
+  // or a value doesn't fit its subrange, instead of carrying on regardless.
+  Semantic(SymbolTable &symbols, bool isRangeChecked);
   virtual ~Semantic() = default;
-  const std::vector<ir::Fragment> &analyse(Block &program);
+  std::vector<ir::Fragment> &analyse(Block &program);
 
 private:
-  void analyseBlock(Block &block);
+  // Where the elements of an array type are, worked out when it's defined.
+  // Sizes are in bytes since elements can be narrower than a word.
+  struct ArrayLayout {
+    int low, high;
+    const Type *indexType;
+    const Type *elementType;
+    int elementSize;
+    // Packed arrays of booleans give each element a single bit instead.
+    bool isPacked;
+    // The size of the whole array and the offset its first element would be
+    // at if every index started at zero, which is how addresses are computed.
+    int size;
+    int64_t firstOffset;
+  };
+  // The bounds of a subrange type and the type its values behave as.
+  // Variables of it take a whole word but array elements only take as many
+  // bytes as the bounds need.
+  struct SubrangeLayout {
+    int low, high;
+    const Type *hostType;
+    ir::MemType memType;
+  };
+  ir::StatementPtr analyseBlock(Block &block);
   void analyseConstDefs(const std::vector<ConstDef> &constDefs);
   void analyseTypeDefs(const std::vector<TypeDef> &typeDefs);
+  const ArrayLayout &analyseArray(const Array &array);
+  std::pair<int, int> analyseArrayIndex(const ArrayIndex &index,
+                                        const Type *&indexType);
+  const SubrangeLayout &analyseSubrange(const Subrange &subrange);
   void analyseVarDecls(const std::vector<VarDecl> &varDecls);
   void
   analyseFunctions(const std::vector<std::unique_ptr<Function>> &functions);
-  void analyseBlockStatements(Statement &statement);
+  ir::StatementPtr analyseBlockStatements(Statement &statement);
   ir::StatementPtr analyseStatement(Statement &statement);
+  ir::StatementPtr analyseStatementKind(Statement &statement);
   ir::StatementPtr analyseAssignment(Statement &statement);
   ir::StatementPtr analyseCompound(Statement &statement);
   ir::StatementPtr analyseIf(Statement &statement);
   ir::StatementPtr analyseCase(Statement &statement);
   ir::StatementPtr analyseWhile(Statement &statement);
+  ir::StatementPtr analyseFor(Statement &statement);
   ir::StatementPtr analyseCallStatement(Statement &statement);
+  ir::StatementPtr analyseIntrinsic(Call &call, Intrinsic intrinsic);
+  ir::StatementPtr analyseWriteArg(Expr &arg);
+  ir::StatementPtr analyseReadArg(Expr &arg);
   using ExprResult = std::pair<ir::ExprPtr, const Type *>;
+  // Something that can be assigned to, which is either an expression or an
+  // element of a packed array.
+  struct Target {
+    ir::ExprPtr expr;
+    const Type *type;
+    std::optional<Translate::PackedBit> bit;
+  };
+  Target analyseTarget(Expr &expr);
+  Target analyseElement(Expr &expr);
+  // The value of an expression, with subranges replaced by their host type.
   ExprResult analyseExpr(Expr &expr);
+  // The value of an expression with the type it was declared with, which is
+  // what an assignment to it has to respect.
+  ExprResult analyseExprKind(Expr &expr);
   ExprResult analyseStringLiteral(Expr &expr);
   ExprResult analyseNumberLiteral(Expr &expr);
   ExprResult analyseVarRef(Expr &expr);
   ExprResult analyseBinaryOp(Expr &expr);
   ExprResult analyseCall(Expr &expr);
   ExprResult analyseMemberRef(Expr &expr);
+  ExprResult analyseIndexRef(Expr &expr);
   bool isCompatibleType(const Type *lhs, const Type *rhs) const;
+  void checkAssignable(const VarRef &varRef) const;
+  // The value to store into something of type `type`. Constants outside a
+  // subrange are rejected and anything else is range checked if checks are
+  // on.
+  ir::ExprPtr checkRange(ir::ExprPtr value, const Type *type);
+  const Type *getHostType(const Type *type) const;
+  // How a value of the type is stored as an array element.
+  ir::MemType getMemType(const Type *type) const;
   SymbolTable &symbols;
   Environment env;
+  ConstEvaluator constEvaluator;
   Translate translate;
+  // The control variables of the enclosing `for` loops and whether the loop
+  // body reads them.
+  std::vector<std::pair<const VarEntry *, bool>> controlVariables;
+  // Whether anything calls into the runtime, which means the main program has
+  // to flush its output at the end.
+  bool isRuntimeUsed;
+  bool isRangeChecked;
+  std::unordered_map<const Type *, ArrayLayout> arrayLayouts;
+  std::unordered_map<const Type *, SubrangeLayout> subrangeLayouts;
+  // The range checks of the indices, subrange values and divisors in the
+  // statement being analysed and the bits of packed arrays that it uses, which
+  // have to be worked out before it.
+  std::vector<ir::StatementPtr> pendingChecks;
 };
 
 } // namespace descartes
@@ -0,0 +1,358 @@
+#include "Ssa.h"
+
+#include "Dominators.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace descartes::ssa {
+
+namespace {
+
+bool isValue(const Instruction &instruction) {
+  return !instruction.isTerminator() && instruction.op != Opcode::Store;
+}
+
+// An address split into a base and a constant offset from it. Frame slots
+// share a base that is distinct from any other pointer.
+struct DecomposedAddress {
+  const Instruction *base;
+  int offset;
+};
+
+DecomposedAddress decompose(const Instruction &address) {
+  if (address.op == Opcode::Local)
+    return {nullptr, address.value};
+  if (address.op == Opcode::ArithOp &&
+      address.arithOp == ir::ArithOpKind::Add) {
+    const Instruction &lhs = *address.operands.at(0);
+    const Instruction &rhs = *address.operands.at(1);
+    if (rhs.op == Opcode::Const)
+      return {&lhs, rhs.value};
+    if (lhs.op == Opcode::Const)
+      return {&rhs, lhs.value};
+  }
+  return {&address, 0};
+}
+
+} // namespace
+
+Instruction::Instruction(Opcode op, int id)
+    : op(op), id(id), parent(nullptr), value(0),
+      arithOp(ir::ArithOpKind::Add), relOp(ir::RelOpKind::Equal),
+      memType(ir::MemType::Word) {}
+
+bool Instruction::isTerminator() const {
+  switch (op) {
+  case Opcode::Jump:
+  case Opcode::CondJump:
+  case Opcode::JumpTable:
+  case Opcode::Return:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool Instruction::hasSideEffects() const {
+  return op == Opcode::Store || op == Opcode::Call || isTerminator();
+}
+
+bool Instruction::readsMemory() const {
+  return op == Opcode::Load || op == Opcode::Call;
+}
+
+void Instruction::addOperand(Instruction *operand) {
+  useIndices.push_back(operand->users.size());
+  operand->users.push_back(this);
+  operand->userOperands.push_back(operands.size());
+  operands.push_back(operand);
+}
+
+void Instruction::setOperand(size_t index, Instruction *operand) {
+  if (operands.at(index) == operand)
+    return;
+  removeUse(index);
+  operands.at(index) = operand;
+  useIndices.at(index) = operand->users.size();
+  operand->users.push_back(this);
+  operand->userOperands.push_back(index);
+}
+
+void Instruction::removeOperand(size_t index) {
+  removeUse(index);
+  operands.erase(operands.begin() + index);
+  useIndices.erase(useIndices.begin() + index);
+  // The later operands move down by one.
+  for (size_t i = index; i < operands.size(); ++i)
+    --operands.at(i)->userOperands.at(useIndices.at(i));
+}
+
+void Instruction::dropOperands() {
+  for (size_t i = 0; i < operands.size(); ++i)
+    removeUse(i);
+  operands.clear();
+  useIndices.clear();
+}
+
+void Instruction::replaceAllUsesWith(Instruction *replacement) {
+  assert(replacement != this);
+  for (size_t i = 0; i < users.size(); ++i) {
+    Instruction *user = users.at(i);
+    const size_t operandIndex = userOperands.at(i);
+    user->operands.at(operandIndex) = replacement;
+    user->useIndices.at(operandIndex) = replacement->users.size();
+    replacement->users.push_back(user);
+    replacement->userOperands.push_back(operandIndex);
+  }
+  users.clear();
+  userOperands.clear();
+}
+
+void Instruction::removeUse(size_t index) {
+  // The last use of the operand takes the place of this one.
+  Instruction *operand = operands.at(index);
+  const size_t useIndex = useIndices.at(index);
+  assert(operand->users.at(useIndex) == this);
+  Instruction *lastUser = operand->users.back();
+  const size_t lastOperand = operand->userOperands.back();
+  operand->users.at(useIndex) = lastUser;
+  operand->userOperands.at(useIndex) = lastOperand;
+  lastUser->useIndices.at(lastOperand) = useIndex;
+  operand->users.pop_back();
+  operand->userOperands.pop_back();
+}
+
+Block::Block(int id, std::optional<Symbol> label) : id(id), label(label) {}
+
+Instruction *Block::getTerminator() const {
+  if (instructions.empty() || !instructions.back()->isTerminator())
+    return nullptr;
+  return instructions.back().get();
+}
+
+std::vector<Instruction *> Block::getPhis() const {
+  std::vector<Instruction *> phis;
+  for (const auto &instruction : instructions) {
+    if (instruction->op != Opcode::Phi)
+      break;
+    phis.push_back(instruction.get());
+  }
+  return phis;
+}
+
+size_t Block::getPredIndex(const Block *pred) const {
+  const auto iter = std::find(preds.begin(), preds.end(), pred);
+  assert(iter != preds.end());
+  return iter - preds.begin();
+}
+
+Instruction *Block::append(InstructionPtr instruction) {
+  return insert(instructions.end(), std::move(instruction));
+}
+
+Instruction *Block::insertBefore(const Instruction *position,
+                                 InstructionPtr instruction) {
+  assert(position->parent == this);
+  return insert(position->position, std::move(instruction));
+}
+
+Instruction *Block::insertPhi(InstructionPtr phi) {
+  assert(phi->op == Opcode::Phi);
+  return insert(instructions.begin(), std::move(phi));
+}
+
+void Block::erase(Instruction *instruction) {
+  assert(instruction->users.empty());
+  instruction->dropOperands();
+  remove(instruction);
+}
+
+InstructionPtr Block::remove(Instruction *instruction) {
+  assert(instruction->parent == this);
+  InstructionPtr result = std::move(*instruction->position);
+  instructions.erase(instruction->position);
+  result->parent = nullptr;
+  return result;
+}
+
+Instruction *Block::insert(InstructionList::iterator position,
+                           InstructionPtr instruction) {
+  instruction->parent = this;
+  const auto iter = instructions.insert(position, std::move(instruction));
+  (*iter)->position = iter;
+  return iter->get();
+}
+
+Function::Function(ir::Level &level)
+    : level(level), valueCount(0), blockCount(0) {}
+
+Block *Function::getEntry() const { return blocks.front().get(); }
+
+Block *Function::makeBlock(std::optional<Symbol> label) {
+  blocks.push_back(std::make_unique<Block>(blockCount++, label));
+  return blocks.back().get();
+}
+
+InstructionPtr Function::makeInstruction(Opcode op) {
+  return std::make_unique<Instruction>(op, valueCount++);
+}
+
+void Function::addEdge(Block *from, Block *to) {
+  from->succs.push_back(to);
+  to->preds.push_back(from);
+}
+
+void Function::removeEdge(Block *from, size_t succIndex) {
+  Block *to = from->succs.at(succIndex);
+  from->succs.erase(from->succs.begin() + succIndex);
+  const size_t predIndex = to->getPredIndex(from);
+  to->preds.erase(to->preds.begin() + predIndex);
+  for (Instruction *phi : to->getPhis())
+    phi->removeOperand(predIndex);
+}
+
+Block *Function::splitEdge(Block *from, size_t succIndex) {
+  Block *to = from->succs.at(succIndex);
+  Block *middle = makeBlock();
+  from->succs.at(succIndex) = middle;
+  to->preds.at(to->getPredIndex(from)) = middle;
+  middle->preds.push_back(from);
+  middle->succs.push_back(to);
+  middle->append(makeInstruction(Opcode::Jump));
+  return middle;
+}
+
+void Function::removeUnreachableBlocks() {
+  std::vector<bool> reachable(blockCount, false);
+  std::vector<Block *> worklist = {getEntry()};
+  reachable.at(getEntry()->id) = true;
+  while (!worklist.empty()) {
+    Block *block = worklist.back();
+    worklist.pop_back();
+    for (Block *succ : block->succs) {
+      if (!reachable.at(succ->id)) {
+        reachable.at(succ->id) = true;
+        worklist.push_back(succ);
+      }
+    }
+  }
+  for (auto &block : blocks) {
+    if (reachable.at(block->id))
+      continue;
+    // Edges between unreachable blocks go with them. Detaching those could
+    // take operands from a phi whose operands have already been dropped.
+    for (size_t i = block->succs.size(); i-- > 0;) {
+      if (reachable.at(block->succs.at(i)->id))
+        removeEdge(block.get(), i);
+    }
+    for (auto &instruction : block->instructions)
+      instruction->dropOperands();
+  }
+  // Values in unreachable blocks can only be used by other unreachable blocks
+  // so once every operand is dropped they can all be destroyed.
+  blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+                              [&reachable](const BlockPtr &block) {
+                                return !reachable.at(block->id);
+                              }),
+               blocks.end());
+}
+
+void Function::removeTrivialPhis() {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const auto &block : blocks) {
+      for (Instruction *phi : block->getPhis()) {
+        Instruction *same = nullptr;
+        bool trivial = true;
+        for (Instruction *operand : phi->operands) {
+          if (operand == phi || operand == same)
+            continue;
+          if (same) {
+            trivial = false;
+            break;
+          }
+          same = operand;
+        }
+        if (!trivial || !same)
+          continue;
+        phi->replaceAllUsesWith(same);
+        block->erase(phi);
+        changed = true;
+      }
+    }
+  }
+}
+
+bool mayAlias(const Instruction &lhs, int lhsSize, const Instruction &rhs,
+              int rhsSize) {
+  const DecomposedAddress l = decompose(lhs), r = decompose(rhs);
+  const bool overlaps =
+      l.offset < r.offset + rhsSize && r.offset < l.offset + lhsSize;
+  if (l.base == r.base)
+    return overlaps;
+  const auto isStatic = [](const Instruction *base) {
+    return base && base->op == Opcode::Name;
+  };
+  if (isStatic(l.base) && isStatic(r.base))
+    return !(l.base->symbol == r.base->symbol) || overlaps;
+  // Static data is never part of a frame.
+  return !(isStatic(l.base) && !r.base) && !(isStatic(r.base) && !l.base);
+}
+
+std::string verify(const Function &function) {
+  const DominatorTree domTree(function);
+  const auto describe = [](const Instruction &instruction) {
+    return "Instruction " + std::to_string(instruction.id) + " in block " +
+           std::to_string(instruction.parent->id);
+  };
+  for (const auto &block : function.blocks) {
+    const Instruction *terminator = block->getTerminator();
+    if (!terminator)
+      return "Block " + std::to_string(block->id) + " has no terminator";
+    for (const Block *succ : block->succs) {
+      if (std::count(succ->preds.begin(), succ->preds.end(), block.get()) !=
+          std::count(block->succs.begin(), block->succs.end(), succ))
+        return "Block " + std::to_string(block->id) +
+               " has mismatched edges";
+    }
+    bool seenNonPhi = false;
+    for (const auto &instruction : block->instructions) {
+      const std::string name = describe(*instruction);
+      if (instruction->parent != block.get() ||
+          instruction->position->get() != instruction.get())
+        return name + " has the wrong parent";
+      if (instruction->isTerminator() && instruction.get() != terminator)
+        return name + " is a terminator in the middle of the block";
+      if (instruction->op == Opcode::Phi) {
+        if (seenNonPhi)
+          return name + " is a phi after other instructions";
+        if (instruction->operands.size() != block->preds.size())
+          return name + " doesn't match the predecessors";
+      } else {
+        seenNonPhi = true;
+      }
+      for (const Instruction *operand : instruction->operands) {
+        if (!isValue(*operand))
+          return name + " uses an instruction without a value";
+        const auto useCount = std::count(instruction->operands.begin(),
+                                         instruction->operands.end(), operand);
+        if (std::count(operand->users.begin(), operand->users.end(),
+                       instruction.get()) != useCount)
+          return name + " is missing from the users of its operand";
+        if (domTree.isReachable(block.get()) &&
+            !domTree.dominates(operand, instruction.get()))
+          return name + " isn't dominated by its operand";
+      }
+      for (const Instruction *user : instruction->users) {
+        if (std::find(user->operands.begin(), user->operands.end(),
+                      instruction.get()) == user->operands.end())
+          return name + " has a user that doesn't use it";
+      }
+    }
+  }
+  return "";
+}
+
+} // namespace descartes::ssa
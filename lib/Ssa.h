@@ -0,0 +1,150 @@
+#pragma once
+
+#include <Ir.h>
+
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace descartes::ssa {
+
+enum class Opcode {
+  // Values.
+  Const,
+  Name,
+  FramePointer,
+  Param,
+  Local,
+  Temp,
+  Phi,
+  ArithOp,
+  Load,
+  Call,
+  // Side effects.
+  Store,
+  // Terminators.
+  Jump,
+  CondJump,
+  JumpTable,
+  Return,
+};
+
+struct Block;
+struct Instruction;
+using InstructionPtr = std::unique_ptr<Instruction>;
+// Instructions are kept in a list so that they can be inserted and taken out
+// in constant time wherever they are in the block.
+using InstructionList = std::list<InstructionPtr>;
+
+// An instruction defines at most one value which its users refer to directly.
+// `operands` and `users` are kept in sync and form the def-use chains; a user
+// appears once in `users` for every operand that refers to the instruction.
+//
+// Operands by opcode:
+// - Param: none, `value` is the index of the formal.
+// - Local: none, `value` is the frame offset. Evaluates to the slot address.
+// - Temp: none, `value` is the `ir::Temp` id. Only loaded and stored.
+// - Phi: one incoming value per predecessor of the parent block, in order.
+// - Load: the address. `memType` is how much it reads.
+// - Store: the address then the value. `memType` is how much it writes.
+// - Call: the arguments, `symbol` is the function.
+// - CondJump: the two sides of `relOp`. Jumps to the first successor of the
+//   parent block when it holds and the second otherwise.
+// - JumpTable: the index into the successors of the parent block.
+// - Return: the return value, if any.
+struct Instruction {
+  Instruction(Opcode op, int id);
+  bool isTerminator() const;
+  bool hasSideEffects() const;
+  bool readsMemory() const;
+  void addOperand(Instruction *operand);
+  void setOperand(size_t index, Instruction *operand);
+  void removeOperand(size_t index);
+  void dropOperands();
+  void replaceAllUsesWith(Instruction *replacement);
+  Opcode op;
+  const int id;
+  Block *parent;
+  // Where the instruction is in the instructions of `parent`.
+  InstructionList::iterator position;
+  std::vector<Instruction *> operands;
+  std::vector<Instruction *> users;
+  int value;
+  std::optional<Symbol> symbol;
+  ir::ArithOpKind arithOp;
+  ir::RelOpKind relOp;
+  ir::MemType memType;
+
+private:
+  void removeUse(size_t index);
+  // Where each operand lists this instruction in its `users`, and which operand
+  // of each user refers back to it, so that a use is dropped in constant time.
+  std::vector<size_t> useIndices;
+  std::vector<size_t> userOperands;
+};
+
+// A basic block ends with exactly one terminator and its phis come first.
+// The order of `succs` is significant to the terminator.
+struct Block {
+  Block(int id, std::optional<Symbol> label);
+  Instruction *getTerminator() const;
+  std::vector<Instruction *> getPhis() const;
+  size_t getPredIndex(const Block *pred) const;
+  Instruction *append(InstructionPtr instruction);
+  Instruction *insertBefore(const Instruction *position,
+                            InstructionPtr instruction);
+  Instruction *insertPhi(InstructionPtr phi);
+  // Removes an instruction that no longer has any users.
+  void erase(Instruction *instruction);
+  // Takes an instruction out of the block with its operands and users intact
+  // so that it can be placed in another one.
+  InstructionPtr remove(Instruction *instruction);
+  const int id;
+  std::optional<Symbol> label;
+  InstructionList instructions;
+  std::vector<Block *> preds, succs;
+
+private:
+  Instruction *insert(InstructionList::iterator position,
+                      InstructionPtr instruction);
+};
+using BlockPtr = std::unique_ptr<Block>;
+
+// The control flow graph of a single fragment. The first block is the entry
+// and holds the frame slots and temporaries of the level.
+struct Function {
+  explicit Function(ir::Level &level);
+  Block *getEntry() const;
+  Block *makeBlock(std::optional<Symbol> label = std::nullopt);
+  InstructionPtr makeInstruction(Opcode op);
+  void addEdge(Block *from, Block *to);
+  // Removes the edge to the successor at `succIndex` along with the incoming
+  // phi values for it.
+  void removeEdge(Block *from, size_t succIndex);
+  // Places an empty block on the edge to the successor at `succIndex`.
+  Block *splitEdge(Block *from, size_t succIndex);
+  void removeUnreachableBlocks();
+  // Replaces phis that only ever see one value other than themselves, which
+  // removing edges can leave behind.
+  void removeTrivialPhis();
+  ir::Level &level;
+  std::vector<BlockPtr> blocks;
+  int valueCount;
+  int blockCount;
+};
+
+// Whether accesses of `lhsSize` and `rhsSize` bytes at two addresses can
+// overlap. Addresses are only told apart when they are different frame slots
+// of the level, the same base with constant offsets far enough apart, or
+// static data and a frame slot.
+bool mayAlias(const Instruction &lhs, int lhsSize, const Instruction &rhs,
+              int rhsSize);
+
+// Checks the structural invariants of the CFG and the def-use chains, and that
+// every definition dominates its uses. Returns a description of the first
+// problem found or an empty string if there isn't one.
+std::string verify(const Function &function);
+
+} // namespace descartes::ssa
@@ -0,0 +1,232 @@
+#include "SsaBuilder.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace descartes {
+
+SsaBuilder::SsaBuilder()
+    : function(nullptr), current(nullptr), hasReturnValue(false) {}
+
+std::unique_ptr<ssa::Function> SsaBuilder::build(ir::Fragment &frag) {
+  auto result = std::make_unique<ssa::Function>(*frag.first);
+  function = result.get();
+  placed.clear();
+  labelBlocks.clear();
+  entryValues.clear();
+  hasReturnValue = false;
+  ssa::Block *entry = function->makeBlock();
+  ssa::Block *body = function->makeBlock();
+  placed = {entry, body};
+  current = body;
+  buildStatement(*frag.second);
+  // Falling off the end of the body returns from the function.
+  if (!current)
+    placeBlock(function->makeBlock());
+  std::vector<ssa::Instruction *> returnValue;
+  if (hasReturnValue)
+    returnValue.push_back(
+        emit(ssa::Opcode::Load,
+             {getEntryValue(ssa::Opcode::Temp, ir::returnValue)}));
+  terminate(ssa::Opcode::Return, std::move(returnValue), {});
+  // The entry block only holds the slots of the level so add its terminator
+  // last.
+  entry->append(function->makeInstruction(ssa::Opcode::Jump));
+  function->addEdge(entry, body);
+  // Keep the blocks in the order of the canonical traces.
+  std::vector<int> order(function->blockCount, 0);
+  for (size_t i = 0; i < placed.size(); ++i)
+    order.at(placed.at(i)->id) = i;
+  std::stable_sort(
+      function->blocks.begin(), function->blocks.end(),
+      [&order](const ssa::BlockPtr &lhs, const ssa::BlockPtr &rhs) {
+        return order.at(lhs->id) < order.at(rhs->id);
+      });
+  function->removeUnreachableBlocks();
+  function = nullptr;
+  current = nullptr;
+  return result;
+}
+
+void SsaBuilder::buildStatement(const ir::Statement &statement) {
+  if (statement.getKind() == ir::StatementKind::Sequence) {
+    const auto &sequence = static_cast<const ir::Sequence &>(statement);
+    for (const auto &s : sequence.statements)
+      buildStatement(*s);
+    return;
+  }
+  if (statement.getKind() == ir::StatementKind::Label) {
+    placeBlock(
+        getLabelBlock(static_cast<const ir::Label &>(statement).label));
+    return;
+  }
+  // Statements after a jump can only be reached through a label so they're
+  // dead. Give them a block anyway and let it be removed with the other
+  // unreachable blocks.
+  if (!current)
+    placeBlock(function->makeBlock());
+  switch (statement.getKind()) {
+  case ir::StatementKind::Jump: {
+    const auto &jump = static_cast<const ir::Jump &>(statement);
+    terminate(ssa::Opcode::Jump, {}, {getLabelBlock(jump.jumpLabel)});
+    break;
+  }
+  case ir::StatementKind::CondJump: {
+    const auto &condJump = static_cast<const ir::CondJump &>(statement);
+    ssa::Instruction *lhs = buildExpr(*condJump.lhs);
+    ssa::Instruction *rhs = buildExpr(*condJump.rhs);
+    ssa::Block *thenBlock = getLabelBlock(condJump.thenLabel);
+    ssa::Block *elseBlock = getLabelBlock(condJump.elseLabel);
+    ssa::Block *block = current;
+    terminate(ssa::Opcode::CondJump, {lhs, rhs}, {thenBlock, elseBlock});
+    block->getTerminator()->relOp = condJump.op;
+    break;
+  }
+  case ir::StatementKind::JumpTable: {
+    const auto &jumpTable = static_cast<const ir::JumpTable &>(statement);
+    ssa::Instruction *index = buildExpr(*jumpTable.index);
+    std::vector<ssa::Block *> succs;
+    for (Symbol label : jumpTable.labels)
+      succs.push_back(getLabelBlock(label));
+    terminate(ssa::Opcode::JumpTable, {index}, std::move(succs));
+    break;
+  }
+  case ir::StatementKind::Move: {
+    const auto &move = static_cast<const ir::Move &>(statement);
+    ssa::Instruction *address;
+    ir::MemType memType = ir::MemType::Word;
+    if (move.dst->getKind() == ir::ExprKind::Temp) {
+      const int temp = static_cast<const ir::Temp &>(*move.dst).id;
+      assert(temp != ir::framePointer);
+      if (temp == ir::returnValue)
+        hasReturnValue = true;
+      address = getEntryValue(ssa::Opcode::Temp, temp);
+    } else {
+      assert(move.dst->getKind() == ir::ExprKind::Mem);
+      const auto &mem = static_cast<const ir::Mem &>(*move.dst);
+      address = buildExpr(*mem.expr);
+      memType = mem.type;
+    }
+    ssa::Instruction *value = buildExpr(*move.src);
+    emit(ssa::Opcode::Store, {address, value})->memType = memType;
+    break;
+  }
+  case ir::StatementKind::CallStatement:
+    buildExpr(*static_cast<const ir::CallStatement &>(statement).call);
+    break;
+  default:
+    assert(!"Unexpected statement kind");
+  }
+}
+
+ssa::Instruction *SsaBuilder::buildExpr(const ir::Expr &expr) {
+  switch (expr.getKind()) {
+  case ir::ExprKind::Const: {
+    ssa::Instruction *constant = emit(ssa::Opcode::Const);
+    constant->value = static_cast<const ir::Const &>(expr).value;
+    return constant;
+  }
+  case ir::ExprKind::Name: {
+    ssa::Instruction *name = emit(ssa::Opcode::Name);
+    name->symbol = static_cast<const ir::Name &>(expr).value;
+    return name;
+  }
+  case ir::ExprKind::Temp: {
+    const int temp = static_cast<const ir::Temp &>(expr).id;
+    if (temp == ir::framePointer)
+      return getEntryValue(ssa::Opcode::FramePointer, 0);
+    return emit(ssa::Opcode::Load,
+                {getEntryValue(ssa::Opcode::Temp, temp)});
+  }
+  case ir::ExprKind::Mem: {
+    const auto &mem = static_cast<const ir::Mem &>(expr);
+    ssa::Instruction *load = emit(ssa::Opcode::Load, {buildExpr(*mem.expr)});
+    load->memType = mem.type;
+    return load;
+  }
+  case ir::ExprKind::ArithOp: {
+    const auto &arithOp = static_cast<const ir::ArithOp &>(expr);
+    // Addresses of the level's own frame slots get their own instruction so
+    // that they can be recognised and promoted.
+    if (arithOp.op == ir::ArithOpKind::Add &&
+        arithOp.lhs->getKind() == ir::ExprKind::Temp &&
+        static_cast<const ir::Temp &>(*arithOp.lhs).id == ir::framePointer &&
+        arithOp.rhs->getKind() == ir::ExprKind::Const) {
+      const int offset = static_cast<const ir::Const &>(*arithOp.rhs).value;
+      const auto &locals = function->level.locals;
+      if (std::any_of(locals.begin(), locals.end(),
+                      [offset](const ir::Access &access) {
+                        return access.offset == offset;
+                      }))
+        return getEntryValue(ssa::Opcode::Local, offset);
+    }
+    ssa::Instruction *lhs = buildExpr(*arithOp.lhs);
+    ssa::Instruction *rhs = buildExpr(*arithOp.rhs);
+    ssa::Instruction *result = emit(ssa::Opcode::ArithOp, {lhs, rhs});
+    result->arithOp = arithOp.op;
+    return result;
+  }
+  case ir::ExprKind::Call: {
+    const auto &call = static_cast<const ir::Call &>(expr);
+    std::vector<ssa::Instruction *> args;
+    for (const auto &arg : call.args)
+      args.push_back(buildExpr(*arg));
+    ssa::Instruction *result = emit(ssa::Opcode::Call, std::move(args));
+    result->symbol = call.functionName;
+    return result;
+  }
+  case ir::ExprKind::CondExpr:
+    break;
+  }
+  assert(!"Expression isn't canonical");
+  return nullptr;
+}
+
+ssa::Instruction *
+SsaBuilder::emit(ssa::Opcode op, std::vector<ssa::Instruction *> operands) {
+  auto instruction = function->makeInstruction(op);
+  for (ssa::Instruction *operand : operands)
+    instruction->addOperand(operand);
+  return current->append(std::move(instruction));
+}
+
+ssa::Instruction *SsaBuilder::getEntryValue(ssa::Opcode op, int value) {
+  const auto key = std::make_pair(op, value);
+  const auto iter = entryValues.find(key);
+  if (iter != entryValues.end())
+    return iter->second;
+  auto instruction = function->makeInstruction(op);
+  instruction->value = value;
+  ssa::Instruction *result =
+      function->getEntry()->append(std::move(instruction));
+  entryValues.emplace(key, result);
+  return result;
+}
+
+ssa::Block *SsaBuilder::getLabelBlock(Symbol label) {
+  const auto iter = labelBlocks.find(label);
+  if (iter != labelBlocks.end())
+    return iter->second;
+  ssa::Block *block = function->makeBlock(label);
+  labelBlocks.emplace(label, block);
+  return block;
+}
+
+void SsaBuilder::placeBlock(ssa::Block *block) {
+  // Fall through into the new block.
+  if (current)
+    terminate(ssa::Opcode::Jump, {}, {block});
+  current = block;
+  placed.push_back(block);
+}
+
+void SsaBuilder::terminate(ssa::Opcode op,
+                           std::vector<ssa::Instruction *> operands,
+                           std::vector<ssa::Block *> succs) {
+  emit(op, std::move(operands));
+  for (ssa::Block *succ : succs)
+    function->addEdge(current, succ);
+  current = nullptr;
+}
+
+} // namespace descartes
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Ssa.h>
+
+#include <map>
+#include <unordered_map>
+
+namespace descartes {
+
+// Builds the control flow graph of a canonical fragment. Frame slots of the
+// level and `ir::Temp`s are still accessed with loads and stores so the result
+// is only in SSA form once `Mem2Reg` has promoted them.
+class SsaBuilder {
+public:
+  SsaBuilder();
+  virtual ~SsaBuilder() = default;
+  std::unique_ptr<ssa::Function> build(ir::Fragment &frag);
+
+private:
+  void buildStatement(const ir::Statement &statement);
+  ssa::Instruction *buildExpr(const ir::Expr &expr);
+  ssa::Instruction *emit(ssa::Opcode op,
+                         std::vector<ssa::Instruction *> operands = {});
+  ssa::Instruction *getEntryValue(ssa::Opcode op, int value);
+  ssa::Block *getLabelBlock(Symbol label);
+  void placeBlock(ssa::Block *block);
+  void terminate(ssa::Opcode op, std::vector<ssa::Instruction *> operands,
+                 std::vector<ssa::Block *> succs);
+  ssa::Function *function;
+  ssa::Block *current;
+  std::vector<ssa::Block *> placed;
+  std::unordered_map<Symbol, ssa::Block *, SymbolHash> labelBlocks;
+  std::map<std::pair<ssa::Opcode, int>, ssa::Instruction *> entryValues;
+  bool hasReturnValue;
+};
+
+} // namespace descartes
@@ -0,0 +1,272 @@
+#include "SsaLowering.h"
+
+#include <cassert>
+
+namespace descartes {
+
+namespace {
+
+// Values that are cheaper to recompute at every use than to keep in a
+// temporary.
+bool isRematerialisable(const ssa::Instruction &value) {
+  switch (value.op) {
+  case ssa::Opcode::Const:
+  case ssa::Opcode::Name:
+  case ssa::Opcode::FramePointer:
+  case ssa::Opcode::Local:
+  case ssa::Opcode::Temp:
+    return true;
+  case ssa::Opcode::Param:
+    // Reading an argument is a load from the frame so only repeat it when
+    // there's a single use.
+    return value.users.size() == 1;
+  default:
+    return false;
+  }
+}
+
+// Whether evaluating the value later than where it is defined could give a
+// different result or trap in a different place.
+bool isOrderSensitive(const ssa::Instruction &value) {
+  return value.op == ssa::Opcode::Load ||
+         (value.op == ssa::Opcode::ArithOp &&
+          value.arithOp == ir::ArithOpKind::Divide);
+}
+
+} // namespace
+
+SsaLowering::SsaLowering(SymbolTable &symbols)
+    : symbols(symbols), canonicaliser(symbols), function(nullptr) {}
+
+void SsaLowering::lower(ssa::Function &function, ir::Fragment &frag) {
+  assert(&function.level == frag.first.get());
+  this->function = &function;
+  folded.clear();
+  temps.clear();
+  function.removeUnreachableBlocks();
+  splitCriticalEdges();
+  findFoldedValues();
+  exitLabel = symbols.makeUnique("S");
+  std::vector<ir::StatementPtr> statements;
+  for (auto &block : function.blocks)
+    lowerBlock(*block, statements);
+  statements.push_back(std::make_unique<ir::Label>(*exitLabel));
+  // Let the canonicaliser lay out the blocks and tidy up the jumps.
+  frag.second = std::make_unique<ir::Sequence>(std::move(statements));
+  canonicaliser.canonicalise(frag);
+  exitLabel.reset();
+  this->function = nullptr;
+}
+
+void SsaLowering::splitCriticalEdges() {
+  // Phi copies are placed at the end of the predecessor so it mustn't have
+  // any other successors.
+  const size_t blockCount = function->blocks.size();
+  for (size_t i = 0; i < blockCount; ++i) {
+    ssa::Block *block = function->blocks.at(i).get();
+    if (block->succs.size() < 2)
+      continue;
+    for (size_t succIndex = 0; succIndex < block->succs.size(); ++succIndex) {
+      const ssa::Block *succ = block->succs.at(succIndex);
+      if (succ->preds.size() > 1 && !succ->getPhis().empty())
+        function->splitEdge(block, succIndex);
+    }
+  }
+}
+
+void SsaLowering::findFoldedValues() {
+  // Folded values are evaluated where they're used so a value is also order
+  // sensitive if any of the values folded into it are.
+  std::unordered_set<const ssa::Instruction *> orderSensitive;
+  for (const auto &block : function->blocks) {
+    for (const auto &instruction : block->instructions) {
+      const ssa::Instruction &value = *instruction;
+      if (isRematerialisable(value)) {
+        folded.insert(&value);
+        continue;
+      }
+      if (value.op != ssa::Opcode::ArithOp && value.op != ssa::Opcode::Load)
+        continue;
+      if (value.users.size() != 1)
+        continue;
+      const ssa::Instruction *user = value.users.front();
+      if (user->parent != block.get() || user->op == ssa::Opcode::Phi)
+        continue;
+      bool sensitive = isOrderSensitive(value);
+      for (const ssa::Instruction *operand : value.operands)
+        sensitive = sensitive || orderSensitive.count(operand);
+      // Nothing between the definition and the use may write to memory.
+      bool canFold = true;
+      for (auto iter = std::next(value.position);
+           sensitive && canFold && iter->get() != user; ++iter)
+        canFold = !(*iter)->hasSideEffects();
+      if (!canFold)
+        continue;
+      folded.insert(&value);
+      if (sensitive)
+        orderSensitive.insert(&value);
+    }
+  }
+}
+
+void SsaLowering::lowerBlock(ssa::Block &block,
+                             std::vector<ir::StatementPtr> &out) {
+  out.push_back(std::make_unique<ir::Label>(getLabel(block)));
+  for (const auto &instruction : block.instructions) {
+    const ssa::Instruction &value = *instruction;
+    if (value.op == ssa::Opcode::Phi || value.isTerminator() ||
+        folded.count(&value))
+      continue;
+    if (value.op == ssa::Opcode::Store) {
+      const ssa::Instruction &address = *value.operands.at(0);
+      ir::ExprPtr dst;
+      if (address.op == ssa::Opcode::Temp)
+        dst = std::make_unique<ir::Temp>(address.value);
+      else
+        dst = std::make_unique<ir::Mem>(lowerOperand(address), value.memType);
+      out.push_back(std::make_unique<ir::Move>(
+          std::move(dst), lowerOperand(*value.operands.at(1))));
+    } else if (value.users.empty()) {
+      // Values that nothing uses are only kept for their side effects.
+      if (value.op == ssa::Opcode::Call)
+        out.push_back(std::make_unique<ir::CallStatement>(lowerValue(value)));
+    } else {
+      out.push_back(std::make_unique<ir::Move>(
+          std::make_unique<ir::Temp>(getTemp(value)), lowerValue(value)));
+    }
+  }
+  lowerPhiCopies(block, out);
+  lowerTerminator(block, out);
+}
+
+void SsaLowering::lowerPhiCopies(const ssa::Block &block,
+                                 std::vector<ir::StatementPtr> &out) {
+  if (block.succs.size() != 1)
+    return;
+  const ssa::Block *succ = block.succs.front();
+  const auto phis = succ->getPhis();
+  if (phis.empty())
+    return;
+  const size_t predIndex = succ->getPredIndex(&block);
+  if (phis.size() == 1) {
+    const ssa::Instruction &incoming = *phis.front()->operands.at(predIndex);
+    if (&incoming != phis.front())
+      out.push_back(std::make_unique<ir::Move>(
+          std::make_unique<ir::Temp>(getTemp(*phis.front())),
+          lowerOperand(incoming)));
+    return;
+  }
+  // The phis are all assigned at once so one phi may read the old value of
+  // another. Read every incoming value before writing any of them.
+  std::vector<int> copies;
+  for (const ssa::Instruction *phi : phis) {
+    const int copy = function->level.newTemp();
+    out.push_back(std::make_unique<ir::Move>(
+        std::make_unique<ir::Temp>(copy),
+        lowerOperand(*phi->operands.at(predIndex))));
+    copies.push_back(copy);
+  }
+  for (size_t i = 0; i < phis.size(); ++i)
+    out.push_back(std::make_unique<ir::Move>(
+        std::make_unique<ir::Temp>(getTemp(*phis.at(i))),
+        std::make_unique<ir::Temp>(copies.at(i))));
+}
+
+void SsaLowering::lowerTerminator(ssa::Block &block,
+                                  std::vector<ir::StatementPtr> &out) {
+  const ssa::Instruction &terminator = *block.getTerminator();
+  switch (terminator.op) {
+  case ssa::Opcode::Jump:
+    out.push_back(std::make_unique<ir::Jump>(getLabel(*block.succs.at(0))));
+    break;
+  case ssa::Opcode::CondJump:
+    out.push_back(std::make_unique<ir::CondJump>(
+        terminator.relOp, lowerOperand(*terminator.operands.at(0)),
+        lowerOperand(*terminator.operands.at(1)),
+        getLabel(*block.succs.at(0)), getLabel(*block.succs.at(1))));
+    break;
+  case ssa::Opcode::JumpTable: {
+    std::vector<Symbol> labels;
+    for (ssa::Block *succ : block.succs)
+      labels.push_back(getLabel(*succ));
+    out.push_back(std::make_unique<ir::JumpTable>(
+        lowerOperand(*terminator.operands.at(0)), std::move(labels)));
+    break;
+  }
+  case ssa::Opcode::Return:
+    if (!terminator.operands.empty())
+      out.push_back(std::make_unique<ir::Move>(
+          std::make_unique<ir::Temp>(ir::returnValue),
+          lowerOperand(*terminator.operands.front())));
+    out.push_back(std::make_unique<ir::Jump>(*exitLabel));
+    break;
+  default:
+    assert(!"Unknown terminator");
+  }
+}
+
+ir::ExprPtr SsaLowering::lowerOperand(const ssa::Instruction &operand) {
+  if (folded.count(&operand))
+    return lowerValue(operand);
+  return std::make_unique<ir::Temp>(getTemp(operand));
+}
+
+ir::ExprPtr SsaLowering::lowerValue(const ssa::Instruction &value) {
+  const auto makeFrameSlot = [](int offset) {
+    return std::make_unique<ir::ArithOp>(
+        ir::ArithOpKind::Add, std::make_unique<ir::Temp>(ir::framePointer),
+        std::make_unique<ir::Const>(offset));
+  };
+  switch (value.op) {
+  case ssa::Opcode::Const:
+    return std::make_unique<ir::Const>(value.value);
+  case ssa::Opcode::Name:
+    return std::make_unique<ir::Name>(*value.symbol);
+  case ssa::Opcode::FramePointer:
+    return std::make_unique<ir::Temp>(ir::framePointer);
+  case ssa::Opcode::Local:
+    return makeFrameSlot(value.value);
+  case ssa::Opcode::Param:
+    // Arguments start out in the frame slots of the formals. A promoted formal
+    // is never stored to so the slot still holds the argument.
+    return std::make_unique<ir::Mem>(
+        makeFrameSlot(function->level.formals.at(value.value).offset));
+  case ssa::Opcode::ArithOp:
+    return std::make_unique<ir::ArithOp>(
+        value.arithOp, lowerOperand(*value.operands.at(0)),
+        lowerOperand(*value.operands.at(1)));
+  case ssa::Opcode::Load: {
+    const ssa::Instruction &address = *value.operands.front();
+    if (address.op == ssa::Opcode::Temp)
+      return std::make_unique<ir::Temp>(address.value);
+    return std::make_unique<ir::Mem>(lowerOperand(address), value.memType);
+  }
+  case ssa::Opcode::Call: {
+    std::vector<ir::ExprPtr> args;
+    for (const ssa::Instruction *arg : value.operands)
+      args.push_back(lowerOperand(*arg));
+    return std::make_unique<ir::Call>(*value.symbol, std::move(args));
+  }
+  default:
+    break;
+  }
+  assert(!"Instruction has no value");
+  return nullptr;
+}
+
+int SsaLowering::getTemp(const ssa::Instruction &value) {
+  const auto iter = temps.find(&value);
+  if (iter != temps.end())
+    return iter->second;
+  const int temp = function->level.newTemp();
+  temps.emplace(&value, temp);
+  return temp;
+}
+
+Symbol SsaLowering::getLabel(ssa::Block &block) {
+  if (!block.label)
+    block.label = symbols.makeUnique("S");
+  return *block.label;
+}
+
+} // namespace descartes
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Canonical.h>
+#include <Ssa.h>
+
+#include <unordered_map>
+#include <unordered_set>
+
+namespace descartes {
+
+// Turns a function back into canonical tree IR. Every value that is used
+// somewhere other than directly by the next use site gets a temporary and phis
+// become copies at the end of their predecessors. Values with a single use in
+// the same block are folded back into the tree of their user so that backends
+// can still match addressing modes and operands across several instructions.
+class SsaLowering {
+public:
+  explicit SsaLowering(SymbolTable &symbols);
+  virtual ~SsaLowering() = default;
+  // Replaces the body of the fragment that `function` was built from.
+  void lower(ssa::Function &function, ir::Fragment &frag);
+
+private:
+  void splitCriticalEdges();
+  void findFoldedValues();
+  void lowerBlock(ssa::Block &block, std::vector<ir::StatementPtr> &out);
+  void lowerPhiCopies(const ssa::Block &block,
+                      std::vector<ir::StatementPtr> &out);
+  void lowerTerminator(ssa::Block &block, std::vector<ir::StatementPtr> &out);
+  ir::ExprPtr lowerOperand(const ssa::Instruction &operand);
+  ir::ExprPtr lowerValue(const ssa::Instruction &value);
+  int getTemp(const ssa::Instruction &value);
+  Symbol getLabel(ssa::Block &block);
+  SymbolTable &symbols;
+  Canonicaliser canonicaliser;
+  ssa::Function *function;
+  std::unordered_set<const ssa::Instruction *> folded;
+  std::unordered_map<const ssa::Instruction *, int> temps;
+  std::optional<Symbol> exitLabel;
+};
+
+} // namespace descartes
@@ -0,0 +1,393 @@
+#include "StrengthReduction.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace descartes {
+
+namespace {
+
+// Truncates to the 32 bits that constants hold.
+int wrap(long long value) {
+  return static_cast<int32_t>(static_cast<uint32_t>(value));
+}
+
+bool isConst(const ssa::Instruction &instruction) {
+  return instruction.op == ssa::Opcode::Const;
+}
+
+// The multiplier and shift that divide by `divisor` when applied to the high
+// half of the product. Values are whole 64 bit words at runtime so this is
+// the 64 bit version of figure 10-1 of Warren's "Hacker's Delight".
+struct Reciprocal {
+  int64_t multiplier;
+  int shift;
+};
+
+Reciprocal getReciprocal(int divisor) {
+  const uint64_t two63 = 0x8000000000000000u;
+  const uint64_t absDivisor =
+      divisor < 0 ? 0u - static_cast<uint64_t>(static_cast<int64_t>(divisor))
+                  : static_cast<uint64_t>(divisor);
+  const uint64_t t = two63 + (divisor < 0 ? 1 : 0);
+  const uint64_t absNc = t - 1 - t % absDivisor;
+  int p = 63;
+  uint64_t q1 = two63 / absNc, r1 = two63 - q1 * absNc;
+  uint64_t q2 = two63 / absDivisor, r2 = two63 - q2 * absDivisor;
+  uint64_t delta;
+  do {
+    ++p;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= absNc) {
+      ++q1;
+      r1 -= absNc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= absDivisor) {
+      ++q2;
+      r2 -= absDivisor;
+    }
+    delta = absDivisor - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  const uint64_t multiplier = q2 + 1;
+  return {static_cast<int64_t>(divisor < 0 ? 0u - multiplier : multiplier),
+          p - 64};
+}
+
+} // namespace
+
+StrengthReduction::StrengthReduction() : function(nullptr) {}
+
+void StrengthReduction::run(ssa::Function &function) {
+  this->function = &function;
+  function.removeUnreachableBlocks();
+  for (const auto &block : function.blocks) {
+    std::vector<ssa::Instruction *> instructions;
+    for (const auto &instruction : block->instructions)
+      instructions.push_back(instruction.get());
+    for (ssa::Instruction *instruction : instructions) {
+      if (instruction->op == ssa::Opcode::ArithOp &&
+          instruction->arithOp == ir::ArithOpKind::Divide &&
+          isConst(*instruction->operands.at(1)))
+        reduceDivision(instruction);
+    }
+  }
+  const ssa::DominatorTree domTree(function);
+  const ssa::LoopInfo loopInfo(function, domTree);
+  for (const auto &loop : loopInfo.getLoops()) {
+    ssa::Block *preheader = loop->getPreheader();
+    const std::vector<ssa::Block *> latches = loop->getLatches();
+    // Every iteration has to go around the same back edge.
+    if (!preheader || latches.size() != 1 || loop->header->preds.size() != 2)
+      continue;
+    const size_t latchIndex = loop->header->getPredIndex(latches.front());
+    variables.clear();
+    findBasicVariables(*loop, latchIndex);
+    deriveVariables(*loop, preheader, latchIndex);
+    replaceExitTests(*loop, preheader, domTree);
+    removeDeadVariables(*loop, latchIndex);
+  }
+  variables.clear();
+  this->function = nullptr;
+}
+
+void StrengthReduction::reduceDivision(ssa::Instruction *division) {
+  ssa::Instruction *dividend = division->operands.at(0);
+  const int divisor = division->operands.at(1)->value;
+  // Dividing by zero is left to fail at runtime.
+  if (divisor == 0 || divisor == 1)
+    return;
+  const auto emit = [this, division](ir::ArithOpKind op, ssa::Instruction *lhs,
+                                     ssa::Instruction *rhs) {
+    return insertArithOp(division, op, lhs, rhs);
+  };
+  const auto constant = [this, division](int value) {
+    return insertConst(division, value);
+  };
+  ssa::Instruction *quotient;
+  const long long absDivisor = divisor < 0 ? -static_cast<long long>(divisor)
+                                           : static_cast<long long>(divisor);
+  if (divisor == -1) {
+    quotient = emit(ir::ArithOpKind::Subtract, constant(0), dividend);
+  } else if ((absDivisor & (absDivisor - 1)) == 0) {
+    int shift = 0;
+    while ((1LL << shift) != absDivisor)
+      ++shift;
+    // Shifting rounds down so negative dividends are biased to round towards
+    // zero instead.
+    ssa::Instruction *sign =
+        emit(ir::ArithOpKind::ShiftRight, dividend, constant(63));
+    ssa::Instruction *bias = emit(ir::ArithOpKind::And, sign,
+                                  constant(wrap((1LL << shift) - 1)));
+    quotient = emit(ir::ArithOpKind::ShiftRight,
+                    emit(ir::ArithOpKind::Add, dividend, bias),
+                    constant(shift));
+    if (divisor < 0)
+      quotient = emit(ir::ArithOpKind::Subtract, constant(0), quotient);
+  } else {
+    const Reciprocal reciprocal = getReciprocal(divisor);
+    // Constants are 32 bits so the multiplier is put together from halves,
+    // which are loop invariant if the division is in a loop.
+    const int low = wrap(reciprocal.multiplier);
+    const long long high = (reciprocal.multiplier >> 32) + (low < 0 ? 1 : 0);
+    if (high != wrap(high))
+      return;
+    ssa::Instruction *multiplier = emit(
+        ir::ArithOpKind::Add,
+        emit(ir::ArithOpKind::ShiftLeft, constant(static_cast<int>(high)),
+             constant(32)),
+        constant(low));
+    quotient = emit(ir::ArithOpKind::MultiplyHigh, dividend, multiplier);
+    // The multiplier wrapped around so the dividend has to be added back.
+    if (divisor > 0 && reciprocal.multiplier < 0)
+      quotient = emit(ir::ArithOpKind::Add, quotient, dividend);
+    else if (divisor < 0 && reciprocal.multiplier > 0)
+      quotient = emit(ir::ArithOpKind::Subtract, quotient, dividend);
+    if (reciprocal.shift > 0)
+      quotient = emit(ir::ArithOpKind::ShiftRight, quotient,
+                      constant(reciprocal.shift));
+    // Round negative quotients towards zero by adding one.
+    quotient =
+        emit(ir::ArithOpKind::Subtract, quotient,
+             emit(ir::ArithOpKind::ShiftRight, quotient, constant(63)));
+  }
+  division->replaceAllUsesWith(quotient);
+  division->parent->erase(division);
+}
+
+void StrengthReduction::findBasicVariables(const ssa::Loop &loop,
+                                           size_t latchIndex) {
+  const size_t entryIndex = 1 - latchIndex;
+  for (ssa::Instruction *phi : loop.header->getPhis()) {
+    ssa::Instruction *next = phi->operands.at(latchIndex);
+    if (next->op != ssa::Opcode::ArithOp || !loop.contains(next->parent))
+      continue;
+    const ssa::Instruction *lhs = next->operands.at(0);
+    const ssa::Instruction *rhs = next->operands.at(1);
+    long long step;
+    if (next->arithOp == ir::ArithOpKind::Add && lhs == phi && isConst(*rhs))
+      step = rhs->value;
+    else if (next->arithOp == ir::ArithOpKind::Add && rhs == phi &&
+             isConst(*lhs))
+      step = lhs->value;
+    else if (next->arithOp == ir::ArithOpKind::Subtract && lhs == phi &&
+             isConst(*rhs))
+      step = -static_cast<long long>(rhs->value);
+    else
+      continue;
+    if (step != wrap(step))
+      continue;
+    auto variable = std::make_unique<InductionVariable>(InductionVariable{
+        phi, phi->operands.at(entryIndex), next, static_cast<int>(step),
+        nullptr, 1, nullptr});
+    variable->basis = variable.get();
+    variables.push_back(std::move(variable));
+  }
+}
+
+void StrengthReduction::deriveVariables(const ssa::Loop &loop,
+                                        ssa::Block *preheader,
+                                        size_t latchIndex) {
+  ssa::Instruction *preheaderEnd = preheader->getTerminator();
+  // Derived variables are appended as they're made so that they can be
+  // derived from in turn.
+  for (size_t i = 0; i < variables.size(); ++i) {
+    const InductionVariable &from = *variables.at(i);
+    std::vector<ssa::Instruction *> users = from.phi->users;
+    std::sort(users.begin(), users.end());
+    users.erase(std::unique(users.begin(), users.end()), users.end());
+    for (ssa::Instruction *user : users) {
+      if (user == from.next || user->op != ssa::Opcode::ArithOp ||
+          !loop.contains(user->parent))
+        continue;
+      ssa::Instruction *lhs = user->operands.at(0);
+      ssa::Instruction *rhs = user->operands.at(1);
+      ssa::Instruction *other = lhs == from.phi ? rhs : lhs;
+      if (other == from.phi)
+        continue;
+      std::optional<int> factor;
+      if (user->arithOp == ir::ArithOpKind::Multiply && isConst(*other))
+        factor = other->value;
+      else if (user->arithOp == ir::ArithOpKind::ShiftLeft && other == rhs &&
+               isConst(*other) && other->value >= 0 && other->value < 31)
+        factor = 1 << other->value;
+      auto derived = std::make_unique<InductionVariable>(from);
+      if (factor) {
+        // Values are whole words at runtime, so products that don't fit a 32
+        // bit constant are left for runtime or not derived at all.
+        const auto scale =
+            ir::foldArithOp(ir::ArithOpKind::Multiply, from.scale, *factor);
+        const auto step =
+            ir::foldArithOp(ir::ArithOpKind::Multiply, from.step, *factor);
+        if (*factor == 0 || !scale || !step)
+          continue;
+        derived->scale = *scale;
+        derived->step = *step;
+        const auto init =
+            isConst(*from.init)
+                ? ir::foldArithOp(ir::ArithOpKind::Multiply,
+                                  from.init->value, *factor)
+                : std::nullopt;
+        derived->init =
+            init ? insertConst(preheaderEnd, *init)
+                 : insertArithOp(preheaderEnd, ir::ArithOpKind::Multiply,
+                                 from.init, insertConst(preheaderEnd, *factor));
+        if (from.offset)
+          derived->offset =
+              insertArithOp(preheaderEnd, ir::ArithOpKind::Multiply,
+                            from.offset, insertConst(preheaderEnd, *factor));
+      } else if (user->arithOp == ir::ArithOpKind::Add &&
+                 from.basis != &from && !from.offset &&
+                 (isConst(*other) || !loop.contains(other->parent))) {
+        // Only offsets from multiples are worth a variable of their own since
+        // the multiple usually becomes dead as a result.
+        derived->init =
+            insertArithOp(preheaderEnd, ir::ArithOpKind::Add, from.init,
+                          isConst(*other)
+                              ? insertConst(preheaderEnd, other->value)
+                              : other);
+        derived->offset = other;
+      } else {
+        continue;
+      }
+      makeVariable(*derived, latchIndex);
+      user->replaceAllUsesWith(derived->phi);
+      user->parent->erase(user);
+      variables.push_back(std::move(derived));
+    }
+  }
+}
+
+void StrengthReduction::makeVariable(InductionVariable &variable,
+                                     size_t latchIndex) {
+  ssa::Block *header = variable.phi->parent;
+  auto phi = function->makeInstruction(ssa::Opcode::Phi);
+  for (size_t i = 0; i < header->preds.size(); ++i)
+    phi->addOperand(variable.init);
+  variable.phi = header->insertPhi(std::move(phi));
+  // Step once per iteration, just before going around the loop again.
+  ssa::Instruction *latchEnd = header->preds.at(latchIndex)->getTerminator();
+  variable.next = insertArithOp(latchEnd, ir::ArithOpKind::Add, variable.phi,
+                                insertConst(latchEnd, variable.step));
+  variable.phi->setOperand(latchIndex, variable.next);
+}
+
+void StrengthReduction::replaceExitTests(const ssa::Loop &loop,
+                                         ssa::Block *preheader,
+                                         const ssa::DominatorTree &domTree) {
+  ssa::Instruction *preheaderEnd = preheader->getTerminator();
+  const ssa::Block *latch = loop.getLatches().front();
+  for (const auto &basic : variables) {
+    if (basic->basis != basic.get())
+      continue;
+    std::vector<ssa::Instruction *> uses;
+    for (ssa::Instruction *user : basic->phi->users) {
+      if (user != basic->next)
+        uses.push_back(user);
+    }
+    if (uses.size() != 1 || basic->next->users.size() != 1)
+      continue;
+    ssa::Instruction *test = uses.front();
+    // The test has to run on every iteration so that the basic variable can't
+    // go past the bound.
+    if (test->op != ssa::Opcode::CondJump ||
+        (test->relOp != ir::RelOpKind::Equal &&
+         test->relOp != ir::RelOpKind::NotEqual) ||
+        !loop.contains(test->parent) ||
+        !domTree.dominates(test->parent, latch))
+      continue;
+    const size_t boundIndex = test->operands.at(0) == basic->phi ? 1 : 0;
+    ssa::Instruction *bound = test->operands.at(boundIndex);
+    if (!isConst(*bound) && loop.contains(bound->parent))
+      continue;
+    // Prefer the most derived variable that is still used for something else.
+    const InductionVariable *replacement = nullptr;
+    for (const auto &derived : variables) {
+      if (derived->basis == basic.get() && derived != basic &&
+          std::any_of(derived->phi->users.begin(), derived->phi->users.end(),
+                      [&derived](const ssa::Instruction *user) {
+                        return user != derived->next;
+                      }))
+        replacement = derived.get();
+    }
+    if (!replacement)
+      continue;
+    // Multiplying by an odd number is a bijection on wrapping words so
+    // equality is unaffected. Otherwise the scaled values must not overflow,
+    // which holds if the variable steps by one from a constant towards a
+    // constant bound that fits once scaled.
+    const int scale = replacement->scale;
+    if (scale % 2 == 0) {
+      if (!isConst(*basic->init) || !isConst(*bound) ||
+          (basic->step != 1 && basic->step != -1))
+        continue;
+      const long long distance =
+          static_cast<long long>(bound->value) - basic->init->value;
+      if (distance * basic->step < 0 ||
+          !ir::foldArithOp(ir::ArithOpKind::Multiply, basic->init->value,
+                           scale) ||
+          !ir::foldArithOp(ir::ArithOpKind::Multiply, bound->value, scale))
+        continue;
+    }
+    const auto foldedBound =
+        isConst(*bound)
+            ? ir::foldArithOp(ir::ArithOpKind::Multiply, bound->value, scale)
+            : std::nullopt;
+    ssa::Instruction *scaledBound =
+        foldedBound
+            ? insertConst(preheaderEnd, *foldedBound)
+            : insertArithOp(preheaderEnd, ir::ArithOpKind::Multiply, bound,
+                            insertConst(preheaderEnd, scale));
+    // Adding the same offset to both sides doesn't change equality either.
+    if (replacement->offset)
+      scaledBound = insertArithOp(preheaderEnd, ir::ArithOpKind::Add,
+                                  scaledBound, replacement->offset);
+    test->setOperand(1 - boundIndex, replacement->phi);
+    test->setOperand(boundIndex, scaledBound);
+  }
+}
+
+void StrengthReduction::removeDeadVariables(const ssa::Loop &loop,
+                                            size_t latchIndex) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (ssa::Instruction *phi : loop.header->getPhis()) {
+      ssa::Instruction *next = phi->operands.at(latchIndex);
+      // A variable that only feeds its own step is dead.
+      if (next->op != ssa::Opcode::ArithOp || !loop.contains(next->parent) ||
+          next->users.size() != 1 ||
+          !std::all_of(phi->users.begin(), phi->users.end(),
+                       [next](const ssa::Instruction *user) {
+                         return user == next;
+                       }))
+        continue;
+      phi->dropOperands();
+      next->parent->erase(next);
+      loop.header->erase(phi);
+      changed = true;
+      break;
+    }
+  }
+}
+
+ssa::Instruction *StrengthReduction::insertArithOp(
+    const ssa::Instruction *position, ir::ArithOpKind op, ssa::Instruction *lhs,
+    ssa::Instruction *rhs) {
+  auto instruction = function->makeInstruction(ssa::Opcode::ArithOp);
+  instruction->arithOp = op;
+  instruction->addOperand(lhs);
+  instruction->addOperand(rhs);
+  return position->parent->insertBefore(position, std::move(instruction));
+}
+
+ssa::Instruction *StrengthReduction::insertConst(
+    const ssa::Instruction *position, int value) {
+  auto instruction = function->makeInstruction(ssa::Opcode::Const);
+  instruction->value = value;
+  return position->parent->insertBefore(position, std::move(instruction));
+}
+
+} // namespace descartes
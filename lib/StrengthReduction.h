@@ -0,0 +1,58 @@
+#pragma once
+
+#include <Loops.h>
+
+namespace descartes {
+
+// Replaces arithmetic with cheaper equivalents.
+//
+// Division by a constant becomes a multiplication by a fixed point reciprocal
+// and shifts as in Granlund and Montgomery's "Division by Invariant Integers
+// using Multiplication". Powers of two only need a shift and a correction that
+// rounds negative dividends towards zero.
+//
+// A basic induction variable is a loop header phi that moves by a constant on
+// every iteration. Multiples of it, and invariant offsets from those multiples,
+// become induction variables of their own that are stepped with an add, which
+// turns `base + i * stride` into a value bumped by `stride`. If the only other
+// use of a basic variable is an equality test that exits the loop, the test is
+// rewritten in terms of a derived variable and the basic one is removed,
+// leaving a single add and compare per iteration.
+class StrengthReduction {
+public:
+  StrengthReduction();
+  virtual ~StrengthReduction() = default;
+  void run(ssa::Function &function);
+
+private:
+  // A derived variable is `basic * scale + offset` on every iteration, where
+  // `offset` is loop invariant or missing. Basic variables are their own
+  // basis with a scale of one.
+  struct InductionVariable {
+    ssa::Instruction *phi;
+    ssa::Instruction *init;
+    ssa::Instruction *next;
+    int step;
+    const InductionVariable *basis;
+    int scale;
+    ssa::Instruction *offset;
+  };
+  void reduceDivision(ssa::Instruction *division);
+  void findBasicVariables(const ssa::Loop &loop, size_t latchIndex);
+  void deriveVariables(const ssa::Loop &loop, ssa::Block *preheader,
+                       size_t latchIndex);
+  // Gives a variable with its `init` and `step` set a phi and a step of its
+  // own.
+  void makeVariable(InductionVariable &variable, size_t latchIndex);
+  void replaceExitTests(const ssa::Loop &loop, ssa::Block *preheader,
+                        const ssa::DominatorTree &domTree);
+  void removeDeadVariables(const ssa::Loop &loop, size_t latchIndex);
+  ssa::Instruction *insertArithOp(const ssa::Instruction *position,
+                                  ir::ArithOpKind op, ssa::Instruction *lhs,
+                                  ssa::Instruction *rhs);
+  ssa::Instruction *insertConst(const ssa::Instruction *position, int value);
+  ssa::Function *function;
+  std::vector<std::unique_ptr<InductionVariable>> variables;
+};
+
+} // namespace descartes
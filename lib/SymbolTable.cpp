@@ -4,19 +4,27 @@
 
 namespace descartes {
 
-SymbolTable::SymbolTable() : currentId(0) {}
+SymbolTable::SymbolTable() : currentId(0), uniqueCount(0) {}
 
 Symbol SymbolTable::make(const std::string &name) {
   const auto iter = symbolMap.find(name);
   if (iter != symbolMap.end())
     return iter->second;
-  auto entry = std::make_pair(name, Symbol(currentId++));
-  entry.second.value = &entry.first;
-  auto result = symbolMap.insert(std::move(entry));
+  auto result = symbolMap.emplace(name, Symbol(currentId++));
   assert(result.second);
+  // Map nodes are stable so the symbol can point at its key.
+  result.first->second.value = &result.first->first;
   return result.first->second;
 }
 
+Symbol SymbolTable::makeUnique(const std::string &prefix) {
+  std::string name;
+  do {
+    name = prefix + std::to_string(uniqueCount++);
+  } while (symbolMap.find(name) != symbolMap.end());
+  return make(name);
+}
+
 std::optional<Symbol> SymbolTable::lookup(const std::string &name) const {
   const auto iter = symbolMap.find(name);
   if (iter != symbolMap.end())
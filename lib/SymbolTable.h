@@ -13,10 +13,13 @@ public:
   SymbolTable();
   virtual ~SymbolTable() = default;
   Symbol make(const std::string &name);
+  // Makes a symbol that hasn't been used yet by appending a number to `prefix`.
+  Symbol makeUnique(const std::string &prefix);
   std::optional<Symbol> lookup(const std::string &name) const;
 
 private:
   int currentId;
+  int uniqueCount;
   std::unordered_map<std::string, Symbol> symbolMap;
 };
 
@@ -0,0 +1,190 @@
+#include "TieredEngine.h"
+
+#include <BytecodeCompiler.h>
+#include <Encoder.h>
+#include <InstructionSelector.h>
+#include <RegisterAllocator.h>
+
+#include <algorithm>
+#include <cassert>
+
+namespace descartes {
+
+namespace {
+
+bytecode::Module compileBytecode(const std::vector<ir::Fragment> &frags) {
+  BytecodeCompiler bytecodeCompiler;
+  return bytecodeCompiler.compile(frags);
+}
+
+void addCallee(const ir::Expr &expr, std::vector<std::string> &names) {
+  if (expr.getKind() == ir::ExprKind::Call)
+    names.push_back(static_cast<const ir::Call &>(expr).functionName.getName());
+}
+
+// The names of the functions that a canonical fragment calls.
+std::vector<std::string> getCalleeNames(const ir::Fragment &frag) {
+  std::vector<std::string> names;
+  for (const auto &statement :
+       static_cast<const ir::Sequence &>(*frag.second).statements) {
+    if (statement->getKind() == ir::StatementKind::Move)
+      addCallee(*static_cast<const ir::Move &>(*statement).src, names);
+    else if (statement->getKind() == ir::StatementKind::CallStatement)
+      addCallee(*static_cast<const ir::CallStatement &>(*statement).call,
+                names);
+  }
+  return names;
+}
+
+bool hasDisplay(const bytecode::Module &module) {
+  return std::any_of(module.statics.begin(), module.statics.end(),
+                     [](const bytecode::Static &object) {
+                       return object.name == ir::displayName;
+                     });
+}
+
+} // namespace
+
+TieredEngine::TieredEngine(SymbolTable &symbols,
+                           const std::vector<ir::Fragment> &frags,
+                           uint32_t hotThreshold, bool isBackground)
+    : symbols(symbols), frags(frags), module(compileBytecode(frags)),
+      interpreter(module), isBackground(isBackground), isStale(false) {
+  // Programs hold on to the address of the display so it goes in pages of its
+  // own that stay put while native code comes and goes. String literals never
+  // change so native code has copies of its own.
+  for (size_t i = 0; i < module.statics.size(); ++i) {
+    const bytecode::Static &object = module.statics.at(i);
+    if (object.name != ir::displayName)
+      continue;
+    x86::ObjectCode staticsCode = {{}, {}, object.size, {}, {}};
+    staticsCode.symbols.push_back({object.name, x86::SymbolType::Object,
+                                   x86::Section::Bss, 0, object.size, false});
+    statics.load(staticsCode);
+    interpreter.bindStatic(
+        i, static_cast<int64_t *>(statics.getAddress(object.name)));
+  }
+  for (const ir::Fragment &frag : frags) {
+    callees.emplace_back();
+    for (const std::string &name : getCalleeNames(frag)) {
+      const auto iter = std::find_if(
+          module.functions.begin(), module.functions.end(),
+          [&name](const auto &function) { return function.name == name; });
+      // Calls into the runtime are native already.
+      if (iter != module.functions.end())
+        callees.back().push_back(iter - module.functions.begin());
+    }
+  }
+  interpreter.setHotThreshold(hotThreshold,
+                              [this](size_t function) { onHot(function); });
+  interpreter.setSafePointHandler([this]() {
+    // The request can outlive a wait for the same compile.
+    if (!compiler.joinable())
+      return;
+    compiler.join();
+    install();
+  });
+}
+
+TieredEngine::~TieredEngine() {
+  if (compiler.joinable())
+    compiler.join();
+}
+
+int64_t TieredEngine::call(const std::string &name,
+                           const std::vector<int64_t> &args) {
+  return interpreter.call(name, args);
+}
+
+void TieredEngine::run() { interpreter.run(); }
+
+bool TieredEngine::isNative(const std::string &name) const {
+  return std::any_of(nativeFunctions.begin(), nativeFunctions.end(),
+                     [this, &name](size_t function) {
+                       return module.functions.at(function).name == name;
+                     });
+}
+
+void TieredEngine::wait() {
+  while (compiler.joinable()) {
+    compiler.join();
+    install();
+  }
+}
+
+void TieredEngine::onHot(size_t function) {
+  // Everything the function can call has to come along with it.
+  const size_t count = hotFunctions.size();
+  std::vector<size_t> worklist = {function};
+  while (!worklist.empty()) {
+    const size_t next = worklist.back();
+    worklist.pop_back();
+    if (!hotFunctions.insert(next).second)
+      continue;
+    worklist.insert(worklist.end(), callees.at(next).begin(),
+                    callees.at(next).end());
+  }
+  if (hotFunctions.size() == count)
+    return;
+  if (compiler.joinable()) {
+    isStale = true;
+    return;
+  }
+  startCompiling();
+}
+
+void TieredEngine::startCompiling() {
+  compiling = hotFunctions;
+  isStale = false;
+  if (!isBackground) {
+    compiled = compile(compiling);
+    install();
+    return;
+  }
+  compiler = std::thread([this]() {
+    compiled = compile(compiling);
+    interpreter.requestSafePoint();
+  });
+}
+
+x86::ObjectCode TieredEngine::compile(const std::set<size_t> &functions) {
+  InstructionSelector instructionSelector(symbols);
+  RegisterAllocator registerAllocator(symbols);
+  std::vector<x86::Function> machineFunctions;
+  for (size_t function : functions) {
+    machineFunctions.push_back(instructionSelector.select(frags.at(function)));
+    registerAllocator.run(machineFunctions.back());
+  }
+  Encoder encoder;
+  x86::ObjectCode code = encoder.encode(machineFunctions);
+  // The display is the one the interpreter already uses.
+  for (x86::ObjectSymbol &symbol : code.symbols) {
+    if (symbol.name == ir::displayName) {
+      symbol.section.reset();
+      symbol.size = 0;
+      code.bssSize = 0;
+    }
+  }
+  return code;
+}
+
+void TieredEngine::install() {
+  // Nothing native is running while the interpreter is so the old code can go.
+  for (size_t function : nativeFunctions)
+    interpreter.setNativeEntry(function, nullptr);
+  jit = std::make_unique<Jit>();
+  if (hasDisplay(module))
+    jit->addSymbol(ir::displayName, statics.getAddress(ir::displayName));
+  jit->load(compiled);
+  nativeFunctions = compiling;
+  for (size_t function : nativeFunctions) {
+    const bytecode::Function &bytecodeFunction = module.functions.at(function);
+    if (Interpreter::canCallNative(bytecodeFunction))
+      interpreter.setNativeEntry(function,
+                                 jit->getAddress(bytecodeFunction.name));
+  }
+  if (isStale)
+    startCompiling();
+}
+
+} // namespace descartes
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Interpreter.h>
+#include <Ir.h>
+#include <Jit.h>
+#include <ObjectCode.h>
+#include <SymbolTable.h>
+
+#include <memory>
+#include <set>
+#include <thread>
+
+namespace descartes {
+
+// Runs a program in the interpreter to begin with and moves the functions that
+// get hot over to native code, so short programs start straight away and long
+// ones still end up running natively.
+//
+// A hot function is compiled along with everything it can call, since native
+// code can't call back into the interpreter, and calls to it from the
+// interpreter go to native code once it's loaded. Every time another function
+// gets hot the whole set is compiled again into a new object that replaces the
+// last one. Compiling can happen on another thread, in which case the new
+// object is swapped in at the next call the interpreter makes.
+//
+// There's no on stack replacement: a function that gets hot in a loop keeps
+// running in the interpreter until it's next called.
+class TieredEngine {
+public:
+  static const uint32_t defaultHotThreshold = 1000;
+  TieredEngine(SymbolTable &symbols, const std::vector<ir::Fragment> &frags,
+               uint32_t hotThreshold, bool isBackground);
+  virtual ~TieredEngine();
+  TieredEngine(const TieredEngine &) = delete;
+  TieredEngine &operator=(const TieredEngine &) = delete;
+  int64_t call(const std::string &name, const std::vector<int64_t> &args);
+  void run();
+  bool isNative(const std::string &name) const;
+  // Finishes any compiling that's under way and loads the result.
+  void wait();
+
+private:
+  void onHot(size_t function);
+  void startCompiling();
+  x86::ObjectCode compile(const std::set<size_t> &functions);
+  void install();
+  SymbolTable &symbols;
+  const std::vector<ir::Fragment> &frags;
+  const bytecode::Module module;
+  Interpreter interpreter;
+  const bool isBackground;
+  std::vector<std::vector<size_t>> callees;
+  std::set<size_t> hotFunctions;
+  std::set<size_t> nativeFunctions;
+  Jit statics;
+  std::unique_ptr<Jit> jit;
+  std::thread compiler;
+  std::set<size_t> compiling;
+  x86::ObjectCode compiled;
+  // Whether more functions got hot while compiling.
+  bool isStale;
+};
+
+} // namespace descartes
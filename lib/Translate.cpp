@@ -1,6 +1,9 @@
 #include "Translate.h"
 
+#include <algorithm>
+#include <bitset>
 #include <cassert>
+#include <limits>
 
 namespace descartes {
 
@@ -40,8 +43,60 @@ ir::RelOpKind binOpKindToRelOpKind(BinaryOpKind kind) {
   }
 }
 
+const ir::Name *getString(const ir::ExprPtr &expr) {
+  if (expr->getKind() != ir::ExprKind::Name)
+    return nullptr;
+  const auto *name = static_cast<const ir::Name *>(expr.get());
+  return ir::isString(name->value) ? name : nullptr;
+}
+
+const ir::Const *getConst(const ir::ExprPtr &expr) {
+  if (expr->getKind() != ir::ExprKind::Const)
+    return nullptr;
+  return static_cast<const ir::Const *>(expr.get());
+}
+
+// Copies a value that has already been evaluated into a constant or a
+// temporary.
+ir::ExprPtr copyBound(const ir::Expr &bound) {
+  if (bound.getKind() == ir::ExprKind::Const)
+    return std::make_unique<ir::Const>(
+        static_cast<const ir::Const &>(bound).value);
+  assert(bound.getKind() == ir::ExprKind::Temp);
+  return std::make_unique<ir::Temp>(static_cast<const ir::Temp &>(bound).id);
+}
+
+// Case dispatch tuning. Jump tables need enough entries to beat a short compare
+// tree and must not be mostly holes. Bit tests build their mask in an
+// `ir::Const` so the range must fit in its bits.
+const size_t minJumpTableEntries = 4;
+const long long minJumpTableDensityPercent = 40;
+const long long maxJumpTableRange = 4096;
+const size_t minBitTestCases = 3;
+const size_t maxBitTestDestinations = 3;
+const int maxBitTestRange = 30;
+// Below this many clusters a linear sequence of tests is as good as a binary
+// search.
+const size_t maxLinearClusters = 3;
+
 } // namespace
 
+// A run of sorted case values that is dispatched with a single strategy.
+struct Translate::CaseCluster {
+  enum class Kind {
+    // Every value in [low, high] goes to the same arm.
+    Range,
+    // Indexes a table of arm labels with `selector - low`.
+    JumpTable,
+    // Tests membership of `1 << (selector - low)` in a mask per arm.
+    BitTest,
+  };
+  Kind kind;
+  int low, high;
+  // The (value, arm index) pairs covered by this cluster.
+  std::vector<std::pair<int, size_t>> cases;
+};
+
 Translate::Translate(SymbolTable &symbols) : symbols(symbols), labelCount(0) {}
 
 ir::StatementPtr Translate::makeMove(ir::ExprPtr &&lhs, ir::ExprPtr &&rhs) {
@@ -55,77 +110,248 @@ ir::StatementPtr Translate::makeSequence(std::vector<ir::StatementPtr> &&body) {
 ir::StatementPtr Translate::makeIf(ir::ExprPtr &&condExpr,
                                    ir::StatementPtr &&thenStatement,
                                    ir::StatementPtr &&elseStatement) {
-  // TODO: Refactor to avoid repetition.
-  // This means we've got a nested conditional jump here.
-  if (condExpr->getKind() == ir::ExprKind::CondExpr) {
-    auto *condExprPtr = static_cast<ir::CondExpr *>(condExpr.get());
-    auto *condJumpPtr =
-        static_cast<ir::CondJump *>(condExprPtr->condJump.get());
-    assert(condJumpPtr);
-    // Save the then and else labels.
-    std::vector<ir::StatementPtr> seq;
-    seq.push_back(std::move(condExprPtr->condJump));
-    seq.push_back(std::make_unique<ir::Label>(condJumpPtr->thenLabel));
-    seq.push_back(std::move(thenStatement));
-    // Else statement is optional.
-    if (elseStatement) {
-      seq.push_back(std::make_unique<ir::Label>(condJumpPtr->elseLabel));
-      seq.push_back(std::move(elseStatement));
-    }
-    return makeSequence(std::move(seq));
+  // A constant condition means that only one branch can ever be taken.
+  if (const auto *constCond = getConst(condExpr)) {
+    if (constCond->value)
+      return std::move(thenStatement);
+    if (elseStatement)
+      return std::move(elseStatement);
+    return makeSequence({});
   }
-  // Otherwise it's something else that resolves to a boolean such as a variable
-  // or function call.
-  Symbol thenLabel = makeLabel(), elseLabel = makeLabel();
-  auto cond = std::make_unique<ir::CondJump>(
-      ir::RelOpKind::Equal, std::move(condExpr), std::make_unique<ir::Const>(1),
-      thenLabel, elseLabel);
+  auto cond = makeCondition(std::move(condExpr));
+  const Symbol thenLabel = cond->thenLabel, elseLabel = cond->elseLabel;
   std::vector<ir::StatementPtr> seq;
   seq.push_back(std::move(cond));
   seq.push_back(std::make_unique<ir::Label>(thenLabel));
   seq.push_back(std::move(thenStatement));
   if (elseStatement) {
-    // TODO: Make labels optional for conditionals in the IR.
-    //
-    // We need a proper way of saying that we don't intend to jump to an `else`
-    // block.
+    // The then branch must skip over the else branch.
+    const Symbol joinLabel = makeLabel();
+    seq.push_back(std::make_unique<ir::Jump>(joinLabel));
     seq.push_back(std::make_unique<ir::Label>(elseLabel));
     seq.push_back(std::move(elseStatement));
+    seq.push_back(std::make_unique<ir::Label>(joinLabel));
+  } else {
+    seq.push_back(std::make_unique<ir::Label>(elseLabel));
   }
   return makeSequence(std::move(seq));
 }
 
-ir::StatementPtr Translate::makeWhile(ir::ExprPtr &&condExpr,
+ir::StatementPtr Translate::makeWhile(std::vector<ir::StatementPtr> &&prelude,
+                                      ir::ExprPtr &&condExpr,
                                       ir::StatementPtr &&body) {
-  if (condExpr->getKind() == ir::ExprKind::CondExpr) {
-    auto *condExprPtr = static_cast<ir::CondExpr *>(condExpr.get());
-    auto *condJumpPtr =
-        static_cast<ir::CondJump *>(condExprPtr->condJump.get());
-    assert(condJumpPtr);
-    const Symbol condLabel = makeLabel();
-    std::vector<ir::StatementPtr> seq;
-    seq.push_back(std::make_unique<ir::Label>(condLabel));
-    seq.push_back(std::move(condExprPtr->condJump));
-    seq.push_back(std::make_unique<ir::Label>(condJumpPtr->thenLabel));
-    seq.push_back(std::move(body));
-    seq.push_back(std::make_unique<ir::Jump>(condLabel));
-    seq.push_back(std::make_unique<ir::Label>(condJumpPtr->elseLabel));
-    return makeSequence(std::move(seq));
+  // The body of a loop whose condition is constant false is dead.
+  if (const auto *constCond = getConst(condExpr)) {
+    if (!constCond->value)
+      return makeSequence(std::move(prelude));
   }
-  // Otherwise it's something else that resolves to a boolean such as a variable
-  // function or call.
-  const Symbol thenLabel = makeLabel(), elseLabel = makeLabel(),
-               condLabel = makeLabel();
-  auto cond = std::make_unique<ir::CondJump>(
-      ir::RelOpKind::Equal, std::move(condExpr), std::make_unique<ir::Const>(1),
-      thenLabel, elseLabel);
+  auto cond = makeCondition(std::move(condExpr));
+  const Symbol condLabel = makeLabel(), thenLabel = cond->thenLabel,
+               elseLabel = cond->elseLabel;
   std::vector<ir::StatementPtr> seq;
   seq.push_back(std::make_unique<ir::Label>(condLabel));
+  for (auto &statement : prelude)
+    seq.push_back(std::move(statement));
   seq.push_back(std::move(cond));
-  seq.push_back(std::make_unique<ir::Label>(cond->thenLabel));
+  seq.push_back(std::make_unique<ir::Label>(thenLabel));
   seq.push_back(std::move(body));
   seq.push_back(std::make_unique<ir::Jump>(condLabel));
-  seq.push_back(std::make_unique<ir::Label>(cond->elseLabel));
+  seq.push_back(std::make_unique<ir::Label>(elseLabel));
+  return makeSequence(std::move(seq));
+}
+
+ir::StatementPtr Translate::makeFor(ir::Access control, ir::ExprPtr &&first,
+                                    ir::ExprPtr &&last, bool to,
+                                    bool countDown,
+                                    std::optional<std::pair<int, int>> range,
+                                    ir::StatementPtr &&body) {
+  std::vector<ir::StatementPtr> seq;
+  // Both bounds are evaluated exactly once, before the first iteration.
+  const auto evaluateOnce = [this, &seq](ir::ExprPtr &&bound) -> ir::ExprPtr {
+    if (getConst(bound))
+      return std::move(bound);
+    const int temp = getCurrentLevel()->newTemp();
+    seq.push_back(makeMove(std::make_unique<ir::Temp>(temp), std::move(bound)));
+    return std::make_unique<ir::Temp>(temp);
+  };
+  ir::ExprPtr firstBound = evaluateOnce(std::move(first)),
+              lastBound = evaluateOnce(std::move(last));
+  const auto makeFirst = [&firstBound]() { return copyBound(*firstBound); };
+  const auto makeLast = [&lastBound]() { return copyBound(*lastBound); };
+  const auto *firstConst = getConst(firstBound),
+             *lastConst = getConst(lastBound);
+  const ir::RelOpKind emptyOp =
+      to ? ir::RelOpKind::GreaterThan : ir::RelOpKind::LessThan;
+  if (firstConst && lastConst &&
+      ir::foldRelOp(emptyOp, firstConst->value, lastConst->value))
+    return makeSequence(std::move(seq));
+  const Symbol bodyLabel = makeLabel(), latchLabel = makeLabel(),
+               doneLabel = makeLabel(), endLabel = makeLabel();
+  // Skip the loop entirely if the range is empty.
+  if (!firstConst || !lastConst) {
+    const Symbol initLabel = makeLabel();
+    seq.push_back(std::make_unique<ir::CondJump>(emptyOp, makeFirst(),
+                                                 makeLast(), endLabel,
+                                                 initLabel));
+    seq.push_back(std::make_unique<ir::Label>(initLabel));
+  }
+  // An empty loop never gives the control variable either value.
+  const auto checkBound = [this, &range, &seq](ir::ExprPtr &bound) {
+    const auto *constBound = getConst(bound);
+    if (constBound && constBound->value >= range->first &&
+        constBound->value <= range->second)
+      return;
+    bound = makeRangeCheck(copyBound(*bound), range->first, range->second,
+                           seq);
+  };
+  if (range) {
+    checkBound(firstBound);
+    checkBound(lastBound);
+  }
+  seq.push_back(makeMove(makeVarRef(control), makeFirst()));
+  const ir::ArithOpKind step =
+      to ? ir::ArithOpKind::Add : ir::ArithOpKind::Subtract;
+  if (countDown) {
+    // The trip count minus one. Wrapping on overflow still gives the right
+    // number of iterations when compared against zero.
+    const int counter = getCurrentLevel()->newTemp();
+    seq.push_back(makeMove(
+        std::make_unique<ir::Temp>(counter),
+        to ? makeArithOp(BinaryOpKind::Subtract, makeLast(), makeFirst())
+           : makeArithOp(BinaryOpKind::Subtract, makeFirst(), makeLast())));
+    seq.push_back(std::make_unique<ir::Label>(bodyLabel));
+    seq.push_back(std::move(body));
+    seq.push_back(std::make_unique<ir::CondJump>(
+        ir::RelOpKind::Equal, std::make_unique<ir::Temp>(counter),
+        std::make_unique<ir::Const>(0), doneLabel, latchLabel));
+    seq.push_back(std::make_unique<ir::Label>(latchLabel));
+    seq.push_back(makeMove(std::make_unique<ir::Temp>(counter),
+                           std::make_unique<ir::ArithOp>(
+                               ir::ArithOpKind::Subtract,
+                               std::make_unique<ir::Temp>(counter),
+                               std::make_unique<ir::Const>(1))));
+    seq.push_back(std::make_unique<ir::Jump>(bodyLabel));
+    // Leave the control variable at the final value as the other form does.
+    seq.push_back(std::make_unique<ir::Label>(doneLabel));
+    seq.push_back(makeMove(makeVarRef(control), makeLast()));
+  } else {
+    // Testing for the last value before stepping means that the control
+    // variable can't overflow when the bound is at the end of its range.
+    seq.push_back(std::make_unique<ir::Label>(bodyLabel));
+    seq.push_back(std::move(body));
+    seq.push_back(std::make_unique<ir::CondJump>(
+        ir::RelOpKind::Equal, makeVarRef(control), makeLast(), doneLabel,
+        latchLabel));
+    seq.push_back(std::make_unique<ir::Label>(latchLabel));
+    seq.push_back(makeMove(makeVarRef(control),
+                           std::make_unique<ir::ArithOp>(
+                               step, makeVarRef(control),
+                               std::make_unique<ir::Const>(1))));
+    seq.push_back(std::make_unique<ir::Jump>(bodyLabel));
+    seq.push_back(std::make_unique<ir::Label>(doneLabel));
+  }
+  seq.push_back(std::make_unique<ir::Label>(endLabel));
+  return makeSequence(std::move(seq));
+}
+
+ir::StatementPtr Translate::makeCase(ir::ExprPtr &&selector, CaseArms &&arms,
+                                     ir::StatementPtr &&elseStatement) {
+  std::vector<std::pair<int, size_t>> cases;
+  for (size_t armIndex = 0; armIndex < arms.size(); ++armIndex) {
+    for (int value : arms.at(armIndex).first)
+      cases.emplace_back(value, armIndex);
+  }
+  std::sort(cases.begin(), cases.end());
+  // Duplicate values would make the dispatch ambiguous, even for a constant
+  // selector.
+  for (size_t i = 1; i < cases.size(); ++i) {
+    if (cases.at(i - 1).first == cases.at(i).first)
+      throw SemanticError("Duplicate case label");
+  }
+  // A constant selector statically picks its arm.
+  if (const auto *constSelector = getConst(selector)) {
+    for (auto &arm : arms) {
+      for (int value : arm.first) {
+        if (value == constSelector->value)
+          return std::move(arm.second);
+      }
+    }
+    if (elseStatement)
+      return std::move(elseStatement);
+    return makeSequence({});
+  }
+  // Partition the sorted values into clusters, preferring jump tables, then
+  // contiguous ranges and bit tests, falling back to single values.
+  std::vector<CaseCluster> clusters;
+  for (size_t i = 0; i < cases.size();) {
+    const long long first = cases.at(i).first;
+    size_t tableEnd = i;
+    for (size_t j = i + 1; j < cases.size(); ++j) {
+      const long long range = cases.at(j).first - first + 1;
+      if (range > maxJumpTableRange)
+        break;
+      if (static_cast<long long>(j - i + 1) * 100 >=
+          range * minJumpTableDensityPercent)
+        tableEnd = j;
+    }
+    size_t rangeEnd = i;
+    while (rangeEnd + 1 < cases.size() &&
+           cases.at(rangeEnd + 1).first == cases.at(rangeEnd).first + 1 &&
+           cases.at(rangeEnd + 1).second == cases.at(i).second)
+      ++rangeEnd;
+    size_t bitTestEnd = i;
+    std::vector<size_t> destinations;
+    for (size_t j = i; j < cases.size(); ++j) {
+      if (cases.at(j).first - first > maxBitTestRange)
+        break;
+      const size_t arm = cases.at(j).second;
+      if (std::find(destinations.begin(), destinations.end(), arm) ==
+          destinations.end())
+        destinations.push_back(arm);
+      if (destinations.size() > maxBitTestDestinations)
+        break;
+      bitTestEnd = j;
+    }
+    CaseCluster cluster;
+    size_t clusterEnd = rangeEnd;
+    cluster.kind = CaseCluster::Kind::Range;
+    if (tableEnd - i + 1 >= minJumpTableEntries && tableEnd > rangeEnd) {
+      cluster.kind = CaseCluster::Kind::JumpTable;
+      clusterEnd = tableEnd;
+    } else if (bitTestEnd - i + 1 >= minBitTestCases &&
+               bitTestEnd > rangeEnd) {
+      cluster.kind = CaseCluster::Kind::BitTest;
+      clusterEnd = bitTestEnd;
+    }
+    cluster.low = cases.at(i).first;
+    cluster.high = cases.at(clusterEnd).first;
+    cluster.cases.assign(cases.begin() + i, cases.begin() + clusterEnd + 1);
+    clusters.push_back(std::move(cluster));
+    i = clusterEnd + 1;
+  }
+  std::vector<Symbol> armLabels;
+  for (size_t i = 0; i < arms.size(); ++i)
+    armLabels.push_back(makeLabel());
+  const Symbol defaultLabel = makeLabel(), endLabel = makeLabel();
+  // Evaluate the selector once.
+  const int selectorTemp = getCurrentLevel()->newTemp();
+  std::vector<ir::StatementPtr> seq;
+  seq.push_back(makeMove(std::make_unique<ir::Temp>(selectorTemp),
+                         std::move(selector)));
+  if (clusters.empty())
+    seq.push_back(std::make_unique<ir::Jump>(defaultLabel));
+  else
+    lowerCaseClusters(clusters, 0, clusters.size(), selectorTemp, std::nullopt,
+                      std::nullopt, armLabels, defaultLabel, seq);
+  for (size_t i = 0; i < arms.size(); ++i) {
+    seq.push_back(std::make_unique<ir::Label>(armLabels.at(i)));
+    seq.push_back(std::move(arms.at(i).second));
+    seq.push_back(std::make_unique<ir::Jump>(endLabel));
+  }
+  seq.push_back(std::make_unique<ir::Label>(defaultLabel));
+  if (elseStatement)
+    seq.push_back(std::move(elseStatement));
+  seq.push_back(std::make_unique<ir::Label>(endLabel));
   return makeSequence(std::move(seq));
 }
 
@@ -133,77 +359,510 @@ ir::StatementPtr Translate::makeCallStatement(ir::ExprPtr &&callExpr) const {
   return std::make_unique<ir::CallStatement>(std::move(callExpr));
 }
 
+ir::StatementPtr Translate::makeReturn(ir::Access result) const {
+  return std::make_unique<ir::Move>(
+      std::make_unique<ir::Temp>(ir::returnValue), makeVarRef(result));
+}
+
 ir::ExprPtr Translate::makeName(const StringLiteral &stringLiteral) const {
-  return std::make_unique<ir::Name>(stringLiteral.val);
+  return makeString(stringLiteral.val);
+}
+
+ir::ExprPtr Translate::makeString(Symbol value) const {
+  return std::make_unique<ir::Name>(
+      symbols.make(ir::stringPrefix + value.getName()));
 }
 
 ir::ExprPtr Translate::makeConst(const NumberLiteral &numberLiteral) const {
   return std::make_unique<ir::Const>(numberLiteral.val);
 }
 
+ir::ExprPtr Translate::makeConstValue(const ConstEntry &constEntry) const {
+  if (const auto *intVal = std::get_if<int>(&constEntry.value))
+    return std::make_unique<ir::Const>(*intVal);
+  return makeString(std::get<Symbol>(constEntry.value));
+}
+
 ir::ExprPtr Translate::makeVarRef(ir::Access access) const {
-  // We should be checking from the current frame onwards.
-  ir::ExprPtr frameAddr = getCurrentFramePointer();
-  for (auto levelIt = levels.rbegin(); levelIt != levels.rend(); ++levelIt) {
-    const auto &currentLevel = *levelIt;
-    if (currentLevel.get() == access.level) {
-      // The memory address is the offset from the frame pointer.
-      auto memAddress = std::make_unique<ir::ArithOp>(
-          ir::ArithOpKind::Add, std::move(frameAddr),
-          std::make_unique<ir::Const>(access.offset));
-      return std::make_unique<ir::Mem>(std::move(memAddress));
+  if (access.level == levels.back().get()) {
+    // Nested functions have been translated by the time the body of their
+    // parent is so it's known whether anything else reaches this.
+    const ir::Access resolved = access.level->resolve(access);
+    if (resolved.isInRegister())
+      return std::make_unique<ir::Temp>(*resolved.temp);
+  }
+  return std::make_unique<ir::Mem>(makeVarAddress(access));
+}
+
+ir::ExprPtr Translate::makeVarAddress(ir::Access access) const {
+  if (access.level != levels.back().get())
+    access.level->setEscapes(access);
+  // The memory address is the offset from the owning frame's pointer.
+  return std::make_unique<ir::ArithOp>(
+      ir::ArithOpKind::Add, makeFrameAddress(access.level),
+      std::make_unique<ir::Const>(access.offset));
+}
+
+ir::ExprPtr Translate::makeRangeCheck(ir::ExprPtr value, int low, int high,
+                                      std::vector<ir::StatementPtr> &checks) {
+  const int temp = getCurrentLevel()->newTemp();
+  const Symbol highLabel = makeLabel(), okLabel = makeLabel(),
+               errorLabel = makeLabel(), doneLabel = makeLabel();
+  checks.push_back(
+      makeMove(std::make_unique<ir::Temp>(temp), std::move(value)));
+  checks.push_back(std::make_unique<ir::CondJump>(
+      ir::RelOpKind::LessThan, std::make_unique<ir::Temp>(temp),
+      std::make_unique<ir::Const>(low), errorLabel, highLabel));
+  checks.push_back(std::make_unique<ir::Label>(highLabel));
+  checks.push_back(std::make_unique<ir::CondJump>(
+      ir::RelOpKind::GreaterThan, std::make_unique<ir::Temp>(temp),
+      std::make_unique<ir::Const>(high), errorLabel, okLabel));
+  checks.push_back(std::make_unique<ir::Label>(okLabel));
+  checks.push_back(std::make_unique<ir::Jump>(doneLabel));
+  // The runtime never returns from the error, but nothing downstream knows
+  // that. Clamping the value there leaves it within bounds on both paths into
+  // the join.
+  checks.push_back(std::make_unique<ir::Label>(errorLabel));
+  checks.push_back(makeCallStatement(
+      makeRuntimeCall(runtime::FunctionKind::RangeError, {})));
+  checks.push_back(makeMove(std::make_unique<ir::Temp>(temp),
+                            std::make_unique<ir::Const>(low)));
+  checks.push_back(std::make_unique<ir::Label>(doneLabel));
+  return std::make_unique<ir::Temp>(temp);
+}
+
+ir::ExprPtr Translate::makeDivisorCheck(ir::ExprPtr value,
+                                        std::vector<ir::StatementPtr> &checks) {
+  const int temp = getCurrentLevel()->newTemp();
+  const Symbol okLabel = makeLabel(), errorLabel = makeLabel();
+  checks.push_back(
+      makeMove(std::make_unique<ir::Temp>(temp), std::move(value)));
+  checks.push_back(std::make_unique<ir::CondJump>(
+      ir::RelOpKind::Equal, std::make_unique<ir::Temp>(temp),
+      std::make_unique<ir::Const>(0), errorLabel, okLabel));
+  // The runtime flushes the output before it stops, which a trap wouldn't.
+  // It never returns, so the error goes round in a loop of its own rather than
+  // joining the division and making everything after it forget what memory
+  // held.
+  checks.push_back(std::make_unique<ir::Label>(errorLabel));
+  checks.push_back(makeCallStatement(
+      makeRuntimeCall(runtime::FunctionKind::DivisionError, {})));
+  checks.push_back(std::make_unique<ir::Jump>(errorLabel));
+  checks.push_back(std::make_unique<ir::Label>(okLabel));
+  return std::make_unique<ir::Temp>(temp);
+}
+
+Translate::PackedBit
+Translate::makePackedBit(ir::ExprPtr address, ir::ExprPtr position,
+                         std::vector<ir::StatementPtr> &prelude) {
+  ir::Level *level = getCurrentLevel();
+  const int index = level->newTemp();
+  const PackedBit bit = {level->newTemp(), level->newTemp()};
+  prelude.push_back(
+      makeMove(std::make_unique<ir::Temp>(index), std::move(position)));
+  // Bits fill each word from the bottom up, so the word is the position
+  // divided by the bits in a word and the shift is what's left over.
+  auto wordOffset = std::make_unique<ir::ArithOp>(
+      ir::ArithOpKind::ShiftLeft,
+      std::make_unique<ir::ArithOp>(ir::ArithOpKind::ShiftRight,
+                                    std::make_unique<ir::Temp>(index),
+                                    std::make_unique<ir::Const>(6)),
+      std::make_unique<ir::Const>(3));
+  prelude.push_back(makeMove(
+      std::make_unique<ir::Temp>(bit.word),
+      std::make_unique<ir::ArithOp>(ir::ArithOpKind::Add, std::move(address),
+                                    std::move(wordOffset))));
+  prelude.push_back(makeMove(
+      std::make_unique<ir::Temp>(bit.shift),
+      std::make_unique<ir::ArithOp>(ir::ArithOpKind::And,
+                                    std::make_unique<ir::Temp>(index),
+                                    std::make_unique<ir::Const>(63))));
+  return bit;
+}
+
+ir::ExprPtr Translate::makePackedLoad(const PackedBit &bit) const {
+  return std::make_unique<ir::ArithOp>(
+      ir::ArithOpKind::And,
+      std::make_unique<ir::ArithOp>(
+          ir::ArithOpKind::ShiftRight,
+          std::make_unique<ir::Mem>(std::make_unique<ir::Temp>(bit.word)),
+          std::make_unique<ir::Temp>(bit.shift)),
+      std::make_unique<ir::Const>(1));
+}
+
+ir::StatementPtr Translate::makePackedStore(const PackedBit &bit,
+                                            ir::ExprPtr value) const {
+  // There's no complement or or, but `-1 - mask` is the complement and adding
+  // a bit that has just been cleared is the same as or-ing it in.
+  auto mask = std::make_unique<ir::ArithOp>(
+      ir::ArithOpKind::Subtract, std::make_unique<ir::Const>(-1),
+      std::make_unique<ir::ArithOp>(ir::ArithOpKind::ShiftLeft,
+                                    std::make_unique<ir::Const>(1),
+                                    std::make_unique<ir::Temp>(bit.shift)));
+  auto cleared = std::make_unique<ir::ArithOp>(
+      ir::ArithOpKind::And,
+      std::make_unique<ir::Mem>(std::make_unique<ir::Temp>(bit.word)),
+      std::move(mask));
+  auto set = std::make_unique<ir::ArithOp>(
+      ir::ArithOpKind::ShiftLeft, std::move(value),
+      std::make_unique<ir::Temp>(bit.shift));
+  // The value goes first so that anything it calls has written memory by the
+  // time the word is read.
+  return std::make_unique<ir::Move>(
+      std::make_unique<ir::Mem>(std::make_unique<ir::Temp>(bit.word)),
+      std::make_unique<ir::ArithOp>(ir::ArithOpKind::Add, std::move(set),
+                                    std::move(cleared)));
+}
+
+ir::ExprPtr
+Translate::makeElementAddress(ir::ExprPtr address,
+                              std::vector<ir::ExprPtr> &&indices,
+                              const std::vector<std::pair<int, int>> &bounds,
+                              int elementSize,
+                              std::vector<ir::StatementPtr> *checks) {
+  assert(!indices.empty() && indices.size() == bounds.size());
+  // Elements are in row-major order so the position of one is its indices in
+  // a mixed radix. Subtracting the position the lower bounds would have in
+  // one go leaves a single multiplication by the element size at the end.
+  ir::ExprPtr position;
+  int64_t firstPosition = 0;
+  for (size_t i = 0; i < indices.size(); ++i) {
+    const auto [low, high] = bounds.at(i);
+    ir::ExprPtr index = std::move(indices.at(i));
+    if (checks && !getConst(index))
+      index = makeRangeCheck(std::move(index), low, high, *checks);
+    if (position) {
+      const int length = high - low + 1;
+      position = makeArithOp(
+          BinaryOpKind::Add,
+          makeArithOp(BinaryOpKind::Multiply, std::move(position),
+                      std::make_unique<ir::Const>(length)),
+          std::move(index));
+      firstPosition = firstPosition * length + low;
     } else {
-      // Since it's not in the current frame, we need to read the first arg
-      // (static link) and get the address of the parent frame.
-      const ir::Access staticLink = currentLevel->locals.front();
-      auto frameMem = std::make_unique<ir::ArithOp>(
-          ir::ArithOpKind::Add, std::move(frameAddr),
-          std::make_unique<ir::Const>(staticLink.offset));
-      frameAddr = std::make_unique<ir::Mem>(std::move(frameMem));
+      position = std::move(index);
+      firstPosition = low;
     }
   }
-  throw SemanticError("Could not find frame owning access");
+  // The semantic analyser keeps the bounds small enough for this to fit.
+  assert(firstPosition >= std::numeric_limits<int>::min() &&
+         firstPosition <= std::numeric_limits<int>::max());
+  if (firstPosition != 0)
+    position = makeArithOp(BinaryOpKind::Subtract, std::move(position),
+                           std::make_unique<ir::Const>(firstPosition));
+  ir::ExprPtr offset =
+      makeArithOp(BinaryOpKind::Multiply, std::move(position),
+                  std::make_unique<ir::Const>(elementSize));
+  // Constant indices fold into the displacement of the array itself.
+  if (const auto *constOffset = getConst(offset)) {
+    auto *arithOp = address->getKind() == ir::ExprKind::ArithOp
+                        ? static_cast<ir::ArithOp *>(address.get())
+                        : nullptr;
+    if (arithOp && arithOp->op == ir::ArithOpKind::Add &&
+        getConst(arithOp->rhs)) {
+      static_cast<ir::Const &>(*arithOp->rhs).value += constOffset->value;
+      return address;
+    }
+  }
+  return makeArithOp(BinaryOpKind::Add, std::move(address), std::move(offset));
+}
+
+ir::ExprPtr Translate::makeCall(Symbol functionName, const ir::Level *parent,
+                                std::vector<ir::ExprPtr> &&args) const {
+  // Functions receive the frame of the level they were declared in as their
+  // static link.
+  if (parent)
+    args.insert(args.begin(), makeFrameAddress(parent));
+  return std::make_unique<ir::Call>(functionName, std::move(args));
+}
+
+ir::ExprPtr Translate::makeRuntimeCall(runtime::FunctionKind kind,
+                                       std::vector<ir::ExprPtr> &&args) const {
+  const runtime::Function &function = runtime::getFunction(kind);
+  assert(args.size() == function.argumentCount);
+  return std::make_unique<ir::Call>(symbols.make(function.name),
+                                    std::move(args));
 }
 
 ir::ExprPtr Translate::makeArithOp(BinaryOpKind kind, ir::ExprPtr lhs,
                                    ir::ExprPtr rhs) const {
   const ir::ArithOpKind k = binOpKindToArithOpKind(kind);
+  const auto *lhsConst = getConst(lhs), *rhsConst = getConst(rhs);
+  if (lhsConst && rhsConst) {
+    if (auto folded = ir::foldArithOp(k, lhsConst->value, rhsConst->value))
+      return std::make_unique<ir::Const>(*folded);
+  }
   return std::make_unique<ir::ArithOp>(k, std::move(lhs), std::move(rhs));
 }
 
 ir::ExprPtr Translate::makeCondJump(BinaryOpKind kind, ir::ExprPtr lhs,
                                     ir::ExprPtr rhs) {
-  const Symbol thenLabel = makeLabel(), elseLabel = makeLabel();
   const ir::RelOpKind k = binOpKindToRelOpKind(kind);
+  // Comparisons between constants evaluate to a constant boolean.
+  const auto *lhsConst = getConst(lhs), *rhsConst = getConst(rhs);
+  if (lhsConst && rhsConst)
+    return std::make_unique<ir::Const>(
+        ir::foldRelOp(k, lhsConst->value, rhsConst->value));
+  const Symbol thenLabel = makeLabel(), elseLabel = makeLabel();
   auto condJump = std::make_unique<ir::CondJump>(
       k, std::move(lhs), std::move(rhs), thenLabel, elseLabel);
   auto condExpr = std::make_unique<ir::CondExpr>(std::move(condJump));
   return condExpr;
 }
 
-void Translate::pushFrag(const ir::Level &level, StatementPtr body) {
-  frags.emplace_back(level, std::move(body));
+ir::ExprPtr Translate::makeStringCompare(BinaryOpKind kind, ir::ExprPtr lhs,
+                                         ir::ExprPtr rhs) {
+  // Comparisons between literals evaluate to a constant boolean too.
+  const auto *lhsString = getString(lhs), *rhsString = getString(rhs);
+  if (lhsString && rhsString) {
+    const int order = ir::getStringValue(lhsString->value)
+                          .compare(ir::getStringValue(rhsString->value));
+    return std::make_unique<ir::Const>(ir::foldRelOp(
+        binOpKindToRelOpKind(kind), (order > 0) - (order < 0), 0));
+  }
+  std::vector<ir::ExprPtr> args;
+  args.push_back(std::move(lhs));
+  args.push_back(std::move(rhs));
+  // Equality can give up as soon as the lengths differ.
+  if (kind == BinaryOpKind::Equal || kind == BinaryOpKind::NotEqual)
+    return makeCondJump(
+        kind == BinaryOpKind::Equal ? BinaryOpKind::NotEqual
+                                    : BinaryOpKind::Equal,
+        makeRuntimeCall(runtime::FunctionKind::EqualStrings, std::move(args)),
+        std::make_unique<ir::Const>(0));
+  return makeCondJump(
+      kind,
+      makeRuntimeCall(runtime::FunctionKind::CompareStrings, std::move(args)),
+      std::make_unique<ir::Const>(0));
+}
+
+ir::ExprPtr Translate::makeConcat(ir::ExprPtr lhs, ir::ExprPtr rhs) const {
+  const auto *lhsString = getString(lhs), *rhsString = getString(rhs);
+  if (lhsString && rhsString)
+    return std::make_unique<ir::Name>(
+        symbols.make(lhsString->value.getName() +
+                     ir::getStringValue(rhsString->value)));
+  std::vector<ir::ExprPtr> args;
+  args.push_back(std::move(lhs));
+  args.push_back(std::move(rhs));
+  return makeRuntimeCall(runtime::FunctionKind::ConcatStrings, std::move(args));
+}
+
+void Translate::pushFrag(ir::StatementPtr body) {
+  // Formals that live in temporaries are copied out of the frame first.
+  const ir::Level &level = *levels.back();
+  std::vector<ir::StatementPtr> seq;
+  for (const ir::Access &formal : level.formals) {
+    for (const ir::Access &local : level.locals) {
+      if (local.offset != formal.offset || !local.isInRegister())
+        continue;
+      auto frameAddress = std::make_unique<ir::ArithOp>(
+          ir::ArithOpKind::Add, getCurrentFramePointer(),
+          std::make_unique<ir::Const>(local.offset));
+      seq.push_back(std::make_unique<ir::Move>(
+          std::make_unique<ir::Temp>(*local.temp),
+          std::make_unique<ir::Mem>(std::move(frameAddress))));
+    }
+  }
+  if (!seq.empty()) {
+    seq.push_back(std::move(body));
+    body = makeSequence(std::move(seq));
+  }
+  // The fragment takes ownership of the current level so that accesses into it
+  // remain valid after the level is exited.
+  frags.emplace_back(std::move(levels.back()), std::move(body));
 }
 
-const std::vector<ir::Fragment> &Translate::getFrags() const { return frags; }
+std::vector<ir::Fragment> &Translate::getFrags() { return frags; }
 
 void Translate::enterLevel(Symbol name) {
-  levels.push_back(std::make_unique<ir::Level>(name));
+  levels.push_back(std::make_unique<ir::Level>(
+      name, levels.empty() ? nullptr : levels.back().get()));
 }
 
 void Translate::exitLevel() { levels.pop_back(); }
 
 ir::Level *Translate::getCurrentLevel() { return levels.back().get(); }
 
+void Translate::lowerCaseClusters(const std::vector<CaseCluster> &clusters,
+                                  size_t begin, size_t end, int selector,
+                                  std::optional<int> low,
+                                  std::optional<int> high,
+                                  const std::vector<Symbol> &armLabels,
+                                  Symbol defaultLabel,
+                                  std::vector<ir::StatementPtr> &seq) {
+  assert(begin < end);
+  if (end - begin <= maxLinearClusters) {
+    // Test each cluster in turn, falling through to the next on a miss.
+    for (size_t i = begin; i < end; ++i) {
+      const bool isLast = i + 1 == end;
+      const Symbol missLabel = isLast ? defaultLabel : makeLabel();
+      lowerCaseCluster(clusters.at(i), selector, low, high, armLabels,
+                       defaultLabel, missLabel, seq);
+      if (!isLast)
+        seq.push_back(std::make_unique<ir::Label>(missLabel));
+    }
+    return;
+  }
+  // Split on the middle cluster so that dispatch is logarithmic in the number
+  // of clusters. Each half knows the bounds established by the comparisons on
+  // its path which lets it skip redundant range checks.
+  const size_t middle = begin + (end - begin) / 2;
+  const int pivot = clusters.at(middle).low;
+  const Symbol lowerLabel = makeLabel(), upperLabel = makeLabel();
+  seq.push_back(std::make_unique<ir::CondJump>(
+      ir::RelOpKind::LessThan, std::make_unique<ir::Temp>(selector),
+      std::make_unique<ir::Const>(pivot), lowerLabel, upperLabel));
+  seq.push_back(std::make_unique<ir::Label>(lowerLabel));
+  lowerCaseClusters(clusters, begin, middle, selector, low, pivot - 1,
+                    armLabels, defaultLabel, seq);
+  seq.push_back(std::make_unique<ir::Label>(upperLabel));
+  lowerCaseClusters(clusters, middle, end, selector, pivot, high, armLabels,
+                    defaultLabel, seq);
+}
+
+void Translate::lowerCaseCluster(const CaseCluster &cluster, int selector,
+                                 std::optional<int> low,
+                                 std::optional<int> high,
+                                 const std::vector<Symbol> &armLabels,
+                                 Symbol defaultLabel, Symbol missLabel,
+                                 std::vector<ir::StatementPtr> &seq) {
+  const auto makeSelector = [selector]() {
+    return std::make_unique<ir::Temp>(selector);
+  };
+  // Bounds check the selector against the cluster unless the path leading here
+  // already proves it.
+  const bool checkLow = !low || *low < cluster.low,
+             checkHigh = !high || *high > cluster.high;
+  if (cluster.kind == CaseCluster::Kind::Range && checkLow && checkHigh &&
+      cluster.low == cluster.high) {
+    seq.push_back(std::make_unique<ir::CondJump>(
+        ir::RelOpKind::Equal, makeSelector(),
+        std::make_unique<ir::Const>(cluster.low),
+        armLabels.at(cluster.cases.front().second), missLabel));
+    return;
+  }
+  if (checkLow) {
+    const Symbol inLabel = makeLabel();
+    seq.push_back(std::make_unique<ir::CondJump>(
+        ir::RelOpKind::LessThan, makeSelector(),
+        std::make_unique<ir::Const>(cluster.low), missLabel, inLabel));
+    seq.push_back(std::make_unique<ir::Label>(inLabel));
+  }
+  // Values in the cluster's range that don't belong to an arm can't belong to
+  // any other cluster either so they go straight to the default.
+  if (cluster.kind == CaseCluster::Kind::Range) {
+    const Symbol armLabel = armLabels.at(cluster.cases.front().second);
+    if (checkHigh)
+      seq.push_back(std::make_unique<ir::CondJump>(
+          ir::RelOpKind::GreaterThan, makeSelector(),
+          std::make_unique<ir::Const>(cluster.high), missLabel, armLabel));
+    else
+      seq.push_back(std::make_unique<ir::Jump>(armLabel));
+    return;
+  }
+  if (checkHigh) {
+    const Symbol inLabel = makeLabel();
+    seq.push_back(std::make_unique<ir::CondJump>(
+        ir::RelOpKind::GreaterThan, makeSelector(),
+        std::make_unique<ir::Const>(cluster.high), missLabel, inLabel));
+    seq.push_back(std::make_unique<ir::Label>(inLabel));
+  }
+  ir::ExprPtr index = makeArithOp(BinaryOpKind::Subtract, makeSelector(),
+                                  std::make_unique<ir::Const>(cluster.low));
+  if (cluster.kind == CaseCluster::Kind::JumpTable) {
+    std::vector<Symbol> tableLabels(cluster.high - cluster.low + 1,
+                                    defaultLabel);
+    for (const auto &c : cluster.cases)
+      tableLabels.at(c.first - cluster.low) = armLabels.at(c.second);
+    seq.push_back(std::make_unique<ir::JumpTable>(std::move(index),
+                                                  std::move(tableLabels)));
+    return;
+  }
+  // Bit test. Compute the bit for the selector once and test it against the
+  // mask of each destination, most common first.
+  std::vector<std::pair<size_t, int>> masks;
+  for (const auto &c : cluster.cases) {
+    const int bit = 1 << (c.first - cluster.low);
+    auto iter = std::find_if(
+        masks.begin(), masks.end(),
+        [&c](const std::pair<size_t, int> &m) { return m.first == c.second; });
+    if (iter == masks.end())
+      masks.emplace_back(c.second, bit);
+    else
+      iter->second |= bit;
+  }
+  std::stable_sort(masks.begin(), masks.end(),
+                   [](const std::pair<size_t, int> &lhs,
+                      const std::pair<size_t, int> &rhs) {
+                     return std::bitset<32>(lhs.second).count() >
+                            std::bitset<32>(rhs.second).count();
+                   });
+  const int bitTemp = getCurrentLevel()->newTemp();
+  seq.push_back(makeMove(
+      std::make_unique<ir::Temp>(bitTemp),
+      std::make_unique<ir::ArithOp>(ir::ArithOpKind::ShiftLeft,
+                                    std::make_unique<ir::Const>(1),
+                                    std::move(index))));
+  for (size_t i = 0; i < masks.size(); ++i) {
+    const bool isLast = i + 1 == masks.size();
+    const Symbol nextLabel = isLast ? defaultLabel : makeLabel();
+    auto test = std::make_unique<ir::ArithOp>(
+        ir::ArithOpKind::And, std::make_unique<ir::Temp>(bitTemp),
+        std::make_unique<ir::Const>(masks.at(i).second));
+    seq.push_back(std::make_unique<ir::CondJump>(
+        ir::RelOpKind::NotEqual, std::move(test),
+        std::make_unique<ir::Const>(0), armLabels.at(masks.at(i).first),
+        nextLabel));
+    if (!isLast)
+      seq.push_back(std::make_unique<ir::Label>(nextLabel));
+  }
+}
+
 // TODO: Make a label type to ensure that they're not exchangeable with symbols.
 Symbol Translate::makeLabel() {
   const std::string labelName = "L" + std::to_string(labelCount++);
   return symbols.make(labelName);
 }
 
+std::unique_ptr<ir::CondJump>
+Translate::makeCondition(ir::ExprPtr &&condExpr) {
+  // A relational check already carries its own jump.
+  if (condExpr->getKind() == ir::ExprKind::CondExpr) {
+    auto *condExprPtr = static_cast<ir::CondExpr *>(condExpr.get());
+    assert(condExprPtr->condJump->getKind() == ir::StatementKind::CondJump);
+    return std::unique_ptr<ir::CondJump>(
+        static_cast<ir::CondJump *>(condExprPtr->condJump.release()));
+  }
+  // Otherwise it's something else that resolves to a boolean such as a variable
+  // or function call.
+  return std::make_unique<ir::CondJump>(
+      ir::RelOpKind::Equal, std::move(condExpr), std::make_unique<ir::Const>(1),
+      makeLabel(), makeLabel());
+}
+
+ir::ExprPtr Translate::makeFrameAddress(const ir::Level *level) const {
+  // We should be checking from the current frame onwards.
+  ir::ExprPtr frameAddr = getCurrentFramePointer();
+  for (auto levelIt = levels.rbegin(); levelIt != levels.rend(); ++levelIt) {
+    const auto &currentLevel = *levelIt;
+    if (currentLevel.get() == level)
+      return frameAddr;
+    // Since it's not in the current frame, we need to read the first arg
+    // (static link) and get the address of the parent frame.
+    const ir::Access staticLink = currentLevel->locals.front();
+    if (levelIt != levels.rbegin())
+      currentLevel->setEscapes(staticLink);
+    auto frameMem = std::make_unique<ir::ArithOp>(
+        ir::ArithOpKind::Add, std::move(frameAddr),
+        std::make_unique<ir::Const>(staticLink.offset));
+    frameAddr = std::make_unique<ir::Mem>(std::move(frameMem));
+  }
+  throw SemanticError("Could not find frame owning access");
+}
+
 ir::ExprPtr Translate::getCurrentFramePointer() const {
-  // TODO: Get current frame pointer for each arch.
-  return nullptr;
+  return std::make_unique<ir::Temp>(ir::framePointer);
 }
 
 } // namespace descartes
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "Environment.h"
 #include "Ir.h"
+#include "Runtime.h"
+
+#include <optional>
 
 namespace descartes {
 
@@ -13,22 +17,95 @@ public:
   ir::StatementPtr makeIf(ir::ExprPtr &&condExpr,
                           ir::StatementPtr &&thenStatement,
                           ir::StatementPtr &&elseStatement);
-  ir::StatementPtr makeWhile(ir::ExprPtr &&condExpr, ir::StatementPtr &&body);
+  // `prelude` runs before every evaluation of the condition.
+  ir::StatementPtr makeWhile(std::vector<ir::StatementPtr> &&prelude,
+                             ir::ExprPtr &&condExpr, ir::StatementPtr &&body);
+  // `countDown` counts the remaining iterations down to zero instead of
+  // comparing the control variable against the bound, which is only valid if
+  // nothing reads the control variable while the loop is running. If there's
+  // a `range`, both bounds are checked against it once the loop is known to
+  // run.
+  ir::StatementPtr makeFor(ir::Access control, ir::ExprPtr &&first,
+                           ir::ExprPtr &&last, bool to, bool countDown,
+                           std::optional<std::pair<int, int>> range,
+                           ir::StatementPtr &&body);
+  // Each arm pairs its label values with the statement to execute.
+  using CaseArms = std::vector<std::pair<std::vector<int>, ir::StatementPtr>>;
+  ir::StatementPtr makeCase(ir::ExprPtr &&selector, CaseArms &&arms,
+                            ir::StatementPtr &&elseStatement);
   ir::StatementPtr makeCallStatement(ir::ExprPtr &&callExpr) const;
+  ir::StatementPtr makeReturn(ir::Access result) const;
   ir::ExprPtr makeName(const StringLiteral &stringLiteral) const;
+  ir::ExprPtr makeString(Symbol value) const;
   ir::ExprPtr makeConst(const NumberLiteral &numberLiteral) const;
+  ir::ExprPtr makeConstValue(const ConstEntry &constEntry) const;
   ir::ExprPtr makeVarRef(ir::Access access) const;
+  ir::ExprPtr makeVarAddress(ir::Access access) const;
+  // A temporary holding `value`, with statements added to `checks` that stop
+  // the program unless it's between `low` and `high`. They have to run before
+  // the temporary is used.
+  ir::ExprPtr makeRangeCheck(ir::ExprPtr value, int low, int high,
+                             std::vector<ir::StatementPtr> &checks);
+  // Likewise for a divisor, which stops the program if it's zero.
+  ir::ExprPtr makeDivisorCheck(ir::ExprPtr value,
+                               std::vector<ir::StatementPtr> &checks);
+  // The address of an element of the array at `address`, where each index
+  // comes with the bounds of its dimension and elements are `elementSize`
+  // bytes apart. If `checks` isn't null, every index is range checked into it.
+  ir::ExprPtr makeElementAddress(ir::ExprPtr address,
+                                 std::vector<ir::ExprPtr> &&indices,
+                                 const std::vector<std::pair<int, int>> &bounds,
+                                 int elementSize,
+                                 std::vector<ir::StatementPtr> *checks);
+  // An element of a packed boolean array, which is a single bit. The address of
+  // the word it's in and its position there are kept in temporaries so that
+  // reading and writing it evaluates the index once.
+  struct PackedBit {
+    int word, shift;
+  };
+  // The bit at `position`, counting from the first element of the array at
+  // `address`. It's worked out by statements added to `prelude`, which have
+  // to run before the bit is used.
+  PackedBit makePackedBit(ir::ExprPtr address, ir::ExprPtr position,
+                          std::vector<ir::StatementPtr> &prelude);
+  ir::ExprPtr makePackedLoad(const PackedBit &bit) const;
+  // Rewrites the word with the bit cleared and then set to `value`.
+  ir::StatementPtr makePackedStore(const PackedBit &bit,
+                                   ir::ExprPtr value) const;
+  // `parent` is the level the function was declared in, or null for functions
+  // that don't take a static link.
+  ir::ExprPtr makeCall(Symbol functionName, const ir::Level *parent,
+                       std::vector<ir::ExprPtr> &&args) const;
+  ir::ExprPtr makeRuntimeCall(runtime::FunctionKind kind,
+                              std::vector<ir::ExprPtr> &&args) const;
   ir::ExprPtr makeArithOp(BinaryOpKind kind, ir::ExprPtr lhs,
                           ir::ExprPtr rhs) const;
   ir::ExprPtr makeCondJump(BinaryOpKind kind, ir::ExprPtr lhs, ir::ExprPtr rhs);
-  void pushFrag(const ir::Level &level, StatementPtr body);
-  const std::vector<ir::Fragment> &getFrags() const;
+  ir::ExprPtr makeStringCompare(BinaryOpKind kind, ir::ExprPtr lhs,
+                                ir::ExprPtr rhs);
+  ir::ExprPtr makeConcat(ir::ExprPtr lhs, ir::ExprPtr rhs) const;
+  void pushFrag(ir::StatementPtr body);
+  std::vector<ir::Fragment> &getFrags();
   void enterLevel(Symbol name);
   void exitLevel();
   ir::Level *getCurrentLevel();
 
 private:
+  struct CaseCluster;
+  void lowerCaseClusters(const std::vector<CaseCluster> &clusters,
+                         size_t begin, size_t end, int selector,
+                         std::optional<int> low, std::optional<int> high,
+                         const std::vector<Symbol> &armLabels,
+                         Symbol defaultLabel,
+                         std::vector<ir::StatementPtr> &seq);
+  void lowerCaseCluster(const CaseCluster &cluster, int selector,
+                        std::optional<int> low, std::optional<int> high,
+                        const std::vector<Symbol> &armLabels,
+                        Symbol defaultLabel, Symbol missLabel,
+                        std::vector<ir::StatementPtr> &seq);
   Symbol makeLabel();
+  std::unique_ptr<ir::CondJump> makeCondition(ir::ExprPtr &&condExpr);
+  ir::ExprPtr makeFrameAddress(const ir::Level *level) const;
   ir::ExprPtr getCurrentFramePointer() const;
   SymbolTable &symbols;
   std::vector<ir::Fragment> frags;
@@ -0,0 +1,222 @@
+#include "X86.h"
+
+#include <algorithm>
+
+namespace descartes::x86 {
+
+namespace {
+
+// Registers that a call is free to overwrite.
+const int callerSavedRegisters[] = {rax, rcx, rdx, rsi, rdi, r8, r9, r10, r11};
+
+void addAddressUses(const Operand &operand, std::vector<int> &uses) {
+  if (operand.kind != OperandKind::Memory)
+    return;
+  if (operand.reg)
+    uses.push_back(*operand.reg);
+  if (operand.index)
+    uses.push_back(*operand.index);
+}
+
+} // namespace
+
+Operand Operand::makeRegister(int reg) {
+  Operand operand{OperandKind::Register, reg, std::nullopt, 1, 0,
+                  std::nullopt};
+  return operand;
+}
+
+Operand Operand::makeImmediate(int value) {
+  Operand operand{OperandKind::Immediate, std::nullopt, std::nullopt, 1, value,
+                  std::nullopt};
+  return operand;
+}
+
+Operand Operand::makeMemory(int base, int displacement) {
+  Operand operand{OperandKind::Memory, base, std::nullopt, 1, displacement,
+                  std::nullopt};
+  return operand;
+}
+
+Operand Operand::makeMemory(int base, int index, int scale) {
+  Operand operand{OperandKind::Memory, base, index, scale, 0, std::nullopt};
+  return operand;
+}
+
+Operand Operand::makeStatic(Symbol symbol, int displacement) {
+  Operand operand{OperandKind::Memory, std::nullopt, std::nullopt, 1,
+                  displacement, symbol};
+  return operand;
+}
+
+Operand Operand::makeLabel(Symbol label) {
+  Operand operand{OperandKind::Label, std::nullopt, std::nullopt, 1, 0, label};
+  return operand;
+}
+
+bool Operand::isRegister(int reg) const {
+  return kind == OperandKind::Register && this->reg == reg;
+}
+
+Condition toCondition(ir::RelOpKind kind) {
+  switch (kind) {
+  case ir::RelOpKind::Equal:
+    return Condition::Equal;
+  case ir::RelOpKind::NotEqual:
+    return Condition::NotEqual;
+  case ir::RelOpKind::LessThan:
+    return Condition::Less;
+  case ir::RelOpKind::GreaterThan:
+    return Condition::Greater;
+  case ir::RelOpKind::LessThanEqual:
+    return Condition::LessEqual;
+  case ir::RelOpKind::GreaterThanEqual:
+    return Condition::GreaterEqual;
+  }
+  return Condition::Equal;
+}
+
+Condition swapCondition(Condition condition) {
+  switch (condition) {
+  case Condition::Less:
+    return Condition::Greater;
+  case Condition::Greater:
+    return Condition::Less;
+  case Condition::LessEqual:
+    return Condition::GreaterEqual;
+  case Condition::GreaterEqual:
+    return Condition::LessEqual;
+  default:
+    return condition;
+  }
+}
+
+Instruction::Instruction(Opcode op, std::vector<Operand> operands)
+    : op(op), operands(std::move(operands)), condition(Condition::Equal),
+      size(ir::wordSize), argumentCount(0), returnsValue(false) {}
+
+std::vector<int> getUses(const Instruction &instruction) {
+  std::vector<int> uses;
+  for (const Operand &operand : instruction.operands)
+    addAddressUses(operand, uses);
+  const auto &operands = instruction.operands;
+  switch (instruction.op) {
+  case Opcode::Mov:
+  case Opcode::Lea:
+    if (operands.front().kind == OperandKind::Register)
+      uses.push_back(*operands.front().reg);
+    break;
+  case Opcode::Imul:
+    if (operands.size() == 3) {
+      if (operands.at(1).kind == OperandKind::Register)
+        uses.push_back(*operands.at(1).reg);
+      break;
+    }
+    if (operands.size() == 1) {
+      if (operands.front().kind == OperandKind::Register)
+        uses.push_back(*operands.front().reg);
+      uses.push_back(rax);
+      break;
+    }
+    [[fallthrough]];
+  case Opcode::Add:
+  case Opcode::Sub:
+  case Opcode::And:
+  case Opcode::Shl:
+  case Opcode::Sar:
+  case Opcode::Cmp:
+    for (const Operand &operand : operands) {
+      if (operand.kind == OperandKind::Register)
+        uses.push_back(*operand.reg);
+    }
+    break;
+  case Opcode::Cqo:
+    uses.push_back(rax);
+    break;
+  case Opcode::Idiv:
+    if (operands.front().kind == OperandKind::Register)
+      uses.push_back(*operands.front().reg);
+    uses.push_back(rax);
+    uses.push_back(rdx);
+    break;
+  case Opcode::Push:
+    if (operands.front().kind == OperandKind::Register)
+      uses.push_back(*operands.front().reg);
+    break;
+  case Opcode::Call:
+    for (size_t i = 0; i < instruction.argumentCount; ++i)
+      uses.push_back(argumentRegisters[i]);
+    break;
+  case Opcode::Ret:
+    if (instruction.returnsValue)
+      uses.push_back(rax);
+    break;
+  default:
+    break;
+  }
+  return uses;
+}
+
+std::vector<int> getDefs(const Instruction &instruction) {
+  const auto &operands = instruction.operands;
+  switch (instruction.op) {
+  case Opcode::Mov:
+  case Opcode::Movsx:
+  case Opcode::Movzx:
+  case Opcode::Lea:
+  case Opcode::Add:
+  case Opcode::Sub:
+  case Opcode::And:
+  case Opcode::Shl:
+  case Opcode::Sar:
+  case Opcode::Pop:
+    if (operands.back().kind == OperandKind::Register)
+      return {*operands.back().reg};
+    return {};
+  case Opcode::Cqo:
+    return {rdx};
+  case Opcode::Imul:
+    if (operands.size() == 1)
+      return {rax, rdx};
+    if (operands.back().kind == OperandKind::Register)
+      return {*operands.back().reg};
+    return {};
+  case Opcode::Idiv:
+    return {rax, rdx};
+  case Opcode::Call:
+    return std::vector<int>(std::begin(callerSavedRegisters),
+                            std::end(callerSavedRegisters));
+  default:
+    return {};
+  }
+}
+
+Function::Function(const ir::Level &level)
+    : level(level), registerCount(physicalRegisterCount), frameSize(0) {}
+
+int getDisplaySize(const std::vector<Function> &functions) {
+  int depth = -1;
+  for (const Function &function : functions) {
+    if (function.level.isDisplayed)
+      depth = std::max(depth, function.level.depth);
+  }
+  return (depth + 1) * ir::wordSize;
+}
+
+std::vector<Symbol> getStrings(const std::vector<Function> &functions) {
+  std::vector<Symbol> strings;
+  for (const Function &function : functions) {
+    for (const Instruction &instruction : function.instructions) {
+      for (const Operand &operand : instruction.operands) {
+        if (operand.kind == OperandKind::Memory && operand.symbol &&
+            ir::isString(*operand.symbol) &&
+            std::find(strings.begin(), strings.end(), *operand.symbol) ==
+                strings.end())
+          strings.push_back(*operand.symbol);
+      }
+    }
+  }
+  return strings;
+}
+
+} // namespace descartes::x86
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <Ir.h>
+
+#include <optional>
+#include <vector>
+
+// Machine code for x86-64 following the System V ABI. Instructions refer to
+// registers by number: the hardware registers come first in their encoding
+// order and every number after them is a virtual register that the register
+// allocator maps to one of them.
+namespace descartes::x86 {
+
+static const int rax = 0;
+static const int rcx = 1;
+static const int rdx = 2;
+static const int rbx = 3;
+static const int rsp = 4;
+static const int rbp = 5;
+static const int rsi = 6;
+static const int rdi = 7;
+static const int r8 = 8;
+static const int r9 = 9;
+static const int r10 = 10;
+static const int r11 = 11;
+static const int r12 = 12;
+static const int r13 = 13;
+static const int r14 = 14;
+static const int r15 = 15;
+static const int physicalRegisterCount = 16;
+
+inline bool isVirtual(int reg) { return reg >= physicalRegisterCount; }
+
+// The registers that the first arguments of a call are passed in.
+static const int argumentRegisters[] = {rdi, rsi, rdx, rcx, r8, r9};
+static const size_t argumentRegisterCount = 6;
+
+// The IR's frame pointer points at the first slot of the frame, which is the
+// word just below the saved %rbp.
+static const int frameBase = -8;
+
+enum class OperandKind {
+  Register,
+  Immediate,
+  Memory,
+  Label,
+};
+
+// Memory operands address `base + displacement`, or `symbol + displacement`
+// relative to %rip when there's no base so that the code can be loaded
+// anywhere.
+struct Operand {
+  static Operand makeRegister(int reg);
+  static Operand makeImmediate(int value);
+  static Operand makeMemory(int base, int displacement);
+  static Operand makeMemory(int base, int index, int scale);
+  static Operand makeStatic(Symbol symbol, int displacement);
+  static Operand makeLabel(Symbol label);
+  bool isRegister(int reg) const;
+  OperandKind kind;
+  // The register of a `Register` operand or the base of a `Memory` one.
+  std::optional<int> reg;
+  std::optional<int> index;
+  int scale;
+  // The immediate or the displacement.
+  int value;
+  std::optional<Symbol> symbol;
+};
+
+enum class Opcode {
+  // Marks the position of `operands[0]`.
+  Label,
+  // Stores only `size` bytes of the register when the destination is memory.
+  Mov,
+  // Load `size` bytes and sign or zero extend them to the whole register.
+  Movsx,
+  Movzx,
+  Lea,
+  Add,
+  Sub,
+  // Multiplies the destination by the source, or the second operand by an
+  // immediate first operand when there are three. With just one operand it
+  // multiplies %rax by it and leaves the double width product in %rdx:%rax.
+  Imul,
+  And,
+  // Shifts by an immediate or by %cl.
+  Shl,
+  Sar,
+  // Sign extends %rax into %rdx ahead of a division.
+  Cqo,
+  Idiv,
+  Cmp,
+  Jmp,
+  Jcc,
+  Call,
+  Push,
+  Pop,
+  Leave,
+  Ret,
+};
+
+enum class Condition {
+  Equal,
+  NotEqual,
+  Less,
+  Greater,
+  LessEqual,
+  GreaterEqual,
+};
+
+Condition toCondition(ir::RelOpKind kind);
+// The condition that holds when the operands of the comparison are swapped.
+Condition swapCondition(Condition condition);
+
+// Operands are in AT&T order with the destination last.
+struct Instruction {
+  Instruction(Opcode op, std::vector<Operand> operands);
+  Opcode op;
+  std::vector<Operand> operands;
+  Condition condition;
+  // The bytes of memory that a `mov`, `movsx` or `movzx` touches.
+  int size;
+  // The number of arguments a call passes in registers.
+  size_t argumentCount;
+  // Whether a return hands back %rax.
+  bool returnsValue;
+  // The labels an indirect jump can go to.
+  std::vector<Symbol> targets;
+};
+
+std::vector<int> getUses(const Instruction &instruction);
+std::vector<int> getDefs(const Instruction &instruction);
+
+struct JumpTable {
+  Symbol label;
+  std::vector<Symbol> targets;
+};
+
+struct Function {
+  explicit Function(const ir::Level &level);
+  int makeRegister() { return registerCount++; }
+  const ir::Level &level;
+  std::vector<Instruction> instructions;
+  std::vector<JumpTable> jumpTables;
+  int registerCount;
+  // Bytes reserved below the saved %rbp once registers are allocated.
+  int frameSize;
+};
+
+// The bytes needed for the display, which is zero when no level is displayed.
+int getDisplaySize(const std::vector<Function> &functions);
+
+// The string literals the functions refer to, each once, in the order they
+// first appear.
+std::vector<Symbol> getStrings(const std::vector<Function> &functions);
+
+} // namespace descartes::x86
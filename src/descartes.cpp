@@ -1,10 +1,37 @@
+#include <AsmPrinter.h>
 #include <AstPrinter.h>
+#include <BytecodeCompiler.h>
+#include <BytecodeImage.h>
+#include <CPrinter.h>
+#include <Canonical.h>
+#include <Dce.h>
+#include <Display.h>
+#include <ElfWriter.h>
+#include <Encoder.h>
+#include <FrameCompaction.h>
+#include <Gvn.h>
+#include <Inliner.h>
+#include <InstructionSelector.h>
+#include <Interpreter.h>
+#include <IrPrinter.h>
+#include <Jit.h>
 #include <Lexer.h>
+#include <Licm.h>
+#include <Mem2Reg.h>
 #include <Parser.h>
+#include <RangePropagation.h>
+#include <RegisterAllocator.h>
+#include <Runtime.h>
+#include <Sccp.h>
 #include <Semantic.h>
+#include <SsaBuilder.h>
+#include <SsaLowering.h>
+#include <StrengthReduction.h>
+#include <TieredEngine.h>
 
 #include <argparse/argparse.hpp>
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -14,8 +41,11 @@ namespace descartes {
 
 std::string accumulateSource(std::ifstream &file) {
   std::string source, line;
-  while (std::getline(file, line))
+  while (std::getline(file, line)) {
+    // Keep the line break so tokens on adjacent lines stay separate.
     source.append(line);
+    source.push_back('\n');
+  }
   return source;
 }
 
@@ -32,6 +62,42 @@ int main(int argc, char *argv[]) {
       .help("print the ast generated by the parser")
       .default_value(false)
       .implicit_value(true);
+  argParser.add_argument("--print_ir")
+      .help("print the optimised ir generated for each fragment")
+      .default_value(false)
+      .implicit_value(true);
+  argParser.add_argument("--emit_asm")
+      .help("write x86-64 assembly for the program to the given file")
+      .default_value(std::string());
+  argParser.add_argument("--emit_obj")
+      .help("write an x86-64 ELF object file for the program to the given file")
+      .default_value(std::string());
+  argParser.add_argument("--emit_c")
+      .help("write the program as C to the given file")
+      .default_value(std::string());
+  argParser.add_argument("--run")
+      .help("compile the program into memory and run it")
+      .default_value(false)
+      .implicit_value(true);
+  argParser.add_argument("--interpret")
+      .help("compile the program into bytecode and interpret it")
+      .default_value(false)
+      .implicit_value(true);
+  argParser.add_argument("--emit_bytecode")
+      .help("write a bytecode image for the program to the given file")
+      .default_value(std::string());
+  argParser.add_argument("--run_image")
+      .help("interpret a bytecode image instead of compiling a program")
+      .default_value(false)
+      .implicit_value(true);
+  argParser.add_argument("--run_tiered")
+      .help("interpret the program and compile hot functions into memory")
+      .default_value(false)
+      .implicit_value(true);
+  argParser.add_argument("--range_checks")
+      .help("stop the program when an array index is out of bounds")
+      .default_value(false)
+      .implicit_value(true);
   try {
     argParser.parse_args(argc, argv);
   } catch (const std::runtime_error &argParseError) {
@@ -41,6 +107,33 @@ int main(int argc, char *argv[]) {
   const auto fileName = argParser.get<std::string>("file");
   const bool printTokens = argParser.get<bool>("--print_tokens");
   const bool printAst = argParser.get<bool>("--print_ast");
+  const bool printIr = argParser.get<bool>("--print_ir");
+  const auto asmFileName = argParser.get<std::string>("--emit_asm");
+  const auto objFileName = argParser.get<std::string>("--emit_obj");
+  const auto cFileName = argParser.get<std::string>("--emit_c");
+  const bool run = argParser.get<bool>("--run");
+  const bool interpret = argParser.get<bool>("--interpret");
+  const auto bytecodeFileName = argParser.get<std::string>("--emit_bytecode");
+  const bool runImage = argParser.get<bool>("--run_image");
+  const bool runTiered = argParser.get<bool>("--run_tiered");
+  const bool rangeChecks = argParser.get<bool>("--range_checks");
+  // Images are already compiled so none of the front end is needed.
+  if (runImage) {
+    try {
+      descartes::ImageReader imageReader;
+      const auto module = imageReader.read(fileName);
+      descartes::Interpreter interpreter(module);
+      interpreter.run();
+    } catch (const descartes::ImageError &imageError) {
+      std::cerr << "IMAGE: " << imageError.what() << "\n";
+    } catch (const descartes::InterpreterError &interpreterError) {
+      // Whatever the program wrote before the error goes out first.
+      descartes_flush();
+      std::cerr << "INTERPRETER: " << interpreterError.what() << "\n";
+      return 1;
+    }
+    return 0;
+  }
   std::ifstream file(fileName);
   if (!file) {
     std::cerr << "Could not open file " << fileName << "\n";
@@ -57,15 +150,117 @@ int main(int argc, char *argv[]) {
       descartes::AstPrinter printer;
       printer.printBlock(program);
     }
-    descartes::Semantic semantic(parser.getSymbols());
-    const auto &frags = semantic.analyse(program);
-    static_cast<void>(frags);
+    descartes::Semantic semantic(parser.getSymbols(), rangeChecks);
+    auto &frags = semantic.analyse(program);
+    descartes::Canonicaliser canonicaliser(parser.getSymbols());
+    descartes::SsaBuilder ssaBuilder;
+    descartes::Mem2Reg mem2Reg;
+    descartes::Sccp sccp;
+    descartes::Gvn gvn;
+    descartes::RangePropagation rangePropagation;
+    descartes::Licm licm;
+    descartes::StrengthReduction strengthReduction;
+    descartes::Dce dce;
+    descartes::FrameCompaction frameCompaction;
+    descartes::Inliner inliner;
+    descartes::Display display(parser.getSymbols());
+    descartes::SsaLowering ssaLowering(parser.getSymbols());
+    std::vector<std::unique_ptr<descartes::ssa::Function>> functions;
+    for (auto &frag : frags) {
+      canonicaliser.canonicalise(frag);
+      functions.push_back(ssaBuilder.build(frag));
+      mem2Reg.run(*functions.back());
+    }
+    // Inlining needs every function at once and can leave some fragments
+    // without any callers.
+    inliner.run(functions);
+    display.run(functions);
+    frags.erase(std::remove_if(frags.begin(), frags.end(),
+                               [&functions](const auto &frag) {
+                                 return std::none_of(
+                                     functions.begin(), functions.end(),
+                                     [&frag](const auto &function) {
+                                       return &function->level ==
+                                              frag.first.get();
+                                     });
+                               }),
+                frags.end());
+    for (size_t i = 0; i < frags.size(); ++i) {
+      auto &function = *functions.at(i);
+      sccp.run(function);
+      gvn.run(function);
+      rangePropagation.run(function);
+      licm.run(function);
+      strengthReduction.run(function);
+      dce.run(function);
+      frameCompaction.run(function);
+      ssaLowering.lower(function, frags.at(i));
+    }
+    if (printIr) {
+      descartes::IrPrinter printer;
+      printer.printFragments(frags);
+    }
+    if (!cFileName.empty()) {
+      std::ofstream cFile(cFileName);
+      descartes::CPrinter cPrinter(cFile);
+      cPrinter.print(frags);
+    }
+    if (interpret || !bytecodeFileName.empty()) {
+      descartes::BytecodeCompiler bytecodeCompiler;
+      const auto module = bytecodeCompiler.compile(frags);
+      if (!bytecodeFileName.empty()) {
+        std::ofstream bytecodeFile(bytecodeFileName, std::ios::binary);
+        descartes::ImageWriter imageWriter(bytecodeFile);
+        imageWriter.write(module);
+      }
+      if (interpret) {
+        descartes::Interpreter interpreter(module);
+        interpreter.run();
+      }
+    }
+    if (runTiered) {
+      descartes::TieredEngine engine(
+          parser.getSymbols(), frags,
+          descartes::TieredEngine::defaultHotThreshold, true);
+      engine.run();
+    }
+    if (asmFileName.empty() && objFileName.empty() && !run)
+      return 0;
+    descartes::InstructionSelector instructionSelector(parser.getSymbols());
+    descartes::RegisterAllocator registerAllocator(parser.getSymbols());
+    std::vector<descartes::x86::Function> machineFunctions;
+    for (const auto &frag : frags) {
+      machineFunctions.push_back(instructionSelector.select(frag));
+      registerAllocator.run(machineFunctions.back());
+    }
+    if (!asmFileName.empty()) {
+      std::ofstream asmFile(asmFileName);
+      descartes::AsmPrinter asmPrinter(asmFile);
+      asmPrinter.print(machineFunctions);
+    }
+    descartes::Encoder encoder;
+    if (!objFileName.empty()) {
+      std::ofstream objFile(objFileName, std::ios::binary);
+      descartes::ElfWriter elfWriter(objFile);
+      elfWriter.write(encoder.encode(machineFunctions));
+    }
+    if (run) {
+      descartes::Jit jit;
+      jit.load(encoder.encode(machineFunctions));
+      jit.run();
+    }
   } catch (const descartes::LexerError &lexerError) {
     std::cerr << "LEXER: " << lexerError.what() << "\n";
   } catch (const descartes::ParserError &parserError) {
     std::cerr << "PARSER: " << parserError.what() << "\n";
   } catch (const descartes::SemanticError &semanticError) {
     std::cerr << "SEMANTIC: " << semanticError.what() << "\n";
+  } catch (const descartes::JitError &jitError) {
+    std::cerr << "JIT: " << jitError.what() << "\n";
+  } catch (const descartes::InterpreterError &interpreterError) {
+    descartes_flush();
+    std::cerr << "INTERPRETER: " << interpreterError.what() << "\n";
+    return 1;
   }
   return 0;
 }
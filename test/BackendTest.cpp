@@ -0,0 +1,763 @@
+#include <AsmPrinter.h>
+#include <BytecodeCompiler.h>
+#include <CPrinter.h>
+#include <ElfWriter.h>
+#include <Encoder.h>
+#include <InstructionSelector.h>
+#include <LiveIntervals.h>
+#include <Interpreter.h>
+#include <RegisterAllocator.h>
+
+#include "TestUtil.h"
+
+#include <dlfcn.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <catch2/catch.hpp>
+
+namespace descartes::test {
+
+namespace {
+
+// Selects instructions for every canonicalised fragment of a program.
+struct MachineProgram : public AnalysedProgram {
+  explicit MachineProgram(const std::string &source)
+      : AnalysedProgram(source) {
+    Canonicaliser canonicaliser(parser.getSymbols());
+    InstructionSelector instructionSelector(parser.getSymbols());
+    for (auto &frag : frags) {
+      canonicaliser.canonicalise(frag);
+      functions.push_back(instructionSelector.select(frag));
+    }
+  }
+  const x86::Function &getFunction(const std::string &name) const {
+    const auto iter = std::find_if(
+        functions.begin(), functions.end(), [&name](const auto &function) {
+          return function.level.name.getName() == name;
+        });
+    REQUIRE(iter != functions.end());
+    return *iter;
+  }
+  std::vector<x86::Function> functions;
+};
+
+size_t countInstructions(const x86::Function &function, x86::Opcode op) {
+  return std::count_if(
+      function.instructions.begin(), function.instructions.end(),
+      [op](const x86::Instruction &instruction) {
+        return instruction.op == op;
+      });
+}
+
+bool isFrameSlot(const x86::Operand &operand) {
+  return operand.kind == x86::OperandKind::Memory && operand.reg == x86::rbp &&
+         !operand.index;
+}
+
+void requireHardwareRegisters(const x86::Function &function) {
+  for (const auto &instruction : function.instructions) {
+    for (int reg : x86::getUses(instruction))
+      REQUIRE_FALSE(x86::isVirtual(reg));
+    for (int reg : x86::getDefs(instruction))
+      REQUIRE_FALSE(x86::isVirtual(reg));
+  }
+}
+
+bool isCalleeSaved(const x86::Operand &operand) {
+  return operand.kind == x86::OperandKind::Register &&
+         (operand.reg == x86::rbx || *operand.reg >= x86::r12);
+}
+
+// Encodes a lone function and returns its bytes.
+std::vector<uint8_t>
+encodeFunction(const std::vector<x86::Instruction> &instructions) {
+  SymbolTable symbols;
+  ir::Level level(symbols.make("f"), nullptr);
+  std::vector<x86::Function> functions;
+  functions.emplace_back(level);
+  functions.back().instructions.emplace_back(
+      x86::Opcode::Label,
+      std::vector<x86::Operand>{x86::Operand::makeLabel(level.name)});
+  functions.back().instructions.insert(functions.back().instructions.end(),
+                                       instructions.begin(),
+                                       instructions.end());
+  Encoder encoder;
+  const x86::ObjectCode code = encoder.encode(functions);
+  const x86::ObjectSymbol &function = code.symbols.back();
+  REQUIRE(function.name == "f");
+  return std::vector<uint8_t>(code.text.begin() + function.offset,
+                              code.text.end());
+}
+
+} // namespace
+
+TEST_CASE("instruction selection folds frame slots into addresses",
+          "[backend]") {
+  MachineProgram program("var"
+                         "  x: integer;"
+                         "function f(a: integer): integer;"
+                         "  var t: integer;"
+                         "  function g(b: integer): integer;"
+                         "  begin"
+                         "    g := t + b "
+                         "  end;"
+                         "begin"
+                         "  t := a + 1;"
+                         "  f := g(t)"
+                         "end;"
+                         "begin"
+                         "  x := f(x)"
+                         "end.");
+  const auto &f = program.getFunction("f");
+  // `t` escapes so it's stored straight into its slot.
+  REQUIRE(std::any_of(f.instructions.begin(), f.instructions.end(),
+                      [](const x86::Instruction &instruction) {
+                        return instruction.op == x86::Opcode::Mov &&
+                               isFrameSlot(instruction.operands.back());
+                      }));
+  // The only frame address that's computed is the static link passed to `g`.
+  REQUIRE(std::count_if(f.instructions.begin(), f.instructions.end(),
+                        [](const x86::Instruction &instruction) {
+                          return instruction.op == x86::Opcode::Lea &&
+                                 isFrameSlot(instruction.operands.front());
+                        }) == 1);
+  const auto &g = program.getFunction("g");
+  REQUIRE(std::any_of(g.instructions.begin(), g.instructions.end(),
+                      [](const x86::Instruction &instruction) {
+                        const auto &operands = instruction.operands;
+                        return instruction.op == x86::Opcode::Mov &&
+                               operands.front().kind ==
+                                   x86::OperandKind::Memory &&
+                               operands.front().reg &&
+                               x86::isVirtual(*operands.front().reg);
+                      }));
+}
+
+TEST_CASE("instruction selection scales array indices in addresses",
+          "[backend]") {
+  MachineProgram program("type"
+                         "  row = array [1..10] of integer;"
+                         "var"
+                         "  a: row;"
+                         "  i: integer;"
+                         "procedure clear(k: integer);"
+                         "begin"
+                         "  a[k] := 0 "
+                         "end;"
+                         "begin"
+                         "  read(i);"
+                         "  a[i] := i;"
+                         "  clear(i)"
+                         "end.");
+  const auto isScaled = [](const x86::Operand &operand) {
+    return operand.kind == x86::OperandKind::Memory && operand.index &&
+           operand.scale == 8;
+  };
+  // The array is in the frame of `main` so the element is addressed straight
+  // off it, with the lower bound in the displacement.
+  const auto &main = program.getFunction("main");
+  REQUIRE(std::any_of(main.instructions.begin(), main.instructions.end(),
+                      [&isScaled](const x86::Instruction &instruction) {
+                        const auto &dst = instruction.operands.back();
+                        return instruction.op == x86::Opcode::Mov &&
+                               isScaled(dst) && dst.reg == x86::rbp;
+                      }));
+  REQUIRE(countInstructions(main, x86::Opcode::Imul) == 0);
+  // `clear` reaches it through the static link, which takes a `lea` first.
+  const auto &clear = program.getFunction("clear");
+  REQUIRE(std::any_of(clear.instructions.begin(), clear.instructions.end(),
+                      [&isScaled](const x86::Instruction &instruction) {
+                        return instruction.op == x86::Opcode::Lea &&
+                               isScaled(instruction.operands.front());
+                      }));
+  REQUIRE(countInstructions(clear, x86::Opcode::Imul) == 0);
+}
+
+TEST_CASE("instruction selection splits displacements that don't fit",
+          "[backend]") {
+  MachineProgram program("function f(a: integer): integer;"
+                         "begin"
+                         "  f := (a + 2147483647) + 2147483647 "
+                         "end;"
+                         "begin"
+                         "  f(1)"
+                         "end.");
+  const auto &f = program.getFunction("f");
+  // The sum leaves 32 bits so each constant gets a `lea` of its own.
+  size_t leas = 0;
+  for (const auto &instruction : f.instructions) {
+    if (instruction.op == x86::Opcode::Lea &&
+        instruction.operands.front().value == 2147483647)
+      ++leas;
+  }
+  REQUIRE(leas == 2);
+}
+
+TEST_CASE("instruction selection widens narrow array elements",
+          "[backend]") {
+  MachineProgram program("type"
+                         "  small = -100..100;"
+                         "  bytes = array [1..8] of 0..255;"
+                         "  smalls = array [1..8] of small;"
+                         "var"
+                         "  b: bytes;"
+                         "  s: smalls;"
+                         "  i: integer;"
+                         "begin"
+                         "  read(i);"
+                         "  s[i] := b[i] - 100;"
+                         "  b[i] := 7 "
+                         "end.");
+  const auto &main = program.getFunction("main");
+  // Elements are loaded with the extension that their bounds need.
+  const auto findSized = [&main](x86::Opcode op, int size) {
+    return std::any_of(main.instructions.begin(), main.instructions.end(),
+                       [op, size](const x86::Instruction &instruction) {
+                         return instruction.op == op &&
+                                instruction.size == size;
+                       });
+  };
+  REQUIRE(findSized(x86::Opcode::Movzx, 1));
+  REQUIRE(findSized(x86::Opcode::Mov, 1));
+  REQUIRE(countInstructions(main, x86::Opcode::Movsx) == 0);
+  // Stores only write the element's own byte, from a register.
+  for (const auto &instruction : main.instructions) {
+    if (instruction.op == x86::Opcode::Mov && instruction.size == 1)
+      REQUIRE(instruction.operands.front().kind ==
+              x86::OperandKind::Register);
+  }
+}
+
+TEST_CASE("instruction selection compares and branches", "[backend]") {
+  MachineProgram program("var"
+                         "  x: integer;"
+                         "function f(a: integer): integer;"
+                         "begin"
+                         "  f := a + x "
+                         "end;"
+                         "begin"
+                         "  if 3 < x then x := 1 else x := f(2)"
+                         "end.");
+  const auto &main = program.functions.back();
+  const auto &instructions = main.instructions;
+  const auto cmp = std::find_if(
+      instructions.begin(), instructions.end(),
+      [](const x86::Instruction &instruction) {
+        return instruction.op == x86::Opcode::Cmp;
+      });
+  REQUIRE(cmp != instructions.end());
+  // The constant moves to the side where `cmp` takes an immediate and `x` is
+  // compared where it lies in the frame.
+  REQUIRE(cmp->operands.front().kind == x86::OperandKind::Immediate);
+  REQUIRE(cmp->operands.front().value == 3);
+  REQUIRE(isFrameSlot(cmp->operands.back()));
+  REQUIRE((cmp + 1)->op == x86::Opcode::Jcc);
+  REQUIRE((cmp + 1)->condition == x86::Condition::Greater);
+}
+
+TEST_CASE("instruction selection passes arguments past the sixth on the stack",
+          "[backend]") {
+  MachineProgram program("var"
+                         "  x: integer;"
+                         "function f(a: integer, b: integer, c: integer,"
+                         "  d: integer, e: integer, g: integer, h: integer)"
+                         "  : integer;"
+                         "begin"
+                         "  f := a + h "
+                         "end;"
+                         "begin"
+                         "  x := f(1, 2, 3, 4, 5, 6, 7)"
+                         "end.");
+  // With the static link that's two on the stack, which keeps it aligned.
+  const auto &main = program.functions.back();
+  REQUIRE(countInstructions(main, x86::Opcode::Push) == 2);
+  REQUIRE(countInstructions(main, x86::Opcode::Sub) == 0);
+  const auto call = std::find_if(
+      main.instructions.begin(), main.instructions.end(),
+      [](const x86::Instruction &instruction) {
+        return instruction.op == x86::Opcode::Call;
+      });
+  REQUIRE(call != main.instructions.end());
+  REQUIRE(call->argumentCount == 6);
+  REQUIRE((call + 1)->op == x86::Opcode::Add);
+  REQUIRE((call + 1)->operands.front().value == 16);
+}
+
+TEST_CASE("register allocation leaves only hardware registers", "[backend]") {
+  MachineProgram program("var"
+                         "  x: integer;"
+                         "  y: integer;"
+                         "begin"
+                         "  x := 7;"
+                         "  y := x / 2 + x * 3;"
+                         "  while y > 0 do y := y - x "
+                         "end.");
+  RegisterAllocator registerAllocator(program.parser.getSymbols());
+  for (auto &function : program.functions) {
+    registerAllocator.run(function);
+    REQUIRE(function.frameSize % 16 == 0);
+    requireHardwareRegisters(function);
+  }
+  std::ostringstream out;
+  AsmPrinter asmPrinter(out);
+  asmPrinter.print(program.functions);
+  const std::string assembly = out.str();
+  REQUIRE(assembly.find("_start:\n\tcall main\n") != std::string::npos);
+  REQUIRE(assembly.find("main:\n\tpushq %rbp\n\tmovq %rsp, %rbp\n") !=
+          std::string::npos);
+  REQUIRE(assembly.find("\tcqto\n") != std::string::npos);
+  REQUIRE(assembly.find("\tidivq ") != std::string::npos);
+  REQUIRE(assembly.find("\tleave\n\tret\n") != std::string::npos);
+}
+
+TEST_CASE("live intervals follow values around loops", "[backend]") {
+  SymbolTable symbols;
+  const Symbol loop = symbols.make("loop"), done = symbols.make("done");
+  ir::Level level(symbols.make("f"), nullptr);
+  x86::Function function(level);
+  const int i = function.makeRegister(), n = function.makeRegister();
+  const auto emit = [&function](x86::Opcode op,
+                                std::vector<x86::Operand> operands) {
+    function.instructions.emplace_back(op, std::move(operands));
+  };
+  emit(x86::Opcode::Label, {x86::Operand::makeLabel(level.name)});
+  emit(x86::Opcode::Mov, {x86::Operand::makeImmediate(0),
+                          x86::Operand::makeRegister(i)});
+  emit(x86::Opcode::Mov, {x86::Operand::makeImmediate(5),
+                          x86::Operand::makeRegister(n)});
+  emit(x86::Opcode::Label, {x86::Operand::makeLabel(loop)});
+  emit(x86::Opcode::Cmp,
+       {x86::Operand::makeRegister(n), x86::Operand::makeRegister(i)});
+  emit(x86::Opcode::Jcc, {x86::Operand::makeLabel(done)});
+  function.instructions.back().condition = x86::Condition::GreaterEqual;
+  emit(x86::Opcode::Add,
+       {x86::Operand::makeRegister(n), x86::Operand::makeRegister(i)});
+  emit(x86::Opcode::Jmp, {x86::Operand::makeLabel(loop)});
+  emit(x86::Opcode::Label, {x86::Operand::makeLabel(done)});
+  emit(x86::Opcode::Mov,
+       {x86::Operand::makeRegister(i), x86::Operand::makeRegister(x86::rax)});
+  emit(x86::Opcode::Ret, {});
+  function.instructions.back().returnsValue = true;
+
+  x86::LiveIntervals liveIntervals(function);
+  const auto &blocks = liveIntervals.getBlocks();
+  REQUIRE(blocks.size() == 4);
+  REQUIRE(blocks.at(1).liveIn == std::vector<int>{i, n});
+  REQUIRE(blocks.at(2).succs == std::vector<size_t>{1});
+  REQUIRE(blocks.at(3).liveIn == std::vector<int>{i});
+  // `n` is needed around the loop for as long as it runs but not after it.
+  const x86::LiveInterval *nInterval = liveIntervals.getInterval(n);
+  REQUIRE(nInterval->getStart() == x86::getDefPosition(2));
+  REQUIRE(nInterval->getEnd() == x86::getUsePosition(8));
+  const x86::LiveInterval *iInterval = liveIntervals.getInterval(i);
+  REQUIRE(iInterval->getEnd() == x86::getDefPosition(9));
+  REQUIRE(iInterval->uses.size() == 5);
+  // %rax is only taken once `i` is done with.
+  const x86::LiveInterval *rax = liveIntervals.getInterval(x86::rax);
+  REQUIRE(rax->getStart() == x86::getDefPosition(9));
+  REQUIRE_FALSE(iInterval->findIntersection(*rax));
+  REQUIRE(liveIntervals.getInterval(x86::rbx) == nullptr);
+}
+
+TEST_CASE("register allocation keeps values across calls in callee saved "
+          "registers",
+          "[backend]") {
+  MachineProgram program("var"
+                         "  x: integer;"
+                         "function f(n: integer): integer;"
+                         "begin"
+                         "  if n = 0 then f := 1 else f := n * f(n - 1)"
+                         "end;"
+                         "begin"
+                         "  x := f(5)"
+                         "end.");
+  RegisterAllocator registerAllocator(program.parser.getSymbols());
+  for (auto &function : program.functions)
+    registerAllocator.run(function);
+  const auto &instructions = program.getFunction("f").instructions;
+  // The register is saved right after the frame is set up and restored right
+  // before it's torn down.
+  REQUIRE(instructions.at(3).op == x86::Opcode::Sub);
+  const x86::Instruction &save = instructions.at(4);
+  REQUIRE(save.op == x86::Opcode::Mov);
+  REQUIRE(isCalleeSaved(save.operands.front()));
+  REQUIRE(isFrameSlot(save.operands.back()));
+  const auto leave = std::find_if(
+      instructions.begin(), instructions.end(),
+      [](const x86::Instruction &instruction) {
+        return instruction.op == x86::Opcode::Leave;
+      });
+  REQUIRE(leave != instructions.end());
+  const x86::Instruction &restore = *(leave - 1);
+  REQUIRE(restore.op == x86::Opcode::Mov);
+  REQUIRE(restore.operands.front().value == save.operands.back().value);
+  REQUIRE(restore.operands.back().reg == save.operands.front().reg);
+  // Nothing spills.
+  REQUIRE(std::none_of(instructions.begin(), instructions.end(),
+                       [](const x86::Instruction &instruction) {
+                         return std::any_of(
+                             instruction.operands.begin(),
+                             instruction.operands.end(),
+                             [](const x86::Operand &operand) {
+                               return operand.isRegister(x86::r10);
+                             });
+                       }));
+}
+
+TEST_CASE("register allocation spills when registers run out", "[backend]") {
+  MachineProgram program(
+      "var"
+      "  x: integer;"
+      "function g(n: integer): integer;"
+      "begin"
+      "  g := n + 1 "
+      "end;"
+      "begin"
+      "  x := g(1) + (g(2) + (g(3) + (g(4) + (g(5) + (g(6) + (g(7) + g(8)))))))"
+      "end.");
+  RegisterAllocator registerAllocator(program.parser.getSymbols());
+  for (auto &function : program.functions) {
+    registerAllocator.run(function);
+    requireHardwareRegisters(function);
+  }
+  // Seven results live across calls, which is more than there are callee
+  // saved registers for.
+  const x86::Function &main = program.functions.back();
+  const auto &instructions = main.instructions;
+  const size_t saves = std::count_if(
+      instructions.begin(), instructions.end(),
+      [](const x86::Instruction &instruction) {
+        return instruction.op == x86::Opcode::Mov &&
+               isCalleeSaved(instruction.operands.front()) &&
+               isFrameSlot(instruction.operands.back());
+      });
+  REQUIRE(saves >= 5);
+  REQUIRE(main.frameSize >= 7 * ir::wordSize);
+}
+
+TEST_CASE("register allocation scales with the size of a procedure",
+          "[backend]") {
+  // Each branch leaves values waiting in a hole until the code after the
+  // branches, so the intervals in a hole grow with the procedure.
+  const auto allocate = [](int statements) {
+    std::string source = "var"
+                         "  x: integer;"
+                         "  y: integer;"
+                         "  z: integer;"
+                         "begin"
+                         "  read(x);"
+                         "  y := 0;"
+                         "  z := 1;";
+    for (int i = 0; i < statements; ++i) {
+      const std::string value = std::to_string(i);
+      source += "  if x > " + value + " then y := y + " + value +
+                " else z := z + y;";
+    }
+    source += "  writeln(y, z) "
+              "end.";
+    LoweredProgram program(source);
+    InstructionSelector instructionSelector(program.parser.getSymbols());
+    std::vector<x86::Function> functions;
+    for (const auto &frag : program.frags)
+      functions.push_back(instructionSelector.select(frag));
+    RegisterAllocator registerAllocator(program.parser.getSymbols());
+    const auto start = std::chrono::steady_clock::now();
+    for (auto &function : functions)
+      registerAllocator.run(function);
+    const auto duration = std::chrono::steady_clock::now() - start;
+    for (const auto &function : functions)
+      requireHardwareRegisters(function);
+    return duration;
+  };
+  const auto small = allocate(500);
+  const auto large = allocate(2000);
+  // Four times the code should take about four times as long. Anything that
+  // goes through every interval for each one takes sixteen.
+  REQUIRE(large < small * 10);
+}
+
+TEST_CASE("encoder matches the assembler", "[backend]") {
+  using x86::Operand;
+  const auto reg = Operand::makeRegister;
+  const auto instruction = [](x86::Opcode op, std::vector<Operand> operands) {
+    return x86::Instruction(op, std::move(operands));
+  };
+  const std::vector<x86::Instruction> instructions = {
+      instruction(x86::Opcode::Mov, {reg(x86::rax), reg(x86::rbx)}),
+      instruction(x86::Opcode::Mov,
+                  {Operand::makeMemory(x86::rbp, -16), reg(x86::rdi)}),
+      instruction(x86::Opcode::Add,
+                  {Operand::makeImmediate(1), reg(x86::r12)}),
+      instruction(x86::Opcode::Lea,
+                  {Operand::makeMemory(x86::r13, x86::rax, 8), reg(x86::r9)}),
+      instruction(x86::Opcode::Imul, {Operand::makeImmediate(1000),
+                                      reg(x86::rsi), reg(x86::rcx)}),
+      instruction(x86::Opcode::Idiv, {Operand::makeMemory(x86::rsp, -8)}),
+      instruction(x86::Opcode::Push, {reg(x86::r12)}),
+      instruction(x86::Opcode::Sar, {reg(x86::rcx), reg(x86::r8)}),
+      instruction(x86::Opcode::Mov, {Operand::makeImmediate(-5),
+                                     Operand::makeMemory(x86::r12, 24)}),
+      instruction(x86::Opcode::Cmp,
+                  {reg(x86::r11), Operand::makeMemory(x86::rbx, 0)}),
+      instruction(x86::Opcode::Imul, {reg(x86::r9)}),
+      instruction(x86::Opcode::Imul, {Operand::makeMemory(x86::rbx, 8)}),
+  };
+  // As encoded by GNU as.
+  const std::vector<uint8_t> expected = {
+      0x48, 0x89, 0xc3, 0x48, 0x8b, 0x7d, 0xf0, 0x49, 0x83, 0xc4, 0x01,
+      0x4d, 0x8d, 0x4c, 0xc5, 0x00, 0x48, 0x69, 0xce, 0xe8, 0x03, 0x00,
+      0x00, 0x48, 0xf7, 0x7c, 0x24, 0xf8, 0x41, 0x54, 0x49, 0xd3, 0xf8,
+      0x49, 0xc7, 0x44, 0x24, 0x18, 0xfb, 0xff, 0xff, 0xff, 0x4c, 0x39,
+      0x1b, 0x49, 0xf7, 0xe9, 0x48, 0xf7, 0x6b, 0x08};
+  REQUIRE(encodeFunction(instructions) == expected);
+}
+
+TEST_CASE("encoder matches the assembler for narrow loads and stores",
+          "[backend]") {
+  using x86::Operand;
+  const auto reg = Operand::makeRegister;
+  const auto instruction = [](x86::Opcode op, int size,
+                              std::vector<Operand> operands) {
+    x86::Instruction result(op, std::move(operands));
+    result.size = size;
+    return result;
+  };
+  const std::vector<x86::Instruction> instructions = {
+      instruction(x86::Opcode::Movsx, 1,
+                  {Operand::makeMemory(x86::rbp, -3), reg(x86::rax)}),
+      instruction(x86::Opcode::Movzx, 2,
+                  {Operand::makeMemory(x86::r12, 0), reg(x86::rsi)}),
+      instruction(x86::Opcode::Movsx, 4,
+                  {Operand::makeMemory(x86::rbx, 8), reg(x86::r9)}),
+      instruction(x86::Opcode::Movzx, 4,
+                  {Operand::makeMemory(x86::rcx, 0), reg(x86::rdx)}),
+      instruction(x86::Opcode::Movzx, 1,
+                  {Operand::makeMemory(x86::rax, 5), reg(x86::r10)}),
+      instruction(x86::Opcode::Mov, 1,
+                  {reg(x86::rsi), Operand::makeMemory(x86::rbp, -1)}),
+      instruction(x86::Opcode::Mov, 2,
+                  {reg(x86::r8), Operand::makeMemory(x86::rax, 2)}),
+      instruction(x86::Opcode::Mov, 4,
+                  {reg(x86::rcx), Operand::makeMemory(x86::rdi, 0)}),
+      instruction(x86::Opcode::Mov, 1,
+                  {reg(x86::rax), Operand::makeMemory(x86::r13, 0)}),
+  };
+  // As encoded by GNU as. Storing %sil needs a REX prefix of its own.
+  const std::vector<uint8_t> expected = {
+      0x48, 0x0f, 0xbe, 0x45, 0xfd, 0x49, 0x0f, 0xb7, 0x34, 0x24, 0x4c,
+      0x63, 0x4b, 0x08, 0x8b, 0x11, 0x4c, 0x0f, 0xb6, 0x50, 0x05, 0x40,
+      0x88, 0x75, 0xff, 0x66, 0x44, 0x89, 0x40, 0x02, 0x89, 0x0f, 0x41,
+      0x88, 0x45, 0x00};
+  REQUIRE(encodeFunction(instructions) == expected);
+}
+
+TEST_CASE("encoder resolves branches and relocates between sections",
+          "[backend]") {
+  MachineProgram program("var"
+                         "  x: integer;"
+                         "function f(n: integer): integer;"
+                         "begin"
+                         "  case n of"
+                         "    0: f := 5;"
+                         "    1: f := 7;"
+                         "    2: f := 11;"
+                         "    3: f := 13"
+                         "  else"
+                         "    f := 17"
+                         "  end "
+                         "end;"
+                         "begin"
+                         "  x := f(2)"
+                         "end.");
+  RegisterAllocator registerAllocator(program.parser.getSymbols());
+  for (auto &function : program.functions)
+    registerAllocator.run(function);
+  Encoder encoder;
+  const x86::ObjectCode code = encoder.encode(program.functions);
+  // `_start` calls the main program, which comes last.
+  const auto &main = code.symbols.back();
+  REQUIRE(main.name == "main");
+  REQUIRE(code.text.front() == 0xe8);
+  const int32_t distance = code.text.at(1) | code.text.at(2) << 8 |
+                           code.text.at(3) << 16 | code.text.at(4) << 24;
+  REQUIRE(5 + distance == static_cast<int32_t>(main.offset));
+  // The table holds absolute addresses of its targets and the code finds it
+  // relative to itself.
+  const auto &table = program.getFunction("f").jumpTables;
+  REQUIRE(table.size() == 1);
+  REQUIRE(code.rodata.size() == table.front().targets.size() * ir::wordSize);
+  const auto &relocations = code.relocations;
+  REQUIRE(std::count_if(relocations.begin(), relocations.end(),
+                        [&code](const x86::Relocation &relocation) {
+                          return relocation.section == x86::Section::Rodata &&
+                                 relocation.type ==
+                                     x86::RelocationType::Absolute64 &&
+                                 code.symbols.at(relocation.symbol).type ==
+                                     x86::SymbolType::Section;
+                        }) == static_cast<long>(table.front().targets.size()));
+  REQUIRE(std::any_of(relocations.begin(), relocations.end(),
+                      [](const x86::Relocation &relocation) {
+                        return relocation.section == x86::Section::Text &&
+                               relocation.type ==
+                                   x86::RelocationType::Relative32;
+                      }));
+}
+
+TEST_CASE("elf writer produces a relocatable object", "[backend]") {
+  x86::ObjectCode code{{0xc3}, {}, 16, {}, {}};
+  code.symbols.push_back({".text", x86::SymbolType::Section,
+                          x86::Section::Text, 0, 0, false});
+  code.symbols.push_back(
+      {"puts", x86::SymbolType::None, std::nullopt, 0, 0, true});
+  code.symbols.push_back({"f", x86::SymbolType::Function, x86::Section::Text,
+                          0, 1, false});
+  code.relocations.push_back(
+      {x86::Section::Text, 0, x86::RelocationType::Call32, 1, -4});
+  std::ostringstream out;
+  ElfWriter elfWriter(out);
+  elfWriter.write(code);
+  const std::string file = out.str();
+  const auto read = [&file](size_t offset, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i)
+      value |= static_cast<uint64_t>(static_cast<uint8_t>(file.at(offset + i)))
+               << (i * 8);
+    return value;
+  };
+  REQUIRE(file.substr(0, 4) == "\x7f" "ELF");
+  // A 64 bit little endian relocatable file for x86-64.
+  REQUIRE(read(4, 1) == 2);
+  REQUIRE(read(5, 1) == 1);
+  REQUIRE(read(16, 2) == 1);
+  REQUIRE(read(18, 2) == 62);
+  const uint64_t sectionHeaders = read(40, 8);
+  const uint64_t sectionCount = read(60, 2);
+  REQUIRE(sectionHeaders + sectionCount * 64 == file.size());
+  const auto getSection = [&](size_t index, size_t field, size_t size) {
+    return read(sectionHeaders + index * 64 + field, size);
+  };
+  // `.text` holds the code.
+  REQUIRE(file.at(getSection(1, 24, 8)) == '\xc3');
+  // The symbol table has the local symbols first, so the undefined global
+  // symbol moves past the function and the relocation follows it.
+  const uint64_t symbolTable = 6;
+  REQUIRE(getSection(symbolTable, 4, 4) == 2);
+  REQUIRE(getSection(symbolTable, 44, 4) == 3);
+  const uint64_t relocations = getSection(4, 24, 8);
+  REQUIRE(getSection(4, 32, 8) == 24);
+  REQUIRE(read(relocations + 8, 8) == (uint64_t{3} << 32 | 4));
+  REQUIRE(static_cast<int64_t>(read(relocations + 16, 8)) == -4);
+  // The zeroed data only takes up space once loaded.
+  REQUIRE(getSection(3, 4, 4) == 8);
+  REQUIRE(getSection(3, 32, 8) == 16);
+}
+
+TEST_CASE("c printer writes frames and static links", "[backend]") {
+  LoweredProgram program("var"
+                         "  x: integer;"
+                         "function f(n: integer): integer;"
+                         "  var t: integer;"
+                         "  function g(m: integer): integer;"
+                         "  begin"
+                         "    g := m + t "
+                         "  end;"
+                         "begin"
+                         "  t := n * 2;"
+                         "  f := g(1)"
+                         "end;"
+                         "begin"
+                         "  x := f(3)"
+                         "end.");
+  std::ostringstream out;
+  CPrinter cPrinter(out);
+  cPrinter.print(program.frags);
+  const std::string source = out.str();
+  // `t` escapes into the frame and `g` reaches it through its static link.
+  REQUIRE(source.find("int64_t pascal_f(int64_t a0) {") != std::string::npos);
+  REQUIRE(source.find("int64_t pascal_g(int64_t a0, int64_t a1) {") !=
+          std::string::npos);
+  REQUIRE(source.find("int64_t frame[2];") != std::string::npos);
+  REQUIRE(source.find("int main(void) {\n  pascal_main();") !=
+          std::string::npos);
+}
+
+TEST_CASE("c printer output agrees with the interpreter", "[backend]") {
+  if (std::system("cc --version > /dev/null 2>&1") != 0)
+    return;
+  LoweredProgram program("var"
+                         "  z: integer;"
+                         "function f(n: integer): integer;"
+                         "var"
+                         "  a: integer;"
+                         "  s: integer;"
+                         "  t: integer;"
+                         "begin"
+                         "  a := n + 1; s := 0; t := 0;"
+                         "  while t < n do"
+                         "  begin"
+                         "    s := s + a * t - s / 3;"
+                         "    case t - (t / 4) * 4 of"
+                         "      0: a := a + 1;"
+                         "      1: a := a * 2;"
+                         "      2: a := a - 3;"
+                         "      3: s := s + 1"
+                         "    else"
+                         "      a := a"
+                         "    end;"
+                         "    t := t + 1"
+                         "  end;"
+                         "  f := s + a "
+                         "end;"
+                         "function outer(a: integer): integer;"
+                         "  var t: integer;"
+                         "  function middle(b: integer): integer;"
+                         "    function inner(c: integer): integer;"
+                         "    begin"
+                         "      if c = 0 then inner := t "
+                         "      else inner := inner(c - 1) + 1"
+                         "    end;"
+                         "  begin"
+                         "    middle := inner(b) + inner(b + 1)"
+                         "  end;"
+                         "begin"
+                         "  t := a * 100;"
+                         "  outer := middle(a) + middle(1)"
+                         "end;"
+                         "begin"
+                         "  z := f(3) + outer(1)"
+                         "end.");
+  const auto directory = std::filesystem::temp_directory_path();
+  const std::string sourceName = directory / "descartes_test.c";
+  const std::string libraryName = directory / "descartes_test.so";
+  {
+    std::ofstream source(sourceName);
+    CPrinter cPrinter(source);
+    cPrinter.print(program.frags);
+  }
+  REQUIRE(std::system(("cc -O2 -Wall -Werror -shared -fPIC -o " +
+                       libraryName + " " + sourceName)
+                          .c_str()) == 0);
+  void *library = dlopen(libraryName.c_str(), RTLD_NOW | RTLD_LOCAL);
+  REQUIRE(library);
+  BytecodeCompiler bytecodeCompiler;
+  const bytecode::Module module = bytecodeCompiler.compile(program.frags);
+  Interpreter interpreter(module);
+  for (const char *name : {"f", "outer"}) {
+    const auto function = reinterpret_cast<int64_t (*)(int64_t)>(
+        dlsym(library, ("pascal_" + std::string(name)).c_str()));
+    REQUIRE(function);
+    for (int64_t n = 0; n < 40; n += 3)
+      REQUIRE(function(n) == interpreter.call(name, {n}));
+  }
+  dlclose(library);
+  std::filesystem::remove(sourceName);
+  std::filesystem::remove(libraryName);
+}
+
+} // namespace descartes::test
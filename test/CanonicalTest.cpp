@@ -0,0 +1,178 @@
+#include <Canonical.h>
+
+#include "TestUtil.h"
+
+#include <catch2/catch.hpp>
+
+namespace descartes::test {
+
+namespace {
+
+bool containsCall(const ir::Expr &expr) {
+  switch (expr.getKind()) {
+  case ir::ExprKind::Call:
+    return true;
+  case ir::ExprKind::ArithOp: {
+    const auto &arithOp = static_cast<const ir::ArithOp &>(expr);
+    return containsCall(*arithOp.lhs) || containsCall(*arithOp.rhs);
+  }
+  case ir::ExprKind::Mem:
+    return containsCall(*static_cast<const ir::Mem &>(expr).expr);
+  case ir::ExprKind::CondExpr:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool argsContainCall(const ir::Expr &expr) {
+  const auto &call = static_cast<const ir::Call &>(expr);
+  for (const auto &arg : call.args)
+    if (containsCall(*arg))
+      return true;
+  return false;
+}
+
+// Checks the invariants promised by `Canonicaliser` on a fragment body.
+void checkCanonical(const ir::Statement &body) {
+  REQUIRE(body.getKind() == ir::StatementKind::Sequence);
+  const auto &statements = static_cast<const ir::Sequence &>(body).statements;
+  for (size_t i = 0; i < statements.size(); ++i) {
+    const auto &statement = *statements[i];
+    const ir::Statement *next =
+        i + 1 < statements.size() ? statements[i + 1].get() : nullptr;
+    switch (statement.getKind()) {
+    case ir::StatementKind::Sequence:
+      FAIL("Nested sequence");
+      break;
+    case ir::StatementKind::Move: {
+      const auto &move = static_cast<const ir::Move &>(statement);
+      REQUIRE_FALSE(containsCall(*move.dst));
+      if (move.src->getKind() == ir::ExprKind::Call) {
+        REQUIRE(move.dst->getKind() == ir::ExprKind::Temp);
+        REQUIRE_FALSE(argsContainCall(*move.src));
+      } else {
+        REQUIRE_FALSE(containsCall(*move.src));
+      }
+      break;
+    }
+    case ir::StatementKind::CallStatement:
+      REQUIRE_FALSE(argsContainCall(
+          *static_cast<const ir::CallStatement &>(statement).call));
+      break;
+    case ir::StatementKind::CondJump: {
+      const auto &condJump = static_cast<const ir::CondJump &>(statement);
+      REQUIRE_FALSE(containsCall(*condJump.lhs));
+      REQUIRE_FALSE(containsCall(*condJump.rhs));
+      REQUIRE(next);
+      REQUIRE(next->getKind() == ir::StatementKind::Label);
+      REQUIRE(static_cast<const ir::Label *>(next)->label ==
+              condJump.elseLabel);
+      break;
+    }
+    case ir::StatementKind::Jump:
+      if (next && next->getKind() == ir::StatementKind::Label)
+        REQUIRE_FALSE(static_cast<const ir::Label *>(next)->label ==
+                      static_cast<const ir::Jump &>(statement).jumpLabel);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+void testCanonical(const std::string &source) {
+  AnalysedProgram analysed(source);
+  Canonicaliser canonicaliser(analysed.parser.getSymbols());
+  for (auto &frag : analysed.frags) {
+    canonicaliser.canonicalise(frag);
+    checkCanonical(*frag.second);
+  }
+}
+
+} // namespace
+
+TEST_CASE("canonical nested calls", "[canonical]") {
+  const char *program = "var"
+                        "  x: integer;"
+                        "function f(a: integer): integer;"
+                        "begin"
+                        "  f := a + 1 "
+                        "end;"
+                        "begin"
+                        "  x := f(f(1)) + f(2);"
+                        "  f(f(x))"
+                        "end.";
+  testCanonical(program);
+}
+
+TEST_CASE("canonical conditions", "[canonical]") {
+  const char *program = "var"
+                        "  x: integer;"
+                        "  y: integer;"
+                        "  b: boolean;"
+                        "begin"
+                        "  b := x < y;"
+                        "  if x = 1 then"
+                        "    y := 2"
+                        "  else"
+                        "    y := 3;"
+                        "  while x < 10 do"
+                        "    if b then"
+                        "      x := x + 1 "
+                        "end.";
+  testCanonical(program);
+}
+
+TEST_CASE("canonical case", "[canonical]") {
+  const char *program = "var"
+                        "  x: integer;"
+                        "  y: integer;"
+                        "begin"
+                        "  case x of"
+                        "    1: y := 1;"
+                        "    2: y := 2;"
+                        "    3: y := 3;"
+                        "    4: y := 5 "
+                        "  end;"
+                        "  case y of"
+                        "    1, 100: x := 1;"
+                        "    1000: x := 2 "
+                        "  else"
+                        "    x := 0 "
+                        "  end "
+                        "end.";
+  testCanonical(program);
+}
+
+TEST_CASE("canonical basic blocks", "[canonical]") {
+  AnalysedProgram analysed("var"
+                           "  x: integer;"
+                           "begin"
+                           "  while x < 10 do"
+                           "    x := x + 1 "
+                           "end.");
+  auto &symbols = analysed.parser.getSymbols();
+  Canonicaliser canonicaliser(symbols);
+  auto &frag = analysed.frags.front();
+  canonicaliser.canonicalise(frag);
+  auto &body = static_cast<ir::Sequence &>(*frag.second);
+  auto blocks = canonicaliser.makeBasicBlocks(std::move(body.statements),
+                                              symbols.make("exit"));
+  REQUIRE(blocks.size() >= 2);
+  for (const auto &block : blocks) {
+    REQUIRE(block.front()->getKind() == ir::StatementKind::Label);
+    auto last = block.back()->getKind();
+    REQUIRE((last == ir::StatementKind::Jump ||
+             last == ir::StatementKind::CondJump ||
+             last == ir::StatementKind::JumpTable));
+    for (size_t i = 1; i + 1 < block.size(); ++i) {
+      auto kind = block[i]->getKind();
+      REQUIRE(kind != ir::StatementKind::Label);
+      REQUIRE(kind != ir::StatementKind::Jump);
+      REQUIRE(kind != ir::StatementKind::CondJump);
+    }
+  }
+}
+
+} // namespace descartes::test
@@ -0,0 +1,287 @@
+#include <BytecodeCompiler.h>
+#include <BytecodeImage.h>
+#include <Interpreter.h>
+
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include <catch2/catch.hpp>
+
+namespace descartes::test {
+
+namespace {
+
+std::vector<bytecode::Opcode> getOpcodes(const bytecode::Module &module,
+                                         const std::string &name) {
+  const auto function =
+      std::find_if(module.functions.begin(), module.functions.end(),
+                   [&name](const bytecode::Function &function) {
+                     return function.name == name;
+                   });
+  REQUIRE(function != module.functions.end());
+  const size_t end = function + 1 == module.functions.end()
+                         ? module.code.size()
+                         : (function + 1)->entry;
+  std::vector<bytecode::Opcode> opcodes;
+  for (size_t i = function->entry; i < end;
+       i += bytecode::getInstructionSize(&module.code.at(i)))
+    opcodes.push_back(static_cast<bytecode::Opcode>(module.code.at(i)));
+  return opcodes;
+}
+
+// Calls a function of one argument in the interpreter and in native code and
+// checks that they agree.
+int64_t callBoth(Interpreter &interpreter, Jit &jit, const std::string &name,
+                 int64_t arg) {
+  const int64_t result = interpreter.call(name, {arg});
+  REQUIRE(reinterpret_cast<long (*)(long)>(jit.getAddress(name))(arg) ==
+          result);
+  return result;
+}
+
+void writeFile(const std::string &fileName, const std::string &contents) {
+  std::ofstream file(fileName, std::ios::binary);
+  file << contents;
+}
+
+} // namespace
+
+TEST_CASE("interpreter agrees with native code", "[interpreter]") {
+  LoweredProgram program(
+      "var"
+      "  z: integer;"
+      "function g(a: integer, b: integer): integer;"
+      "begin"
+      "  g := a * 3 + b "
+      "end;"
+      "function f(n: integer): integer;"
+      "var"
+      "  a: integer;"
+      "  b: integer;"
+      "  s: integer;"
+      "  t: integer;"
+      "begin"
+      "  a := n + 1; b := n * 2; s := 0; t := 0;"
+      "  while t < n do"
+      "  begin"
+      "    s := s + g(a, t) + b / 3 - t * 7;"
+      "    if s > 1000 then s := s - 997;"
+      "    case t - (t / 3) * 3 of"
+      "      0: a := a + 1;"
+      "      1: b := b + g(a, t);"
+      "      2: a := a - 2;"
+      "      3: b := b * 2"
+      "    else"
+      "      t := t"
+      "    end;"
+      "    t := t + 1"
+      "  end;"
+      "  f := s + a + b "
+      "end;"
+      "function outer(a: integer): integer;"
+      "  var t: integer;"
+      "  function middle(b: integer): integer;"
+      "    function inner(c: integer): integer;"
+      "    begin"
+      "      if c = 0 then inner := t else inner := inner(c - 1) + 1"
+      "    end;"
+      "  begin"
+      "    middle := inner(b) + inner(b + 1)"
+      "  end;"
+      "begin"
+      "  t := a * 100;"
+      "  outer := middle(a) + middle(1)"
+      "end;"
+      "begin"
+      "  z := f(3) + f(4) + g(z, z) + outer(1) + outer(2)"
+      "end.");
+  BytecodeCompiler bytecodeCompiler;
+  const bytecode::Module module = bytecodeCompiler.compile(program.frags);
+  Interpreter interpreter(module);
+  Jit jit;
+  loadProgram(jit, program);
+  REQUIRE(callBoth(interpreter, jit, "outer", 3) == 1210);
+  REQUIRE(callBoth(interpreter, jit, "outer", 4) == 1612);
+  for (int64_t n = 0; n < 60; n += 7)
+    callBoth(interpreter, jit, "f", n);
+  interpreter.run();
+}
+
+TEST_CASE("bytecode keeps frame slots in registers", "[interpreter]") {
+  // The counter escapes into the nested function so it stays in the frame.
+  AnalysedProgram program("var"
+                          "  x: integer;"
+                          "function f(n: integer): integer;"
+                          "  var i: integer;"
+                          "  function g(m: integer): integer;"
+                          "  begin"
+                          "    g := m + i"
+                          "  end;"
+                          "begin"
+                          "  i := 0;"
+                          "  f := 0;"
+                          "  while i < 100 do"
+                          "  begin"
+                          "    f := g(n);"
+                          "    i := i + 1"
+                          "  end "
+                          "end;"
+                          "begin"
+                          "  x := f(1) + f(2)"
+                          "end.");
+  Canonicaliser canonicaliser(program.parser.getSymbols());
+  for (auto &frag : program.frags)
+    canonicaliser.canonicalise(frag);
+  BytecodeCompiler bytecodeCompiler;
+  const bytecode::Module module = bytecodeCompiler.compile(program.frags);
+  // Testing and incrementing the counter each take a single instruction.
+  const auto opcodes = getOpcodes(module, "f");
+  REQUIRE(std::count(opcodes.begin(), opcodes.end(),
+                     bytecode::Opcode::Load) == 0);
+  REQUIRE(std::count(opcodes.begin(), opcodes.end(),
+                     bytecode::Opcode::Store) == 0);
+  REQUIRE(std::count(opcodes.begin(), opcodes.end(),
+                     bytecode::Opcode::JumpIfGreaterEqualImmediate) +
+              std::count(opcodes.begin(), opcodes.end(),
+                         bytecode::Opcode::JumpIfLessImmediate) ==
+          1);
+  REQUIRE(std::count(opcodes.begin(), opcodes.end(),
+                     bytecode::Opcode::AddImmediate) == 1);
+  // The nested function reads it with a single load through its static link.
+  const auto nestedOpcodes = getOpcodes(module, "g");
+  REQUIRE(std::count(nestedOpcodes.begin(), nestedOpcodes.end(),
+                     bytecode::Opcode::Load) == 1);
+  Interpreter interpreter(module);
+  REQUIRE(interpreter.call("f", {0, 7}) == 106);
+}
+
+TEST_CASE("interpreter reports runtime errors", "[interpreter]") {
+  LoweredProgram program("var"
+                         "  x: integer;"
+                         "function d(n: integer): integer;"
+                         "begin"
+                         "  d := 100 / n "
+                         "end;"
+                         "function r(n: integer): integer;"
+                         "begin"
+                         "  r := r(n + 1) + 1 "
+                         "end;"
+                         "begin"
+                         "  x := d(4) + d(5) + r(0) + r(1)"
+                         "end.");
+  BytecodeCompiler bytecodeCompiler;
+  const bytecode::Module module = bytecodeCompiler.compile(program.frags);
+  Interpreter interpreter(module);
+  // Dividing by zero is checked in the program itself and stops it through
+  // the runtime, like a range check error.
+  REQUIRE(interpreter.call("d", {4}) == 25);
+  REQUIRE_THROWS_MATCHES(interpreter.call("r", {0}), InterpreterError,
+                         Catch::Message("Stack overflow"));
+  REQUIRE_THROWS_MATCHES(interpreter.call("d", {1, 2}), InterpreterError,
+                         Catch::Message("Wrong number of arguments for d"));
+}
+
+TEST_CASE("bytecode images load back the same module", "[interpreter]") {
+  LoweredProgram program("var"
+                         "  x: integer;"
+                         "function outer(a: integer, b: integer): integer;"
+                         "  var t: integer;"
+                         "  function middle(c: integer): integer;"
+                         "    function inner(d: integer): integer;"
+                         "    begin"
+                         "      if d = 0 then inner := t "
+                         "      else inner := inner(d - 1) + 1"
+                         "    end;"
+                         "  begin"
+                         "    middle := inner(c)"
+                         "  end;"
+                         "begin"
+                         "  t := a * 100;"
+                         "  case b of"
+                         "    0: outer := middle(1);"
+                         "    1: outer := middle(2);"
+                         "    2: outer := middle(3);"
+                         "    3: outer := middle(4)"
+                         "  else"
+                         "    outer := 0"
+                         "  end "
+                         "end;"
+                         "begin"
+                         "  x := outer(1, 2)"
+                         "end.");
+  BytecodeCompiler bytecodeCompiler;
+  const bytecode::Module module = bytecodeCompiler.compile(program.frags);
+  const std::string fileName =
+      std::filesystem::temp_directory_path() / "descartes_test.dbc";
+  {
+    std::ofstream file(fileName, std::ios::binary);
+    ImageWriter imageWriter(file);
+    imageWriter.write(module);
+  }
+  ImageReader imageReader;
+  const bytecode::Module loaded = imageReader.read(fileName);
+  REQUIRE(loaded.code == module.code);
+  REQUIRE(loaded.functions.size() == module.functions.size());
+  for (size_t i = 0; i < module.functions.size(); ++i) {
+    const bytecode::Function &function = module.functions.at(i);
+    const bytecode::Function &loadedFunction = loaded.functions.at(i);
+    REQUIRE(loadedFunction.name == function.name);
+    REQUIRE(loadedFunction.entry == function.entry);
+    REQUIRE(loadedFunction.frameSlotCount == function.frameSlotCount);
+    REQUIRE(loadedFunction.registerCount == function.registerCount);
+    REQUIRE(loadedFunction.formals == function.formals);
+    REQUIRE(loadedFunction.returnRegister == function.returnRegister);
+  }
+  REQUIRE(loaded.statics.size() == 1);
+  REQUIRE(loaded.statics.front().name == module.statics.front().name);
+  REQUIRE(loaded.statics.front().size == module.statics.front().size);
+  Interpreter interpreter(loaded);
+  REQUIRE(interpreter.call("outer", {3, 1}) == 302);
+  REQUIRE(interpreter.call("outer", {3, 7}) == 0);
+  interpreter.run();
+  std::filesystem::remove(fileName);
+}
+
+TEST_CASE("malformed bytecode images are rejected", "[interpreter]") {
+  LoweredProgram program("var"
+                         "  x: integer;"
+                         "begin"
+                         "  x := 1 "
+                         "end.");
+  BytecodeCompiler bytecodeCompiler;
+  std::ostringstream out;
+  ImageWriter imageWriter(out);
+  imageWriter.write(bytecodeCompiler.compile(program.frags));
+  const std::string image = out.str();
+  const std::string fileName =
+      std::filesystem::temp_directory_path() / "descartes_test.dbc";
+  ImageReader imageReader;
+  std::filesystem::remove(fileName);
+  REQUIRE_THROWS_MATCHES(imageReader.read(fileName), ImageError,
+                         Catch::Message("Could not open image " + fileName));
+  writeFile(fileName, "program p; begin end.");
+  REQUIRE_THROWS_MATCHES(imageReader.read(fileName), ImageError,
+                         Catch::Message("Not a bytecode image: " + fileName));
+  std::string changed = image;
+  changed.at(4) = 100;
+  writeFile(fileName, changed);
+  REQUIRE_THROWS_MATCHES(imageReader.read(fileName), ImageError,
+                         Catch::Message("Unsupported image version 100"));
+  writeFile(fileName, image.substr(0, image.size() - 4));
+  REQUIRE_THROWS_MATCHES(imageReader.read(fileName), ImageError,
+                         Catch::Message("Malformed image: strings"));
+  // Point the first instruction at an opcode that doesn't exist.
+  changed = image;
+  changed.at(104) = 100;
+  writeFile(fileName, changed);
+  REQUIRE_THROWS_MATCHES(imageReader.read(fileName), ImageError,
+                         Catch::Message("Malformed image: bad opcode"));
+  writeFile(fileName, image);
+  REQUIRE(imageReader.read(fileName).code.size() > 0);
+  std::filesystem::remove(fileName);
+}
+
+} // namespace descartes::test
@@ -0,0 +1,118 @@
+#include <Encoder.h>
+
+#include "TestUtil.h"
+
+#include <catch2/catch.hpp>
+
+namespace descartes::test {
+
+namespace {
+
+std::vector<long> recorded;
+
+void record(long value) { recorded.push_back(value); }
+
+} // namespace
+
+TEST_CASE("jit runs compiled functions", "[jit]") {
+  LoweredProgram program("var"
+                         "  x: integer;"
+                         "function fact(n: integer): integer;"
+                         "begin"
+                         "  if n = 0 then"
+                         "    fact := 1"
+                         "  else"
+                         "    fact := n * fact(n - 1)"
+                         "end;"
+                         "function pick(n: integer): integer;"
+                         "begin"
+                         "  case n of"
+                         "    0: pick := 5;"
+                         "    1: pick := 7;"
+                         "    2: pick := 11;"
+                         "    3: pick := 13"
+                         "  else"
+                         "    pick := 17"
+                         "  end "
+                         "end;"
+                         "begin"
+                         "  x := fact(5) + pick(2)"
+                         "end.");
+  Jit jit;
+  loadProgram(jit, program);
+  const auto fact =
+      reinterpret_cast<long (*)(long)>(jit.getAddress("fact"));
+  REQUIRE(fact(10) == 3628800);
+  // The jump table is found relative to the code and holds the absolute
+  // addresses of the arms.
+  const auto pick = reinterpret_cast<long (*)(long)>(jit.getAddress("pick"));
+  REQUIRE(pick(0) == 5);
+  REQUIRE(pick(3) == 13);
+  REQUIRE(pick(9) == 17);
+  jit.run();
+}
+
+TEST_CASE("jit runs nested functions through the display", "[jit]") {
+  LoweredProgram program("var"
+                         "  x: integer;"
+                         "function outer(a: integer): integer;"
+                         "  var t: integer;"
+                         "  function middle(b: integer): integer;"
+                         "    function inner(c: integer): integer;"
+                         "    begin"
+                         "      if c = 0 then inner := t else "
+                         "inner := inner(c - 1) + 1"
+                         "    end;"
+                         "  begin"
+                         "    middle := inner(b) + inner(b + 1)"
+                         "  end;"
+                         "begin"
+                         "  t := a * 100;"
+                         "  outer := middle(a) + middle(1)"
+                         "end;"
+                         "begin"
+                         "  x := outer(3) + outer(4)"
+                         "end.");
+  Jit jit;
+  loadProgram(jit, program);
+  const auto outer =
+      reinterpret_cast<long (*)(long)>(jit.getAddress("outer"));
+  REQUIRE(outer(3) == 1210);
+  REQUIRE(outer(4) == 1612);
+}
+
+TEST_CASE("jit resolves symbols defined by the host", "[jit]") {
+  SymbolTable symbols;
+  ir::Level level(symbols.make("main"), nullptr);
+  std::vector<x86::Function> functions;
+  functions.emplace_back(level);
+  using x86::Operand;
+  const auto instruction = [](x86::Opcode op, std::vector<Operand> operands) {
+    return x86::Instruction(op, std::move(operands));
+  };
+  functions.back().instructions = {
+      instruction(x86::Opcode::Label, {Operand::makeLabel(level.name)}),
+      instruction(x86::Opcode::Sub, {Operand::makeImmediate(8),
+                                     Operand::makeRegister(x86::rsp)}),
+      instruction(x86::Opcode::Mov, {Operand::makeImmediate(42),
+                                     Operand::makeRegister(x86::rdi)}),
+      instruction(x86::Opcode::Call,
+                  {Operand::makeLabel(symbols.make("record"))}),
+      instruction(x86::Opcode::Add, {Operand::makeImmediate(8),
+                                     Operand::makeRegister(x86::rsp)}),
+      instruction(x86::Opcode::Ret, {}),
+  };
+  functions.back().instructions.at(3).argumentCount = 1;
+  Encoder encoder;
+  const x86::ObjectCode code = encoder.encode(functions);
+  Jit jit;
+  REQUIRE_THROWS_MATCHES(jit.load(code), JitError,
+                         Catch::Message("Undefined symbol: record"));
+  jit.addSymbol("record", reinterpret_cast<void *>(&record));
+  jit.load(code);
+  recorded.clear();
+  jit.run();
+  REQUIRE(recorded == std::vector<long>{42});
+}
+
+} // namespace descartes::test
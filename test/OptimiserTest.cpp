@@ -0,0 +1,1186 @@
+#include <Dce.h>
+#include <Display.h>
+#include <FrameCompaction.h>
+#include <Gvn.h>
+#include <Inliner.h>
+#include <Licm.h>
+#include <RangePropagation.h>
+#include <Sccp.h>
+#include <StrengthReduction.h>
+
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include <catch2/catch.hpp>
+
+namespace descartes::test {
+
+namespace {
+
+// Takes the main program since that's where the interesting code is in these
+// tests.
+ssa::Function &getMain(SsaProgram &program) {
+  return *program.functions.back();
+}
+
+void runSccp(SsaProgram &program) {
+  Sccp sccp;
+  for (auto &function : program.functions) {
+    sccp.run(*function);
+    REQUIRE(ssa::verify(*function).empty());
+  }
+}
+
+void runGvn(SsaProgram &program) {
+  Gvn gvn;
+  for (auto &function : program.functions) {
+    gvn.run(*function);
+    REQUIRE(ssa::verify(*function).empty());
+  }
+}
+
+void runRangePropagation(SsaProgram &program) {
+  Sccp sccp;
+  Gvn gvn;
+  RangePropagation rangePropagation;
+  for (auto &function : program.functions) {
+    sccp.run(*function);
+    gvn.run(*function);
+    rangePropagation.run(*function);
+    REQUIRE(ssa::verify(*function).empty());
+  }
+}
+
+void runLicm(SsaProgram &program) {
+  Gvn gvn;
+  Licm licm;
+  for (auto &function : program.functions) {
+    gvn.run(*function);
+    licm.run(*function);
+    REQUIRE(ssa::verify(*function).empty());
+  }
+}
+
+// Counts the instructions that are evaluated on every iteration of some loop.
+size_t countInLoops(const ssa::Function &function, ssa::Opcode op) {
+  const ssa::DominatorTree domTree(function);
+  const ssa::LoopInfo loopInfo(function, domTree);
+  size_t count = 0;
+  for (const auto &block : function.blocks) {
+    if (!loopInfo.getLoopFor(block.get()))
+      continue;
+    count += std::count_if(block->instructions.begin(),
+                           block->instructions.end(),
+                           [op](const ssa::InstructionPtr &instruction) {
+                             return instruction->op == op;
+                           });
+  }
+  return count;
+}
+
+void runStrengthReduction(SsaProgram &program) {
+  Sccp sccp;
+  Gvn gvn;
+  Licm licm;
+  StrengthReduction strengthReduction;
+  for (auto &function : program.functions) {
+    sccp.run(*function);
+    gvn.run(*function);
+    licm.run(*function);
+    strengthReduction.run(*function);
+    REQUIRE(ssa::verify(*function).empty());
+  }
+}
+
+void runInliner(SsaProgram &program) {
+  Inliner inliner;
+  inliner.run(program.functions);
+  for (auto &function : program.functions)
+    REQUIRE(ssa::verify(*function).empty());
+}
+
+void runDce(SsaProgram &program) {
+  Dce dce;
+  for (auto &function : program.functions) {
+    dce.run(*function);
+    REQUIRE(ssa::verify(*function).empty());
+  }
+}
+
+void runDisplay(SsaProgram &program) {
+  Display display(program.parser.getSymbols());
+  display.run(program.functions);
+  for (auto &function : program.functions)
+    REQUIRE(ssa::verify(*function).empty());
+}
+
+// Evaluates straight line arithmetic with wrapping 64 bit words like the
+// backends use, where every parameter has the same value.
+int64_t evaluate(const ssa::Instruction &instruction, int64_t param) {
+  switch (instruction.op) {
+  case ssa::Opcode::Const:
+    return instruction.value;
+  case ssa::Opcode::Param:
+    return param;
+  case ssa::Opcode::ArithOp:
+    break;
+  default:
+    FAIL("Can't evaluate instruction " << instruction.id);
+  }
+  const int64_t lhs = evaluate(*instruction.operands.at(0), param);
+  const int64_t rhs = evaluate(*instruction.operands.at(1), param);
+  const uint64_t l = lhs, r = rhs;
+  switch (instruction.arithOp) {
+  case ir::ArithOpKind::Add:
+    return static_cast<int64_t>(l + r);
+  case ir::ArithOpKind::Subtract:
+    return static_cast<int64_t>(l - r);
+  case ir::ArithOpKind::Multiply:
+    return static_cast<int64_t>(l * r);
+  case ir::ArithOpKind::Divide:
+    return lhs / rhs;
+  case ir::ArithOpKind::ShiftLeft:
+    return static_cast<int64_t>(l << (r & 63));
+  case ir::ArithOpKind::ShiftRight:
+    return lhs >> (r & 63);
+  case ir::ArithOpKind::And:
+    return lhs & rhs;
+  case ir::ArithOpKind::MultiplyHigh:
+    return static_cast<int64_t>((static_cast<__int128>(lhs) * rhs) >> 64);
+  }
+  return 0;
+}
+
+ssa::Function &getFunction(SsaProgram &program, const std::string &name) {
+  for (auto &function : program.functions) {
+    if (function->level.name.getName() == name)
+      return *function;
+  }
+  FAIL("No function named " << name);
+  throw std::logic_error("Unreachable");
+}
+
+const ssa::Instruction *findCall(const ssa::Function &function) {
+  for (const auto &block : function.blocks) {
+    for (const auto &instruction : block->instructions) {
+      if (instruction->op == ssa::Opcode::Call)
+        return instruction.get();
+    }
+  }
+  return nullptr;
+}
+
+// Counts the branches that compare something against a constant.
+size_t countCompares(const ssa::Function &function, ir::RelOpKind relOp,
+                     int value) {
+  size_t count = 0;
+  for (const auto &block : function.blocks) {
+    const ssa::Instruction *terminator = block->getTerminator();
+    count += terminator->op == ssa::Opcode::CondJump &&
+                     terminator->relOp == relOp &&
+                     terminator->operands.at(1)->op == ssa::Opcode::Const &&
+                     terminator->operands.at(1)->value == value
+                 ? 1
+                 : 0;
+  }
+  return count;
+}
+
+} // namespace
+
+TEST_CASE("sccp removes branches on constant variables", "[optimiser]") {
+  SsaProgram program("var"
+                     "  debug: integer;"
+                     "  x: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  debug := 0;"
+                     "  x := 1;"
+                     "  if debug = 1 then"
+                     "    x := f(x);"
+                     "  if debug <> 0 then"
+                     "    x := f(x + 1);"
+                     "  f(x)"
+                     "end.");
+  runSccp(program);
+  auto &main = getMain(program);
+  REQUIRE(countInstructions(main, ssa::Opcode::CondJump) == 0);
+  REQUIRE(countInstructions(main, ssa::Opcode::Call) == 1);
+  REQUIRE(countInstructions(main, ssa::Opcode::Phi) == 0);
+  // Only the constant can reach the call.
+  const auto *call = findCall(main);
+  REQUIRE(call->operands.at(1)->op == ssa::Opcode::Const);
+  REQUIRE(call->operands.at(1)->value == 1);
+}
+
+TEST_CASE("sccp merges equal constants at joins", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  if f(0) = 1 then"
+                     "    x := 2"
+                     "  else"
+                     "    x := 1 + 1;"
+                     "  f(x * 3)"
+                     "end.");
+  runSccp(program);
+  auto &main = getMain(program);
+  // The branch depends on a call so it stays.
+  REQUIRE(countInstructions(main, ssa::Opcode::CondJump) == 1);
+  REQUIRE(countInstructions(main, ssa::Opcode::Phi) == 0);
+  const ssa::Instruction *lastCall = nullptr;
+  for (const auto &block : main.blocks) {
+    for (const auto &instruction : block->instructions) {
+      if (instruction->op == ssa::Opcode::Call)
+        lastCall = instruction.get();
+    }
+  }
+  REQUIRE(lastCall->operands.at(1)->op == ssa::Opcode::Const);
+  REQUIRE(lastCall->operands.at(1)->value == 6);
+}
+
+TEST_CASE("sccp through loops", "[optimiser]") {
+  SsaProgram program("var"
+                     "  i: integer;"
+                     "  k: integer;"
+                     "  never: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  k := 5;"
+                     "  i := 0;"
+                     "  never := 0;"
+                     "  while i < 10 do"
+                     "  begin"
+                     "    if k = 5 then"
+                     "      i := i + 1"
+                     "    else"
+                     "      never := f(i);"
+                     "    k := k * 1 "
+                     "  end;"
+                     "  f(never)"
+                     "end.");
+  runSccp(program);
+  auto &main = getMain(program);
+  // Only the loop condition is left and `k` stays constant around the loop.
+  REQUIRE(countInstructions(main, ssa::Opcode::CondJump) == 1);
+  REQUIRE(countInstructions(main, ssa::Opcode::Phi) == 1);
+  REQUIRE(countInstructions(main, ssa::Opcode::Call) == 1);
+  const auto *call = findCall(main);
+  REQUIRE(call->operands.at(1)->op == ssa::Opcode::Const);
+  REQUIRE(call->operands.at(1)->value == 0);
+}
+
+TEST_CASE("sccp skips loops that never run", "[optimiser]") {
+  SsaProgram program("var"
+                     "  i: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  i := 10;"
+                     "  while i < 10 do"
+                     "    i := f(i);"
+                     "  f(i)"
+                     "end.");
+  runSccp(program);
+  auto &main = getMain(program);
+  REQUIRE(countInstructions(main, ssa::Opcode::CondJump) == 0);
+  REQUIRE(countInstructions(main, ssa::Opcode::Call) == 1);
+  REQUIRE(countInstructions(main, ssa::Opcode::Phi) == 0);
+}
+
+TEST_CASE("sccp removes whole loops inside branches it folds",
+          "[optimiser]") {
+  SsaProgram program("var"
+                     "  i: integer;"
+                     "  n: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  n := 0;"
+                     "  for i := 1 to n do"
+                     "    f(i);"
+                     "  if n > 0 then"
+                     "    while i < n do"
+                     "      i := f(i) "
+                     "end.");
+  runSccp(program);
+  auto &main = getMain(program);
+  // The headers of both loops had phis for `i` fed by their latches.
+  REQUIRE(countInstructions(main, ssa::Opcode::CondJump) == 0);
+  REQUIRE(countInstructions(main, ssa::Opcode::Call) == 0);
+  REQUIRE(countInstructions(main, ssa::Opcode::Phi) == 0);
+}
+
+TEST_CASE("sccp leaves division by zero to runtime", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "  z: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  z := 0;"
+                     "  x := 10 / z;"
+                     "  f(x)"
+                     "end.");
+  runSccp(program);
+  auto &main = getMain(program);
+  // The check on the divisor always fails, so the runtime reports the error
+  // and nothing after it is reached.
+  const auto *call = findCall(main);
+  REQUIRE(call);
+  REQUIRE(call->symbol->getName() == "descartes_division_error");
+  REQUIRE(countInstructions(main, ssa::Opcode::Call) == 1);
+  REQUIRE(countInstructions(main, ssa::Opcode::Return) == 0);
+}
+
+TEST_CASE("sccp jump tables", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "  y: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  x := 3;"
+                     "  case x of"
+                     "    1: y := f(1);"
+                     "    2: y := f(2);"
+                     "    3: y := 30;"
+                     "    4: y := f(4);"
+                     "    5: y := f(5) "
+                     "  end;"
+                     "  f(y)"
+                     "end.");
+  runSccp(program);
+  auto &main = getMain(program);
+  REQUIRE(countInstructions(main, ssa::Opcode::JumpTable) == 0);
+  REQUIRE(countInstructions(main, ssa::Opcode::Call) == 1);
+  REQUIRE(findCall(main)->operands.at(1)->value == 30);
+}
+
+TEST_CASE("gvn loads the static link chain once", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function outer(a: integer): integer;"
+                     "  function inner(b: integer): integer;"
+                     "  begin"
+                     "    inner := x * b + x * x - b / x "
+                     "  end;"
+                     "begin"
+                     "  outer := inner(a) "
+                     "end;"
+                     "begin"
+                     "  x := outer(2)"
+                     "end.");
+  auto &inner = getFunction(program, "inner");
+  REQUIRE(countInstructions(inner, ssa::Opcode::Load) == 8);
+  runGvn(program);
+  // One load for each link in the chain and one for `x`.
+  REQUIRE(countInstructions(inner, ssa::Opcode::Load) == 2);
+  // `x * b` and `x * x` are still different. Both the static link and `x` are
+  // at offset zero so no address arithmetic is left.
+  REQUIRE(countInstructions(inner, ssa::Opcode::ArithOp) == 5);
+}
+
+TEST_CASE("gvn merges pure expressions", "[optimiser]") {
+  SsaProgram program("function f(a: integer, b: integer): integer;"
+                     "begin"
+                     "  f := (a + b) * (b + a) + (a + b) * 1 "
+                     "end;"
+                     "begin"
+                     "  f(1, 2)"
+                     "end.");
+  runGvn(program);
+  auto &f = getFunction(program, "f");
+  // `a + b`, the multiply and the final add.
+  REQUIRE(countInstructions(f, ssa::Opcode::ArithOp) == 3);
+}
+
+TEST_CASE("gvn forwards stores to loads", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "  y: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  x := a;"
+                     "  y := a + 1;"
+                     "  f := x + y "
+                     "end;"
+                     "begin"
+                     "  x := f(1);"
+                     "  y := f(x)"
+                     "end.");
+  runGvn(program);
+  auto &f = getFunction(program, "f");
+  // `x` and `y` are different offsets from the same static link.
+  REQUIRE(countInstructions(f, ssa::Opcode::Load) == 0);
+  REQUIRE(countInstructions(f, ssa::Opcode::Store) == 2);
+}
+
+TEST_CASE("gvn doesn't merge loads across writes", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function g(a: integer): integer;"
+                     "begin"
+                     "  g := a "
+                     "end;"
+                     "function f(a: integer): integer;"
+                     "  var"
+                     "    i: integer;"
+                     "    total: integer;"
+                     "begin"
+                     "  total := x;"
+                     "  g(a);"
+                     "  total := total + x;"
+                     "  i := 0;"
+                     "  while i < a do"
+                     "  begin"
+                     "    total := total + x;"
+                     "    x := i;"
+                     "    i := i + 1 "
+                     "  end;"
+                     "  f := total "
+                     "end;"
+                     "begin"
+                     "  x := f(1)"
+                     "end.");
+  runGvn(program);
+  auto &f = getFunction(program, "f");
+  // Before and after the call and once in the loop since the loop body writes
+  // to `x`.
+  REQUIRE(countInstructions(f, ssa::Opcode::Load) == 3);
+}
+
+TEST_CASE("loops nest", "[optimiser]") {
+  SsaProgram program("var"
+                     "  i: integer;"
+                     "  j: integer;"
+                     "  total: integer;"
+                     "begin"
+                     "  i := 0;"
+                     "  total := 0;"
+                     "  while i < 10 do"
+                     "  begin"
+                     "    j := 0;"
+                     "    while j < i do"
+                     "      j := j + 1;"
+                     "    total := total + j;"
+                     "    i := i + 1 "
+                     "  end;"
+                     "  while total > 0 do"
+                     "    total := total - 1 "
+                     "end.");
+  auto &main = getMain(program);
+  const ssa::DominatorTree domTree(main);
+  const ssa::LoopInfo loopInfo(main, domTree);
+  const auto &loops = loopInfo.getLoops();
+  REQUIRE(loops.size() == 3);
+  const ssa::Loop *inner = nullptr;
+  for (const auto &loop : loops) {
+    REQUIRE(loop->getLatches().size() == 1);
+    REQUIRE(loop->getEntries().size() == 1);
+    REQUIRE(loop->blocks.front() == loop->header);
+    if (loop->depth == 2)
+      inner = loop.get();
+  }
+  REQUIRE(inner);
+  REQUIRE(inner->parent);
+  REQUIRE(inner->parent->depth == 1);
+  REQUIRE(inner->parent->children.size() == 1);
+  REQUIRE(inner->parent->contains(inner->header));
+  REQUIRE(inner->blocks.size() < inner->parent->blocks.size());
+  REQUIRE(loopInfo.getLoopFor(inner->header) == inner);
+  REQUIRE(!loopInfo.getLoopFor(main.getEntry()));
+  // Inner loops come before the loops containing them.
+  const auto position = [&loops](const ssa::Loop *loop) {
+    return std::find_if(loops.begin(), loops.end(),
+                        [loop](const std::unique_ptr<ssa::Loop> &other) {
+                          return other.get() == loop;
+                        });
+  };
+  REQUIRE(position(inner) < position(inner->parent));
+}
+
+TEST_CASE("licm hoists static link walks and arithmetic", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function f(a: integer): integer;"
+                     "  var"
+                     "    i: integer;"
+                     "    total: integer;"
+                     "  function g(n: integer): integer;"
+                     "    var"
+                     "      j: integer;"
+                     "      sum: integer;"
+                     "  begin"
+                     "    j := 0;"
+                     "    sum := 0;"
+                     "    while j < n do"
+                     "    begin"
+                     "      sum := sum + x * a;"
+                     "      j := j + 1 "
+                     "    end;"
+                     "    g := sum "
+                     "  end;"
+                     "begin"
+                     "  i := 0;"
+                     "  total := 0;"
+                     "  while i < a do"
+                     "  begin"
+                     "    total := total + x * 2;"
+                     "    i := i + 1 "
+                     "  end;"
+                     "  f := total + g(a) "
+                     "end;"
+                     "begin"
+                     "  x := f(1)"
+                     "end.");
+  runLicm(program);
+  // `x` and `a` are reached through the static links and the product doesn't
+  // change between iterations. The loads are the static link of `f` then `x`
+  // and `a`.
+  auto &g = getFunction(program, "g");
+  REQUIRE(countInLoops(g, ssa::Opcode::Load) == 0);
+  REQUIRE(countInLoops(g, ssa::Opcode::ArithOp) == 2);
+  REQUIRE(countInstructions(g, ssa::Opcode::Load) == 3);
+  auto &f = getFunction(program, "f");
+  REQUIRE(countInLoops(f, ssa::Opcode::Load) == 0);
+  REQUIRE(countInLoops(f, ssa::Opcode::ArithOp) == 2);
+}
+
+TEST_CASE("licm keeps loads that the loop may change", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "  y: integer;"
+                     "function h(a: integer): integer;"
+                     "begin"
+                     "  h := a "
+                     "end;"
+                     "function f(a: integer): integer;"
+                     "  var"
+                     "    i: integer;"
+                     "    total: integer;"
+                     "begin"
+                     "  i := 0;"
+                     "  total := 0;"
+                     "  while i < a do"
+                     "  begin"
+                     "    total := total + x + y;"
+                     "    x := i;"
+                     "    i := i + 1 "
+                     "  end;"
+                     "  while i > 0 do"
+                     "  begin"
+                     "    total := total + y;"
+                     "    i := h(i) - 1 "
+                     "  end;"
+                     "  f := total "
+                     "end;"
+                     "begin"
+                     "  x := f(1)"
+                     "end.");
+  runLicm(program);
+  auto &f = getFunction(program, "f");
+  // `y` can leave the first loop since only `x` is written but the call in the
+  // second loop could change it.
+  REQUIRE(countInLoops(f, ssa::Opcode::Load) == 2);
+}
+
+TEST_CASE("licm hoists out of nested loops", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function f(a: integer): integer;"
+                     "  var"
+                     "    i: integer;"
+                     "    j: integer;"
+                     "    total: integer;"
+                     "begin"
+                     "  i := 0;"
+                     "  total := 0;"
+                     "  while i < a do"
+                     "  begin"
+                     "    j := 0;"
+                     "    while j < i do"
+                     "    begin"
+                     "      total := total + x * a + j * a;"
+                     "      j := j + 1 "
+                     "    end;"
+                     "    i := i + 1 "
+                     "  end;"
+                     "  f := total / 4 "
+                     "end;"
+                     "begin"
+                     "  x := f(1)"
+                     "end.");
+  runLicm(program);
+  auto &f = getFunction(program, "f");
+  REQUIRE(countInLoops(f, ssa::Opcode::Load) == 0);
+  const ssa::DominatorTree domTree(f);
+  const ssa::LoopInfo loopInfo(f, domTree);
+  // `x * a` leaves both loops while `j * a` has to stay in the inner one.
+  const auto &loops = loopInfo.getLoops();
+  REQUIRE(loops.size() == 2);
+  size_t multiplies = 0;
+  for (const ssa::Block *block : loops.back()->blocks) {
+    for (const auto &instruction : block->instructions) {
+      if (instruction->op == ssa::Opcode::ArithOp &&
+          instruction->arithOp == ir::ArithOpKind::Multiply)
+        ++multiplies;
+    }
+  }
+  REQUIRE(multiplies == 1);
+}
+
+TEST_CASE("strength reduction divides by constants", "[optimiser]") {
+  const int min = std::numeric_limits<int>::min();
+  const int max = std::numeric_limits<int>::max();
+  const int64_t wideMin = std::numeric_limits<int64_t>::min();
+  const int64_t wideMax = std::numeric_limits<int64_t>::max();
+  // Values are whole words at runtime so dividends can be well outside 32 bits
+  // even though constants can't.
+  const std::vector<int64_t> dividends = {
+      wideMin,     wideMin + 1,    -314146179328, -4294967296,
+      min - 1LL,   min,            min + 1,       -1000000,
+      -641,        -100,           -7,            -6,
+      -1,          0,              1,             2,
+      5,           6,              7,             99,
+      100,         641,            1000000,       max - 1,
+      max,         max + 1LL,      4294967296,    733007751765,
+      wideMax - 1, wideMax};
+  for (int divisor : {2, 3, 5, 6, 7, 8, 10, 100, 641, 1 << 30, max, -1, -2,
+                      -3, -7, -8, -100, min}) {
+    // Negative literals are folded from a subtraction.
+    std::string divisorExpr = std::to_string(divisor);
+    if (divisor == min)
+      divisorExpr = "(0 - " + std::to_string(max) + " - 1)";
+    else if (divisor < 0)
+      divisorExpr = "(0 - " + std::to_string(-divisor) + ")";
+    SsaProgram program("function f(a: integer): integer;"
+                       "begin"
+                       "  f := a / " +
+                       divisorExpr + " end; begin f(1) end.");
+    runStrengthReduction(program);
+    auto &f = getFunction(program, "f");
+    REQUIRE(countInstructions(f, ssa::Opcode::ArithOp) > 0);
+    for (const auto &block : f.blocks) {
+      for (const auto &instruction : block->instructions)
+        REQUIRE(!(instruction->op == ssa::Opcode::ArithOp &&
+                  instruction->arithOp == ir::ArithOpKind::Divide));
+    }
+    const ssa::Instruction *result = nullptr;
+    for (const auto &block : f.blocks) {
+      if (block->getTerminator()->op == ssa::Opcode::Return)
+        result = block->getTerminator()->operands.at(0);
+    }
+    REQUIRE(result);
+    for (int64_t dividend : dividends) {
+      if (divisor == -1 && dividend == wideMin)
+        continue;
+      INFO(dividend << " / " << divisor);
+      REQUIRE(evaluate(*result, dividend) == dividend / divisor);
+    }
+  }
+}
+
+TEST_CASE("strength reduction replaces multiplies of induction variables",
+          "[optimiser]") {
+  SsaProgram program("function f(a: integer): integer;"
+                     "  var"
+                     "    i: integer;"
+                     "    total: integer;"
+                     "begin"
+                     "  total := 0;"
+                     "  for i := 1 to 10 do"
+                     "    total := total + i * 8 + i;"
+                     "  f := total "
+                     "end;"
+                     "begin"
+                     "  f(1)"
+                     "end.");
+  runStrengthReduction(program);
+  auto &f = getFunction(program, "f");
+  REQUIRE(countInLoops(f, ssa::Opcode::ArithOp) == 4);
+  for (const auto &block : f.blocks) {
+    for (const auto &instruction : block->instructions)
+      REQUIRE(instruction->arithOp != ir::ArithOpKind::Multiply);
+  }
+}
+
+TEST_CASE("strength reduction leaves one add and compare per iteration",
+          "[optimiser]") {
+  SsaProgram program("function f(base: integer, n: integer): integer;"
+                     "  var"
+                     "    i: integer;"
+                     "    total: integer;"
+                     "begin"
+                     "  total := 0;"
+                     "  for i := 0 to 99 do"
+                     "    total := total + (base + i * 8);"
+                     "  f := total "
+                     "end;"
+                     "begin"
+                     "  f(1, 2)"
+                     "end.");
+  runStrengthReduction(program);
+  auto &f = getFunction(program, "f");
+  // The sum and the single variable that walks `base + i * 8`, which the exit
+  // test now compares against `base + 792`.
+  REQUIRE(countInLoops(f, ssa::Opcode::ArithOp) == 2);
+  REQUIRE(countInLoops(f, ssa::Opcode::CondJump) == 1);
+  REQUIRE(countInLoops(f, ssa::Opcode::Phi) == 2);
+}
+
+TEST_CASE("strength reduction keeps tests that could overflow",
+          "[optimiser]") {
+  SsaProgram program("function f(n: integer): integer;"
+                     "  var"
+                     "    i: integer;"
+                     "    total: integer;"
+                     "begin"
+                     "  total := 0;"
+                     "  for i := 0 to n do"
+                     "    total := total + i * 8;"
+                     "  f := total "
+                     "end;"
+                     "begin"
+                     "  f(1)"
+                     "end.");
+  runStrengthReduction(program);
+  auto &f = getFunction(program, "f");
+  // `i * 8` can wrap around before `i` reaches an unknown bound so `i` has to
+  // stay for the exit test.
+  REQUIRE(countInLoops(f, ssa::Opcode::Phi) == 3);
+  REQUIRE(countInLoops(f, ssa::Opcode::ArithOp) == 3);
+}
+
+TEST_CASE("inliner replaces calls to small functions", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  if a < 0 then"
+                     "    f := 0 - a "
+                     "  else"
+                     "    f := a "
+                     "end;"
+                     "begin"
+                     "  x := f(x) + f(x + 1) + f(2)"
+                     "end.");
+  runInliner(program);
+  REQUIRE(program.functions.size() == 1);
+  auto &main = getMain(program);
+  REQUIRE(countInstructions(main, ssa::Opcode::Call) == 0);
+  // Each copy merges the values of its two returns.
+  REQUIRE(countInstructions(main, ssa::Opcode::Phi) == 3);
+  // `x` starts out as zero so every copy folds away.
+  runSccp(program);
+  REQUIRE(countInstructions(main, ssa::Opcode::CondJump) == 0);
+}
+
+TEST_CASE("inliner leaves recursive functions", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function count(n: integer): integer;"
+                     "  function step(m: integer): integer;"
+                     "  begin"
+                     "    step := count(m - 1) + 1 "
+                     "  end;"
+                     "begin"
+                     "  if n = 0 then count := 0 else count := step(n) "
+                     "end;"
+                     "function fact(n: integer): integer;"
+                     "begin"
+                     "  if n = 0 then fact := 1 else fact := n * fact(n - 1) "
+                     "end;"
+                     "begin"
+                     "  x := fact(x);"
+                     "  x := count(x)"
+                     "end.");
+  runInliner(program);
+  REQUIRE(program.functions.size() == 4);
+  REQUIRE(countInstructions(getMain(program), ssa::Opcode::Call) == 2);
+  REQUIRE(countInstructions(getFunction(program, "fact"),
+                            ssa::Opcode::Call) == 1);
+}
+
+TEST_CASE("inliner reaches outer variables from the caller", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function outer(a: integer): integer;"
+                     "  var t: integer;"
+                     "  function inner(b: integer): integer;"
+                     "  begin"
+                     "    t := t + b + x;"
+                     "    inner := t "
+                     "  end;"
+                     "begin"
+                     "  t := a;"
+                     "  while t < 100 do t := inner(t);"
+                     "  outer := t "
+                     "end;"
+                     "begin"
+                     "  x := 3;"
+                     "  x := outer(x)"
+                     "end.");
+  auto &outer = getFunction(program, "outer");
+  REQUIRE(countInstructions(outer, ssa::Opcode::Store) > 0);
+  runInliner(program);
+  REQUIRE(program.functions.size() == 1);
+  // Neither `t` nor `x` has to stay in a frame once nothing else reaches it.
+  auto &main = getMain(program);
+  REQUIRE(countInstructions(main, ssa::Opcode::Call) == 0);
+  REQUIRE(countInstructions(main, ssa::Opcode::Load) == 0);
+  REQUIRE(countInstructions(main, ssa::Opcode::Store) == 0);
+}
+
+TEST_CASE("inliner keeps functions that pass on their frame",
+          "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function outer(a: integer): integer;"
+                     "  function inner(b: integer): integer;"
+                     "  begin"
+                     "    if b = 0 then"
+                     "      inner := a + x "
+                     "    else"
+                     "      inner := inner(b - 1) "
+                     "  end;"
+                     "begin"
+                     "  outer := inner(a) "
+                     "end;"
+                     "begin"
+                     "  x := outer(x)"
+                     "end.");
+  runInliner(program);
+  REQUIRE(program.functions.size() == 3);
+  REQUIRE(countInstructions(getMain(program), ssa::Opcode::Call) == 1);
+  // Main still passes its frame to `outer` so `x` stays in it.
+  REQUIRE(countInstructions(getMain(program), ssa::Opcode::Store) == 1);
+}
+
+TEST_CASE("inliner limits the size of callees", "[optimiser]") {
+  const std::string function = "function f(a: integer): integer;"
+                               "begin"
+                               "  a := a * a + a * 3 + 1;"
+                               "  a := a * a + a * 3 + 1;"
+                               "  a := a * a + a * 3 + 1;"
+                               "  a := a * a + a * 3 + 1;"
+                               "  a := a * a + a * 3 + 1;"
+                               "  a := a * a + a * 3 + 1;"
+                               "  a := a * a + a * 3 + 1;"
+                               "  f := a "
+                               "end;";
+  SECTION("called once") {
+    SsaProgram program("var x: integer;" + function + "begin"
+                       "  x := f(x)"
+                       "end.");
+    runInliner(program);
+    REQUIRE(countInstructions(getMain(program), ssa::Opcode::Call) == 0);
+  }
+  SECTION("called twice") {
+    SsaProgram program("var x: integer;" + function + "begin"
+                       "  x := f(x) + f(x)"
+                       "end.");
+    runInliner(program);
+    REQUIRE(countInstructions(getMain(program), ssa::Opcode::Call) == 2);
+  }
+}
+
+TEST_CASE("dce removes branches around dead code", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function f(a: integer): integer;"
+                     "  var t: integer;"
+                     "begin"
+                     "  if a < 0 then"
+                     "    t := a * 2 "
+                     "  else"
+                     "    t := a * 3;"
+                     "  f := a + 1 "
+                     "end;"
+                     "begin"
+                     "  x := f(x)"
+                     "end.");
+  runDce(program);
+  auto &f = getFunction(program, "f");
+  REQUIRE(countInstructions(f, ssa::Opcode::CondJump) == 0);
+  REQUIRE(countInstructions(f, ssa::Opcode::Phi) == 0);
+  REQUIRE(countInstructions(f, ssa::Opcode::ArithOp) == 1);
+}
+
+TEST_CASE("dce keeps loops and division", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function f(a: integer, b: integer): integer;"
+                     "  var t: integer;"
+                     "begin"
+                     "  t := a / b;"
+                     "  t := a / 2;"
+                     "  while a <> 0 do"
+                     "    if b < 0 then a := a - 2 else a := a - 1;"
+                     "  f := 0 "
+                     "end;"
+                     "begin"
+                     "  x := f(x, x)"
+                     "end.");
+  runDce(program);
+  auto &f = getFunction(program, "f");
+  // The loop might never terminate and `b` might be zero but the branch in the
+  // loop body still decides how quickly the loop gets there. The check on `b`
+  // stops the program.
+  REQUIRE(countInstructions(f, ssa::Opcode::CondJump) == 3);
+  REQUIRE(countInstructions(f, ssa::Opcode::ArithOp) == 3);
+}
+
+TEST_CASE("dce removes stores that are never read", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function outer(a: integer): integer;"
+                     "  var t: integer;"
+                     "  function inner(b: integer): integer;"
+                     "  begin"
+                     "    inner := t + b "
+                     "  end;"
+                     "begin"
+                     "  t := 1;"
+                     "  t := a;"
+                     "  outer := inner(a);"
+                     "  t := 3 "
+                     "end;"
+                     "begin"
+                     "  x := outer(x)"
+                     "end.");
+  auto &outer = getFunction(program, "outer");
+  REQUIRE(countInstructions(outer, ssa::Opcode::Store) == 3);
+  runDce(program);
+  // Only the store that the call can see is left.
+  REQUIRE(countInstructions(outer, ssa::Opcode::Store) == 1);
+}
+
+TEST_CASE("frame compaction packs the slots that are left", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function outer(a: integer): integer;"
+                     "  var t: integer;"
+                     "  u: integer;"
+                     "  v: integer;"
+                     "  function inner(b: integer): integer;"
+                     "  begin"
+                     "    inner := t + b "
+                     "  end;"
+                     "begin"
+                     "  u := a;"
+                     "  v := u + 1;"
+                     "  t := v;"
+                     "  outer := inner(a) "
+                     "end;"
+                     "begin"
+                     "  x := outer(x)"
+                     "end.");
+  auto &outer = getFunction(program, "outer");
+  auto &main = getMain(program);
+  REQUIRE(outer.level.locals.size() == 6);
+  REQUIRE(main.level.locals.size() == 1);
+  runDce(program);
+  FrameCompaction frameCompaction;
+  for (auto &function : program.functions)
+    frameCompaction.run(*function);
+  // The static link, `a` and `t` are all that's left of the frame of `outer`
+  // but the slot of the return value stays behind as a gap in front of `t`.
+  // `x` was promoted.
+  REQUIRE(outer.level.locals.size() == 4);
+  REQUIRE(main.level.locals.empty());
+}
+
+TEST_CASE("display replaces static link chains", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function outer(a: integer): integer;"
+                     "  function inner(b: integer): integer;"
+                     "  begin"
+                     "    if b = 0 then"
+                     "      inner := x "
+                     "    else"
+                     "      inner := inner(b - 1) + 1 "
+                     "  end;"
+                     "begin"
+                     "  outer := inner(a) "
+                     "end;"
+                     "begin"
+                     "  x := outer(x)"
+                     "end.");
+  auto &inner = getFunction(program, "inner");
+  REQUIRE(countInstructions(inner, ssa::Opcode::Load) == 2);
+  runDisplay(program);
+  // `x` is read straight from the frame that main puts in the display so
+  // neither of the other functions needs a static link.
+  auto &main = getMain(program);
+  REQUIRE(main.level.isDisplayed);
+  REQUIRE(countInstructions(main, ssa::Opcode::Store) == 3);
+  REQUIRE(countInstructions(inner, ssa::Opcode::Load) == 2);
+  REQUIRE(getFunction(program, "outer").level.formals.size() == 1);
+  REQUIRE(inner.level.formals.size() == 1);
+  for (auto &function : program.functions) {
+    REQUIRE(!function->level.hasStaticLink);
+    for (const auto &block : function->blocks) {
+      for (const auto &instruction : block->instructions) {
+        if (instruction->op == ssa::Opcode::Call)
+          REQUIRE(instruction->operands.size() == 1);
+      }
+    }
+  }
+}
+
+TEST_CASE("display keeps static links that are used", "[optimiser]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function outer(a: integer): integer;"
+                     "  var t: integer;"
+                     "  function inner(b: integer): integer;"
+                     "  begin"
+                     "    if b = 0 then"
+                     "      inner := t "
+                     "    else"
+                     "      inner := inner(b - 1) + 1 "
+                     "  end;"
+                     "begin"
+                     "  t := a;"
+                     "  outer := inner(a) "
+                     "end;"
+                     "begin"
+                     "  x := outer(x)"
+                     "end.");
+  runDisplay(program);
+  // `inner` reaches `t` through its static link, which it also passes on to
+  // itself, but `outer` doesn't use its own.
+  auto &outer = getFunction(program, "outer");
+  auto &inner = getFunction(program, "inner");
+  REQUIRE(!outer.level.hasStaticLink);
+  REQUIRE(outer.level.formals.size() == 1);
+  REQUIRE(inner.level.hasStaticLink);
+  REQUIRE(inner.level.formals.size() == 2);
+  for (auto &function : program.functions) {
+    REQUIRE(!function->level.isDisplayed);
+    REQUIRE(countInstructions(*function, ssa::Opcode::Name) == 0);
+  }
+  // Main doesn't pass its frame to anything so `x` is promoted.
+  REQUIRE(countInstructions(getMain(program), ssa::Opcode::Store) == 0);
+}
+
+TEST_CASE("range propagation removes checks that loops make redundant",
+          "[optimiser]") {
+  SsaProgram program("type"
+                     "  row = array [1..10] of integer;"
+                     "function sum(n: integer): integer;"
+                     "var"
+                     "  a: row;"
+                     "  i: integer;"
+                     "  s: integer;"
+                     "begin"
+                     "  for i := 1 to 10 do"
+                     "    a[i] := i;"
+                     "  for i := 10 downto 1 do"
+                     "    a[i] := a[i] + i;"
+                     "  s := 0;"
+                     "  i := 10;"
+                     "  while i > 0 do"
+                     "  begin"
+                     "    s := s + a[i];"
+                     "    i := i - 1"
+                     "  end;"
+                     "  sum := s "
+                     "end;"
+                     "begin "
+                     "end.",
+                     true);
+  // Each index that is checked reports failures with a call of its own.
+  auto &sum = *program.functions.front();
+  REQUIRE(countInstructions(sum, ssa::Opcode::Call) == 4);
+  runRangePropagation(program);
+  // Only the loop tests are left.
+  REQUIRE(countInstructions(sum, ssa::Opcode::Call) == 0);
+  REQUIRE(countInstructions(sum, ssa::Opcode::CondJump) == 3);
+}
+
+TEST_CASE("range propagation uses subranges and narrow elements",
+          "[optimiser]") {
+  SsaProgram program("type"
+                     "  digit = 0..9;"
+                     "  row = array [digit] of integer;"
+                     "  bytes = array [1..4] of 0..255;"
+                     "  table = array [0..255] of integer;"
+                     "function f(n: integer): integer;"
+                     "var"
+                     "  d: digit;"
+                     "  a: row;"
+                     "  b: bytes;"
+                     "  t: table;"
+                     "begin"
+                     "  d := n;"
+                     "  a[d] := 1;"
+                     "  t[b[1]] := 2;"
+                     "  f := a[d] + t[b[1]] "
+                     "end;"
+                     "begin "
+                     "end.",
+                     true);
+  auto &f = *program.functions.front();
+  REQUIRE(countInstructions(f, ssa::Opcode::Call) == 5);
+  runRangePropagation(program);
+  // A checked digit stays a digit and a byte can't leave the table, so only
+  // the check on `n` is left.
+  REQUIRE(countInstructions(f, ssa::Opcode::Call) == 1);
+  REQUIRE(countInstructions(f, ssa::Opcode::CondJump) == 2);
+}
+
+TEST_CASE("range propagation keeps checks that might fail", "[optimiser]") {
+  SsaProgram program("type"
+                     "  row = array [1..10] of integer;"
+                     "procedure fill(n: integer);"
+                     "var"
+                     "  a: row;"
+                     "  i: integer;"
+                     "begin"
+                     "  for i := 1 to n do"
+                     "    a[i] := 0;"
+                     "  for i := 0 to 9 do"
+                     "    a[i] := 0;"
+                     "  i := 1;"
+                     "  while i < 100 do"
+                     "  begin"
+                     "    a[i] := 0;"
+                     "    i := i * 2"
+                     "  end "
+                     "end;"
+                     "begin "
+                     "end.",
+                     true);
+  runRangePropagation(program);
+  auto &fill = *program.functions.front();
+  // Each loop keeps the check its bounds don't prove. Doubling isn't a step
+  // that ranges follow so the last loop keeps both.
+  REQUIRE(countInstructions(fill, ssa::Opcode::Call) == 3);
+  REQUIRE(countCompares(fill, ir::RelOpKind::GreaterThan, 10) == 2);
+  REQUIRE(countCompares(fill, ir::RelOpKind::LessThan, 1) == 2);
+}
+
+} // namespace descartes::test
@@ -57,6 +57,16 @@ TEST_CASE("parse block", "[parser]") {
   testParser(program);
 }
 
+TEST_CASE("parse constant expressions", "[parser]") {
+  const char *program = "const"
+                        "  x = 1;"
+                        "  y = -(x + 2) * 3;"
+                        "  z = 'foo' + 'bar';"
+                        "begin "
+                        "end.";
+  testParser(program);
+}
+
 TEST_CASE("parse procedure", "[parser]") {
   const char *program = "procedure foo(x : integer);"
                         "const"
@@ -105,6 +115,18 @@ TEST_CASE("parse case statement", "[parser]") {
   testParser(program);
 }
 
+TEST_CASE("parse case statement with label lists and else", "[parser]") {
+  const char *program = "begin"
+                        "  case x of"
+                        "    1, 2: y := 'small';"
+                        "    3: y := 'three'"
+                        "  else"
+                        "    y := 'other'"
+                        "  end "
+                        "end.";
+  testParser(program);
+}
+
 TEST_CASE("parse repeat-until statement", "[parser]") {
   const char *program = "begin"
                         "  repeat"
@@ -123,4 +145,88 @@ TEST_CASE("parse with statement", "[parser]") {
   testParser(program);
 }
 
+TEST_CASE("parse array types and indexing", "[parser]") {
+  const std::string program = "type"
+                              "  colour = (red, green, blue);"
+                              "  grid = array [1..3, colour] of integer;"
+                              "var"
+                              "  g: grid;"
+                              "begin"
+                              "  g[1, red] := g[2][blue] + 1 "
+                              "end.";
+  Lexer lexer(program, false);
+  Parser parser(lexer);
+  const Block block = parser.parse();
+  // Each index after the first is another array inside the last.
+  REQUIRE(block.typeDefs.size() == 2);
+  const Type &gridType = *block.typeDefs.at(1).type;
+  REQUIRE(gridType.getKind() == TypeKind::Array);
+  const auto &rows = static_cast<const Array &>(gridType);
+  REQUIRE(rows.index.low);
+  REQUIRE(!rows.index.typeIdentifier);
+  REQUIRE(rows.elementType->getKind() == TypeKind::Array);
+  const auto &columns = static_cast<const Array &>(*rows.elementType);
+  REQUIRE(columns.index.typeIdentifier->getName() == "colour");
+  REQUIRE(columns.elementType->getKind() == TypeKind::Alias);
+}
+
+TEST_CASE("parse subrange types", "[parser]") {
+  const std::string program = "type"
+                              "  digit = 0..9;"
+                              "  offset = -max..max;"
+                              "  byte = digit;"
+                              "  row = array [digit] of 1..100;"
+                              "begin "
+                              "end.";
+  Lexer lexer(program, false);
+  Parser parser(lexer);
+  const Block block = parser.parse();
+  REQUIRE(block.typeDefs.size() == 4);
+  REQUIRE(block.typeDefs.at(0).type->getKind() == TypeKind::Subrange);
+  REQUIRE(block.typeDefs.at(1).type->getKind() == TypeKind::Subrange);
+  // A name on its own is still an alias.
+  REQUIRE(block.typeDefs.at(2).type->getKind() == TypeKind::Alias);
+  const auto &row = static_cast<const Array &>(*block.typeDefs.at(3).type);
+  REQUIRE(row.elementType->getKind() == TypeKind::Subrange);
+}
+
+TEST_CASE("parse packed types", "[parser]") {
+  const std::string program = "type"
+                              "  bits = packed array [1..10, 1..3] of boolean;"
+                              "  point = packed record"
+                              "    x: integer;"
+                              "    y: integer "
+                              "  end;"
+                              "  row = array [1..10] of boolean;"
+                              "begin "
+                              "end.";
+  Lexer lexer(program, false);
+  Parser parser(lexer);
+  const Block block = parser.parse();
+  REQUIRE(block.typeDefs.size() == 3);
+  // Packing applies to the rows too.
+  const auto &bits = static_cast<const Array &>(*block.typeDefs.at(0).type);
+  REQUIRE(bits.isPacked);
+  REQUIRE(bits.elementType->isPacked);
+  REQUIRE(block.typeDefs.at(1).type->isPacked);
+  REQUIRE_FALSE(block.typeDefs.at(2).type->isPacked);
+  const std::string badProgram = "type"
+                                 "  count = packed integer;"
+                                 "begin "
+                                 "end.";
+  Lexer badLexer(badProgram, false);
+  Parser badParser(badLexer);
+  REQUIRE_THROWS_AS(badParser.parse(), ParserError);
+}
+
+TEST_CASE("parse array with a bad index", "[parser]") {
+  const std::string program = "type"
+                              "  row = array [1 + 2] of integer;"
+                              "begin "
+                              "end.";
+  Lexer lexer(program, false);
+  Parser parser(lexer);
+  REQUIRE_THROWS_AS(parser.parse(), ParserError);
+}
+
 } // namespace descartes::test
@@ -0,0 +1,586 @@
+#include <BytecodeCompiler.h>
+#include <CPrinter.h>
+#include <ElfWriter.h>
+#include <Interpreter.h>
+#include <Runtime.h>
+#include <TieredEngine.h>
+
+#include "TestUtil.h"
+
+#include <catch2/catch.hpp>
+
+#include <sys/wait.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+
+namespace descartes::test {
+
+namespace {
+
+// Runs `body` with the runtime reading `input` and returns what it wrote.
+std::string captureOutput(const std::string &input,
+                          const std::function<void()> &body) {
+  std::FILE *inputFile = std::tmpfile(), *outputFile = std::tmpfile();
+  std::fputs(input.c_str(), inputFile);
+  std::fflush(inputFile);
+  std::rewind(inputFile);
+  runtime::redirect(fileno(inputFile), fileno(outputFile));
+  body();
+  runtime::redirect(0, 1);
+  std::rewind(outputFile);
+  std::string output;
+  char buffer[4096];
+  size_t count;
+  while ((count = std::fread(buffer, 1, sizeof(buffer), outputFile)) > 0)
+    output.append(buffer, count);
+  std::fclose(inputFile);
+  std::fclose(outputFile);
+  return output;
+}
+
+std::string readFile(const std::string &fileName) {
+  std::ifstream file(fileName, std::ios::binary);
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+// Runs an executable with `input` and returns what it wrote to either output,
+// checking that it exits with `status`.
+std::string runExecutable(const std::string &fileName, const std::string &input,
+                          int status) {
+  const auto directory = std::filesystem::temp_directory_path();
+  const std::string inputName = directory / "descartes_test.in";
+  const std::string outputName = directory / "descartes_test.out";
+  std::ofstream(inputName) << input;
+  const int result = std::system(
+      (fileName + " < " + inputName + " > " + outputName + " 2>&1").c_str());
+  REQUIRE(WIFEXITED(result));
+  REQUIRE(WEXITSTATUS(result) == status);
+  const std::string output = readFile(outputName);
+  std::filesystem::remove(inputName);
+  std::filesystem::remove(outputName);
+  return output;
+}
+
+const char *const ioSource = "var"
+                             "  n: integer;"
+                             "  i: integer;"
+                             "  x: integer;"
+                             "begin"
+                             "  read(n);"
+                             "  readln;"
+                             "  for i := 1 to n do"
+                             "  begin"
+                             "    read(x);"
+                             "    writeln(x * i);"
+                             "    writeln(x < i)"
+                             "  end;"
+                             "  write(0 - n)"
+                             "end.";
+const char *const ioInput = "3 ignored\n5\n-7 100\n";
+const char *const ioOutput = "5\nFALSE\n-14\nTRUE\n300\nFALSE\n-3";
+
+const char *const stringSource = "const"
+                                 "  greeting = 'Hello, ';"
+                                 "var"
+                                 "  name: string;"
+                                 "  line: string;"
+                                 "  i: integer;"
+                                 "begin"
+                                 "  readln(name);"
+                                 "  line := greeting + name + '!';"
+                                 "  writeln(line);"
+                                 "  for i := 1 to 3 do"
+                                 "    line := line + line;"
+                                 "  writeln(line = greeting + name + '!');"
+                                 "  writeln(name < 'world', name >= 'world');"
+                                 "  writeln('abc' < 'abd', 'ab' + 'c' = 'abc')"
+                                 "end.";
+const char *const stringInput = "Pascal\n";
+const char *const stringOutput =
+    "Hello, Pascal!\nFALSE\nTRUEFALSE\nTRUETRUE\n";
+
+// Integers are whole words at runtime, so products can leave 32 bits and
+// division by a constant has to work on what they leave.
+const char *const wideSource = "var"
+                               "  y: integer;"
+                               "  n: integer;"
+                               "begin"
+                               "  read(n);"
+                               "  y := n * 65536 * 65536;"
+                               "  writeln(y / 7, ' ', (0 - y) / 3);"
+                               "  writeln(y / 8, ' ', (0 - y) / 8, ' ',"
+                               "          (0 - y) / (0 - 641));"
+                               "  writeln((n + 2147483647) + 2147483647, ' ',"
+                               "          n - 2147483647 - 2147483647 -"
+                               "          2147483647)"
+                               "end.";
+const char *const wideInput = "73";
+const char *const wideOutput =
+    "44790373229 -104510870869\n39191576576 -39191576576 489130440\n"
+    "4294967367 -6442450868\n";
+
+// Multiples of loop counters that leave 32 bits, which strength reduction
+// steps and tests against in place of the counters.
+const char *const wideLoopSource = "var"
+                                   "  i: integer;"
+                                   "  n: integer;"
+                                   "  k: integer;"
+                                   "begin"
+                                   "  read(n);"
+                                   "  for i := 1000000 to n do"
+                                   "    writeln(i * 5000);"
+                                   "  k := 0;"
+                                   "  i := 1;"
+                                   "  while i <> 400000 do begin"
+                                   "    k := k + i * 6000;"
+                                   "    i := i + 1 "
+                                   "  end;"
+                                   "  writeln(k)"
+                                   "end.";
+const char *const wideLoopInput = "1000002";
+const char *const wideLoopOutput =
+    "5000000000\n5000005000\n5000010000\n479998800000000\n";
+
+const char *const arraySource = "type"
+                                "  matrix = array [1..3, 1..3] of integer;"
+                                "  colour = (red, green, blue);"
+                                "  tally = array [colour] of integer;"
+                                "  flags = array [2..50] of boolean;"
+                                "var"
+                                "  a: matrix;"
+                                "  b: matrix;"
+                                "  c: matrix;"
+                                "  t: tally;"
+                                "  sieve: flags;"
+                                "  i: integer;"
+                                "  j: integer;"
+                                "  k: integer;"
+                                "  n: integer;"
+                                "procedure multiply(size: integer);"
+                                "var"
+                                "  i: integer;"
+                                "  j: integer;"
+                                "  k: integer;"
+                                "  s: integer;"
+                                "begin"
+                                "  for i := 1 to size do"
+                                "    for j := 1 to size do"
+                                "    begin"
+                                "      s := 0;"
+                                "      for k := 1 to size do"
+                                "        s := s + a[i, k] * b[k][j];"
+                                "      c[i, j] := s"
+                                "    end "
+                                "end;"
+                                "begin"
+                                "  read(n);"
+                                "  for i := 1 to 3 do"
+                                "    for j := 1 to 3 do"
+                                "    begin"
+                                "      a[i, j] := i + j * n;"
+                                "      b[i][j] := i - j"
+                                "    end;"
+                                "  multiply(3);"
+                                "  for i := 1 to 3 do"
+                                "    writeln(c[i, 1], ' ', c[i, 2], ' ',"
+                                "            c[i, 3]);"
+                                "  for i := 2 to 50 do"
+                                "    sieve[i] := true;"
+                                "  for i := 2 to 7 do"
+                                "    if sieve[i] then"
+                                "    begin"
+                                "      j := i * i;"
+                                "      while j <= 50 do"
+                                "      begin"
+                                "        sieve[j] := false;"
+                                "        j := j + i"
+                                "      end "
+                                "    end;"
+                                "  k := 0;"
+                                "  for i := 2 to 50 do"
+                                "    if sieve[i] then"
+                                "      k := k + 1;"
+                                "  t[red] := n;"
+                                "  t[blue] := t[red] * 2;"
+                                "  writeln(k, ' ', t[blue])"
+                                "end.";
+const char *const arrayInput = "2";
+const char *const arrayOutput = "19 4 -11\n22 4 -14\n25 4 -17\n15 4\n";
+
+const char *const subrangeSource = "type"
+                                   "  byte = 0..255;"
+                                   "  small = -100..100;"
+                                   "  medium = -30000..30000;"
+                                   "  wide = 0..100000;"
+                                   "  big = -100000..100000;"
+                                   "  bytes = array [0..7] of byte;"
+                                   "  smalls = array [1..4] of small;"
+                                   "  mediums = array [1..3] of medium;"
+                                   "  wides = array [1..2] of wide;"
+                                   "  bigs = array [1..2] of big;"
+                                   "var"
+                                   "  b: bytes;"
+                                   "  s: smalls;"
+                                   "  m: mediums;"
+                                   "  w: wides;"
+                                   "  g: bigs;"
+                                   "  i: integer;"
+                                   "  k: integer;"
+                                   "  n: byte;"
+                                   "begin"
+                                   "  read(n);"
+                                   "  for i := 0 to 7 do"
+                                   "    b[i] := i * 30 + n;"
+                                   "  for i := 1 to 4 do"
+                                   "    s[i] := n - i * 25;"
+                                   "  m[1] := -n * 2000;"
+                                   "  m[2] := n * 2000;"
+                                   "  m[3] := b[7];"
+                                   "  w[1] := n * 6000;"
+                                   "  g[1] := -w[1];"
+                                   "  k := 0;"
+                                   "  for i := 0 to 7 do"
+                                   "    k := k + b[i];"
+                                   "  writeln(b[0], ' ', b[7], ' ', s[1], ' ',"
+                                   "          s[4]);"
+                                   "  writeln(m[1], ' ', m[2], ' ', m[3]);"
+                                   "  writeln(w[1], ' ', g[1], ' ', k)"
+                                   "end.";
+const char *const subrangeInput = "15";
+const char *const subrangeOutput =
+    "15 225 -10 -85\n-30000 30000 225\n90000 -90000 960\n";
+
+const char *const packedSource = "type"
+                                 "  sieve = packed array [2..200] of boolean;"
+                                 "  grid = packed array [1..2, 0..69] of "
+                                 "    boolean;"
+                                 "var"
+                                 "  s: sieve;"
+                                 "  g: grid;"
+                                 "  i: integer;"
+                                 "  j: integer;"
+                                 "  n: integer;"
+                                 "  k: integer;"
+                                 "begin"
+                                 "  read(n);"
+                                 "  for i := 2 to n do"
+                                 "    s[i] := true;"
+                                 "  for i := 2 to n do"
+                                 "    if s[i] then begin"
+                                 "      j := i * i;"
+                                 "      while j <= n do begin"
+                                 "        s[j] := false;"
+                                 "        j := j + i "
+                                 "      end "
+                                 "    end;"
+                                 "  k := 0;"
+                                 "  for i := 2 to n do"
+                                 "    if s[i] then"
+                                 "      k := k + 1;"
+                                 "  for i := 0 to 69 do begin"
+                                 "    g[1, i] := i / 3 * 3 = i;"
+                                 "    g[2, i] := g[1, i] = false "
+                                 "  end;"
+                                 "  writeln(k, ' ', s[197], ' ', s[198]);"
+                                 "  writeln(g[1, 66], ' ', g[2, 66], ' ',"
+                                 "          g[1, 67], ' ', g[2, 67])"
+                                 "end.";
+const char *const packedInput = "200";
+const char *const packedOutput = "46 TRUE FALSE\nTRUE FALSE FALSE TRUE\n";
+
+const char *const rangeErrorSource = "type"
+                                     "  row = array [1..5] of integer;"
+                                     "var"
+                                     "  a: row;"
+                                     "  i: integer;"
+                                     "begin"
+                                     "  read(i);"
+                                     "  writeln(i);"
+                                     "  a[i] := i;"
+                                     "  writeln(a[i])"
+                                     "end.";
+
+const char *const subrangeErrorSource = "type"
+                                        "  digit = 0..9;"
+                                        "var"
+                                        "  d: digit;"
+                                        "  i: integer;"
+                                        "begin"
+                                        "  read(i);"
+                                        "  writeln(i);"
+                                        "  d := i;"
+                                        "  writeln(d)"
+                                        "end.";
+
+const char *const forErrorSource = "type"
+                                   "  byte = 0..255;"
+                                   "var"
+                                   "  b: byte;"
+                                   "  n: integer;"
+                                   "begin"
+                                   "  read(n);"
+                                   "  for b := 250 to n do"
+                                   "    writeln(b);"
+                                   "  writeln(n)"
+                                   "end.";
+
+const char *const divisionErrorSource = "var"
+                                        "  x: integer;"
+                                        "  y: integer;"
+                                        "begin"
+                                        "  read(y);"
+                                        "  writeln(42);"
+                                        "  x := 10 / y;"
+                                        "  writeln(x)"
+                                        "end.";
+
+// The layout of a string in memory.
+std::vector<uint64_t> makeString(const std::string &value) {
+  std::vector<uint64_t> string(1 + (value.size() + 7) / 8, 0);
+  string.front() = value.size();
+  std::memcpy(string.data() + 1, value.data(), value.size());
+  return string;
+}
+
+// Runs a program through the interpreter, the JIT and the tiered engine.
+void checkInMemory(const char *source, const std::string &input,
+                   const std::string &output, bool isRangeChecked = false) {
+  LoweredProgram program(source, isRangeChecked);
+  BytecodeCompiler bytecodeCompiler;
+  const bytecode::Module module = bytecodeCompiler.compile(program.frags);
+  Interpreter interpreter(module);
+  REQUIRE(captureOutput(input, [&interpreter]() { interpreter.run(); }) ==
+          output);
+  Jit jit;
+  loadProgram(jit, program);
+  REQUIRE(captureOutput(input, [&jit]() { jit.run(); }) == output);
+  TieredEngine engine(program.parser.getSymbols(), program.frags, 1, false);
+  REQUIRE(captureOutput(input, [&engine]() { engine.run(); }) == output);
+  REQUIRE(engine.isNative("main"));
+}
+
+// Builds a program into executables with the native backend and with the C
+// one, when there are tools to link them.
+void checkExecutables(const char *source, const std::string &input,
+                      const std::string &output, bool isRangeChecked = false,
+                      int status = 0) {
+  LoweredProgram program(source, isRangeChecked);
+  const auto directory = std::filesystem::temp_directory_path();
+  const std::string executableName = directory / "descartes_test";
+  if (std::system("ld --version > /dev/null 2>&1") == 0) {
+    const std::string objectName = directory / "descartes_test.o";
+    InstructionSelector instructionSelector(program.parser.getSymbols());
+    RegisterAllocator registerAllocator(program.parser.getSymbols());
+    std::vector<x86::Function> functions;
+    for (const auto &frag : program.frags) {
+      functions.push_back(instructionSelector.select(frag));
+      registerAllocator.run(functions.back());
+    }
+    {
+      std::ofstream object(objectName, std::ios::binary);
+      ElfWriter elfWriter(object);
+      Encoder encoder;
+      elfWriter.write(encoder.encode(functions));
+    }
+    REQUIRE(std::system(("ld -o " + executableName + " " + objectName + " " +
+                         DESCARTES_RUNTIME_LIBRARY)
+                            .c_str()) == 0);
+    REQUIRE(runExecutable(executableName, input, status) == output);
+    std::filesystem::remove(objectName);
+    std::filesystem::remove(executableName);
+  }
+  if (std::system("cc --version > /dev/null 2>&1") == 0) {
+    const std::string sourceName = directory / "descartes_test.c";
+    {
+      std::ofstream source(sourceName);
+      CPrinter cPrinter(source);
+      cPrinter.print(program.frags);
+    }
+    REQUIRE(std::system(("cc -O2 -Wall -Werror -o " + executableName + " " +
+                         sourceName + " " + DESCARTES_RUNTIME_LIBRARY)
+                            .c_str()) == 0);
+    REQUIRE(runExecutable(executableName, input, status) == output);
+    std::filesystem::remove(sourceName);
+    std::filesystem::remove(executableName);
+  }
+}
+
+} // namespace
+
+TEST_CASE("runtime formats integers", "[runtime]") {
+  const std::string output = captureOutput("", []() {
+    for (int64_t value :
+         {int64_t(0), int64_t(7), int64_t(10), int64_t(99), int64_t(100),
+          int64_t(-1), int64_t(1234567890),
+          int64_t(std::numeric_limits<int32_t>::min()),
+          std::numeric_limits<int64_t>::min(),
+          std::numeric_limits<int64_t>::max()}) {
+      descartes_write_integer(value);
+      descartes_write_newline();
+    }
+    descartes_write_boolean(1);
+    descartes_write_boolean(0);
+  });
+  REQUIRE(output == "0\n7\n10\n99\n100\n-1\n1234567890\n-2147483648\n"
+                    "-9223372036854775808\n9223372036854775807\nTRUEFALSE");
+}
+
+TEST_CASE("runtime output survives filling the buffer", "[runtime]") {
+  const std::string output = captureOutput("", []() {
+    for (int64_t i = 0; i < 100000; ++i) {
+      descartes_write_integer(i);
+      descartes_write_newline();
+    }
+  });
+  std::string expected;
+  for (int64_t i = 0; i < 100000; ++i)
+    expected += std::to_string(i) + "\n";
+  REQUIRE(output == expected);
+}
+
+TEST_CASE("runtime reads integers", "[runtime]") {
+  std::vector<int64_t> values;
+  const std::string input = "  42 trailing\n-17 +8 x\n 5000000000 "
+                            "9223372036854775807 -9223372036854775808";
+  captureOutput(input, [&values]() {
+    values.push_back(descartes_read_integer());
+    descartes_read_newline();
+    values.push_back(descartes_read_integer());
+    values.push_back(descartes_read_integer());
+    descartes_read_newline();
+    // Integers are read into whole words.
+    for (int i = 0; i < 4; ++i)
+      values.push_back(descartes_read_integer());
+  });
+  REQUIRE(values == std::vector<int64_t>{42, -17, 8, 5000000000,
+                                         std::numeric_limits<int64_t>::max(),
+                                         std::numeric_limits<int64_t>::min(),
+                                         0});
+}
+
+TEST_CASE("runtime handles strings", "[runtime]") {
+  const auto hello = makeString("Hello"), world = makeString(", world!"),
+             space = makeString(" "), empty = makeString(""),
+             help = makeString("Help"),
+             longer = makeString("Hello, world! Hello, world!");
+  const auto address = [](const std::vector<uint64_t> &string) {
+    return reinterpret_cast<int64_t>(string.data());
+  };
+  const int64_t joined =
+      descartes_concat_strings(address(hello), address(world));
+  REQUIRE(descartes_equal_strings(joined, joined));
+  REQUIRE(!descartes_equal_strings(joined, address(hello)));
+  REQUIRE(descartes_equal_strings(
+      descartes_concat_strings(
+          joined, descartes_concat_strings(address(space), joined)),
+      address(longer)));
+  REQUIRE(descartes_equal_strings(
+      descartes_concat_strings(address(empty), address(empty)),
+      address(empty)));
+  REQUIRE(descartes_compare_strings(address(hello), address(help)) < 0);
+  REQUIRE(descartes_compare_strings(address(help), address(hello)) > 0);
+  REQUIRE(descartes_compare_strings(address(hello), joined) < 0);
+  REQUIRE(descartes_compare_strings(joined, joined) == 0);
+  REQUIRE(descartes_compare_strings(address(empty), address(hello)) < 0);
+  const std::string line(100, 'x');
+  std::vector<int64_t> strings;
+  const std::string output =
+      captureOutput("first line\n" + line + "\n", [&strings, joined]() {
+        strings.push_back(descartes_read_string());
+        descartes_read_newline();
+        strings.push_back(descartes_read_string());
+        descartes_read_newline();
+        strings.push_back(descartes_read_string());
+        descartes_write_string(joined);
+      });
+  REQUIRE(output == "Hello, world!");
+  REQUIRE(descartes_equal_strings(strings.at(0),
+                                  address(makeString("first line"))));
+  REQUIRE(descartes_equal_strings(strings.at(1), address(makeString(line))));
+  REQUIRE(descartes_equal_strings(strings.at(2), address(empty)));
+}
+
+TEST_CASE("runtime handles strings bigger than a chunk", "[runtime]") {
+  const auto address = [](const std::vector<uint64_t> &string) {
+    return reinterpret_cast<int64_t>(string.data());
+  };
+  // Each half is over a quarter of a chunk already.
+  const std::string half(300000, 'x'), line(1000000, 'y');
+  const auto halfString = makeString(half),
+             whole = makeString(half + half + "!"),
+             bang = makeString("!"), empty = makeString("");
+  const int64_t joined = descartes_concat_strings(
+      descartes_concat_strings(address(halfString), address(halfString)),
+      address(bang));
+  REQUIRE(*reinterpret_cast<const uint64_t *>(joined) == whole.front());
+  REQUIRE(descartes_equal_strings(joined, address(whole)));
+  REQUIRE(descartes_concat_strings(joined, address(empty)) == joined);
+  REQUIRE(descartes_concat_strings(address(empty), joined) == joined);
+  std::vector<int64_t> strings;
+  captureOutput(line + "\nshort\n" + half + "\n", [&strings]() {
+    for (int i = 0; i < 3; ++i) {
+      strings.push_back(descartes_read_string());
+      descartes_read_newline();
+    }
+  });
+  REQUIRE(descartes_equal_strings(strings.at(0), address(makeString(line))));
+  REQUIRE(descartes_equal_strings(strings.at(1), address(makeString("short"))));
+  REQUIRE(descartes_equal_strings(strings.at(2), address(halfString)));
+}
+
+TEST_CASE("programs do input and output in memory", "[runtime]") {
+  checkInMemory(ioSource, ioInput, ioOutput);
+  checkInMemory(stringSource, stringInput, stringOutput);
+  checkInMemory(wideSource, wideInput, wideOutput);
+  checkInMemory(wideLoopSource, wideLoopInput, wideLoopOutput);
+  checkInMemory(arraySource, arrayInput, arrayOutput);
+  checkInMemory(arraySource, arrayInput, arrayOutput, true);
+  checkInMemory(subrangeSource, subrangeInput, subrangeOutput);
+  checkInMemory(subrangeSource, subrangeInput, subrangeOutput, true);
+  checkInMemory(packedSource, packedInput, packedOutput);
+  checkInMemory(packedSource, packedInput, packedOutput, true);
+}
+
+TEST_CASE("executables link against the runtime", "[runtime]") {
+  checkExecutables(ioSource, ioInput, ioOutput);
+  checkExecutables(stringSource, stringInput, stringOutput);
+  checkExecutables(wideSource, wideInput, wideOutput);
+  checkExecutables(wideLoopSource, wideLoopInput, wideLoopOutput);
+  checkExecutables(arraySource, arrayInput, arrayOutput);
+  checkExecutables(arraySource, arrayInput, arrayOutput, true);
+  checkExecutables(subrangeSource, subrangeInput, subrangeOutput);
+  checkExecutables(subrangeSource, subrangeInput, subrangeOutput, true);
+  checkExecutables(packedSource, packedInput, packedOutput);
+  checkExecutables(packedSource, packedInput, packedOutput, true);
+}
+
+TEST_CASE("executables stop on runtime errors", "[runtime]") {
+  checkExecutables(rangeErrorSource, "5", "5\n5\n", true);
+  checkExecutables(rangeErrorSource, "6", "6\nRange check error\n", true, 201);
+  checkExecutables(rangeErrorSource, "0", "0\nRange check error\n", true, 201);
+  checkExecutables(subrangeErrorSource, "9", "9\n9\n", true);
+  checkExecutables(subrangeErrorSource, "10", "10\nRange check error\n", true,
+                   201);
+  checkExecutables(forErrorSource, "251", "250\n251\n251\n", true);
+  checkExecutables(forErrorSource, "0", "0\n", true);
+  checkExecutables(forErrorSource, "300", "Range check error\n", true, 201);
+  // Division by zero is checked either way.
+  checkExecutables(divisionErrorSource, "5", "42\n2\n");
+  checkExecutables(divisionErrorSource, "0", "42\nDivision by zero\n", false,
+                   200);
+  // So are integers in the input that don't fit in a word.
+  checkExecutables(divisionErrorSource, "-9223372036854775809",
+                   "Integer out of range\n", false, 106);
+  checkExecutables(divisionErrorSource, "99999999999999999999",
+                   "Integer out of range\n", false, 106);
+}
+
+} // namespace descartes::test
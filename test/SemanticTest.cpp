@@ -2,6 +2,8 @@
 #include <Parser.h>
 #include <Semantic.h>
 
+#include "TestUtil.h"
+
 #include <catch2/catch.hpp>
 
 namespace descartes::test {
@@ -10,7 +12,7 @@ void testSemanticSuccess(const std::string &source) {
   Lexer lexer(source, false);
   Parser parser(lexer);
   auto program = parser.parse();
-  Semantic semantic(parser.getSymbols());
+  Semantic semantic(parser.getSymbols(), false);
   REQUIRE_NOTHROW(semantic.analyse(program));
 }
 
@@ -18,7 +20,7 @@ void testSemanticFailure(const std::string &source, const std::string &msg) {
   Lexer lexer(source, false);
   Parser parser(lexer);
   auto program = parser.parse();
-  Semantic semantic(parser.getSymbols());
+  Semantic semantic(parser.getSymbols(), false);
   REQUIRE_THROWS_MATCHES(semantic.analyse(program), descartes::SemanticError,
                          Catch::Contains(msg));
 }
@@ -27,8 +29,107 @@ TEST_CASE("semantic hello world", "[semantic]") {
   const char *program = "begin"
                         "  writeln('Hello, world!')"
                         "end.";
-  // FIXME: Once compiler intrinsics are implemented, this should work.
-  testSemanticFailure(program, "Unknown function");
+  testSemanticSuccess(program);
+}
+
+TEST_CASE("semantic string operations", "[semantic]") {
+  const char *program = "var"
+                        "  s: string;"
+                        "  b: boolean;"
+                        "begin"
+                        "  s := 'Hello, ' + 'world';"
+                        "  b := 'abc' < 'abd';"
+                        "  b := s = 'Hello, world' "
+                        "end.";
+  AnalysedProgram analysed(program);
+  auto *body =
+      static_cast<ir::Sequence *>(analysed.frags.front().second.get());
+  REQUIRE(body->statements.size() == 3);
+  // Literals are joined and compared while compiling.
+  auto *concat = static_cast<ir::Move *>(body->statements[0].get());
+  REQUIRE(concat->src->getKind() == ir::ExprKind::Name);
+  REQUIRE(ir::getStringValue(
+              static_cast<ir::Name *>(concat->src.get())->value) ==
+          "Hello, world");
+  auto *compare = static_cast<ir::Move *>(body->statements[1].get());
+  REQUIRE(compare->src->getKind() == ir::ExprKind::Const);
+  REQUIRE(static_cast<ir::Const *>(compare->src.get())->value == 1);
+  auto *equal = static_cast<ir::Move *>(body->statements[2].get());
+  REQUIRE(equal->src->getKind() == ir::ExprKind::CondExpr);
+}
+
+TEST_CASE("semantic string arithmetic", "[semantic]") {
+  const char *program = "var"
+                        "  s: string;"
+                        "begin"
+                        "  s := s - 'a' "
+                        "end.";
+  testSemanticFailure(program, "Expected integer in binary op");
+}
+
+TEST_CASE("semantic input and output", "[semantic]") {
+  const char *program = "var"
+                        "  x: integer;"
+                        "  y: integer;"
+                        "begin"
+                        "  read(x, y);"
+                        "  readln;"
+                        "  readln(x);"
+                        "  write(x + y, x < y);"
+                        "  writeln(true);"
+                        "  writeln()"
+                        "end.";
+  testSemanticSuccess(program);
+}
+
+TEST_CASE("semantic input and output errors", "[semantic]") {
+  testSemanticFailure("const"
+                      "  n = 1;"
+                      "begin"
+                      "  read(n)"
+                      "end.",
+                      "Cannot assign to constant");
+  testSemanticFailure("var"
+                      "  x: integer;"
+                      "begin"
+                      "  read(x + 1)"
+                      "end.",
+                      "Can only read into a variable");
+  testSemanticFailure("var"
+                      "  x: boolean;"
+                      "begin"
+                      "  read(x)"
+                      "end.",
+                      "Can only read integers");
+  testSemanticFailure("var"
+                      "  i: integer;"
+                      "begin"
+                      "  for i := 1 to 2 do read(i)"
+                      "end.",
+                      "Cannot assign to for loop control variable");
+  testSemanticFailure("var"
+                      "  x: integer;"
+                      "begin"
+                      "  x := read(x)"
+                      "end.",
+                      "Intrinsic procedures don't return a value");
+}
+
+TEST_CASE("semantic functions hide intrinsics", "[semantic]") {
+  const char *program = "var"
+                        "  x: integer;"
+                        "function write(a: integer): integer;"
+                        "begin"
+                        "  write := a "
+                        "end;"
+                        "begin"
+                        "  x := write(1)"
+                        "end.";
+  AnalysedProgram analysed(program);
+  // Nothing calls into the runtime so there's no output to flush either.
+  for (const ir::Fragment &frag : analysed.frags)
+    REQUIRE(countStatements(*frag.second, ir::StatementKind::CallStatement) ==
+            0);
 }
 
 TEST_CASE("semantic integer assignment", "[semantic]") {
@@ -206,4 +307,688 @@ TEST_CASE("semantic compatible types 2", "[semantic]") {
   testSemanticSuccess(program);
 }
 
+TEST_CASE("semantic const expressions", "[semantic]") {
+  const char *program = "const"
+                        "  base = 10;"
+                        "  limit = base * 4 + 2;"
+                        "  greeting = 'Hello, ' + 'world';"
+                        "  enabled = limit > base;"
+                        "var"
+                        "  x: integer;"
+                        "  s: string;"
+                        "  b: boolean;"
+                        "begin"
+                        "  x := limit - base;"
+                        "  s := greeting;"
+                        "  b := enabled "
+                        "end.";
+  AnalysedProgram analysed(program);
+  const auto &frags = analysed.frags;
+  REQUIRE(frags.size() == 1);
+  // Only the three variables should be given frame slots.
+  REQUIRE(frags.front().first->locals.size() == 3);
+  auto *body = static_cast<ir::Sequence *>(frags.front().second.get());
+  REQUIRE(body->statements.size() == 3);
+  auto *move = static_cast<ir::Move *>(body->statements.front().get());
+  REQUIRE(move->src->getKind() == ir::ExprKind::Const);
+  REQUIRE(static_cast<ir::Const *>(move->src.get())->value == 32);
+}
+
+TEST_CASE("semantic constant condition folding", "[semantic]") {
+  const char *program = "const"
+                        "  debug = 0;"
+                        "var"
+                        "  x: integer;"
+                        "begin"
+                        "  if debug = 1 then"
+                        "    x := 1"
+                        "  else"
+                        "    x := 2;"
+                        "  while debug <> 0 do"
+                        "    x := x + 1 "
+                        "end.";
+  AnalysedProgram analysed(program);
+  const auto &frags = analysed.frags;
+  auto *body = static_cast<ir::Sequence *>(frags.front().second.get());
+  REQUIRE(body->statements.size() == 2);
+  // The `if` collapses to the else branch.
+  REQUIRE(body->statements.front()->getKind() == ir::StatementKind::Move);
+  // The `while` never executes.
+  auto *loop = static_cast<ir::Sequence *>(body->statements.back().get());
+  REQUIRE(loop->statements.empty());
+}
+
+TEST_CASE("semantic enum constants", "[semantic]") {
+  const char *program = "type"
+                        "  TColour = (red, green, blue);"
+                        "var"
+                        "  c: TColour;"
+                        "  x: integer;"
+                        "begin"
+                        "  c := green;"
+                        "  if c = blue then"
+                        "    x := 1 "
+                        "end.";
+  testSemanticSuccess(program);
+}
+
+TEST_CASE("semantic assign to constant", "[semantic]") {
+  const char *program = "const"
+                        "  x = 1;"
+                        "begin"
+                        "  x := 2"
+                        "end.";
+  testSemanticFailure(program, "Cannot assign to constant");
+}
+
+TEST_CASE("semantic non-constant const expression", "[semantic]") {
+  const char *program = "const"
+                        "  x = foo(1);"
+                        "begin "
+                        "end.";
+  testSemanticFailure(program, "Expected constant expression");
+}
+
+TEST_CASE("semantic constant division by zero", "[semantic]") {
+  const char *program = "const"
+                        "  x = 1 / (2 - 2);"
+                        "begin "
+                        "end.";
+  testSemanticFailure(program, "Division by zero");
+}
+
+TEST_CASE("semantic constant overflow", "[semantic]") {
+  // Constant sections and expressions in statements share the same limits.
+  testSemanticSuccess("const"
+                      "  big = 2147483646 + 1;"
+                      "var"
+                      "  x: integer;"
+                      "begin"
+                      "  x := 2147483646 + 1;"
+                      "  x := (-2147483647 - 1) / 1 "
+                      "end.");
+  testSemanticFailure("const"
+                      "  big = 65536 * 65536;"
+                      "begin "
+                      "end.",
+                      "Overflow in constant expression");
+  testSemanticFailure("const"
+                      "  big = 2147483647 + 1;"
+                      "begin "
+                      "end.",
+                      "Overflow in constant expression");
+  testSemanticFailure("begin"
+                      "  writeln(65536 * 65536) "
+                      "end.",
+                      "Overflow in constant expression");
+  testSemanticFailure("var"
+                      "  x: integer;"
+                      "begin"
+                      "  x := 2147483647 + 1 "
+                      "end.",
+                      "Overflow in constant expression");
+}
+
+TEST_CASE("semantic dense case uses a jump table", "[semantic]") {
+  const char *program = "var"
+                        "  x: integer;"
+                        "  y: integer;"
+                        "begin"
+                        "  case x of"
+                        "    0: y := 10;"
+                        "    1: y := 11;"
+                        "    2, 3: y := 12;"
+                        "    5: y := 13;"
+                        "    6: y := 14"
+                        "  end "
+                        "end.";
+  AnalysedProgram analysed(program);
+  const auto &body = *analysed.frags.front().second;
+  REQUIRE(countStatements(body, ir::StatementKind::JumpTable) == 1);
+}
+
+TEST_CASE("semantic sparse case uses a compare tree", "[semantic]") {
+  const char *program = "var"
+                        "  x: integer;"
+                        "  y: integer;"
+                        "begin"
+                        "  case x of"
+                        "    1: y := 1;"
+                        "    100: y := 2;"
+                        "    1000: y := 3;"
+                        "    10000: y := 4;"
+                        "    100000: y := 5;"
+                        "    1000000: y := 6;"
+                        "    10000000: y := 7;"
+                        "    100000000: y := 8"
+                        "  else"
+                        "    y := 0"
+                        "  end "
+                        "end.";
+  AnalysedProgram analysed(program);
+  const auto &body = *analysed.frags.front().second;
+  REQUIRE(countStatements(body, ir::StatementKind::JumpTable) == 0);
+  // A linear chain would need one compare per label. The tree needs a pivot
+  // compare per split plus at most a handful at each leaf.
+  REQUIRE(countStatements(body, ir::StatementKind::CondJump) == 11);
+}
+
+TEST_CASE("semantic small range case uses a bit test", "[semantic]") {
+  const char *program = "var"
+                        "  x: integer;"
+                        "  y: integer;"
+                        "begin"
+                        "  case x of"
+                        "    0, 5, 10, 20: y := 1;"
+                        "    25, 30: y := 2"
+                        "  end "
+                        "end.";
+  AnalysedProgram analysed(program);
+  const auto &body = *analysed.frags.front().second;
+  REQUIRE(countStatements(body, ir::StatementKind::JumpTable) == 0);
+  // Two bounds checks and one mask test per destination.
+  REQUIRE(countStatements(body, ir::StatementKind::CondJump) == 4);
+}
+
+TEST_CASE("semantic enum case", "[semantic]") {
+  const char *program = "type"
+                        "  TState = (idle, running, stopped);"
+                        "var"
+                        "  state: TState;"
+                        "  x: integer;"
+                        "begin"
+                        "  case state of"
+                        "    idle: x := 0;"
+                        "    running, stopped: x := 1;"
+                        "  end "
+                        "end.";
+  testSemanticSuccess(program);
+}
+
+TEST_CASE("semantic constant case selector", "[semantic]") {
+  const char *program = "const"
+                        "  mode = 2;"
+                        "var"
+                        "  x: integer;"
+                        "begin"
+                        "  case mode of"
+                        "    1: x := 1;"
+                        "    2: x := 2"
+                        "  end "
+                        "end.";
+  AnalysedProgram analysed(program);
+  const auto &body = *analysed.frags.front().second;
+  REQUIRE(countStatements(body, ir::StatementKind::CondJump) == 0);
+  REQUIRE(countStatements(body, ir::StatementKind::Move) == 1);
+}
+
+TEST_CASE("semantic duplicate case label", "[semantic]") {
+  const char *program = "var"
+                        "  x: integer;"
+                        "begin"
+                        "  case x of"
+                        "    1: x := 1;"
+                        "    1: x := 2"
+                        "  end "
+                        "end.";
+  testSemanticFailure(program, "Duplicate case label");
+  // A constant selector doesn't hide them.
+  testSemanticFailure("var"
+                      "  x: integer;"
+                      "begin"
+                      "  case 2 of"
+                      "    1: x := 1;"
+                      "    2, 1: x := 2"
+                      "  end "
+                      "end.",
+                      "Duplicate case label");
+}
+
+TEST_CASE("semantic case label type mismatch", "[semantic]") {
+  const char *program = "type"
+                        "  TState = (idle, running);"
+                        "var"
+                        "  x: integer;"
+                        "begin"
+                        "  case x of"
+                        "    idle: x := 1"
+                        "  end "
+                        "end.";
+  testSemanticFailure(program, "Case label doesn't match selector type");
+}
+
+TEST_CASE("semantic non-ordinal case selector", "[semantic]") {
+  const char *program = "var"
+                        "  s: string;"
+                        "begin"
+                        "  case s of"
+                        "    1: s := 'one'"
+                        "  end "
+                        "end.";
+  testSemanticFailure(program, "Case selector must be an ordinal type");
+}
+
+TEST_CASE("semantic for loops", "[semantic]") {
+  const char *program = "type"
+                        "  TColour = (red, green, blue);"
+                        "var"
+                        "  c: TColour;"
+                        "  i: integer;"
+                        "  x: integer;"
+                        "begin"
+                        "  for i := 1 to 10 do"
+                        "    x := x + i;"
+                        "  for i := x downto 0 do"
+                        "    x := x - 1;"
+                        "  for c := red to blue do"
+                        "    x := x + 1 "
+                        "end.";
+  testSemanticSuccess(program);
+}
+
+TEST_CASE("semantic assign to for loop control variable", "[semantic]") {
+  const char *program = "var"
+                        "  i: integer;"
+                        "begin"
+                        "  for i := 1 to 10 do"
+                        "    i := i + 1 "
+                        "end.";
+  testSemanticFailure(program, "Cannot assign to for loop control variable");
+}
+
+TEST_CASE("semantic reused for loop control variable", "[semantic]") {
+  const char *program = "var"
+                        "  i: integer;"
+                        "  x: integer;"
+                        "begin"
+                        "  for i := 1 to 10 do"
+                        "    for i := 1 to 10 do"
+                        "      x := x + 1 "
+                        "end.";
+  testSemanticFailure(program, "Cannot assign to for loop control variable");
+}
+
+TEST_CASE("semantic non-ordinal for loop control variable", "[semantic]") {
+  const char *program = "var"
+                        "  s: string;"
+                        "begin"
+                        "  for s := 1 to 10 do"
+                        "    s := 'one' "
+                        "end.";
+  testSemanticFailure(program,
+                      "For loop control variable must be an ordinal type");
+}
+
+TEST_CASE("semantic for loop bound type mismatch", "[semantic]") {
+  const char *program = "type"
+                        "  TColour = (red, green, blue);"
+                        "var"
+                        "  c: TColour;"
+                        "begin"
+                        "  for c := 0 to blue do"
+                        "    c := red "
+                        "end.";
+  testSemanticFailure(program,
+                      "For loop bounds don't match control variable type");
+}
+
+TEST_CASE("semantic for loop bounds are evaluated once", "[semantic]") {
+  SsaProgram program("var"
+                     "  i: integer;"
+                     "  x: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  x := 0;"
+                     "  for i := f(0) to f(10) do"
+                     "    x := x + i "
+                     "end.");
+  const auto &main = *program.functions.back();
+  REQUIRE(countInstructions(main, ssa::Opcode::Call) == 2);
+  // The range check and the exit test.
+  REQUIRE(countInstructions(main, ssa::Opcode::CondJump) == 2);
+}
+
+TEST_CASE("semantic checks for loop bounds against subranges", "[semantic]") {
+  const std::string declarations = "type"
+                                   "  byte = 0..255;"
+                                   "var"
+                                   "  b: byte;"
+                                   "  n: integer;"
+                                   "  x: integer;";
+  testSemanticFailure(declarations + "begin"
+                                     "  for b := 250 to 300 do"
+                                     "    x := b "
+                                     "end.",
+                      "Value out of range");
+  testSemanticFailure(declarations + "begin"
+                                     "  for b := 0 downto -1 do"
+                                     "    x := b "
+                                     "end.",
+                      "Value out of range");
+  // Loops that never run don't use their bounds.
+  testSemanticSuccess(declarations + "begin"
+                                     "  for b := 300 to 250 do"
+                                     "    x := b "
+                                     "end.");
+  const std::string program = declarations + "begin"
+                                             "  read(n);"
+                                             "  for b := 0 to n do"
+                                             "    x := b "
+                                             "end.";
+  SsaProgram unchecked(program), checked(program, true);
+  const auto &uncheckedMain = *unchecked.functions.back();
+  const auto &checkedMain = *checked.functions.back();
+  // The empty and exit tests, and then only `n` is checked, against each
+  // bound.
+  REQUIRE(countInstructions(uncheckedMain, ssa::Opcode::CondJump) == 2);
+  REQUIRE(countInstructions(checkedMain, ssa::Opcode::CondJump) == 4);
+  REQUIRE(countInstructions(checkedMain, ssa::Opcode::Call) ==
+          countInstructions(uncheckedMain, ssa::Opcode::Call) + 1);
+}
+
+TEST_CASE("semantic for loops count down when the variable isn't read",
+          "[semantic]") {
+  SsaProgram program("var"
+                     "  i: integer;"
+                     "  n: integer;"
+                     "  x: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a + n "
+                     "end;"
+                     "begin"
+                     "  x := 1;"
+                     "  for i := 1 to n do"
+                     "    x := x * 2;"
+                     "  for n := 1 to x do"
+                     "    x := f(x) "
+                     "end.");
+  const auto &main = *program.functions.back();
+  std::vector<const ssa::Instruction *> exitTests;
+  for (const auto &block : main.blocks) {
+    const ssa::Instruction *terminator = block->getTerminator();
+    if (terminator->op == ssa::Opcode::CondJump &&
+        terminator->relOp == ir::RelOpKind::Equal)
+      exitTests.push_back(terminator);
+  }
+  REQUIRE(exitTests.size() == 2);
+  // The first loop only tests its counter against zero. `n` is visible to `f`
+  // so the second loop has to keep it up to date.
+  const auto isZero = [](const ssa::Instruction *value) {
+    return value->op == ssa::Opcode::Const && value->value == 0;
+  };
+  REQUIRE(isZero(exitTests.front()->operands.at(1)));
+  REQUIRE(!isZero(exitTests.back()->operands.at(1)));
+}
+
+TEST_CASE("semantic keeps variables that don't escape in temporaries",
+          "[semantic]") {
+  AnalysedProgram analysed("var"
+                           "  x: integer;"
+                           "  y: integer;"
+                           "function f(a: integer): integer;"
+                           "begin"
+                           "  f := a + x "
+                           "end;"
+                           "begin"
+                           "  y := 1;"
+                           "  x := f(y)"
+                           "end.");
+  const auto &frags = analysed.frags;
+  REQUIRE(frags.size() == 2);
+  // `x` is read by `f` through the static link so only `y` is in a temporary.
+  auto *main = static_cast<ir::Sequence *>(frags.back().second.get());
+  REQUIRE(main->statements.size() == 2);
+  auto *y = static_cast<ir::Move *>(main->statements.at(0).get());
+  REQUIRE(y->dst->getKind() == ir::ExprKind::Temp);
+  auto *x = static_cast<ir::Move *>(main->statements.at(1).get());
+  REQUIRE(x->dst->getKind() == ir::ExprKind::Mem);
+  // The argument of `f` is copied out of the frame on entry.
+  auto *f = static_cast<ir::Sequence *>(frags.front().second.get());
+  auto *a = static_cast<ir::Move *>(f->statements.front().get());
+  REQUIRE(a->dst->getKind() == ir::ExprKind::Temp);
+  REQUIRE(a->src->getKind() == ir::ExprKind::Mem);
+  const ir::Level &level = *frags.front().first;
+  REQUIRE(level.locals.at(1).isInRegister());
+  REQUIRE(*level.locals.at(1).temp ==
+          static_cast<ir::Temp *>(a->dst.get())->id);
+}
+
+TEST_CASE("semantic arrays", "[semantic]") {
+  const char *program = "type"
+                        "  colour = (red, green, blue);"
+                        "  counts = array [colour] of integer;"
+                        "  grid = array [0..2, -1..1] of boolean;"
+                        "  rows = array [1..2] of counts;"
+                        "var"
+                        "  c: counts;"
+                        "  g: grid;"
+                        "  r: rows;"
+                        "  i: integer;"
+                        "procedure clear(k: colour);"
+                        "begin"
+                        "  c[k] := 0 "
+                        "end;"
+                        "begin"
+                        "  read(i, c[green]);"
+                        "  clear(red);"
+                        "  g[i, i - 1] := c[blue] < i;"
+                        "  r[2][blue] := r[1, red] + c[green];"
+                        "  writeln(g[0][-1])"
+                        "end.";
+  testSemanticSuccess(program);
+  AnalysedProgram analysed(program);
+  // Integers take a word each but the nine booleans fit in two.
+  const ir::Level &level = *analysed.frags.back().first;
+  REQUIRE(level.arrays.size() == 3 + 2 + 2 * 3);
+}
+
+TEST_CASE("semantic array errors", "[semantic]") {
+  const std::string types = "type"
+                            "  colour = (red, green, blue);"
+                            "  row = array [1..3] of integer;";
+  testSemanticFailure(types + "  empty = array [3..1] of integer;"
+                              "begin "
+                              "end.",
+                      "Array index range is empty");
+  testSemanticFailure(types + "  named = array [integer] of integer;"
+                              "begin "
+                              "end.",
+                      "Array index must be an integer or enum range");
+  testSemanticFailure(types + "  mixed = array [1..blue] of integer;"
+                              "begin "
+                              "end.",
+                      "Array index must be an integer or enum range");
+  testSemanticFailure(types + "  huge = array [1..100000000] of integer;"
+                              "begin "
+                              "end.",
+                      "Array is too large");
+  testSemanticFailure(types + "var"
+                              "  a: row;"
+                              "begin"
+                              "  a[red] := 1 "
+                              "end.",
+                      "Array index doesn't match index type");
+  testSemanticFailure(types + "var"
+                              "  a: row;"
+                              "begin"
+                              "  a[4] := 1 "
+                              "end.",
+                      "Array index out of range");
+  testSemanticFailure(types + "var"
+                              "  a: row;"
+                              "  i: integer;"
+                              "begin"
+                              "  i[1] := 1 "
+                              "end.",
+                      "Indexing something that isn't an array");
+  testSemanticFailure(types + "var"
+                              "  a: row;"
+                              "  b: row;"
+                              "begin"
+                              "  a := b "
+                              "end.",
+                      "Cannot assign whole arrays");
+  testSemanticFailure(types + "procedure p(a: row);"
+                              "begin "
+                              "end;"
+                              "begin "
+                              "end.",
+                      "Arrays can't be passed to functions");
+}
+
+TEST_CASE("semantic subranges", "[semantic]") {
+  const char *program = "type"
+                        "  colour = (red, green, blue);"
+                        "  digit = 0..9;"
+                        "  warm = red..green;"
+                        "  small = -100..100;"
+                        "  digits = array [digit] of small;"
+                        "  flags = array [1..3] of boolean;"
+                        "var"
+                        "  d: digit;"
+                        "  w: warm;"
+                        "  a: digits;"
+                        "  f: flags;"
+                        "  i: integer;"
+                        "function half(n: digit): digit;"
+                        "begin"
+                        "  half := n / 2 "
+                        "end;"
+                        "begin"
+                        "  read(d);"
+                        "  i := d + 1;"
+                        "  w := green;"
+                        "  a[d] := half(9) - 50;"
+                        "  f[2] := a[d] < i;"
+                        "  for d := 0 to 9 do"
+                        "    writeln(a[d])"
+                        "end.";
+  testSemanticSuccess(program);
+  AnalysedProgram analysed(program);
+  // Ten bytes of elements fit in two words and the flags in one.
+  const ir::Level &level = *analysed.frags.back().first;
+  REQUIRE(level.arrays.size() == 2 + 1);
+}
+
+TEST_CASE("semantic packed arrays", "[semantic]") {
+  const char *program = "type"
+                        "  sieve = packed array [2..101] of boolean;"
+                        "  grid = packed array [1..3, 0..9] of boolean;"
+                        "  digits = packed array [1..8] of 0..9;"
+                        "var"
+                        "  s: sieve;"
+                        "  g: grid;"
+                        "  d: digits;"
+                        "  i: integer;"
+                        "begin"
+                        "  read(i);"
+                        "  s[i] := true;"
+                        "  g[2, i] := s[i] = g[1, 3];"
+                        "  d[1] := 7;"
+                        "  writeln(s[101], g[3, 9])"
+                        "end.";
+  testSemanticSuccess(program);
+  AnalysedProgram analysed(program);
+  // A hundred bits take two words and each row of the grid takes one. Only
+  // booleans are packed into bits so the digits still take a byte each.
+  const ir::Level &level = *analysed.frags.back().first;
+  REQUIRE(level.arrays.size() == 2 + 3 + 1);
+  testSemanticFailure("type"
+                      "  sieve = packed array [1..10] of boolean;"
+                      "var"
+                      "  s: sieve;"
+                      "begin"
+                      "  s[1][1] := true "
+                      "end.",
+                      "Indexing something that isn't an array");
+  testSemanticFailure("type"
+                      "  sieve = packed array [1..10] of boolean;"
+                      "var"
+                      "  s: sieve;"
+                      "begin"
+                      "  s[11] := true "
+                      "end.",
+                      "Array index out of range");
+}
+
+TEST_CASE("semantic subrange errors", "[semantic]") {
+  const std::string types = "type"
+                            "  colour = (red, green, blue);"
+                            "  digit = 0..9;";
+  testSemanticFailure(types + "  empty = 9..0;"
+                              "begin "
+                              "end.",
+                      "Subrange is empty");
+  testSemanticFailure(types + "  mixed = 0..blue;"
+                              "begin "
+                              "end.",
+                      "Subrange bounds must be integers or enum values");
+  testSemanticFailure(types + "  names = 'a'..'z';"
+                              "begin "
+                              "end.",
+                      "Subrange bounds must be integers or enum values");
+  testSemanticFailure(types + "var"
+                              "  d: digit;"
+                              "begin"
+                              "  d := 10 "
+                              "end.",
+                      "Value out of range");
+  testSemanticFailure(types + "var"
+                              "  d: digit;"
+                              "begin"
+                              "  d := red "
+                              "end.",
+                      "Assignment error");
+  testSemanticFailure(types + "procedure p(d: digit);"
+                              "begin "
+                              "end;"
+                              "begin"
+                              "  p(-1) "
+                              "end.",
+                      "Value out of range");
+}
+
+TEST_CASE("semantic range checks are optional", "[semantic]") {
+  const char *program = "type"
+                        "  row = array [1..10] of integer;"
+                        "var"
+                        "  a: row;"
+                        "  i: integer;"
+                        "begin"
+                        "  read(i);"
+                        "  a[i] := a[3] "
+                        "end.";
+  SsaProgram unchecked(program), checked(program, true);
+  const auto &uncheckedMain = *unchecked.functions.back();
+  const auto &checkedMain = *checked.functions.back();
+  // Only the variable index is checked, against each bound.
+  REQUIRE(countInstructions(uncheckedMain, ssa::Opcode::CondJump) == 0);
+  REQUIRE(countInstructions(checkedMain, ssa::Opcode::CondJump) == 2);
+  REQUIRE(countInstructions(checkedMain, ssa::Opcode::Call) ==
+          countInstructions(uncheckedMain, ssa::Opcode::Call) + 1);
+}
+
+TEST_CASE("semantic checks values assigned to subranges", "[semantic]") {
+  const char *program = "type"
+                        "  digit = 0..9;"
+                        "var"
+                        "  d: digit;"
+                        "  i: integer;"
+                        "begin"
+                        "  read(i);"
+                        "  d := i;"
+                        "  d := 3 "
+                        "end.";
+  SsaProgram unchecked(program), checked(program, true);
+  const auto &uncheckedMain = *unchecked.functions.back();
+  const auto &checkedMain = *checked.functions.back();
+  // Constants are checked while compiling so only `i` needs checking.
+  REQUIRE(countInstructions(uncheckedMain, ssa::Opcode::CondJump) == 0);
+  REQUIRE(countInstructions(checkedMain, ssa::Opcode::CondJump) == 2);
+}
+
 } // namespace descartes::test
@@ -0,0 +1,261 @@
+#include <Dominators.h>
+#include <SsaLowering.h>
+
+#include "TestUtil.h"
+
+#include <catch2/catch.hpp>
+
+namespace descartes::test {
+
+namespace {
+
+ssa::Function &getFunction(SsaProgram &program, const std::string &name) {
+  for (auto &function : program.functions) {
+    if (function->level.name.getName() == name)
+      return *function;
+  }
+  FAIL("No function named " << name);
+  throw std::logic_error("Unreachable");
+}
+
+size_t countLocalSlots(const ssa::Function &function) {
+  return countInstructions(function, ssa::Opcode::Local);
+}
+
+} // namespace
+
+TEST_CASE("ssa promotes straight line locals", "[ssa]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "  y: integer;"
+                     "begin"
+                     "  x := 1;"
+                     "  y := x + 2;"
+                     "  x := y * x "
+                     "end.");
+  auto &function = *program.functions.front();
+  REQUIRE(ssa::verify(function).empty());
+  REQUIRE(countLocalSlots(function) == 0);
+  REQUIRE(countInstructions(function, ssa::Opcode::Load) == 0);
+  REQUIRE(countInstructions(function, ssa::Opcode::Store) == 0);
+  REQUIRE(countInstructions(function, ssa::Opcode::Phi) == 0);
+}
+
+TEST_CASE("ssa places phis at joins", "[ssa]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "  y: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  if f(1) = 1 then"
+                     "    x := 1"
+                     "  else"
+                     "    x := 2;"
+                     "  y := f(x)"
+                     "end.");
+  auto &function = getFunction(program, "main");
+  REQUIRE(ssa::verify(function).empty());
+  REQUIRE(countLocalSlots(function) == 0);
+  REQUIRE(countInstructions(function, ssa::Opcode::Phi) == 1);
+  // The phi merges the two constants and is used by the call.
+  for (const auto &block : function.blocks) {
+    for (auto *phi : block->getPhis()) {
+      REQUIRE(phi->operands.size() == 2);
+      for (auto *operand : phi->operands)
+        REQUIRE(operand->op == ssa::Opcode::Const);
+      REQUIRE(phi->users.size() == 1);
+      REQUIRE(phi->users.front()->op == ssa::Opcode::Call);
+    }
+  }
+}
+
+TEST_CASE("ssa loop variables", "[ssa]") {
+  SsaProgram program("var"
+                     "  i: integer;"
+                     "  total: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  i := 0;"
+                     "  total := 0;"
+                     "  while i < 10 do"
+                     "  begin"
+                     "    total := total + i;"
+                     "    i := i + 1 "
+                     "  end;"
+                     "  f(total)"
+                     "end.");
+  auto &function = getFunction(program, "main");
+  REQUIRE(ssa::verify(function).empty());
+  REQUIRE(countLocalSlots(function) == 0);
+  REQUIRE(countInstructions(function, ssa::Opcode::Phi) == 2);
+  // Both phis live in the loop header which dominates the body.
+  const ssa::DominatorTree domTree(function);
+  const ssa::Block *header = nullptr;
+  for (const auto &block : function.blocks) {
+    if (!block->getPhis().empty()) {
+      REQUIRE((!header || header == block.get()));
+      header = block.get();
+    }
+  }
+  REQUIRE(header);
+  REQUIRE(header->preds.size() == 2);
+  // One edge enters the loop and the other is the back edge.
+  REQUIRE(domTree.dominates(header, header->preds.front()) !=
+          domTree.dominates(header, header->preds.back()));
+}
+
+TEST_CASE("ssa promotes formals", "[ssa]") {
+  SsaProgram program("function f(a: integer, b: integer): integer;"
+                     "begin"
+                     "  a := a + b;"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  f(1, 2)"
+                     "end.");
+  auto &function = getFunction(program, "f");
+  REQUIRE(ssa::verify(function).empty());
+  REQUIRE(countLocalSlots(function) == 0);
+  // The static link isn't used.
+  REQUIRE(countInstructions(function, ssa::Opcode::Param) == 2);
+  const auto *terminator = function.blocks.back()->getTerminator();
+  REQUIRE(terminator->op == ssa::Opcode::Return);
+  REQUIRE(terminator->operands.size() == 1);
+  REQUIRE(terminator->operands.front()->op == ssa::Opcode::ArithOp);
+}
+
+TEST_CASE("ssa keeps escaping locals in the frame", "[ssa]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "  y: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a + x "
+                     "end;"
+                     "begin"
+                     "  x := 1;"
+                     "  y := 2;"
+                     "  y := f(y)"
+                     "end.");
+  auto &main = getFunction(program, "main");
+  REQUIRE(ssa::verify(main).empty());
+  // Only `x` is used by `f`.
+  REQUIRE(countLocalSlots(main) == 1);
+  REQUIRE(countInstructions(main, ssa::Opcode::Store) == 1);
+  auto &f = getFunction(program, "f");
+  REQUIRE(ssa::verify(f).empty());
+  // The static link is promoted and used to load `x` from the parent frame.
+  REQUIRE(countLocalSlots(f) == 0);
+  REQUIRE(countInstructions(f, ssa::Opcode::Load) == 1);
+}
+
+TEST_CASE("ssa dominance frontiers", "[ssa]") {
+  SsaProgram program("var"
+                     "  x: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  x := f(0);"
+                     "  if x = 1 then"
+                     "    x := 2;"
+                     "  f(x)"
+                     "end.");
+  auto &function = getFunction(program, "main");
+  const ssa::DominatorTree domTree(function);
+  const ssa::Block *entry = function.getEntry();
+  for (const auto &block : function.blocks) {
+    REQUIRE(domTree.dominates(entry, block.get()));
+    if (block.get() == entry)
+      continue;
+    // Every block is in the frontier of its predecessors unless they dominate
+    // it.
+    for (auto *pred : block->preds) {
+      const auto &frontier = domTree.getFrontier(pred);
+      const bool inFrontier = std::find(frontier.begin(), frontier.end(),
+                                        block.get()) != frontier.end();
+      REQUIRE(inFrontier == !domTree.dominates(pred, block.get()));
+    }
+  }
+}
+
+TEST_CASE("ssa keeps def-use chains in sync", "[ssa]") {
+  SsaProgram program("begin "
+                     "end.");
+  auto &function = *program.functions.front();
+  ssa::Block *entry = function.getEntry();
+  const ssa::Instruction *terminator = entry->getTerminator();
+  const auto makeValue = [&](ssa::Opcode op) {
+    return entry->insertBefore(terminator, function.makeInstruction(op));
+  };
+  ssa::Instruction *one = makeValue(ssa::Opcode::Const);
+  ssa::Instruction *two = makeValue(ssa::Opcode::Const);
+  ssa::Instruction *sum = makeValue(ssa::Opcode::ArithOp);
+  sum->addOperand(one);
+  sum->addOperand(one);
+  ssa::Instruction *product = makeValue(ssa::Opcode::ArithOp);
+  product->addOperand(sum);
+  product->addOperand(one);
+  product->addOperand(two);
+  REQUIRE(one->users.size() == 3);
+  // Taking out an operand leaves the later ones pointing at their users.
+  product->removeOperand(1);
+  sum->setOperand(0, two);
+  REQUIRE(one->users.size() == 1);
+  REQUIRE(ssa::verify(function).empty());
+  sum->replaceAllUsesWith(one);
+  entry->erase(sum);
+  REQUIRE(product->operands.front() == one);
+  REQUIRE(two->users.size() == 1);
+  REQUIRE(ssa::verify(function).empty());
+  product->dropOperands();
+  REQUIRE(one->users.empty());
+  REQUIRE(two->users.empty());
+  entry->erase(product);
+  REQUIRE(ssa::verify(function).empty());
+}
+
+TEST_CASE("ssa lowering", "[ssa]") {
+  SsaProgram program("var"
+                     "  i: integer;"
+                     "  j: integer;"
+                     "function f(a: integer): integer;"
+                     "begin"
+                     "  f := a "
+                     "end;"
+                     "begin"
+                     "  i := 0;"
+                     "  j := 1;"
+                     "  while i < 10 do"
+                     "  begin"
+                     "    i := i + 1;"
+                     "    j := j * 2 "
+                     "  end;"
+                     "  f(i + j)"
+                     "end.");
+  SsaLowering lowering(program.parser.getSymbols());
+  for (size_t i = 0; i < program.frags.size(); ++i)
+    lowering.lower(*program.functions.at(i), program.frags.at(i));
+  const auto &body = *program.frags.back().second;
+  REQUIRE(body.getKind() == ir::StatementKind::Sequence);
+  // Nothing is left in the frame and each loop iteration ends with copies
+  // into the phi temporaries.
+  for (const auto &statement :
+       static_cast<const ir::Sequence &>(body).statements) {
+    if (statement->getKind() != ir::StatementKind::Move)
+      continue;
+    const auto &move = static_cast<const ir::Move &>(*statement);
+    REQUIRE(move.dst->getKind() == ir::ExprKind::Temp);
+  }
+  REQUIRE(countStatements(body, ir::StatementKind::CondJump) == 1);
+  REQUIRE(countStatements(body, ir::StatementKind::CallStatement) == 1);
+}
+
+} // namespace descartes::test
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <Canonical.h>
+#include <Dce.h>
+#include <Display.h>
+#include <FrameCompaction.h>
+#include <Encoder.h>
+#include <Gvn.h>
+#include <InstructionSelector.h>
+#include <Jit.h>
+#include <Lexer.h>
+#include <Licm.h>
+#include <Mem2Reg.h>
+#include <Parser.h>
+#include <RangePropagation.h>
+#include <RegisterAllocator.h>
+#include <Sccp.h>
+#include <Semantic.h>
+#include <SsaBuilder.h>
+#include <SsaLowering.h>
+#include <StrengthReduction.h>
+
+namespace descartes::test {
+
+// Keeps the front end alive so that the generated IR can be inspected.
+struct AnalysedProgram {
+  explicit AnalysedProgram(const std::string &source,
+                           bool isRangeChecked = false)
+      : source(source), lexer(this->source, false), parser(lexer),
+        program(parser.parse()),
+        semantic(parser.getSymbols(), isRangeChecked),
+        frags(semantic.analyse(program)) {}
+  const std::string source;
+  Lexer lexer;
+  Parser parser;
+  Block program;
+  Semantic semantic;
+  std::vector<ir::Fragment> &frags;
+};
+
+inline size_t countStatements(const ir::Statement &statement,
+                              ir::StatementKind kind) {
+  size_t count = statement.getKind() == kind ? 1 : 0;
+  if (statement.getKind() == ir::StatementKind::Sequence) {
+    for (const auto &s :
+         static_cast<const ir::Sequence &>(statement).statements)
+      count += countStatements(*s, kind);
+  }
+  return count;
+}
+
+// Canonicalises every fragment of a program and builds its SSA form with the
+// frame slots promoted.
+struct SsaProgram : public AnalysedProgram {
+  explicit SsaProgram(const std::string &source, bool isRangeChecked = false)
+      : AnalysedProgram(source, isRangeChecked) {
+    Canonicaliser canonicaliser(parser.getSymbols());
+    SsaBuilder builder;
+    Mem2Reg mem2Reg;
+    for (auto &frag : frags) {
+      canonicaliser.canonicalise(frag);
+      functions.push_back(builder.build(frag));
+      mem2Reg.run(*functions.back());
+    }
+  }
+  std::vector<std::unique_ptr<ssa::Function>> functions;
+};
+
+// Optimises every function like the driver does, short of inlining so that
+// they can all still be called, and lowers them back into canonical IR.
+struct LoweredProgram : public SsaProgram {
+  explicit LoweredProgram(const std::string &source,
+                          bool isRangeChecked = false)
+      : SsaProgram(source, isRangeChecked) {
+    Display display(parser.getSymbols());
+    Sccp sccp;
+    Gvn gvn;
+    RangePropagation rangePropagation;
+    Licm licm;
+    StrengthReduction strengthReduction;
+    Dce dce;
+    FrameCompaction frameCompaction;
+    SsaLowering ssaLowering(parser.getSymbols());
+    display.run(functions);
+    for (size_t i = 0; i < frags.size(); ++i) {
+      auto &function = *functions.at(i);
+      sccp.run(function);
+      gvn.run(function);
+      rangePropagation.run(function);
+      licm.run(function);
+      strengthReduction.run(function);
+      dce.run(function);
+      frameCompaction.run(function);
+      ssaLowering.lower(function, frags.at(i));
+    }
+  }
+};
+
+// Compiles a program to native code and loads it. Functions that don't need a
+// static link can be called directly.
+inline void loadProgram(Jit &jit, LoweredProgram &program) {
+  InstructionSelector instructionSelector(program.parser.getSymbols());
+  RegisterAllocator registerAllocator(program.parser.getSymbols());
+  std::vector<x86::Function> functions;
+  for (const auto &frag : program.frags) {
+    functions.push_back(instructionSelector.select(frag));
+    registerAllocator.run(functions.back());
+  }
+  Encoder encoder;
+  jit.load(encoder.encode(functions));
+}
+
+inline size_t countInstructions(const ssa::Function &function,
+                                ssa::Opcode op) {
+  size_t count = 0;
+  for (const auto &block : function.blocks) {
+    for (const auto &instruction : block->instructions)
+      count += instruction->op == op ? 1 : 0;
+  }
+  return count;
+}
+
+} // namespace descartes::test
@@ -0,0 +1,98 @@
+#include <BytecodeCompiler.h>
+#include <TieredEngine.h>
+
+#include "TestUtil.h"
+
+#include <catch2/catch.hpp>
+
+namespace descartes::test {
+
+namespace {
+
+const char *const nestedSource = "var"
+                                 "  x: integer;"
+                                 "function g(a: integer, b: integer): integer;"
+                                 "begin"
+                                 "  g := a * 3 + b "
+                                 "end;"
+                                 "function f(n: integer): integer;"
+                                 "var"
+                                 "  s: integer;"
+                                 "  t: integer;"
+                                 "begin"
+                                 "  s := 0; t := 0;"
+                                 "  while t < n do"
+                                 "  begin"
+                                 "    s := s + g(s / 7, t);"
+                                 "    t := t + 1"
+                                 "  end;"
+                                 "  f := s "
+                                 "end;"
+                                 "function outer(a: integer): integer;"
+                                 "  var t: integer;"
+                                 "  function middle(b: integer): integer;"
+                                 "    function inner(c: integer): integer;"
+                                 "    begin"
+                                 "      if c = 0 then inner := t "
+                                 "      else inner := inner(c - 1) + 1"
+                                 "    end;"
+                                 "  begin"
+                                 "    middle := inner(b) + inner(b + 1)"
+                                 "  end;"
+                                 "begin"
+                                 "  t := a * 100;"
+                                 "  outer := middle(a) + middle(1)"
+                                 "end;"
+                                 "begin"
+                                 "  x := f(3) + outer(1)"
+                                 "end.";
+
+} // namespace
+
+TEST_CASE("tiered engine compiles hot functions", "[tiered]") {
+  LoweredProgram program(nestedSource);
+  BytecodeCompiler bytecodeCompiler;
+  const bytecode::Module module = bytecodeCompiler.compile(program.frags);
+  Interpreter interpreter(module);
+  TieredEngine engine(program.parser.getSymbols(), program.frags, 50, false);
+  REQUIRE(engine.call("f", {3}) == 3);
+  REQUIRE_FALSE(engine.isNative("f"));
+  REQUIRE_FALSE(engine.isNative("g"));
+  // The loop gets hot part of the way through and takes g along with f.
+  const int64_t result = interpreter.call("f", {100});
+  REQUIRE(engine.call("f", {100}) == result);
+  REQUIRE(engine.isNative("f"));
+  REQUIRE(engine.isNative("g"));
+  REQUIRE_FALSE(engine.isNative("outer"));
+  REQUIRE(engine.call("f", {100}) == result);
+  for (int64_t n = 0; n < 20; ++n)
+    REQUIRE(engine.call("f", {n}) == interpreter.call("f", {n}));
+  engine.run();
+}
+
+TEST_CASE("tiered engine shares the display with native code", "[tiered]") {
+  LoweredProgram program(nestedSource);
+  TieredEngine engine(program.parser.getSymbols(), program.frags, 4, false);
+  // The nested functions get hot part of the way through each call to outer.
+  for (int i = 0; i < 10; ++i) {
+    REQUIRE(engine.call("outer", {3}) == 1210);
+    REQUIRE(engine.call("outer", {4}) == 1612);
+  }
+  REQUIRE(engine.isNative("inner"));
+  REQUIRE(engine.isNative("outer"));
+}
+
+TEST_CASE("tiered engine compiles in the background", "[tiered]") {
+  LoweredProgram program(nestedSource);
+  TieredEngine engine(program.parser.getSymbols(), program.frags, 4, true);
+  for (int i = 0; i < 10; ++i)
+    REQUIRE(engine.call("outer", {3}) == 1210);
+  engine.wait();
+  REQUIRE(engine.isNative("inner"));
+  REQUIRE(engine.isNative("outer"));
+  for (int i = 0; i < 10; ++i)
+    REQUIRE(engine.call("outer", {4}) == 1612);
+  engine.run();
+}
+
+} // namespace descartes::test